@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <signal.h>
@@ -9,88 +10,499 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <time.h>
 #include "../src/lab.h"
+#include "../src/ast.h"
+#include "../src/exec.h"
+#include "../src/event.h"
+#include "../src/jobs.h"
+#include "../src/reader.h"
+#include "../src/history.h"
+#include "../src/complete.h"
+#include "../src/prompt.h"
+#include "../src/vars.h"
 
-static void explain_waitpid(int status)
+// the startup file of interactive shells, in $HOME
+#define RC_FILE ".labrc"
+// the prompt for the lines of a command that is not complete yet
+#define PS2 "> "
+
+// readline's callback interface hands lines to on_line, so the state it
+// needs lives at file scope
+static struct shell sh;
+static struct parser ps;
+static struct arena arena;
+static struct parse_lines lines;	// the command being typed, see on_line
+static bool done;
+static bool reading;	// a prompt is on the screen
+
+/* Ctrl-R: the pattern being searched for and its matches, best first */
+static struct
+{
+	char *pattern;
+	size_t *hits;
+	size_t count;
+	size_t next;
+	char *shown;	// the match put on the line, NULL before the first
+} search;
+
+/*
+ * notify_jobs:
+ *  - Purpose: Report jobs that changed state. While a line is being edited
+ *    it is moved out of the way and drawn again after the report.
+ */
+static void notify_jobs(void)
+{
+	if (!job_pending(sh.jobs))
 	{
-	if (!WIFEXITED(status))
+		return;
+	}
+	if (reading)
 	{
-		fprintf(stderr, "Child exited with status %d\n", WEXITSTATUS(status));
+		rl_clear_visible_line();
+		fflush(rl_outstream);
 	}
-	if (WIFSIGNALED(status))
+	job_notify(&sh);
+	if (reading)
 	{
-		fprintf(stderr, "Child exited via signal %d\n", WTERMSIG(status));
+		rl_forced_update_display();
 	}
-	if (WIFSTOPPED(status))
+}
+
+/*
+ * redraw_prompt:
+ *  - Purpose: The lookup thread found a different branch for the prompt on
+ *    the screen. The line being edited stays as it is.
+ */
+static void redraw_prompt(void)
+{
+	sh.events->woken = false;
+	if (reading && !lines.pending && prompt_stale(&sh))
 	{
-		fprintf(stderr, "Child stopped by %d\n", WSTOPSIG(status));
+		rl_clear_visible_line();
+		rl_set_prompt(prompt_render(&sh));
+		rl_forced_update_display();
 	}
-	if (WIFCONTINUED(status))
+}
+
+/*
+ * cancel_line:
+ *  - Purpose: Ctrl-C at the prompt throws the line away and starts a new one.
+ *    The earlier lines of a command that is not complete go with it.
+ */
+static void cancel_line(void)
+{
+	sh.events->interrupted = false;
+	rl_free_line_state();
+	rl_callback_sigcleanup();
+	rl_crlf();
+	if (lines.pending)
 	{
-		fprintf(stderr, "Child was resumed by delivery of SIGCONT\n");
+		lines.pending = false;
+		rl_set_prompt(prompt_render(&sh));
 	}
+	rl_on_new_line();
+	rl_replace_line("", 0);
+	rl_redisplay();
+	sh.last_status = 130;
 }
 
-int main(int argc, char *argv[])
+/*
+ * on_line:
+ *  - Purpose: Run one line. The handler is removed while the command runs so
+ *    the terminal is back in its normal mode, and installed again after.
+ *      * A line that leaves a command open, like the first line of a for
+ *        loop, is kept and the rest is asked for with PS2. The command runs
+ *        once its last line is in.
+ */
+static void on_line(char *line)
 {
-	parse_args(argc, argv);
-	struct shell sh;
-	sh_init(&sh);
-	char *line = (char *)NULL;
-	while ((line = readline(sh.prompt)))
-	{
-		// do nothing on blank lines don't save history or attempt to exec
-		line = trim_white(line);
-		if (!*line)
+	reading = false;
+	rl_callback_handler_remove();
+	if (!line)
+	{
+		if (lines.pending)
+		{
+			fprintf(stderr, "%s\n", ps.error);
+			sh.last_status = 2;
+		}
+		done = true;
+		return;
+	}
+	// do nothing on blank lines don't save history or attempt to exec, but
+	// inside an open command every line, blank or not, is part of it
+	char *cmd = lines.pending ? line : trim_white(line);
+	if (*cmd || lines.pending)
+	{
+		if (*cmd)
+		{
+			add_history(cmd);
+		}
+		if (*cmd && sh.history)
+		{
+			history_add(sh.history, cmd, strlen(cmd));
+		}
+		// build the command tree in the per line arena and walk it
+		struct node *tree;
+		struct timespec t0, t1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		uint64_t start = bench_begin(&sh);
+		enum parse_status st = parse_lines_add(&ps, &lines, cmd, strlen(cmd), &arena, &tree);
+		bench_end(&sh, BENCH_PARSE, start);
+		if (st == PARSE_ERROR)
+		{
+			fprintf(stderr, "%s\n", ps.error);
+			sh.last_status = 2;
+		}
+		else if (st == PARSE_OK)
+		{
+			exec_node(&sh, tree, &arena);
+		}
+		// all nodes and expanded words are released at once
+		arena_reset(&arena);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		sh.last_ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+	}
+	free(line);
+	notify_jobs();
+	sh.events->interrupted = false;
+	rl_callback_handler_install(lines.pending ? PS2 : prompt_render(&sh), on_line);
+	reading = true;
+}
+
+/*
+ * run_script:
+ *  - Purpose: The non interactive loop, for a script file or commands piped
+ *    into the shell. Input is read a block at a time and there is no
+ *    prompt, history or line editing.
+ *      * When the input is also the stdin of the commands, the file offset
+ *        is handed over to each command and taken back after it.
+ *      * A command that does not end with its line, like a for loop or a
+ *        quoted string over several lines, is run once its last line has
+ *        been read.
+ *      * A syntax error stops the script, as in other shells. It is reported
+ *        at the first line of its command, and a command still open at the
+ *        end of the input is one too.
+ *      * With tail set, the last line goes through exec_tail, so its final
+ *        command can replace the shell.
+ *  - Returns: The exit status of the last command.
+ */
+static int run_script(const char *name, int fd, bool tail)
+{
+	struct line_reader r;
+	struct parse_lines lines;
+	char *line;
+	ssize_t len;
+	unsigned long first = 0;	// the line the current command started on
+	bool share = fd == STDIN_FILENO;
+	line_reader_init(&r, fd);
+	parse_lines_init(&lines);
+	while ((len = line_reader_next(&r, &line)) >= 0)
+	{
+		struct node *tree;
+		if (!lines.pending)
 		{
-			free(line);
+			first = r.lineno;
+		}
+		uint64_t start = bench_begin(&sh);
+		enum parse_status st = parse_lines_add(&ps, &lines, line, len, &arena, &tree);
+		bench_end(&sh, BENCH_PARSE, start);
+		if (st == PARSE_INCOMPLETE)
+		{
+			arena_reset(&arena);
 			continue;
 		}
-		add_history(line);
-		// check to see if we are launching a built in command
-		char **cmd = cmd_parse(line);
-		if (!do_builtin(&sh, cmd))
+		if (st != PARSE_OK)
+		{
+			fprintf(stderr, "%s: line %lu: %s\n", name, first, ps.error);
+			sh.last_status = 2;
+			break;
+		}
+		if (tree)
 		{
-			pid_t pid = fork();
-			if (pid == 0)
+			// Decided before the offset is shared, looking ahead may read
+			bool last = tail && line_reader_at_end(&r);
+			if (share)
 			{
-				/*This is the child process*/
-				pid_t child = getpid();
-				setpgid(child, child);
-				tcsetpgrp(sh.shell_terminal, child);
-				signal(SIGINT, SIG_DFL);
-				signal(SIGQUIT, SIG_DFL);
-				signal(SIGTSTP, SIG_DFL);
-				signal(SIGTTIN, SIG_DFL);
-				signal(SIGTTOU, SIG_DFL);
-				execvp(cmd[0], cmd);
-				exit(EXIT_FAILURE);
+				line_reader_share(&r);
 			}
-			else if (pid < 0)
+			if (last)
 			{
-				// If fork failed we are in trouble!
-				perror("fork return < 0 Process creation failed!");
-				abort();
+				exec_tail(&sh, tree, &arena);
 			}
-			/*
-			This is in the parent put the child process into its own
-			process group and give it control of the terminal
-			to avoid a race condition
-			*/
-			// printf("shell:%d , child%d\n",sh.shell_pgid, pid);
-			setpgid(pid, pid);
-			tcsetpgrp(sh.shell_terminal, pid);
-			int status;
-			int rval = waitpid(pid, &status, 0);
-			if (rval == -1)
+			else
 			{
-				fprintf(stderr, "Wait pid failed with -1\n");
-					explain_waitpid(status);
+				exec_node(&sh, tree, &arena);
+			}
+			if (share)
+			{
+				line_reader_resume(&r);
 			}
-			cmd_free(cmd);
-			// get control of the shell
-			tcsetpgrp(sh.shell_terminal, sh.shell_pgid);
 		}
+		arena_reset(&arena);
+	}
+	if (lines.pending)
+	{
+		fprintf(stderr, "%s: line %lu: %s\n", name, first, ps.error);
+		sh.last_status = 2;
 	}
+	parse_lines_destroy(&lines);
+	line_reader_destroy(&r);
+	return sh.last_status;
+}
+
+/*
+ * run_file:
+ *  - Purpose: Run the script at path, see run_script for tail.
+ *  - Returns: Its exit status, or 127 if it cannot be opened.
+ */
+static int run_file(const char *path, bool tail)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		perror(path);
+		return sh.last_status = 127;
+	}
+	int status = run_script(path, fd, tail);
+	close(fd);
+	return status;
+}
+
+/*
+ * run_rc:
+ *  - Purpose: Run ~/.labrc at the start of an interactive shell, if it
+ *    exists.
+ */
+static void run_rc(void)
+{
+	const char *home = vars_get(sh.vars, "HOME");
+	char path[4096];
+	if (!home || snprintf(path, sizeof(path), "%s/%s", home, RC_FILE) >= (int)sizeof(path))
+	{
+		return;
+	}
+	if (access(path, R_OK) == 0)
+	{
+		run_file(path, false);
+	}
+}
+
+/*
+ * run_string:
+ *  - Purpose: Run the command string given with -c. It is all the shell
+ *    will run, so its last command may replace the shell.
+ */
+static int run_string(const char *name, const char *cmd)
+{
+	struct node *tree;
+	uint64_t start = bench_begin(&sh);
+	enum parse_status st = parse_line(&ps, cmd, strlen(cmd), &arena, &tree);
+	bench_end(&sh, BENCH_PARSE, start);
+	if (st != PARSE_OK)
+	{
+		fprintf(stderr, "%s: -c: %s\n", name, ps.error);
+		return sh.last_status = 2;
+	}
+	exec_tail(&sh, tree, &arena);
+	arena_reset(&arena);
+	return sh.last_status;
+}
+
+/*
+ * search_key:
+ *  - Purpose: Ctrl-R. Replaces readline's linear reverse search.
+ *      * The first press takes the line as the pattern and looks it up in
+ *        the history index; the line becomes the best match.
+ *      * Pressing it again while the match is unchanged shows the next one.
+ *        Editing the line starts a new search.
+ */
+static int search_key(int count, int key)
+{
+	(void)count;
+	(void)key;
+	if (!sh.history)
+	{
+		return rl_ding();
+	}
+	if (!search.shown || strcmp(search.shown, rl_line_buffer) != 0)
+	{
+		free(search.pattern);
+		search.pattern = strdup(rl_line_buffer);
+		size_t max = history_count(sh.history);
+		free(search.hits);
+		search.hits = malloc((max ? max : 1) * sizeof(*search.hits));
+		if (!search.pattern || !search.hits)
+		{
+			fprintf(stderr, "lab: allocation error\n");
+			exit(EXIT_FAILURE);
+		}
+		search.count = history_find(sh.history, search.pattern, strlen(search.pattern), search.hits, max);
+		search.next = 0;
+	}
+	if (search.next == search.count)
+	{
+		return rl_ding();
+	}
+	size_t len;
+	const char *e = history_entry(sh.history, search.hits[search.next++], &len);
+	free(search.shown);
+	search.shown = strndup(e, len);
+	if (!search.shown)
+	{
+		fprintf(stderr, "lab: allocation error\n");
+		exit(EXIT_FAILURE);
+	}
+	rl_replace_line(search.shown, 0);
+	rl_point = rl_end;
+	return 0;
+}
+
+/*
+ * command_generator:
+ *  - Purpose: Hand readline the command names matching text one at a time.
+ *    All of them are looked up on the first call; readline frees the names.
+ */
+static char *command_generator(const char *text, int state)
+{
+	static char **names;
+	static size_t next;
+	if (state == 0)
+	{
+		for (size_t i = next; names && names[i]; i++)
+		{
+			free(names[i]);
+		}
+		free(names);
+		names = command_complete(&sh, text);
+		next = 0;
+	}
+	char *name = names[next];
+	if (name)
+	{
+		next++;
+	}
+	else
+	{
+		free(names);
+		names = NULL;
+	}
+	return name;
+}
+
+/*
+ * complete_line:
+ *  - Purpose: Complete command names where a command starts: at the start
+ *    of the line or after an operator. Anything else, and words with a
+ *    slash, fall back to readline's file name completion.
+ */
+static char **complete_line(const char *text, int start, int end)
+{
+	(void)end;
+	int i = start;
+	while (i > 0 && isspace((unsigned char)rl_line_buffer[i - 1]))
+	{
+		i--;
+	}
+	if ((i > 0 && !strchr(";&|(", rl_line_buffer[i - 1])) || strchr(text, '/'))
+	{
+		return NULL;
+	}
+	return rl_completion_matches(text, command_generator);
+}
+
+/*
+ * run_interactive:
+ *  - Purpose: The readline loop of an interactive shell.
+ */
+static int run_interactive(void)
+{
+	// the history file is mapped on first use, opening it reads nothing
+	char *path = history_default_path(&sh);
+	if (path)
+	{
+		sh.history = history_open(path);
+		free(path);
+	}
+	// signals reach the shell through the event loop, not readline's handlers
+	rl_catch_signals = 0;
+	rl_bind_key(CTRL('R'), search_key);
+	rl_attempted_completion_function = complete_line;
+	parse_lines_init(&lines);
+	rl_callback_handler_install(prompt_render(&sh), on_line);
+	reading = true;
+	while (!done)
+	{
+		int ready = event_poll_input(sh.events, STDIN_FILENO, -1);
+		if (sh.events->interrupted)
+		{
+			cancel_line();
+		}
+		else if (ready > 0)
+		{
+			rl_callback_read_char();
+		}
+		else if (sh.events->woken)
+		{
+			redraw_prompt();
+		}
+		else if (ready < 0)
+		{
+			break;
+		}
+		notify_jobs();
+	}
+	if (reading)
+	{
+		rl_callback_handler_remove();
+	}
+	parse_lines_destroy(&lines);
+	free(search.pattern);
+	free(search.hits);
+	free(search.shown);
+	return sh.last_status;
+}
+
+int main(int argc, char *argv[])
+{
+	struct shell_options opt;
+	if (parse_args(argc, argv, &opt) != 0)
+	{
+		return 2;
+	}
+	if (opt.version)
+	{
+		printf("%s version %d.%d\n", argv[0], lab_VERSION_MAJOR, lab_VERSION_MINOR);
+		return 0;
+	}
+	sh_init_with(&sh, &opt);
+	parser_init(&ps);
+	arena_init(&arena, 0);
+	if (sh.shell_is_interactive && !opt.norc)
+	{
+		run_rc();
+	}
+	int status;
+	if (opt.command)
+	{
+		status = run_string(opt.name, opt.command);
+	}
+	else if (opt.script)
+	{
+		status = run_file(opt.script, true);
+	}
+	else if (!sh.shell_is_interactive)
+	{
+		// input that is not a terminal is read like a script
+		status = run_script(opt.name, STDIN_FILENO, true);
+	}
+	else
+	{
+		status = run_interactive();
+	}
+	bench_report(&sh, stderr);
+	arena_destroy(&arena);
+	parser_destroy(&ps);
 	sh_destroy(&sh);
-}
\ No newline at end of file
+	return status;
+}
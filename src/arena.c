@@ -0,0 +1,96 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+struct arena_block {
+    struct arena_block *next;
+    char *end;
+    max_align_t data[];
+};
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+void arena_init(struct arena *a, size_t block_size) {
+    a->head = a->cur = NULL;
+    a->ptr = a->end = NULL;
+    a->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+/*
+ * new_block:
+ *  - Purpose: Allocate a block with room for at least size bytes.
+ */
+static struct arena_block *new_block(size_t size) {
+    struct arena_block *b = malloc(sizeof(*b) + size);
+    if (!b) {
+        fprintf(stderr, "arena: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    b->next = NULL;
+    b->end = (char *)b->data + size;
+    return b;
+}
+
+/*
+ * arena_alloc:
+ *  - Purpose: Bump allocate from the current block.
+ *      * When the current block is full the next block of the chain is
+ *        reused if it is large enough, otherwise a new block is linked in
+ *        after the current one.
+ */
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if ((size_t)(a->end - a->ptr) < size || !a->ptr) {
+        struct arena_block *next = a->cur ? a->cur->next : a->head;
+        if (!next || (size_t)(next->end - (char *)next->data) < size) {
+            struct arena_block *b = new_block(size > a->block_size ? size : a->block_size);
+            b->next = next;
+            if (a->cur) {
+                a->cur->next = b;
+            } else {
+                a->head = b;
+            }
+            next = b;
+        }
+        a->cur = next;
+        a->ptr = (char *)next->data;
+        a->end = next->end;
+    }
+    void *p = a->ptr;
+    a->ptr += size;
+    return p;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+void arena_reset(struct arena *a) {
+    a->cur = NULL;
+    a->ptr = a->end = NULL;
+}
+
+struct arena_mark arena_save(const struct arena *a) {
+    struct arena_mark m = {a->cur, a->ptr, a->end};
+    return m;
+}
+
+void arena_restore(struct arena *a, struct arena_mark m) {
+    a->cur = m.cur;
+    a->ptr = m.ptr;
+    a->end = m.end;
+}
+
+void arena_destroy(struct arena *a) {
+    struct arena_block *b = a->head;
+    while (b) {
+        struct arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena_init(a, a->block_size);
+}
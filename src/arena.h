@@ -0,0 +1,103 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Default size of an arena block */
+#define ARENA_BLOCK_SIZE 4096
+
+struct arena_block;
+
+/**
+* @brief A bump allocator. Objects are never freed one by one, instead the
+* whole arena is reset at once. Blocks are kept across resets so a steady
+* state workload does no heap allocation at all.
+*/
+struct arena
+{
+    struct arena_block *head;   /* first block of the chain */
+    struct arena_block *cur;    /* block being allocated from */
+    char *ptr;                  /* next free byte in cur */
+    char *end;                  /* end of cur */
+    size_t block_size;
+};
+
+/* A position in an arena, see arena_save */
+struct arena_mark
+{
+    struct arena_block *cur;
+    char *ptr;
+    char *end;
+};
+
+/**
+* @brief Initialize an empty arena. No memory is allocated until the first
+* call to arena_alloc.
+*
+* @param a The arena
+* @param block_size Size of each block, 0 selects ARENA_BLOCK_SIZE
+*/
+
+void arena_init(struct arena *a, size_t block_size);
+/**
+* @brief Allocate size bytes aligned for any object type. Never returns NULL,
+* the process exits if the system is out of memory.
+*
+* @param a The arena
+* @param size Number of bytes
+* @return Pointer to the memory
+*/
+
+void *arena_alloc(struct arena *a, size_t size);
+/**
+* @brief Copy n bytes of s into the arena and NUL terminate the copy.
+*
+* @param a The arena
+* @param s The bytes to copy
+* @param n Number of bytes
+* @return The copy
+*/
+
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+/**
+* @brief Release every object in the arena in O(1). The blocks are kept
+* and reused by later allocations.
+*
+* @param a The arena
+*/
+
+void arena_reset(struct arena *a);
+/**
+* @brief Remember the current position of the arena.
+*
+* @param a The arena
+* @return The position
+*/
+
+struct arena_mark arena_save(const struct arena *a);
+/**
+* @brief Release every object allocated since the position was saved. The
+* blocks are kept, as with arena_reset, so a loop that saves and restores
+* around each iteration reuses the same memory every time.
+*
+* @param a The arena
+* @param m A position saved from the same arena
+*/
+
+void arena_restore(struct arena *a, struct arena_mark m);
+/**
+* @brief Free all blocks owned by the arena.
+*
+* @param a The arena
+*/
+
+void arena_destroy(struct arena *a);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
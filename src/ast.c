@@ -0,0 +1,515 @@
+#include "ast.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+ * The parser is a recursive descent parser over the POSIX grammar subset
+ *
+ *   list     : and_or ((';' | '&' | NEWLINE) and_or)* [';' | '&']
+ *   and_or   : pipeline (('&&' | '||') linebreak pipeline)*
+ *   pipeline : ['!'] command ('|' linebreak command)*
+ *   command  : '(' list ')' redirect* | for redirect* | (word | redirect)+
+ *   for      : 'for' name linebreak ['in' word* (';' | NEWLINE)] linebreak
+ *              'do' list 'done'
+ *   redirect : [IO_NUMBER] redirop word
+ *
+ * It keeps exactly one token of lookahead. Every node and string is taken
+ * from the arena so nothing needs to be freed when the tree is discarded.
+ * Reserved words are only recognized unquoted and where a command starts.
+ */
+
+/* What closes a list */
+enum list_end
+{
+    LIST_TOP,       /* the end of the input */
+    LIST_PAREN,     /* ) */
+    LIST_DONE       /* done */
+};
+
+void parser_init(struct parser *ps) {
+    lex_init(&ps->lx);
+    ps->arena = NULL;
+    ps->error = NULL;
+}
+
+void parser_destroy(struct parser *ps) {
+    lex_destroy(&ps->lx);
+}
+
+/*
+ * advance:
+ *  - Purpose: Load the next token into ps->tok. A lexer error at the end of
+ *    the input (open quote or $( ) means the construct continues on another
+ *    line, and is reported as PARSE_INCOMPLETE by the caller.
+ */
+static enum parse_status advance(struct parser *ps) {
+    if (lex_next(&ps->lx, &ps->tok) == LEX_ERROR) {
+        ps->error = ps->lx.error;
+        return PARSE_INCOMPLETE;
+    }
+    return PARSE_OK;
+}
+
+static bool is_op(struct parser *ps, enum tok_op op) {
+    return ps->tok.type == TOK_OPERATOR && ps->tok.op == op;
+}
+
+static bool is_reserved(struct parser *ps, const char *word) {
+    return ps->tok.type == TOK_WORD && ps->tok.nspans == 0 && strcmp(ps->tok.text, word) == 0;
+}
+
+/*
+ * unexpected:
+ *  - Purpose: Report a syntax error at the lookahead token. Running out of
+ *    input where more is required is reported as incomplete instead.
+ */
+static enum parse_status unexpected(struct parser *ps) {
+    if (ps->tok.type == TOK_EOF) {
+        ps->error = "syntax error: unexpected end of input";
+        return PARSE_INCOMPLETE;
+    }
+    snprintf(ps->errbuf, sizeof(ps->errbuf), "syntax error near unexpected token `%s'",
+             ps->tok.type == TOK_NEWLINE ? "newline" : ps->tok.text);
+    ps->error = ps->errbuf;
+    return PARSE_ERROR;
+}
+
+static enum parse_status skip_newlines(struct parser *ps) {
+    enum parse_status st = PARSE_OK;
+    while (st == PARSE_OK && ps->tok.type == TOK_NEWLINE) {
+        st = advance(ps);
+    }
+    return st;
+}
+
+static struct node *new_node(struct parser *ps, enum node_type type) {
+    struct node *n = arena_alloc(ps->arena, sizeof(*n));
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    return n;
+}
+
+/*
+ * push:
+ *  - Purpose: Append to an arena backed pointer vector, doubling it when full.
+ *    The old storage is simply abandoned in the arena.
+ */
+static void **push(struct parser *ps, void **vec, size_t n, size_t *cap, void *item) {
+    if (n + 1 >= *cap) {
+        size_t ncap = *cap ? *cap * 2 : 8;
+        void **nvec = arena_alloc(ps->arena, ncap * sizeof(void *));
+        if (n) memcpy(nvec, vec, n * sizeof(void *));
+        vec = nvec;
+        *cap = ncap;
+    }
+    vec[n] = item;
+    vec[n + 1] = NULL;
+    return vec;
+}
+
+static enum parse_status parse_list(struct parser *ps, enum list_end until, struct node **out);
+
+/*
+ * parse_redirect:
+ *  - Purpose: Parse [IO_NUMBER] redirop word and link it onto the list at *tail.
+ */
+static enum parse_status parse_redirect(struct parser *ps, struct redir ***tail) {
+    enum parse_status st;
+    int fd = -1;
+    if (ps->tok.type == TOK_IO_NUMBER) {
+        fd = atoi(ps->tok.text);
+        if ((st = advance(ps)) != PARSE_OK) return st;
+    }
+    enum tok_op op = ps->tok.op;
+    if (op == OP_DLESS || op == OP_DLESSDASH) {
+        ps->error = "here-documents are not supported";
+        return PARSE_ERROR;
+    }
+    if ((st = advance(ps)) != PARSE_OK) return st;
+    if (ps->tok.type == TOK_EOF) {
+        ps->error = "syntax error near unexpected token `newline'";
+        return PARSE_ERROR;
+    }
+    if (ps->tok.type != TOK_WORD) return unexpected(ps);
+    struct redir *r = arena_alloc(ps->arena, sizeof(*r));
+    if (fd < 0) {
+        fd = (op == OP_LESS || op == OP_LESSAND || op == OP_LESSGREAT) ? 0 : 1;
+    }
+    r->fd = fd;
+    r->op = op;
+    r->target = arena_strndup(ps->arena, ps->tok.text, ps->tok.len);
+    r->next = NULL;
+    **tail = r;
+    *tail = &r->next;
+    return advance(ps);
+}
+
+/*
+ * parse_for:
+ *  - Purpose: Parse a for loop, from the word "for" up to "done". The words
+ *    after "in" are kept raw, they are expanded each time the loop runs.
+ */
+static enum parse_status parse_for(struct parser *ps, struct node **out) {
+    enum parse_status st;
+    struct node *n = new_node(ps, N_FOR);
+    if ((st = advance(ps)) != PARSE_OK) return st;
+    if (ps->tok.type != TOK_WORD) return unexpected(ps);
+    const char *name = ps->tok.text;
+    bool valid = ps->tok.nspans == 0 && (isalpha((unsigned char)*name) || *name == '_');
+    for (const char *p = name; valid && *p; p++) valid = isalnum((unsigned char)*p) || *p == '_';
+    if (!valid) {
+        snprintf(ps->errbuf, sizeof(ps->errbuf), "`%s': not a valid identifier", name);
+        ps->error = ps->errbuf;
+        return PARSE_ERROR;
+    }
+    n->loop.name = arena_strndup(ps->arena, ps->tok.text, ps->tok.len);
+    if ((st = advance(ps)) != PARSE_OK) return st;
+    if ((st = skip_newlines(ps)) != PARSE_OK) return st;
+    void **words = NULL;
+    size_t nwords = 0, cap = 0;
+    if (is_reserved(ps, "in")) {
+        n->loop.in = true;
+        if ((st = advance(ps)) != PARSE_OK) return st;
+        while (ps->tok.type == TOK_WORD) {
+            char *w = arena_strndup(ps->arena, ps->tok.text, ps->tok.len);
+            words = push(ps, words, nwords++, &cap, w);
+            if ((st = advance(ps)) != PARSE_OK) return st;
+        }
+        if (!is_op(ps, OP_SEMI) && ps->tok.type != TOK_NEWLINE) return unexpected(ps);
+        if ((st = advance(ps)) != PARSE_OK) return st;
+    } else if (is_op(ps, OP_SEMI)) {
+        if ((st = advance(ps)) != PARSE_OK) return st;
+    }
+    if (!words) words = push(ps, words, 0, &cap, NULL);
+    n->loop.words = (char **)words;
+    n->loop.nwords = nwords;
+    if ((st = skip_newlines(ps)) != PARSE_OK) return st;
+    if (!is_reserved(ps, "do")) return unexpected(ps);
+    if ((st = advance(ps)) != PARSE_OK) return st;
+    if ((st = parse_list(ps, LIST_DONE, &n->loop.body)) != PARSE_OK) return st;
+    if (!is_reserved(ps, "done")) return unexpected(ps);
+    if (!n->loop.body) {
+        ps->error = "syntax error near unexpected token `done'";
+        return PARSE_ERROR;
+    }
+    *out = n;
+    return advance(ps);
+}
+
+/*
+ * parse_command:
+ *  - Purpose: Parse a subshell, a for loop or a simple command.
+ */
+static enum parse_status parse_command(struct parser *ps, struct node **out) {
+    enum parse_status st;
+    struct redir *redirs = NULL, **tail = &redirs;
+    if (is_reserved(ps, "for")) {
+        if ((st = parse_for(ps, out)) != PARSE_OK) return st;
+        while (ps->tok.type == TOK_REDIRECT || ps->tok.type == TOK_IO_NUMBER) {
+            if ((st = parse_redirect(ps, &tail)) != PARSE_OK) return st;
+        }
+        (*out)->loop.redirs = redirs;
+        return PARSE_OK;
+    }
+    if (is_op(ps, OP_LPAREN)) {
+        struct node *n = new_node(ps, N_SUBSHELL);
+        if ((st = advance(ps)) != PARSE_OK) return st;
+        if ((st = parse_list(ps, LIST_PAREN, &n->sub.body)) != PARSE_OK) return st;
+        if (!is_op(ps, OP_RPAREN)) return unexpected(ps);
+        if (!n->sub.body) {
+            ps->error = "syntax error near unexpected token `)'";
+            return PARSE_ERROR;
+        }
+        if ((st = advance(ps)) != PARSE_OK) return st;
+        while (ps->tok.type == TOK_REDIRECT || ps->tok.type == TOK_IO_NUMBER) {
+            if ((st = parse_redirect(ps, &tail)) != PARSE_OK) return st;
+        }
+        n->sub.redirs = redirs;
+        *out = n;
+        return PARSE_OK;
+    }
+
+    struct node *n = new_node(ps, N_SIMPLE);
+    void **words = NULL;
+    size_t nwords = 0, cap = 0;
+    for (;;) {
+        if (ps->tok.type == TOK_WORD) {
+            char *w = arena_strndup(ps->arena, ps->tok.text, ps->tok.len);
+            words = push(ps, words, nwords++, &cap, w);
+            if ((st = advance(ps)) != PARSE_OK) return st;
+        } else if (ps->tok.type == TOK_REDIRECT || ps->tok.type == TOK_IO_NUMBER) {
+            if ((st = parse_redirect(ps, &tail)) != PARSE_OK) return st;
+        } else {
+            break;
+        }
+    }
+    if (nwords == 0 && !redirs) return unexpected(ps);
+    if (!words) words = push(ps, words, 0, &cap, NULL);
+    n->simple.words = (char **)words;
+    n->simple.nwords = nwords;
+    n->simple.redirs = redirs;
+    *out = n;
+    return PARSE_OK;
+}
+
+/*
+ * parse_pipeline:
+ *  - Purpose: Parse ['!'] command ('|' linebreak command)*. A single command
+ *    without '!' is returned as is rather than wrapped in a pipeline node.
+ */
+static enum parse_status parse_pipeline(struct parser *ps, struct node **out) {
+    enum parse_status st;
+    bool negate = false;
+    if (ps->tok.type == TOK_WORD && ps->tok.nspans == 0 && strcmp(ps->tok.text, "!") == 0) {
+        negate = true;
+        if ((st = advance(ps)) != PARSE_OK) return st;
+    }
+    void **cmds = NULL;
+    size_t ncmds = 0, cap = 0;
+    struct node *cmd;
+    if ((st = parse_command(ps, &cmd)) != PARSE_OK) return st;
+    cmds = push(ps, cmds, ncmds++, &cap, cmd);
+    while (is_op(ps, OP_PIPE)) {
+        if ((st = advance(ps)) != PARSE_OK) return st;
+        if ((st = skip_newlines(ps)) != PARSE_OK) return st;
+        if ((st = parse_command(ps, &cmd)) != PARSE_OK) return st;
+        cmds = push(ps, cmds, ncmds++, &cap, cmd);
+    }
+    if (ncmds == 1 && !negate) {
+        *out = cmd;
+        return PARSE_OK;
+    }
+    struct node *n = new_node(ps, N_PIPELINE);
+    n->pipeline.cmds = (struct node **)cmds;
+    n->pipeline.ncmds = ncmds;
+    n->pipeline.negate = negate;
+    *out = n;
+    return PARSE_OK;
+}
+
+/*
+ * parse_and_or:
+ *  - Purpose: Parse pipelines joined by && and ||, which are left associative.
+ */
+static enum parse_status parse_and_or(struct parser *ps, struct node **out) {
+    enum parse_status st;
+    struct node *left;
+    if ((st = parse_pipeline(ps, &left)) != PARSE_OK) return st;
+    while (is_op(ps, OP_AND_IF) || is_op(ps, OP_OR_IF)) {
+        struct node *n = new_node(ps, is_op(ps, OP_AND_IF) ? N_AND : N_OR);
+        if ((st = advance(ps)) != PARSE_OK) return st;
+        if ((st = skip_newlines(ps)) != PARSE_OK) return st;
+        n->binary.left = left;
+        if ((st = parse_pipeline(ps, &n->binary.right)) != PARSE_OK) return st;
+        left = n;
+    }
+    *out = left;
+    return PARSE_OK;
+}
+
+/*
+ * at_list_end:
+ *  - Purpose: True when the lookahead closes the current list.
+ */
+static bool at_list_end(struct parser *ps, enum list_end until) {
+    return ps->tok.type == TOK_EOF || (until == LIST_PAREN && is_op(ps, OP_RPAREN)) ||
+           (until == LIST_DONE && is_reserved(ps, "done"));
+}
+
+/*
+ * parse_list:
+ *  - Purpose: Parse and_or lists separated by ; & or newlines. The list is
+ *    built as a left leaning chain of N_SEQ nodes, an and_or followed by &
+ *    is wrapped in an N_BACKGROUND node.
+ */
+static enum parse_status parse_list(struct parser *ps, enum list_end until, struct node **out) {
+    enum parse_status st;
+    struct node *list = NULL;
+    *out = NULL;
+    if ((st = skip_newlines(ps)) != PARSE_OK) return st;
+    while (!at_list_end(ps, until)) {
+        struct node *item;
+        if ((st = parse_and_or(ps, &item)) != PARSE_OK) return st;
+        if (is_op(ps, OP_AMP)) {
+            struct node *bg = new_node(ps, N_BACKGROUND);
+            bg->sub.body = item;
+            item = bg;
+        }
+        if (list) {
+            struct node *seq = new_node(ps, N_SEQ);
+            seq->binary.left = list;
+            seq->binary.right = item;
+            item = seq;
+        }
+        list = item;
+        if (is_op(ps, OP_AMP) || is_op(ps, OP_SEMI) || ps->tok.type == TOK_NEWLINE) {
+            if ((st = advance(ps)) != PARSE_OK) return st;
+            if ((st = skip_newlines(ps)) != PARSE_OK) return st;
+        } else if (!at_list_end(ps, until)) {
+            return unexpected(ps);
+        }
+    }
+    *out = list;
+    return PARSE_OK;
+}
+
+/*
+ * parse_line:
+ *  - Purpose: Lex and parse a complete chunk of input into a tree.
+ */
+enum parse_status parse_line(struct parser *ps, const char *src, size_t len,
+                             struct arena *a, struct node **out) {
+    enum parse_status st;
+    *out = NULL;
+    ps->arena = a;
+    ps->error = NULL;
+    lex_reset(&ps->lx);
+    lex_feed(&ps->lx, src, len);
+    lex_eof(&ps->lx);
+    if ((st = advance(ps)) != PARSE_OK) return st;
+    if ((st = parse_list(ps, LIST_TOP, out)) != PARSE_OK) {
+        *out = NULL;
+        return st;
+    }
+    if (ps->tok.type != TOK_EOF) {
+        *out = NULL;
+        return unexpected(ps);
+    }
+    return PARSE_OK;
+}
+
+void parse_lines_init(struct parse_lines *pl) {
+    pl->text = NULL;
+    pl->len = 0;
+    pl->cap = 0;
+    pl->pending = false;
+}
+
+void parse_lines_destroy(struct parse_lines *pl) {
+    free(pl->text);
+}
+
+static void lines_append(struct parse_lines *pl, const char *s, size_t len) {
+    if (pl->len + len > pl->cap) {
+        size_t ncap = pl->cap ? pl->cap : 256;
+        while (ncap < pl->len + len) ncap *= 2;
+        char *ntext = realloc(pl->text, ncap);
+        if (!ntext) {
+            fprintf(stderr, "parse_lines: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        pl->text = ntext;
+        pl->cap = ncap;
+    }
+    memcpy(pl->text + pl->len, s, len);
+    pl->len += len;
+}
+
+/*
+ * parse_lines_add:
+ *  - Purpose: The parser keeps no state between calls, so a command that
+ *    spans lines is parsed again from its first line each time one is
+ *    added. A line that starts a command is parsed in place and only copied
+ *    when the command turns out to continue.
+ */
+enum parse_status parse_lines_add(struct parser *ps, struct parse_lines *pl, const char *line,
+                                  size_t len, struct arena *a, struct node **out) {
+    const char *src = line;
+    if (pl->pending) {
+        lines_append(pl, "\n", 1);
+        lines_append(pl, line, len);
+        src = pl->text;
+        len = pl->len;
+    }
+    enum parse_status st = parse_line(ps, src, len, a, out);
+    if (st == PARSE_INCOMPLETE && !pl->pending) {
+        pl->len = 0;
+        lines_append(pl, line, len);
+    }
+    pl->pending = st == PARSE_INCOMPLETE;
+    return st;
+}
+
+/*
+ * print_redirs:
+ *  - Purpose: Write redirections separated by blanks, leaving out the
+ *    descriptor when it is the default one for the operator. sep says
+ *    whether the first one needs a blank in front too.
+ */
+static void print_redirs(FILE *f, const struct redir *r, bool sep) {
+    for (; r; r = r->next, sep = true) {
+        int deflt = (r->op == OP_LESS || r->op == OP_LESSAND || r->op == OP_LESSGREAT) ? 0 : 1;
+        if (sep) fputc(' ', f);
+        if (r->fd != deflt) fprintf(f, "%d", r->fd);
+        fprintf(f, "%s%s", tok_op_str(r->op), r->target);
+    }
+}
+
+/*
+ * node_print:
+ *  - Purpose: The inverse of the parser, good enough to show a job.
+ */
+void node_print(FILE *f, const struct node *n) {
+    if (!n) return;
+    switch (n->type) {
+    case N_SIMPLE:
+        for (size_t i = 0; i < n->simple.nwords; i++) {
+            fprintf(f, i ? " %s" : "%s", n->simple.words[i]);
+        }
+        print_redirs(f, n->simple.redirs, n->simple.nwords > 0);
+        break;
+    case N_PIPELINE:
+        if (n->pipeline.negate) fputs("! ", f);
+        for (size_t i = 0; i < n->pipeline.ncmds; i++) {
+            if (i) fputs(" | ", f);
+            node_print(f, n->pipeline.cmds[i]);
+        }
+        break;
+    case N_AND:
+    case N_OR:
+        node_print(f, n->binary.left);
+        fputs(n->type == N_AND ? " && " : " || ", f);
+        node_print(f, n->binary.right);
+        break;
+    case N_SEQ:
+        node_print(f, n->binary.left);
+        fputs(n->binary.left->type == N_BACKGROUND ? " " : "; ", f);
+        node_print(f, n->binary.right);
+        break;
+    case N_BACKGROUND:
+        node_print(f, n->sub.body);
+        fputs(" &", f);
+        break;
+    case N_SUBSHELL:
+        fputc('(', f);
+        node_print(f, n->sub.body);
+        fputc(')', f);
+        print_redirs(f, n->sub.redirs, true);
+        break;
+    case N_FOR:
+        fprintf(f, "for %s", n->loop.name);
+        if (n->loop.in) {
+            fputs(" in", f);
+            for (size_t i = 0; i < n->loop.nwords; i++) fprintf(f, " %s", n->loop.words[i]);
+        }
+        fputs("; do ", f);
+        node_print(f, n->loop.body);
+        fputs(n->loop.body->type == N_BACKGROUND ? " done" : "; done", f);
+        print_redirs(f, n->loop.redirs, true);
+        break;
+    }
+}
+
+char *node_string(const struct node *n) {
+    char *s = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&s, &len);
+    if (!f) {
+        fprintf(stderr, "node_string: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    node_print(f, n);
+    fclose(f);
+    return s;
+}
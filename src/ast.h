@@ -0,0 +1,194 @@
+#ifndef AST_H
+#define AST_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "arena.h"
+#include "lexer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* The kinds of node in a command tree */
+enum node_type
+{
+    N_SIMPLE,       /* words and redirections: ls -l >out */
+    N_PIPELINE,     /* a | b | c */
+    N_AND,          /* a && b */
+    N_OR,           /* a || b */
+    N_SEQ,          /* a ; b */
+    N_BACKGROUND,   /* a & */
+    N_SUBSHELL,     /* ( list ) */
+    N_FOR           /* for name in words; do list; done */
+};
+
+/**
+* @brief A redirection such as 2>>log. The target is the raw word as it was
+* lexed, it is expanded when the redirection is performed.
+*/
+struct redir
+{
+    int fd;             /* the file descriptor being redirected */
+    enum tok_op op;     /* OP_LESS, OP_GREAT, OP_DGREAT, ... */
+    char *target;
+    struct redir *next;
+};
+
+/**
+* @brief A node of the command tree. All nodes and the strings they point to
+* are allocated from the arena passed to parse_line, so the whole tree is
+* released with a single arena_reset.
+*/
+struct node
+{
+    enum node_type type;
+    union
+    {
+        struct
+        {
+            char **words;           /* raw words, NULL terminated */
+            size_t nwords;
+            struct redir *redirs;
+        } simple;
+        struct
+        {
+            struct node **cmds;
+            size_t ncmds;
+            bool negate;            /* ! a | b */
+        } pipeline;
+        struct
+        {
+            struct node *left;
+            struct node *right;
+        } binary;                   /* N_AND, N_OR, N_SEQ */
+        struct
+        {
+            struct node *body;
+            struct redir *redirs;
+        } sub;                      /* N_SUBSHELL, N_BACKGROUND */
+        struct
+        {
+            char *name;
+            char **words;           /* raw words, NULL terminated */
+            size_t nwords;
+            bool in;                /* false without "in", to walk "$@" */
+            struct node *body;
+            struct redir *redirs;
+        } loop;                     /* N_FOR */
+    };
+};
+
+/* Return values of parse_line */
+enum parse_status
+{
+    PARSE_OK,           /* a tree (possibly NULL for an empty line) was produced */
+    PARSE_INCOMPLETE,   /* the input ended inside a construct, more lines are needed */
+    PARSE_ERROR         /* syntax error, see parser.error */
+};
+
+/**
+* @brief Parser state. The lexer and its buffers are reused across lines.
+*/
+struct parser
+{
+    struct lexer lx;
+    struct token tok;       /* the lookahead token */
+    struct arena *arena;
+    const char *error;
+    char errbuf[128];
+};
+
+/**
+* @brief Initialize a parser. Must be released with parser_destroy.
+*
+* @param ps The parser
+*/
+
+void parser_init(struct parser *ps);
+/**
+* @brief Free the resources held by the parser.
+*
+* @param ps The parser
+*/
+
+void parser_destroy(struct parser *ps);
+/**
+* @brief Parse a complete chunk of shell input into a command tree.
+*
+* @param ps The parser
+* @param src The input
+* @param len The length of the input
+* @param a The arena the tree is allocated from
+* @param out Set to the tree, or NULL when the input holds no commands
+* @return PARSE_OK, PARSE_INCOMPLETE or PARSE_ERROR
+*/
+
+enum parse_status parse_line(struct parser *ps, const char *src, size_t len,
+                             struct arena *a, struct node **out);
+/**
+* @brief The lines of a command that continues past the end of a line, for
+* input that arrives a line at a time.
+*/
+struct parse_lines
+{
+    char *text;
+    size_t len;
+    size_t cap;
+    bool pending;   /* the last line ended inside a construct */
+};
+
+/**
+* @brief Initialize an empty set of lines. Must be released with
+* parse_lines_destroy.
+*
+* @param pl The lines
+*/
+
+void parse_lines_init(struct parse_lines *pl);
+/**
+* @brief Free the kept lines.
+*
+* @param pl The lines
+*/
+
+void parse_lines_destroy(struct parse_lines *pl);
+/**
+* @brief Parse line as the next line of a command. While the result is
+* PARSE_INCOMPLETE the lines are kept and parsed again together with the
+* next one; any other result means the next line starts a new command.
+*
+* @param ps The parser
+* @param pl The lines kept so far
+* @param line The line, without its newline
+* @param len Its length
+* @param a The arena the tree is allocated from
+* @param out Set to the tree, or NULL when the input holds no commands
+* @return PARSE_OK, PARSE_INCOMPLETE or PARSE_ERROR
+*/
+
+enum parse_status parse_lines_add(struct parser *ps, struct parse_lines *pl, const char *line,
+                                  size_t len, struct arena *a, struct node **out);
+/**
+* @brief Write a tree back out as shell source, with words exactly as they
+* were typed. Used to show the command of a job.
+*
+* @param f Where to write
+* @param n The tree
+*/
+
+void node_print(FILE *f, const struct node *n);
+/**
+* @brief node_print into a string.
+*
+* @param n The tree
+* @return A string the caller must free
+*/
+
+char *node_string(const struct node *n);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,367 @@
+#include "builtins.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "coreutils.h"
+#include "history.h"
+#include "loadable.h"
+#include "vars.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+/*
+ * builtin_exit:
+ *  - Purpose: exit [n]. Terminate the shell with status n, or with the
+ *    status of the last command.
+ *      * A status that is not a number is reported and the shell exits
+ *        with 2, as in other shells.
+ *      * main never returns, so the --bench report is printed here. A
+ *        subshell leaves it to the shell that forked it.
+ *      * During tests (when SKIP_EXIT is set to "1") it returns the status
+ *        instead.
+ */
+static int builtin_exit(struct shell *sh, char **argv) {
+    int status = sh->last_status;
+    if (argv[1] && argv[2]) {
+        fprintf(stderr, "exit: too many arguments\n");
+        return 1;
+    }
+    if (argv[1]) {
+        char *end;
+        errno = 0;
+        long n = strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end || errno) {
+            fprintf(stderr, "exit: %s: numeric argument required\n", argv[1]);
+            status = 2;
+        } else {
+            status = (int)(n & 0xff);
+        }
+    }
+    char *skip_exit = getenv("SKIP_EXIT");
+    if (skip_exit && strcmp(skip_exit, "1") == 0) {
+        return status;
+    }
+    if (getpid() == sh->pid) bench_report(sh, stderr);
+    exit(status);
+}
+
+/*
+ * builtin_cd:
+ *  - Purpose: cd [dir]. HOME comes from the shell variables, and PWD and
+ *    OLDPWD are updated after a successful change.
+ */
+static int builtin_cd(struct shell *sh, char **argv) {
+    const char *home = vars_get(sh->vars, "HOME");
+    if (!argv[1] && !home) {
+        fprintf(stderr, "cd: HOME not set\n");
+        return 1;
+    }
+    char *dir[] = {argv[0], argv[1] ? argv[1] : (char *)home, NULL};
+    if (change_dir(dir) != 0) return 1;
+    const char *old = vars_get(sh->vars, "PWD");
+    if (old) vars_set(sh->vars, "OLDPWD", old, 0);
+    char *cwd = getcwd(NULL, 0);
+    if (cwd) vars_set(sh->vars, "PWD", cwd, 0);
+    free(cwd);
+    return 0;
+}
+
+static int builtin_hash(struct shell *sh, char **argv) {
+    return path_cache_builtin(sh->path_cache, vars_get(sh->vars, "PATH"), argv);
+}
+
+static int builtin_enable(struct shell *sh, char **argv);
+
+/*
+ * The core builtins in a perfect hash table. The key packs the first and
+ * last byte and the length of the name, the slot is the top CORE_BITS bits
+ * of key * CORE_SEED. The seed was found by brute force search over odd
+ * multipliers so that no two core names share a slot; adding a builtin
+ * means searching again and moving the entries to their new slots.
+ * test_builtin_core_table checks the placement.
+ */
+#define CORE_BITS 5
+#define CORE_SEED 0xc3434247u
+
+static const struct builtin core[1 << CORE_BITS] = {
+    [0]  = {"unset", unset_builtin},
+    [1]  = {"true", true_builtin},
+    [2]  = {"export", export_builtin},
+    [3]  = {"jobs", jobs_builtin},
+    [4]  = {"enable", builtin_enable},
+    [7]  = {"echo", echo_builtin},
+    [8]  = {"wait", wait_builtin},
+    [9]  = {"cd", builtin_cd},
+    [10] = {"bg", bg_builtin},
+    [12] = {"fg", fg_builtin},
+    [15] = {"pwd", pwd_builtin},
+    [17] = {"exit", builtin_exit},
+    [18] = {"[", test_builtin},
+    [20] = {"false", false_builtin},
+    [21] = {"hash", builtin_hash},
+    [24] = {"printf", printf_builtin},
+    [29] = {"history", history_builtin},
+    [31] = {"test", test_builtin},
+};
+
+static size_t core_slot(const char *name, size_t len) {
+    uint32_t key = (unsigned char)name[0] | (uint32_t)(unsigned char)name[len - 1] << 8 |
+                   (uint32_t)len << 16;
+    return (uint32_t)(key * CORE_SEED) >> (32 - CORE_BITS);
+}
+
+const struct builtin *builtin_core_lookup(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0) return NULL;
+    const struct builtin *b = &core[core_slot(name, len)];
+    return b->name && strcmp(b->name, name) == 0 ? b : NULL;
+}
+
+/*
+ * hash_name:
+ *  - Purpose: 64 bit FNV-1a hash of a builtin name.
+ */
+static uint64_t hash_name(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+ * find_slot:
+ *  - Purpose: Linear probe for name. Returns the slot holding it or the empty
+ *    slot where it would be inserted.
+ */
+static struct builtin_entry *find_slot(const struct builtin_table *t, const char *name, uint64_t h) {
+    size_t mask = t->cap - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        struct builtin_entry *e = &t->slots[i];
+        if (!e->b.name || (e->hash == h && strcmp(e->b.name, name) == 0)) return e;
+    }
+}
+
+const struct builtin *builtin_lookup(const struct shell *sh, const char *name) {
+    const struct builtin_table *t = sh->builtins;
+    if (t && t->count) {
+        struct builtin_entry *e = find_slot(t, name, hash_name(name));
+        if (e->b.name) return &e->b;
+    }
+    return builtin_core_lookup(name);
+}
+
+/*
+ * grow:
+ *  - Purpose: Double the table, keeping the load factor at or below one half.
+ */
+static void grow(struct builtin_table *t) {
+    struct builtin_entry *old = t->slots;
+    size_t oldcap = t->cap;
+    t->cap = oldcap ? oldcap * 2 : 16;
+    t->slots = calloc(t->cap, sizeof(*t->slots));
+    if (!t->slots) {
+        fprintf(stderr, "builtin: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].b.name) *find_slot(t, old[i].b.name, old[i].hash) = old[i];
+    }
+    free(old);
+}
+
+/*
+ * release:
+ *  - Purpose: Let a loaded builtin clean up and close its shared object.
+ */
+static void release(struct shell *sh, struct builtin_entry *e) {
+    if (!e->handle) return;
+    if (e->desc->unload) e->desc->unload(sh);
+    dlclose(e->handle);
+    e->handle = NULL;
+    e->desc = NULL;
+}
+
+void builtin_register(struct shell *sh, const char *name, builtin_fn fn) {
+    if (!sh->builtins) {
+        sh->builtins = calloc(1, sizeof(struct builtin_table));
+        if (!sh->builtins) {
+            fprintf(stderr, "builtin: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct builtin_table *t = sh->builtins;
+    if ((t->count + 1) * 2 > t->cap) grow(t);
+    uint64_t h = hash_name(name);
+    struct builtin_entry *e = find_slot(t, name, h);
+    if (!e->b.name) {
+        e->b.name = strdup(name);
+        if (!e->b.name) {
+            fprintf(stderr, "builtin: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        e->hash = h;
+        t->count++;
+    }
+    release(sh, e);
+    e->b.fn = fn;
+}
+
+/*
+ * builtin_unregister:
+ *  - Purpose: Backward shift deletion, as in the path cache.
+ */
+bool builtin_unregister(struct shell *sh, const char *name) {
+    struct builtin_table *t = sh->builtins;
+    if (!t || !t->count) return false;
+    size_t mask = t->cap - 1;
+    struct builtin_entry *e = find_slot(t, name, hash_name(name));
+    if (!e->b.name) return false;
+    release(sh, e);
+    free((char *)e->b.name);
+    size_t hole = e - t->slots;
+    for (size_t i = (hole + 1) & mask; t->slots[i].b.name; i = (i + 1) & mask) {
+        size_t home = t->slots[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            t->slots[hole] = t->slots[i];
+            hole = i;
+        }
+    }
+    memset(&t->slots[hole], 0, sizeof(t->slots[hole]));
+    t->count--;
+    return true;
+}
+
+void builtin_each(const struct shell *sh, void (*fn)(const char *name, void *arg), void *arg) {
+    for (size_t k = 0; k < sizeof(core) / sizeof(core[0]); k++) {
+        if (core[k].name) fn(core[k].name, arg);
+    }
+    const struct builtin_table *t = sh->builtins;
+    for (size_t k = 0; t && k < t->cap; k++) {
+        if (t->slots[k].b.name) fn(t->slots[k].b.name, arg);
+    }
+}
+
+void builtin_table_destroy(struct shell *sh) {
+    struct builtin_table *t = sh->builtins;
+    if (!t) return;
+    for (size_t i = 0; i < t->cap; i++) {
+        if (!t->slots[i].b.name) continue;
+        release(sh, &t->slots[i]);
+        free((char *)t->slots[i].b.name);
+    }
+    free(t->slots);
+    free(t);
+    sh->builtins = NULL;
+}
+
+/*
+ * builtin_load:
+ *  - Purpose: dlopen() the object, find <name>_builtin and register it
+ *    under the name the descriptor gives, <name> if it gives none.
+ *      * Every loaded builtin holds its own reference to the object, so
+ *        unregistering one closes exactly what it opened.
+ *      * RTLD_LOCAL keeps the symbols of different objects apart.
+ */
+int builtin_load(struct shell *sh, const char *path, const char *name) {
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "enable: %s\n", dlerror());
+        return -1;
+    }
+    size_t len = strlen(name);
+    char *sym = malloc(len + sizeof("_builtin"));
+    if (!sym) {
+        fprintf(stderr, "builtin: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(sym, name, len);
+    memcpy(sym + len, "_builtin", sizeof("_builtin"));
+    const struct loadable_builtin *desc = dlsym(handle, sym);
+    free(sym);
+    const char *err = NULL;
+    if (!desc) err = "cannot find the builtin descriptor";
+    else if (desc->abi != SHELL_BUILTIN_ABI) err = "built for another ABI version";
+    else if (!desc->fn) err = "no handler";
+    else if (desc->load && desc->load(sh) != 0) err = "initialization failed";
+    if (err) {
+        fprintf(stderr, "enable: %s: %s: %s\n", path, name, err);
+        dlclose(handle);
+        return -1;
+    }
+    const char *cmd = desc->name ? desc->name : name;
+    builtin_register(sh, cmd, desc->fn);
+    struct builtin_table *t = sh->builtins;
+    struct builtin_entry *e = find_slot(t, cmd, hash_name(cmd));
+    e->handle = handle;
+    e->desc = desc;
+    return 0;
+}
+
+/*
+ * builtin_enable:
+ *  - Purpose: The enable builtin.
+ *      enable                  list the builtins, with the usage of loaded ones
+ *      enable -f file name...  load builtins from a shared object
+ *      enable -d name...       unload builtins loaded with -f
+ */
+static int builtin_enable(struct shell *sh, char **argv) {
+    const char *file = NULL;
+    bool del = false;
+    int i = 1, status = 0;
+    for (; argv[i] && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-f") == 0 && argv[i + 1]) {
+            file = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            del = true;
+        } else if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            fprintf(stderr, "enable: usage: enable [-d] [-f file] [name ...]\n");
+            return 2;
+        }
+    }
+    if (!argv[i] && (file || del)) {
+        fprintf(stderr, "enable: usage: enable [-d] [-f file] [name ...]\n");
+        return 2;
+    }
+    if (!argv[i]) {
+        for (size_t k = 0; k < sizeof(core) / sizeof(core[0]); k++) {
+            if (core[k].name) printf("enable %s\n", core[k].name);
+        }
+        const struct builtin_table *t = sh->builtins;
+        for (size_t k = 0; t && k < t->cap; k++) {
+            const struct builtin_entry *e = &t->slots[k];
+            if (!e->b.name) continue;
+            if (e->handle && e->desc->usage) {
+                printf("enable -f %s\t# %s\n", e->b.name, e->desc->usage);
+            } else {
+                printf(e->handle ? "enable -f %s\n" : "enable %s\n", e->b.name);
+            }
+        }
+        return 0;
+    }
+    for (; argv[i]; i++) {
+        if (file) {
+            if (builtin_load(sh, file, argv[i]) != 0) status = 1;
+            continue;
+        }
+        const struct builtin_table *t = sh->builtins;
+        const struct builtin_entry *e = t && t->count ? find_slot(t, argv[i], hash_name(argv[i])) : NULL;
+        if (del) {
+            if (!e || !e->handle) {
+                fprintf(stderr, "enable: %s: not dynamically loaded\n", argv[i]);
+                status = 1;
+            } else {
+                builtin_unregister(sh, argv[i]);
+            }
+        } else if (!builtin_lookup(sh, argv[i])) {
+            fprintf(stderr, "enable: %s: not a shell builtin\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
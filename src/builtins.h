@@ -0,0 +1,126 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+* @brief A built in command. It runs inside the shell process with the
+* shell state at hand and returns the exit status.
+*
+* @param sh The shell
+* @param argv The arguments, argv[0] is the command name
+* @return The exit status
+*/
+typedef int (*builtin_fn)(struct shell *sh, char **argv);
+
+/* A name and its handler */
+struct builtin
+{
+    const char *name;
+    builtin_fn fn;
+};
+
+struct loadable_builtin;
+
+/* A builtin registered at run time */
+struct builtin_entry
+{
+    struct builtin b;   /* b.name is owned by the table */
+    uint64_t hash;
+    void *handle;       /* dlopen handle of a loaded builtin, or NULL */
+    const struct loadable_builtin *desc;
+};
+
+/**
+* @brief Builtins registered at run time. Open addressing with linear
+* probing, looked up before the core builtins so a registration can replace
+* one of them.
+*/
+struct builtin_table
+{
+    struct builtin_entry *slots;
+    size_t cap;         /* power of two */
+    size_t count;
+};
+
+/**
+* @brief Find a core builtin. The core set is fixed at compile time and
+* stored in a perfect hash table, so a lookup is one multiply and at most
+* one string compare.
+*
+* @param name The command name
+* @return The builtin or NULL
+*/
+
+const struct builtin *builtin_core_lookup(const char *name);
+/**
+* @brief Find the builtin the shell runs for name: a registered one first,
+* then a core one. Never allocates.
+*
+* @param sh The shell
+* @param name The command name
+* @return The builtin or NULL
+*/
+
+const struct builtin *builtin_lookup(const struct shell *sh, const char *name);
+/**
+* @brief Register a builtin, replacing any earlier registration of the
+* same name. A core builtin of that name is shadowed until unregistered.
+*
+* @param sh The shell
+* @param name The command name, copied
+* @param fn The handler
+*/
+
+void builtin_register(struct shell *sh, const char *name, builtin_fn fn);
+/**
+* @brief Remove a registered builtin.
+*
+* @param sh The shell
+* @param name The command name
+* @return True if it was registered
+*/
+
+bool builtin_unregister(struct shell *sh, const char *name);
+/**
+* @brief Load builtin name from a shared object and register it. The object
+* must export a struct loadable_builtin called <name>_builtin, see
+* loadable.h.
+*
+* @param sh The shell
+* @param path The shared object, searched for as dlopen does
+* @param name The builtin
+* @return 0 on success, -1 after printing an error
+*/
+
+int builtin_load(struct shell *sh, const char *path, const char *name);
+/**
+* @brief Call fn with the name of every builtin, core and registered. A
+* registered builtin that shadows a core one is reported twice.
+*
+* @param sh The shell
+* @param fn The callback
+* @param arg Passed to fn
+*/
+
+void builtin_each(const struct shell *sh, void (*fn)(const char *name, void *arg), void *arg);
+/**
+* @brief Free every registered builtin and close the shared objects loaded
+* for them.
+*
+* @param sh The shell
+*/
+
+void builtin_table_destroy(struct shell *sh);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
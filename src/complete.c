@@ -0,0 +1,301 @@
+#include "complete.h"
+#include "builtins.h"
+#include "vars.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+static char *xstrdup(const char *s) {
+    char *d = strdup(s);
+    if (!d) {
+        fprintf(stderr, "complete: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return d;
+}
+
+void command_index_init(struct command_index *ci) {
+    memset(ci, 0, sizeof(*ci));
+}
+
+static void free_dirs(struct command_index *ci) {
+    for (size_t i = 0; i < ci->ndirs; i++) {
+        free(ci->dirs[i].dir);
+        free(ci->dirs[i].names);
+    }
+    free(ci->dirs);
+    free(ci->path_env);
+    ci->dirs = NULL;
+    ci->ndirs = 0;
+    ci->path_env = NULL;
+}
+
+void command_index_destroy(struct command_index *ci) {
+    free_dirs(ci);
+    free(ci->nodes);
+    command_index_init(ci);
+}
+
+/*
+ * new_node:
+ *  - Purpose: Append a node. Nodes are never freed one by one; names that
+ *    disappear only lose their reference, and the trie is rebuilt when
+ *    $PATH changes.
+ */
+static uint32_t new_node(struct command_index *ci, unsigned char c) {
+    if (ci->count == ci->cap) {
+        ci->cap = ci->cap ? ci->cap * 2 : 4096;
+        ci->nodes = realloc(ci->nodes, ci->cap * sizeof(*ci->nodes));
+        if (!ci->nodes) {
+            fprintf(stderr, "complete: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct trie_node *n = &ci->nodes[ci->count];
+    n->child = n->next = n->refs = 0;
+    n->c = c;
+    return ci->count++;
+}
+
+/*
+ * find_node:
+ *  - Purpose: Follow name down from the root.
+ *      * With create set, missing nodes are inserted in sibling order.
+ *  - Returns: The node where name ends, or 0 if it is not in the trie.
+ */
+static uint32_t find_node(struct command_index *ci, const char *name, bool create) {
+    uint32_t n = 0;
+    if (!ci->count) return 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        uint32_t prev = 0, m = ci->nodes[n].child;
+        while (m && ci->nodes[m].c < *p) {
+            prev = m;
+            m = ci->nodes[m].next;
+        }
+        if (!m || ci->nodes[m].c != *p) {
+            if (!create) return 0;
+            uint32_t k = new_node(ci, *p);
+            ci->nodes[k].next = m;
+            if (prev) {
+                ci->nodes[prev].next = k;
+            } else {
+                ci->nodes[n].child = k;
+            }
+            m = k;
+        }
+        n = m;
+    }
+    return n;
+}
+
+/*
+ * dir_mtime:
+ *  - Purpose: Modification time of a directory, zero if it cannot be read.
+ */
+static struct timespec dir_mtime(const char *dir) {
+    struct stat st;
+    struct timespec zero = {0, 0};
+    return stat(dir, &st) == 0 ? st.st_mtim : zero;
+}
+
+/*
+ * scan_dir:
+ *  - Purpose: Read the executables of a directory into the trie and
+ *    remember their names, so they can be taken out again when the
+ *    directory changes.
+ *      * Entries the directory says are neither files nor links are
+ *        skipped without a stat().
+ */
+static void scan_dir(struct command_index *ci, struct command_dir *d) {
+    size_t cap = 0;
+    d->mtime = dir_mtime(d->dir);
+    DIR *dp = opendir(d->dir);
+    if (!dp) return;
+    struct dirent *de;
+    while ((de = readdir(dp))) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+        if (de->d_type != DT_REG && de->d_type != DT_LNK && de->d_type != DT_UNKNOWN) continue;
+        struct stat st;
+        if (fstatat(dirfd(dp), name, &st, 0) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111)) {
+            continue;
+        }
+        size_t len = strlen(name) + 1;
+        if (d->names_len + len > cap) {
+            cap = cap ? cap * 2 : 4096;
+            if (cap < d->names_len + len) cap = d->names_len + len;
+            d->names = realloc(d->names, cap);
+            if (!d->names) {
+                fprintf(stderr, "complete: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(d->names + d->names_len, name, len);
+        d->names_len += len;
+        // find_node may grow ci->nodes, so it runs before the array is read
+        uint32_t k = find_node(ci, name, true);
+        ci->nodes[k].refs++;
+    }
+    closedir(dp);
+}
+
+/*
+ * unscan_dir:
+ *  - Purpose: Take the names read from a directory out of the trie.
+ */
+static void unscan_dir(struct command_index *ci, struct command_dir *d) {
+    for (size_t off = 0; off < d->names_len; off += strlen(d->names + off) + 1) {
+        uint32_t n = find_node(ci, d->names + off, false);
+        if (n && ci->nodes[n].refs) ci->nodes[n].refs--;
+    }
+    free(d->names);
+    d->names = NULL;
+    d->names_len = 0;
+}
+
+/*
+ * rebuild:
+ *  - Purpose: Split a new $PATH and read every directory. An empty
+ *    component means the current directory, as it does for execvp.
+ */
+static void rebuild(struct command_index *ci, const char *path) {
+    free_dirs(ci);
+    ci->count = 0;
+    new_node(ci, 0);
+    ci->path_env = xstrdup(path);
+    size_t n = 1;
+    for (const char *p = path; *p; p++) n += *p == ':';
+    ci->dirs = calloc(n, sizeof(*ci->dirs));
+    if (!ci->dirs) {
+        fprintf(stderr, "complete: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (const char *p = path;;) {
+        const char *e = strchr(p, ':');
+        size_t len = e ? (size_t)(e - p) : strlen(p);
+        struct command_dir *d = &ci->dirs[ci->ndirs++];
+        d->dir = len ? strndup(p, len) : xstrdup(".");
+        if (!d->dir) {
+            fprintf(stderr, "complete: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        scan_dir(ci, d);
+        if (!e) break;
+        p = e + 1;
+    }
+}
+
+void command_index_refresh(struct command_index *ci, const char *path) {
+    if (!path) path = "/usr/local/bin:/bin:/usr/bin";  // the execvp default
+    if (!ci->path_env || strcmp(path, ci->path_env) != 0) {
+        rebuild(ci, path);
+        return;
+    }
+    for (size_t i = 0; i < ci->ndirs; i++) {
+        struct command_dir *d = &ci->dirs[i];
+        struct timespec m = dir_mtime(d->dir);
+        if (m.tv_sec != d->mtime.tv_sec || m.tv_nsec != d->mtime.tv_nsec) {
+            unscan_dir(ci, d);
+            scan_dir(ci, d);
+        }
+    }
+}
+
+/*
+ * walk:
+ *  - Purpose: Report every name below node n in byte order. buf holds the
+ *    name so far, len bytes of it.
+ */
+static void walk(const struct command_index *ci, uint32_t n, char *buf, size_t len,
+                 void (*fn)(const char *name, void *arg), void *arg) {
+    if (ci->nodes[n].refs) {
+        buf[len] = '\0';
+        fn(buf, arg);
+    }
+    if (len >= NAME_MAX) return;
+    for (uint32_t m = ci->nodes[n].child; m; m = ci->nodes[m].next) {
+        buf[len] = ci->nodes[m].c;
+        walk(ci, m, buf, len + 1, fn, arg);
+    }
+}
+
+void command_index_each(const struct command_index *ci, const char *prefix,
+                        void (*fn)(const char *name, void *arg), void *arg) {
+    char buf[NAME_MAX + 1];
+    size_t len = strlen(prefix);
+    if (len > NAME_MAX) return;
+    uint32_t n = find_node((struct command_index *)ci, prefix, false);
+    if (!n && len) return;
+    memcpy(buf, prefix, len);
+    walk(ci, n, buf, len, fn, arg);
+}
+
+/* The names collected by command_complete */
+struct matches
+{
+    const char *prefix;
+    size_t prefix_len;
+    char **names;
+    size_t count;
+    size_t cap;
+};
+
+static void add_match(const char *name, void *arg) {
+    struct matches *m = arg;
+    if (strncmp(name, m->prefix, m->prefix_len) != 0) return;
+    if (m->count + 1 >= m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->names = realloc(m->names, m->cap * sizeof(*m->names));
+        if (!m->names) {
+            fprintf(stderr, "complete: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    m->names[m->count++] = xstrdup(name);
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * command_complete:
+ *  - Purpose: Merge the builtins with the executables found by the trie.
+ *    Several builtins (echo, test, pwd) are usually on $PATH as well, so
+ *    the list is sorted and duplicates dropped.
+ */
+char **command_complete(struct shell *sh, const char *prefix) {
+    struct matches m = {prefix, strlen(prefix), NULL, 0, 0};
+    if (!sh->commands) {
+        sh->commands = malloc(sizeof(struct command_index));
+        if (!sh->commands) {
+            fprintf(stderr, "complete: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        command_index_init(sh->commands);
+    }
+    command_index_refresh(sh->commands, vars_get(sh->vars, "PATH"));
+    builtin_each(sh, add_match, &m);
+    command_index_each(sh->commands, prefix, add_match, &m);
+    if (!m.names) {
+        m.names = malloc(sizeof(*m.names));
+        if (!m.names) {
+            fprintf(stderr, "complete: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    qsort(m.names, m.count, sizeof(*m.names), by_name);
+    size_t n = 0;
+    for (size_t i = 0; i < m.count; i++) {
+        if (n && strcmp(m.names[n - 1], m.names[i]) == 0) {
+            free(m.names[i]);
+        } else {
+            m.names[n++] = m.names[i];
+        }
+    }
+    m.names[n] = NULL;
+    return m.names;
+}
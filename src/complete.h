@@ -0,0 +1,99 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A node of the command trie. Index 0 is the root, so 0 also means none. */
+struct trie_node
+{
+    uint32_t child;     /* first child, children are sorted by c */
+    uint32_t next;      /* next sibling */
+    uint32_t refs;      /* directories holding the name that ends here */
+    unsigned char c;
+};
+
+/* A directory of $PATH and the executables found in it */
+struct command_dir
+{
+    char *dir;
+    struct timespec mtime;  /* when the names were read */
+    char *names;        /* NUL separated */
+    size_t names_len;
+};
+
+/**
+* @brief Every executable on $PATH in a trie, for command completion. The
+* directories are read once; afterwards only a directory whose mtime
+* changed is read again, and a different $PATH rebuilds the trie.
+*/
+struct command_index
+{
+    struct trie_node *nodes;
+    size_t count;
+    size_t cap;
+    char *path_env;     /* $PATH the directories were split from */
+    struct command_dir *dirs;
+    size_t ndirs;
+};
+
+/**
+* @brief Initialize an empty index. Nothing is read until the first
+* refresh.
+*
+* @param ci The index
+*/
+
+void command_index_init(struct command_index *ci);
+/**
+* @brief Free everything held by the index.
+*
+* @param ci The index
+*/
+
+void command_index_destroy(struct command_index *ci);
+/**
+* @brief Bring the index up to date with $PATH, reading only the
+* directories that changed. Costs one stat() per directory when nothing
+* did.
+*
+* @param ci The index
+* @param path The value of $PATH, NULL if it is not set
+*/
+
+void command_index_refresh(struct command_index *ci, const char *path);
+/**
+* @brief The executables whose names start with prefix, in byte order.
+*
+* @param ci The index
+* @param prefix The start of the name
+* @param fn Called with each name, which is only valid during the call
+* @param arg Passed to fn
+*/
+
+void command_index_each(const struct command_index *ci, const char *prefix,
+                        void (*fn)(const char *name, void *arg), void *arg);
+/**
+* @brief Complete a command name: the builtins and the executables on
+* $PATH that start with prefix, sorted and without duplicates. The index
+* is created in sh on first use and refreshed on every call.
+*
+* @param sh The shell
+* @param prefix The start of the name
+* @return A NULL terminated array of names; the caller frees the names and
+* the array
+*/
+
+char **command_complete(struct shell *sh, const char *prefix);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,551 @@
+#include "coreutils.h"
+#include "outbuf.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * put_escape:
+ *  - Purpose: Output the backslash escape starting at p, just after the
+ *    backslash, and return what follows it.
+ *      * echo -e and %b take octal as \0nnn, a printf format as \nnn.
+ *      * \c sets *stop: no more output at all.
+ */
+static const char *put_escape(struct outbuf *o, const char *p, bool zero_octal, bool *stop) {
+    int v = 0, digits = 0;
+    switch (*p) {
+    case 'a': out_char(o, '\a'); return p + 1;
+    case 'b': out_char(o, '\b'); return p + 1;
+    case 'e': out_char(o, 033); return p + 1;
+    case 'f': out_char(o, '\f'); return p + 1;
+    case 'n': out_char(o, '\n'); return p + 1;
+    case 'r': out_char(o, '\r'); return p + 1;
+    case 't': out_char(o, '\t'); return p + 1;
+    case 'v': out_char(o, '\v'); return p + 1;
+    case '\\': out_char(o, '\\'); return p + 1;
+    case 'c':
+        *stop = true;
+        return p + 1;
+    case 'x':
+        for (p++; digits < 2; p++, digits++) {
+            int c = *p;
+            if (c >= '0' && c <= '9') v = v * 16 + c - '0';
+            else if (c >= 'a' && c <= 'f') v = v * 16 + c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v = v * 16 + c - 'A' + 10;
+            else break;
+        }
+        if (digits == 0) {
+            out_copy(o, "\\x", 2);
+        } else {
+            out_char(o, (char)v);
+        }
+        return p;
+    case '\0':
+        out_char(o, '\\');
+        return p;
+    }
+    if (*p >= '0' && *p <= '7' && (!zero_octal || *p == '0')) {
+        if (zero_octal) p++;
+        for (; digits < 3 && *p >= '0' && *p <= '7'; p++, digits++) v = v * 8 + *p - '0';
+        out_char(o, (char)v);
+        return p;
+    }
+    if (!zero_octal && (*p == '"' || *p == '\'')) {
+        out_char(o, *p);
+        return p + 1;
+    }
+    out_char(o, '\\');
+    out_char(o, *p);
+    return p + 1;
+}
+
+/*
+ * put_escaped:
+ *  - Purpose: Output s with echo -e style escapes expanded.
+ */
+static void put_escaped(struct outbuf *o, const char *s, bool *stop) {
+    while (*s && !*stop) {
+        const char *bs = strchr(s, '\\');
+        size_t run = bs ? (size_t)(bs - s) : strlen(s);
+        out_write(o, s, run);
+        if (!bs) return;
+        s = put_escape(o, bs + 1, true, stop);
+    }
+}
+
+int echo_builtin(struct shell *sh, char **argv) {
+    (void)sh;
+    struct outbuf o;
+    bool newline = true, escapes = false, stop = false;
+    int i = 1;
+    // Options are only taken when every letter is one echo knows
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1)) break;
+        for (const char *p = argv[i] + 1; *p; p++) {
+            if (*p == 'n') newline = false;
+            else escapes = *p == 'e';
+        }
+    }
+    out_init(&o, stdout);
+    for (int first = i; argv[i] && !stop; i++) {
+        if (i > first) out_char(&o, ' ');
+        if (escapes) {
+            put_escaped(&o, argv[i], &stop);
+        } else {
+            out_write(&o, argv[i], strlen(argv[i]));
+        }
+    }
+    if (newline && !stop) out_char(&o, '\n');
+    return out_finish(&o, "echo", 0);
+}
+
+/*
+ * num_arg:
+ *  - Purpose: Convert a printf argument to a number. A leading quote gives
+ *    the code of the next character. Bad numbers are reported, converted as
+ *    far as they go and make the status 1.
+ */
+static long long num_arg(const char *s, bool is_unsigned, int *status) {
+    if (!s) return 0;
+    if (*s == '\'' || *s == '"') return (unsigned char)s[1];
+    char *end;
+    long long v;
+    errno = 0;
+    if (is_unsigned && *s != '-') {
+        v = (long long)strtoull(s, &end, 0);
+    } else {
+        v = strtoll(s, &end, 0);
+    }
+    if (end == s || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        *status = 1;
+    }
+    return v;
+}
+
+static double float_arg(const char *s, int *status) {
+    if (!s) return 0;
+    if (*s == '\'' || *s == '"') return (unsigned char)s[1];
+    char *end;
+    errno = 0;
+    double v = strtod(s, &end);
+    if (end == s || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        *status = 1;
+    }
+    return v;
+}
+
+/*
+ * format_once:
+ *  - Purpose: Output fmt once, taking arguments from args[*next] on. Missing
+ *    arguments are empty strings or zero.
+ *  - Returns: false on an invalid conversion, true otherwise.
+ */
+static bool format_once(struct outbuf *o, const char *fmt, char **args, int *next, int *status,
+                        bool *stop) {
+    char spec[64];
+    for (const char *p = fmt; *p && !*stop;) {
+        if (*p == '\\') {
+            p = put_escape(o, p + 1, false, stop);
+            continue;
+        }
+        if (*p != '%') {
+            size_t run = strcspn(p, "%\\");
+            out_write(o, p, run);
+            p += run;
+            continue;
+        }
+        if (p[1] == '%') {
+            out_char(o, '%');
+            p += 2;
+            continue;
+        }
+        // %[flags][width][.precision][length]conversion
+        const char *start = p++;
+        size_t n = 0;
+        int width = 0, prec = 0;
+        bool star_width = false, star_prec = false, plain = true;
+        spec[n++] = '%';
+        while (*p && strchr("-+ #0", *p) && n < 8) {
+            spec[n++] = *p++;
+            plain = false;
+        }
+        if (*p == '*') {
+            star_width = true;
+            width = (int)num_arg(args[*next], false, status);
+            if (args[*next]) (*next)++;
+            spec[n++] = '*';
+            p++;
+            plain = false;
+        } else {
+            while (*p >= '0' && *p <= '9' && n < 24) {
+                spec[n++] = *p++;
+                plain = false;
+            }
+        }
+        if (*p == '.') {
+            spec[n++] = *p++;
+            plain = false;
+            if (*p == '*') {
+                star_prec = true;
+                prec = (int)num_arg(args[*next], false, status);
+                if (args[*next]) (*next)++;
+                spec[n++] = '*';
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9' && n < 40) spec[n++] = *p++;
+            }
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;
+        char conv = *p;
+        const char *arg = args[*next];
+        if (arg) (*next)++;
+        if (!conv) {
+            fprintf(stderr, "printf: %s: missing format character\n", start);
+            return false;
+        }
+        p++;
+        switch (conv) {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X': {
+            bool is_unsigned = conv != 'd' && conv != 'i';
+            long long v = num_arg(arg, is_unsigned, status);
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conv;
+            spec[n] = '\0';
+            if (star_width && star_prec) out_fmt(o, spec, width, prec, v);
+            else if (star_width) out_fmt(o, spec, width, v);
+            else if (star_prec) out_fmt(o, spec, prec, v);
+            else out_fmt(o, spec, v);
+            break;
+        }
+        case 'a':
+        case 'A':
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G': {
+            double v = float_arg(arg, status);
+            spec[n++] = conv;
+            spec[n] = '\0';
+            if (star_width && star_prec) out_fmt(o, spec, width, prec, v);
+            else if (star_width) out_fmt(o, spec, width, v);
+            else if (star_prec) out_fmt(o, spec, prec, v);
+            else out_fmt(o, spec, v);
+            break;
+        }
+        case 'c':
+        case 's': {
+            if (!arg) arg = "";
+            if (conv == 's' && plain) {
+                // The common case needs no formatting and no copy
+                out_write(o, arg, strlen(arg));
+                break;
+            }
+            spec[n++] = conv;
+            spec[n] = '\0';
+            if (conv == 'c') {
+                if (!*arg) break;
+                if (star_width) out_fmt(o, spec, width, *arg);
+                else out_fmt(o, spec, *arg);
+            } else if (star_width && star_prec) {
+                out_fmt(o, spec, width, prec, arg);
+            } else if (star_width) {
+                out_fmt(o, spec, width, arg);
+            } else if (star_prec) {
+                out_fmt(o, spec, prec, arg);
+            } else {
+                out_fmt(o, spec, arg);
+            }
+            break;
+        }
+        case 'b':
+            // Width and precision are not applied to %b
+            if (arg) put_escaped(o, arg, stop);
+            break;
+        default:
+            fprintf(stderr, "printf: %c: invalid format character\n", conv);
+            return false;
+        }
+    }
+    return true;
+}
+
+int printf_builtin(struct shell *sh, char **argv) {
+    (void)sh;
+    struct outbuf o;
+    int status = 0, next = 2;
+    bool stop = false;
+    const char *fmt = argv[1];
+    if (fmt && strcmp(fmt, "--") == 0) {
+        fmt = argv[2];
+        next = 3;
+    }
+    if (!fmt) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    out_init(&o, stdout);
+    // The format is reused while it keeps consuming arguments
+    for (;;) {
+        int before = next;
+        if (!format_once(&o, fmt, argv, &next, &status, &stop)) {
+            status = 1;
+            break;
+        }
+        if (stop || !argv[next] || next == before) break;
+    }
+    return out_finish(&o, "printf", status);
+}
+
+/*
+ * The expression grammar of test, parsed by recursive descent:
+ *   or      := and ("-o" and)*
+ *   and     := not ("-a" not)*
+ *   not     := "!" not | primary
+ *   primary := arg binop arg | "(" or ")" | unop arg | arg
+ * A binary operator in the second position wins over "!" and "(", as POSIX
+ * asks for three argument expressions.
+ */
+struct test_parse
+{
+    const char *name;
+    char **av;
+    int i, n;
+    bool err;
+};
+
+static void test_error(struct test_parse *t, const char *what, const char *arg) {
+    if (t->err) return;
+    t->err = true;
+    if (arg) {
+        fprintf(stderr, "%s: %s: %s\n", t->name, arg, what);
+    } else {
+        fprintf(stderr, "%s: %s\n", t->name, what);
+    }
+}
+
+static bool is_binop(const char *s) {
+    static const char *const ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                      "-gt", "-ge", "-nt", "-ot", "-ef"};
+    for (size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+        if (strcmp(s, ops[k]) == 0) return true;
+    }
+    return false;
+}
+
+static bool is_unop(const char *s) {
+    return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghLkprsStuwxOGzn", s[1]);
+}
+
+static long long test_int(struct test_parse *t, const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (end == s || *end || errno) test_error(t, "integer expression expected", s);
+    return v;
+}
+
+static bool test_unary(struct test_parse *t, char op, const char *arg) {
+    struct stat st;
+    switch (op) {
+    case 'z': return !*arg;
+    case 'n': return *arg;
+    case 't': return isatty((int)test_int(t, arg));
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) != 0) return false;
+    switch (op) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'f': return S_ISREG(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return st.st_mode & S_ISGID;
+    case 'u': return st.st_mode & S_ISUID;
+    case 'k': return st.st_mode & S_ISVTX;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    }
+    return true;    // -e
+}
+
+/*
+ * newer:
+ *  - Purpose: -nt. A file that exists is newer than one that does not.
+ */
+static bool newer(const char *a, const char *b) {
+    struct stat sa, sb;
+    if (stat(a, &sa) != 0) return false;
+    if (stat(b, &sb) != 0) return true;
+    if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec) return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec;
+    return sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec;
+}
+
+static bool test_binary(struct test_parse *t, const char *a, const char *op, const char *b) {
+    if (op[0] != '-') {
+        int c = strcmp(a, b);
+        if (strcmp(op, "!=") == 0) return c != 0;
+        if (strcmp(op, "<") == 0) return c < 0;
+        if (strcmp(op, ">") == 0) return c > 0;
+        return c == 0;
+    }
+    if (strcmp(op, "-nt") == 0) return newer(a, b);
+    if (strcmp(op, "-ot") == 0) return newer(b, a);
+    if (strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev &&
+               sa.st_ino == sb.st_ino;
+    }
+    long long x = test_int(t, a), y = test_int(t, b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static bool test_or(struct test_parse *t);
+
+static bool test_primary(struct test_parse *t) {
+    if (t->i >= t->n) {
+        test_error(t, "argument expected", NULL);
+        return false;
+    }
+    char **av = t->av;
+    int i = t->i;
+    if (i + 2 < t->n && is_binop(av[i + 1])) {
+        t->i += 3;
+        return test_binary(t, av[i], av[i + 1], av[i + 2]);
+    }
+    if (strcmp(av[i], "(") == 0) {
+        t->i++;
+        bool v = test_or(t);
+        if (t->i >= t->n || strcmp(av[t->i], ")") != 0) {
+            test_error(t, "`)' expected", NULL);
+            return false;
+        }
+        t->i++;
+        return v;
+    }
+    if (is_unop(av[i]) && i + 1 < t->n) {
+        t->i += 2;
+        return test_unary(t, av[i][1], av[i + 1]);
+    }
+    t->i++;
+    return av[i][0] != '\0';
+}
+
+static bool test_not(struct test_parse *t) {
+    int i = t->i;
+    if (i + 1 < t->n && strcmp(t->av[i], "!") == 0 && !(i + 2 < t->n && is_binop(t->av[i + 1]))) {
+        t->i++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool test_and(struct test_parse *t) {
+    bool v = test_not(t);
+    while (t->i < t->n && strcmp(t->av[t->i], "-a") == 0) {
+        t->i++;
+        // Both sides are parsed so syntax errors are found either way
+        bool r = test_not(t);
+        v = v && r;
+    }
+    return v;
+}
+
+static bool test_or(struct test_parse *t) {
+    bool v = test_and(t);
+    while (t->i < t->n && strcmp(t->av[t->i], "-o") == 0) {
+        t->i++;
+        bool r = test_and(t);
+        v = v || r;
+    }
+    return v;
+}
+
+int test_builtin(struct shell *sh, char **argv) {
+    (void)sh;
+    struct test_parse t = {argv[0], argv + 1, 0, 0, false};
+    while (t.av[t.n]) t.n++;
+    if (strcmp(argv[0], "[") == 0) {
+        if (t.n == 0 || strcmp(t.av[t.n - 1], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        t.n--;
+    }
+    if (t.n == 0) return 1;
+    if (t.n == 1) return t.av[0][0] ? 0 : 1;
+    bool v = test_or(&t);
+    if (!t.err && t.i < t.n) test_error(&t, "too many arguments", NULL);
+    return t.err ? 2 : !v;
+}
+
+int true_builtin(struct shell *sh, char **argv) {
+    (void)sh;
+    (void)argv;
+    return 0;
+}
+
+int false_builtin(struct shell *sh, char **argv) {
+    (void)sh;
+    (void)argv;
+    return 1;
+}
+
+int pwd_builtin(struct shell *sh, char **argv) {
+    (void)sh;
+    struct outbuf o;
+    bool physical = false;
+    for (int i = 1; argv[i]; i++) {
+        if (strcmp(argv[i], "-P") == 0) {
+            physical = true;
+        } else if (strcmp(argv[i], "-L") == 0) {
+            physical = false;
+        } else {
+            fprintf(stderr, "pwd: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    char *cwd = getcwd(NULL, 0);
+    if (!cwd) {
+        perror("pwd");
+        return 1;
+    }
+    const char *dir = cwd;
+    const char *pwd = vars_get(sh->vars, "PWD");
+    struct stat a, b;
+    if (!physical && pwd && pwd[0] == '/' && stat(pwd, &a) == 0 && stat(".", &b) == 0 &&
+        a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+        dir = pwd;
+    }
+    out_init(&o, stdout);
+    out_write(&o, dir, strlen(dir));
+    out_char(&o, '\n');
+    int status = out_finish(&o, "pwd", 0);
+    free(cwd);
+    return status;
+}
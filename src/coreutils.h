@@ -0,0 +1,78 @@
+#ifndef COREUTILS_H
+#define COREUTILS_H
+#include <stdlib.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Small utilities that scripts run all the time, built into the shell so
+ * they cost a function call instead of a process. Output is collected in
+ * a buffer and handed to stdout with writev() when the command finishes.
+ */
+
+/**
+* @brief The echo builtin: echo [-neE] [arg...]
+*
+* @param sh The shell
+* @param argv The arguments
+* @return 0, or 1 if the output could not be written
+*/
+
+int echo_builtin(struct shell *sh, char **argv);
+/**
+* @brief The printf builtin: printf format [arg...]. The format is reused
+* while arguments remain, as in POSIX printf(1).
+*
+* @param sh The shell
+* @param argv The arguments
+* @return 0, 1 if an argument was not a valid number or the output could
+* not be written, 2 on a usage error
+*/
+
+int printf_builtin(struct shell *sh, char **argv);
+/**
+* @brief The test and [ builtins: test expr, [ expr ]
+*
+* @param sh The shell
+* @param argv The arguments
+* @return 0 if expr is true, 1 if it is false, 2 on a syntax error
+*/
+
+int test_builtin(struct shell *sh, char **argv);
+/**
+* @brief The true builtin.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return 0
+*/
+
+int true_builtin(struct shell *sh, char **argv);
+/**
+* @brief The false builtin.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return 1
+*/
+
+int false_builtin(struct shell *sh, char **argv);
+/**
+* @brief The pwd builtin: pwd [-L | -P]. -L, the default, prints $PWD when
+* it names the current directory.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return 0, or 1 on error
+*/
+
+int pwd_builtin(struct shell *sh, char **argv);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
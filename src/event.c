@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+#include "event.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* Events taken from epoll per call */
+#define EVENT_BATCH 32
+
+/*
+ * open_pidfd:
+ *  - Purpose: pidfd_open() through syscall(), the glibc wrapper only exists
+ *    since 2.36.
+ */
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void event_loop_init(struct event_loop *ev, bool job_signals) {
+    memset(ev, 0, sizeof(*ev));
+    ev->epfd = -1;
+    ev->sigfd = -1;
+    ev->input_fd = -1;
+    ev->wake_fd = -1;
+    ev->job_signals = job_signals;
+    sigemptyset(&ev->mask);
+    sigaddset(&ev->mask, SIGCHLD);
+    if (job_signals) {
+        sigaddset(&ev->mask, SIGINT);
+        sigaddset(&ev->mask, SIGTSTP);
+    }
+    // Blocked from here on, so a child that exits before the signalfd exists
+    // leaves SIGCHLD pending instead of losing it
+    sigprocmask(SIG_BLOCK, &ev->mask, &ev->saved);
+}
+
+/*
+ * ensure_loop:
+ *  - Purpose: Create the epoll instance and the signalfd on first use.
+ *  - Returns: 0 on success, -1 on error.
+ */
+static int ensure_loop(struct event_loop *ev) {
+    if (ev->epfd >= 0) return 0;
+    sigprocmask(SIG_BLOCK, &ev->mask, NULL);
+    ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev->epfd < 0) return -1;
+    ev->sigfd = signalfd(-1, &ev->mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    struct epoll_event e = { .events = EPOLLIN, .data.ptr = &ev->sigfd };
+    if (ev->sigfd < 0 || epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->sigfd, &e) < 0) {
+        if (ev->sigfd >= 0) close(ev->sigfd);
+        close(ev->epfd);
+        ev->epfd = ev->sigfd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * drop_watches:
+ *  - Purpose: Free every watch. The pidfds are only closed, the epoll set
+ *    itself is about to be closed or belongs to the parent after a fork.
+ */
+static void drop_watches(struct event_loop *ev) {
+    struct child_watch *w = ev->watches;
+    while (w) {
+        struct child_watch *next = w->next;
+        if (w->pidfd >= 0) close(w->pidfd);
+        free(w);
+        w = next;
+    }
+    ev->watches = NULL;
+}
+
+static void close_loop(struct event_loop *ev) {
+    drop_watches(ev);
+    if (ev->sigfd >= 0) close(ev->sigfd);
+    if (ev->wake_fd >= 0) close(ev->wake_fd);
+    if (ev->epfd >= 0) close(ev->epfd);
+    ev->epfd = ev->sigfd = ev->input_fd = ev->wake_fd = -1;
+}
+
+void event_loop_destroy(struct event_loop *ev) {
+    close_loop(ev);
+    sigprocmask(SIG_SETMASK, &ev->saved, NULL);
+}
+
+/*
+ * event_loop_after_fork:
+ *  - Purpose: The inherited epoll descriptor shares its interest list with
+ *    the parent, so the child must never touch it. Everything is dropped
+ *    and a forked subshell builds its own loop when it first waits. Only
+ *    SIGCHLD is routed through the child's loop, it does no job control.
+ */
+void event_loop_after_fork(struct event_loop *ev) {
+    close_loop(ev);
+    sigprocmask(SIG_SETMASK, &ev->saved, NULL);
+    ev->job_signals = false;
+    sigemptyset(&ev->mask);
+    sigaddset(&ev->mask, SIGCHLD);
+    ev->interrupted = false;
+}
+
+/*
+ * unlink_watch:
+ *  - Purpose: Forget one watch. The pidfd is removed from epoll explicitly:
+ *    close() alone only does that once every copy of the descriptor is gone,
+ *    and a child that is still between posix_spawn() and exec() holds one.
+ */
+static void unlink_watch(struct event_loop *ev, struct child_watch *w) {
+    if (w->prev) w->prev->next = w->next;
+    else ev->watches = w->next;
+    if (w->next) w->next->prev = w->prev;
+    if (w->pidfd >= 0) {
+        epoll_ctl(ev->epfd, EPOLL_CTL_DEL, w->pidfd, NULL);
+        close(w->pidfd);
+    }
+    free(w);
+}
+
+int event_watch_child(struct event_loop *ev, pid_t pid, child_fn fn, void *ctx) {
+    if (ensure_loop(ev) < 0) return -1;
+    struct child_watch *w = malloc(sizeof(*w));
+    if (!w) {
+        fprintf(stderr, "event: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    w->pid = pid;
+    w->fn = fn;
+    w->ctx = ctx;
+    // A pidfd becomes readable once the child exits, even if it already has
+    w->pidfd = open_pidfd(pid);
+    if (w->pidfd >= 0) {
+        struct epoll_event e = { .events = EPOLLIN, .data.ptr = w };
+        if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, w->pidfd, &e) < 0) {
+            close(w->pidfd);
+            w->pidfd = -1;
+        }
+    }
+    w->prev = NULL;
+    w->next = ev->watches;
+    if (ev->watches) ev->watches->prev = w;
+    ev->watches = w;
+    return 0;
+}
+
+static struct child_watch *find_watch(struct event_loop *ev, pid_t pid) {
+    for (struct child_watch *w = ev->watches; w; w = w->next) {
+        if (w->pid == pid) return w;
+    }
+    return NULL;
+}
+
+void event_unwatch_child(struct event_loop *ev, pid_t pid) {
+    struct child_watch *w = find_watch(ev, pid);
+    if (w) unlink_watch(ev, w);
+}
+
+/*
+ * child_changed:
+ *  - Purpose: Collect the state change of a watched child and report it.
+ *    The watch goes away once the child has been reaped.
+ *  - Returns: True if the watch was removed.
+ */
+static bool child_changed(struct event_loop *ev, struct child_watch *w) {
+    int status;
+    pid_t r;
+    while ((r = waitpid(w->pid, &status, WNOHANG | WUNTRACED | WCONTINUED)) < 0 && errno == EINTR) {
+    }
+    if (r == 0) return false;
+    if (r < 0) {
+        // Someone else reaped it, nothing left to watch
+        unlink_watch(ev, w);
+        return true;
+    }
+    if (w->fn) w->fn(w->ctx, w->pid, status);
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        unlink_watch(ev, w);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * read_signals:
+ *  - Purpose: Drain the signalfd.
+ *      * SIGINT is recorded for whoever is reading input.
+ *      * SIGTSTP is swallowed, the shell itself never stops.
+ *      * SIGCHLD carries the pid that stopped or continued, exits are seen
+ *        through the pidfds. Watches without a pidfd are all polled.
+ */
+static void read_signals(struct event_loop *ev) {
+    struct signalfd_siginfo si[8];
+    bool poll_all = false;
+    ssize_t n;
+    while ((n = read(ev->sigfd, si, sizeof(si))) > 0) {
+        for (size_t i = 0; i < (size_t)n / sizeof(si[0]); i++) {
+            if (si[i].ssi_signo == SIGINT) {
+                ev->interrupted = true;
+            } else if (si[i].ssi_signo == SIGCHLD) {
+                int code = si[i].ssi_code;
+                struct child_watch *w = NULL;
+                if (code == CLD_STOPPED || code == CLD_CONTINUED) {
+                    w = find_watch(ev, (pid_t)si[i].ssi_pid);
+                }
+                if (w) child_changed(ev, w);
+                // Standard signals do not queue, one SIGCHLD may stand for several children
+                poll_all = true;
+            }
+        }
+    }
+    if (!poll_all) return;
+    struct child_watch *w = ev->watches;
+    while (w) {
+        struct child_watch *next = w->next;
+        if (w->pidfd < 0) child_changed(ev, w);
+        w = next;
+    }
+}
+
+static void drain_wake(struct event_loop *ev) {
+    uint64_t n;
+    if (read(ev->wake_fd, &n, sizeof(n)) == sizeof(n)) ev->woken = true;
+}
+
+/*
+ * dispatch:
+ *  - Purpose: One epoll_wait() and the handling of what it returned. Child
+ *    exits are handled before signals so a watch freed by read_signals can
+ *    never still be referenced by the batch.
+ *  - Returns: 1 if the input descriptor is readable, 0 if not, -1 on error.
+ */
+static int dispatch(struct event_loop *ev, int timeout_ms) {
+    struct epoll_event evs[EVENT_BATCH];
+    int n = epoll_wait(ev->epfd, evs, EVENT_BATCH, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    int input = 0;
+    bool signals = false;
+    for (int i = 0; i < n; i++) {
+        void *p = evs[i].data.ptr;
+        if (p == &ev->sigfd) signals = true;
+        else if (p == &ev->input_fd) input = 1;
+        else if (p == &ev->wake_fd) drain_wake(ev);
+        else child_changed(ev, p);
+    }
+    if (signals) read_signals(ev);
+    return input;
+}
+
+int event_run_once(struct event_loop *ev, int timeout_ms) {
+    if (ensure_loop(ev) < 0) return -1;
+    return dispatch(ev, timeout_ms) < 0 ? -1 : 0;
+}
+
+/*
+ * event_take_interrupt:
+ *  - Purpose: Report and clear a Ctrl-C for code that runs without waiting
+ *    on the loop, such as a loop of builtins. sigpending() is checked first
+ *    so the common case costs one cheap syscall and no epoll_wait().
+ */
+bool event_take_interrupt(struct event_loop *ev) {
+    sigset_t pending;
+    if (!ev->interrupted && ev->job_signals && sigpending(&pending) == 0 &&
+        sigismember(&pending, SIGINT)) {
+        event_run_once(ev, 0);
+    }
+    bool interrupted = ev->interrupted;
+    ev->interrupted = false;
+    return interrupted;
+}
+
+/*
+ * event_wait_child:
+ *  - Purpose: Wait for a foreground child. SIGCHLD wakes the loop, so the
+ *    foreground child needs no pidfd of its own. waitpid() is always tried
+ *    before sleeping, and SIGCHLD stays blocked, so an exit can't slip in
+ *    between the check and epoll_wait().
+ */
+int event_wait_child(struct event_loop *ev, pid_t pid, int *status) {
+    if (ensure_loop(ev) < 0) {
+        while (waitpid(pid, status, WUNTRACED) < 0) {
+            if (errno != EINTR) return -1;
+        }
+        return 0;
+    }
+    for (;;) {
+        pid_t r = waitpid(pid, status, WNOHANG | WUNTRACED);
+        if (r == pid) return 0;
+        if (r < 0 && errno != EINTR) return -1;
+        if (r == 0 && dispatch(ev, -1) < 0) return -1;
+    }
+}
+
+/*
+ * event_poll_input:
+ *  - Purpose: Sleep until fd has input while serving child and signal
+ *    events. epoll refuses regular files, which are always readable anyway.
+ */
+int event_poll_input(struct event_loop *ev, int fd, int timeout_ms) {
+    if (ensure_loop(ev) < 0) return -1;
+    if (ev->input_fd != fd) {
+        if (ev->input_fd >= 0) epoll_ctl(ev->epfd, EPOLL_CTL_DEL, ev->input_fd, NULL);
+        ev->input_fd = -1;
+        struct epoll_event e = { .events = EPOLLIN, .data.ptr = &ev->input_fd };
+        if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, fd, &e) < 0) {
+            if (errno != EPERM) return -1;
+            dispatch(ev, 0);
+            return 1;
+        }
+        ev->input_fd = fd;
+    }
+    for (;;) {
+        int r = dispatch(ev, timeout_ms);
+        if (r != 0 || ev->interrupted || ev->woken || timeout_ms >= 0) return r;
+    }
+}
+
+int event_enable_wake(struct event_loop *ev) {
+    if (ensure_loop(ev) < 0) return -1;
+    if (ev->wake_fd >= 0) return 0;
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event e = { .events = EPOLLIN, .data.ptr = &ev->wake_fd };
+    if (fd < 0 || epoll_ctl(ev->epfd, EPOLL_CTL_ADD, fd, &e) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    ev->wake_fd = fd;
+    return 0;
+}
+
+/*
+ * event_wake:
+ *  - Purpose: Bump the eventfd counter. Called from other threads, which is
+ *    why it only writes: an eventfd write is a single atomic add.
+ */
+void event_wake(struct event_loop *ev) {
+    uint64_t one = 1;
+    if (ev->wake_fd >= 0 && write(ev->wake_fd, &one, sizeof(one)) < 0) {
+        // the counter is already far from zero, the loop wakes anyway
+    }
+}
@@ -0,0 +1,165 @@
+#ifndef EVENT_H
+#define EVENT_H
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+* @brief Called when a watched child changes state.
+*
+* @param ctx The pointer given to event_watch_child
+* @param pid The child
+* @param status The status as returned by waitpid
+*/
+typedef void (*child_fn)(void *ctx, pid_t pid, int status);
+
+/* A background child watched through its pidfd */
+struct child_watch
+{
+    pid_t pid;
+    int pidfd;                  /* -1 if pidfd_open is not available */
+    child_fn fn;
+    void *ctx;
+    struct child_watch *prev;
+    struct child_watch *next;
+};
+
+/**
+* @brief The shell's event loop. It is built on epoll and watches:
+*   - a signalfd for SIGCHLD, plus SIGINT and SIGTSTP under job control,
+*   - one pidfd per background child,
+*   - at most one input descriptor (the terminal for readline),
+*   - an eventfd other threads can wake the loop with.
+* The signals are blocked in the shell and only ever delivered through the
+* signalfd, so no signal handler runs at an arbitrary point.
+*/
+struct event_loop
+{
+    int epfd;                   /* -1 until first use */
+    int sigfd;
+    bool job_signals;           /* route SIGINT and SIGTSTP through sigfd */
+    sigset_t mask;              /* the signals read from sigfd */
+    sigset_t saved;             /* the signal mask before the loop existed */
+    struct child_watch *watches;
+    int input_fd;               /* descriptor registered by event_poll_input */
+    volatile bool interrupted;  /* SIGINT arrived while waiting */
+    int wake_fd;                /* eventfd, -1 until event_enable_wake */
+    bool woken;                 /* event_wake was called, cleared by the caller */
+};
+
+/**
+* @brief Initialize the loop. The epoll instance is created lazily but the
+* signals are blocked immediately so no SIGCHLD can be lost.
+*
+* @param ev The loop
+* @param job_signals Also route SIGINT and SIGTSTP through the loop
+*/
+
+void event_loop_init(struct event_loop *ev, bool job_signals);
+/**
+* @brief Close every descriptor, forget all watches and restore the signal
+* mask.
+*
+* @param ev The loop
+*/
+
+void event_loop_destroy(struct event_loop *ev);
+/**
+* @brief Called in a freshly forked child. Drops the inherited descriptors,
+* which still refer to the parent's epoll instance, and restores the
+* signal mask so exec'd programs see normal signals. A later call that
+* needs the loop sets it up again for the child.
+*
+* @param ev The loop
+*/
+
+void event_loop_after_fork(struct event_loop *ev);
+/**
+* @brief Watch a background child. fn is called from inside the loop when
+* the child exits, stops or continues. The watch is removed once the child
+* has exited and been reaped. fn must not unwatch other children.
+*
+* @param ev The loop
+* @param pid The child
+* @param fn Callback, may be NULL
+* @param ctx Passed to fn
+* @return 0 on success, -1 on error
+*/
+
+int event_watch_child(struct event_loop *ev, pid_t pid, child_fn fn, void *ctx);
+/**
+* @brief Stop watching a child without reaping it.
+*
+* @param ev The loop
+* @param pid The child
+*/
+
+void event_unwatch_child(struct event_loop *ev, pid_t pid);
+/**
+* @brief Wait for a foreground child to exit or stop while still serving
+* every other event.
+*
+* @param ev The loop
+* @param pid The child
+* @param status Set to the status from waitpid
+* @return 0 on success, -1 on error
+*/
+
+int event_wait_child(struct event_loop *ev, pid_t pid, int *status);
+/**
+* @brief Serve events until fd is readable, SIGINT arrives, another thread
+* wakes the loop or the timeout expires.
+*
+* @param ev The loop
+* @param fd The input descriptor
+* @param timeout_ms Milliseconds, -1 to wait forever
+* @return 1 if fd is readable, 0 otherwise, -1 on error
+*/
+
+int event_poll_input(struct event_loop *ev, int fd, int timeout_ms);
+/**
+* @brief Wait for and serve one batch of events.
+*
+* @param ev The loop
+* @param timeout_ms Milliseconds, 0 to only serve what is pending, -1 to
+* wait forever
+* @return 0 on success, -1 on error
+*/
+
+int event_run_once(struct event_loop *ev, int timeout_ms);
+/**
+* @brief Check for a Ctrl-C that arrived while no one was waiting on the
+* loop, serving the pending signals if there is one. Clears the flag.
+*
+* @param ev The loop
+* @return true if SIGINT was received
+*/
+
+bool event_take_interrupt(struct event_loop *ev);
+/**
+* @brief Let other threads wake the loop with event_wake. Must be called
+* from the thread that runs the loop, before any other thread may wake it.
+*
+* @param ev The loop
+* @return 0 on success, -1 on error
+*/
+
+int event_enable_wake(struct event_loop *ev);
+/**
+* @brief Wake the loop. Safe to call from any thread once
+* event_enable_wake has returned; the loop sets woken when it notices.
+*
+* @param ev The loop
+*/
+
+void event_wake(struct event_loop *ev);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,967 @@
+#define _GNU_SOURCE  /* posix_spawn_file_actions_addtcsetpgrp_np, pipe2, vmsplice, fopencookie */
+#include "exec.h"
+#include "expand.h"
+#include "pathcache.h"
+#include "event.h"
+#include "jobs.h"
+#include "builtins.h"
+#include "vars.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+/*
+ * glibc 2.35 added a file action that makes the spawned child the terminal's
+ * foreground process group. Without it a foreground job under job control
+ * has to be started with fork() so the child can call tcsetpgrp itself.
+ */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP 1
+#define CAN_SPAWN(sh) 1
+#else
+#define CAN_SPAWN(sh) (!(sh)->job_control)
+#endif
+
+/* Where a launched command gets its standard input and output */
+struct stage_io {
+    pid_t pgid;         /* process group to join, 0 to start a new one */
+    int in;             /* descriptor for stdin, -1 to inherit */
+    int out;            /* descriptor for stdout, -1 to inherit */
+    bool foreground;    /* hand the terminal to the process group */
+};
+
+/* An expanded simple command */
+struct command {
+    char **argv;        /* NULL terminated, argv[0] is NULL for bare assignments */
+    char **assigns;     /* the NAME=value words in front of the command */
+    size_t nassigns;
+};
+
+/* A file descriptor saved while a built in command runs with redirections */
+struct fd_save {
+    int fd;
+    int saved;  /* -1 if fd was closed before the redirection */
+};
+
+int exec_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+/*
+ * expand_command:
+ *  - Purpose: Expand a simple command, splitting off the assignments that
+ *    lead it. Assignments expand to one word each, without field splitting.
+ *  - Returns: false after an expansion error was printed.
+ */
+static bool expand_command(struct shell *sh, struct node *n, struct arena *a, struct command *c) {
+    size_t k = 0;
+    while (k < n->simple.nwords && assignment_name(n->simple.words[k])) k++;
+    c->assigns = arena_alloc(a, (k + 1) * sizeof(char *));
+    c->nassigns = k;
+    for (size_t i = 0; i < k; i++) {
+        if (!(c->assigns[i] = expand_word(sh, a, n->simple.words[i]))) return false;
+    }
+    c->assigns[k] = NULL;
+    c->argv = expand_words(sh, a, n->simple.words + k, n->simple.nwords - k);
+    return c->argv != NULL;
+}
+
+/*
+ * command_envp:
+ *  - Purpose: The environment of an external command: the cached one, or
+ *    a copy with the command's own assignments in it.
+ */
+static char **command_envp(struct shell *sh, const struct command *c, struct arena *a) {
+    return c->nassigns ? vars_envp_with(sh->vars, a, c->assigns, c->nassigns) : vars_envp(sh->vars);
+}
+
+/*
+ * Descriptors below 64 that the spawn file actions queued so far will have
+ * put in place or closed in the child, and the shell descriptor behind
+ * each one put in place.
+ */
+struct fd_plan
+{
+    uint64_t placed;
+    uint64_t closed;
+    int from[64];
+};
+
+/*
+ * fd_valid:
+ *  - Purpose: Tell whether a descriptor named by <& or >& will be open when
+ *    the redirection is applied. Without a plan the redirections are being
+ *    performed one by one in this process, so it is simply checked here.
+ */
+static bool fd_valid(const struct fd_plan *plan, long fd) {
+    if (plan && fd < 64) {
+        if (plan->placed >> fd & 1) return true;
+        if (plan->closed >> fd & 1) return false;
+    }
+    return fcntl((int)fd, F_GETFD) >= 0;
+}
+
+/*
+ * redir_source:
+ *  - Purpose: Resolve a redirection to the descriptor that must end up on r->fd.
+ *      * File targets are opened with close-on-exec set and *opened is set
+ *        so the caller knows to close the descriptor when done.
+ *      * <& and >& name an existing descriptor, "-" yields REDIR_CLOSE.
+ *        Under posix_spawn the descriptor may be one an earlier file action
+ *        of the same command creates, plan says which.
+ *  - Returns: The source descriptor, REDIR_CLOSE, or -1 after printing an error.
+ */
+#define REDIR_CLOSE (-2)
+
+static int redir_source(struct shell *sh, struct redir *r, struct arena *a, const struct fd_plan *plan,
+                        bool *opened) {
+    char *target = expand_word(sh, a, r->target);
+    *opened = false;
+    if (!target) return -1;
+    if (r->op == OP_LESSAND || r->op == OP_GREATAND) {
+        if (strcmp(target, "-") == 0) {
+            return REDIR_CLOSE;
+        }
+        char *end;
+        long src = strtol(target, &end, 10);
+        if (*target == '\0' || *end != '\0' || src < 0 || !fd_valid(plan, src)) {
+            fprintf(stderr, "%s: %s\n", target, *end ? "ambiguous redirect" : "Bad file descriptor");
+            return -1;
+        }
+        return (int)src;
+    }
+    int flags;
+    switch (r->op) {
+    case OP_LESS:      flags = O_RDONLY; break;
+    case OP_DGREAT:    flags = O_WRONLY | O_CREAT | O_APPEND; break;
+    case OP_LESSGREAT: flags = O_RDWR | O_CREAT; break;
+    default:           flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+    }
+    int fd = open(target, flags | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", target, strerror(errno));
+        return -1;
+    }
+    *opened = true;
+    return fd;
+}
+
+/*
+ * redir_perform:
+ *  - Purpose: Make one redirection take effect on the calling process.
+ *  - Returns: 0 on success, -1 after printing an error.
+ */
+static int redir_perform(struct shell *sh, struct redir *r, struct arena *a) {
+    bool opened;
+    int src = redir_source(sh, r, a, NULL, &opened);
+    if (src == REDIR_CLOSE) {
+        close(r->fd);
+        return 0;
+    }
+    if (src < 0) return -1;
+    if (src == r->fd) {
+        fcntl(src, F_SETFD, 0);  // Keep it open across exec
+        return 0;
+    }
+    int rval = dup2(src, r->fd);
+    if (rval < 0) perror("dup2");
+    if (opened) close(src);
+    return rval < 0 ? -1 : 0;
+}
+
+/*
+ * redir_apply / redir_restore:
+ *  - Purpose: Apply redirections inside the shell process for built in
+ *    commands. Every descriptor that is about to be replaced is first saved
+ *    above 10 with close-on-exec set, and put back by redir_restore.
+ */
+static struct fd_save *redir_apply(struct shell *sh, struct redir *redirs, struct arena *a, size_t *nsaved, int *err) {
+    size_t n = 0;
+    for (struct redir *r = redirs; r; r = r->next) n++;
+    struct fd_save *saved = arena_alloc(a, n * sizeof(*saved));
+    *nsaved = 0;
+    *err = 0;
+    fflush(NULL);
+    for (struct redir *r = redirs; r; r = r->next) {
+        saved[*nsaved].fd = r->fd;
+        saved[*nsaved].saved = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+        (*nsaved)++;
+        if (redir_perform(sh, r, a) != 0) {
+            *err = 1;
+            break;
+        }
+    }
+    return saved;
+}
+
+static void redir_restore(struct fd_save *saved, size_t nsaved) {
+    fflush(NULL);
+    while (nsaved-- > 0) {
+        if (saved[nsaved].saved >= 0) {
+            dup2(saved[nsaved].saved, saved[nsaved].fd);
+            close(saved[nsaved].saved);
+        } else {
+            close(saved[nsaved].fd);
+        }
+    }
+}
+
+/*
+ * fork_child:
+ *  - Purpose: fork() and do the job control setup on both sides of it.
+ *      * The child joins process group pgid (or starts a new one when pgid
+ *        is 0), takes the terminal if it is a foreground job and restores
+ *        the default signal dispositions the shell ignores.
+ *      * The parent makes the same setpgid/tcsetpgrp calls to close the race
+ *        where either side runs first.
+ *      * A forked child never does job control itself, drops the shell's
+ *        event loop so it does not share the parent's epoll set, and starts
+ *        with an empty job table.
+ *  - Returns: The pid in the parent, 0 in the child.
+ */
+static pid_t fork_child(struct shell *sh, pid_t pgid, bool foreground) {
+    fflush(NULL);  // Do not let the child inherit pending output
+    pid_t pid = fork();
+    if (pid < 0) {
+        // If fork failed we are in trouble!
+        perror("fork return < 0 Process creation failed!");
+        abort();
+    }
+    if (pid == 0) {
+        if (sh->job_control) {
+            pid_t child = getpid();
+            setpgid(child, pgid ? pgid : child);
+            if (foreground) tcsetpgrp(sh->shell_terminal, pgid ? pgid : child);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGQUIT, SIG_DFL);
+            signal(SIGTSTP, SIG_DFL);
+            signal(SIGTTIN, SIG_DFL);
+            signal(SIGTTOU, SIG_DFL);
+        }
+        sh->job_control = 0;
+        event_loop_after_fork(sh->events);
+        job_table_destroy(sh->jobs);
+        return 0;
+    }
+    if (sh->job_control) {
+        setpgid(pid, pgid ? pgid : pid);
+        if (foreground) tcsetpgrp(sh->shell_terminal, pgid ? pgid : pid);
+    }
+    return pid;
+}
+
+/*
+ * reclaim_terminal:
+ *  - Purpose: Give the terminal back to the shell after a foreground job.
+ */
+static void reclaim_terminal(struct shell *sh) {
+    if (sh->job_control) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+    }
+}
+
+/*
+ * wait_foreground:
+ *  - Purpose: Wait for a foreground job and take the terminal back.
+ *      * The wait runs the event loop, so background jobs that finish
+ *        meanwhile are reaped right away.
+ *      * A job that stops enters the job table and is handed to the event
+ *        loop, its command text is only built at that point.
+ *  - Returns: The status of the job.
+ */
+static int wait_foreground(struct shell *sh, struct job *j, struct node *n) {
+    uint64_t start = bench_begin(sh);
+    job_wait(sh, j);
+    bench_end(sh, BENCH_WAIT, start);
+    reclaim_terminal(sh);
+    int status = job_status(j);
+    if (j->state != JOB_STOPPED) {
+        job_free(j);
+        return status;
+    }
+    j->cmd = node_string(n);
+    job_insert(sh->jobs, j);
+    job_watch(sh, j);
+    if (sh->job_control) {
+        fputc('\n', stderr);  // the terminal only echoed ^Z
+        job_print(stderr, sh->jobs, j, false);
+    }
+    return status;
+}
+
+/*
+ * script_argv:
+ *  - Purpose: The arguments to run a file the kernel refused with ENOEXEC,
+ *    a script without #!, as /bin/sh path args, the way execvp does. out
+ *    must have room for one more pointer than argv.
+ */
+static void script_argv(char **out, const char *path, char **argv) {
+    size_t n = 0;
+    out[0] = "/bin/sh";
+    out[1] = (char *)path;
+    while (argv[++n]) out[n + 1] = argv[n];
+    out[n + 1] = NULL;
+}
+
+static size_t count_args(char **argv) {
+    size_t n = 0;
+    while (argv[n]) n++;
+    return n;
+}
+
+/*
+ * launch_error:
+ *  - Purpose: The message and status for a command that could not be
+ *    started. ENOENT for a file that is there means its #! interpreter is
+ *    missing, which is reported as it is rather than as command not found.
+ */
+static int launch_error(int fd, const char *name, const char *path, int err) {
+    struct stat st;
+    bool missing = err == ENOENT && (!path || stat(path, &st) != 0);
+    if (fd >= 0) dprintf(fd, "%s: %s\n", name, missing ? "command not found" : strerror(err));
+    return missing ? 127 : 126;
+}
+
+/*
+ * exec_argv:
+ *  - Purpose: Replace the current (child) process with the command, resolved
+ *    through the path cache. A script without #! is run by /bin/sh. Never
+ *    returns.
+ */
+static _Noreturn void exec_argv(struct shell *sh, char **argv, char **envp) {
+    const char *path = path_cache_lookup(sh->path_cache, vars_get(sh->vars, "PATH"), argv[0]);
+    int err = ENOENT;
+    if (path) {
+        execve(path, argv, envp);
+        err = errno;
+    }
+    if (err == ENOEXEC) {
+        char *sargv[count_args(argv) + 2];
+        script_argv(sargv, path, argv);
+        execve(sargv[0], sargv, envp);
+        err = errno;
+    }
+    fflush(NULL);
+    _exit(launch_error(STDERR_FILENO, argv[0], path, err));
+}
+
+/*
+ * spawn_simple:
+ *  - Purpose: Launch an external command without fork().
+ *      * The command is resolved through the path cache and the absolute
+ *        path is spawned directly, so $PATH is not searched on every launch.
+ *        It is looked up again only if the cached file no longer exists,
+ *        and a script without #! is run by /bin/sh.
+ *      * posix_spawn() creates the child with clone(CLONE_VM|CLONE_VFORK),
+ *        so launch cost no longer grows with the size of the shell heap.
+ *      * The job control setup done by fork_child() is expressed as spawn
+ *        attributes: SETPGROUP puts the child in its own process group,
+ *        SETSIGDEF restores the signals the shell ignores, SETSIGMASK clears
+ *        any signals the shell has blocked, and the tcsetpgrp file action
+ *        hands it the terminal.
+ *      * Pipe ends from io and redirection targets are dup2'ed into place by
+ *        the file actions. Targets are opened in the shell, so errors are
+ *        reported exactly.
+ *      * envp is passed as it is, the cached environment needs no copy.
+ *  - Returns: 0 with *pidp set, or the exit status of a failed launch.
+ */
+static int spawn_simple(struct shell *sh, char **argv, char **envp, struct redir *redirs,
+                        struct arena *a, const struct stage_io *io, pid_t *pidp) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t sigdef, sigmask;
+    size_t n = 0;
+    for (struct redir *r = redirs; r; r = r->next) n++;
+    int *opened = arena_alloc(a, n * sizeof(int));
+    size_t nopened = 0;
+    int status = 0;
+    struct fd_plan plan = {0, 0, {0}};
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+#ifdef HAVE_SPAWN_TCSETPGRP
+    // Must run before the terminal fd is replaced by a pipe or redirection
+    if (sh->job_control && io->foreground) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&fa, sh->shell_terminal);
+    }
+#endif
+    // Track where the child's fds 0-2 will point so a launch error can be
+    // reported on the stderr the command would have had
+    int stdfds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    // Pipe ends first, explicit redirections may override them
+    if (io->in >= 0) {
+        posix_spawn_file_actions_adddup2(&fa, io->in, STDIN_FILENO);
+        stdfds[0] = io->in;
+    }
+    if (io->out >= 0) {
+        posix_spawn_file_actions_adddup2(&fa, io->out, STDOUT_FILENO);
+        stdfds[1] = io->out;
+    }
+    for (struct redir *r = redirs; r; r = r->next) {
+        bool was_opened;
+        int src = redir_source(sh, r, a, &plan, &was_opened);
+        if (src == REDIR_CLOSE) {
+            posix_spawn_file_actions_addclose(&fa, r->fd);
+            if (r->fd <= 2) stdfds[r->fd] = -1;
+            if (r->fd < 64) {
+                plan.closed |= 1ull << r->fd;
+                plan.placed &= ~(1ull << r->fd);
+            }
+            continue;
+        }
+        if (src < 0) {
+            status = 1;
+            goto out;
+        }
+        if (was_opened) opened[nopened++] = src;
+        posix_spawn_file_actions_adddup2(&fa, src, r->fd);
+        // The shell descriptor the child's src will be a copy of
+        int from = src <= 2 ? stdfds[src] : src < 64 && (plan.placed >> src & 1) ? plan.from[src] : src;
+        if (r->fd <= 2) stdfds[r->fd] = from;
+        if (r->fd < 64) {
+            plan.placed |= 1ull << r->fd;
+            plan.closed &= ~(1ull << r->fd);
+            plan.from[r->fd] = from;
+        }
+    }
+
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    sigemptyset(&sigmask);
+    posix_spawnattr_setsigmask(&attr, &sigmask);
+    if (sh->job_control) {
+        flags |= POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+        posix_spawnattr_setpgroup(&attr, io->pgid);
+        sigemptyset(&sigdef);
+        sigaddset(&sigdef, SIGINT);
+        sigaddset(&sigdef, SIGQUIT);
+        sigaddset(&sigdef, SIGTSTP);
+        sigaddset(&sigdef, SIGTTIN);
+        sigaddset(&sigdef, SIGTTOU);
+        posix_spawnattr_setsigdefault(&attr, &sigdef);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    fflush(NULL);
+    const char *path = path_cache_lookup(sh->path_cache, vars_get(sh->vars, "PATH"), argv[0]);
+    int err = path ? posix_spawn(pidp, path, &fa, &attr, argv, envp) : ENOENT;
+    struct stat st;
+    if (err == ENOENT && path && path != argv[0] && stat(path, &st) != 0) {
+        // The cached file went away, look it up again
+        path_cache_forget(sh->path_cache, argv[0]);
+        path = path_cache_lookup(sh->path_cache, vars_get(sh->vars, "PATH"), argv[0]);
+        err = path ? posix_spawn(pidp, path, &fa, &attr, argv, envp) : ENOENT;
+    }
+    if (err == ENOEXEC) {
+        char **sargv = arena_alloc(a, (count_args(argv) + 2) * sizeof(char *));
+        script_argv(sargv, path, argv);
+        err = posix_spawn(pidp, sargv[0], &fa, &attr, sargv, envp);
+    }
+    if (err != 0) {
+        status = launch_error(stdfds[2], argv[0], path, err);
+    } else if (sh->job_control) {
+        pid_t pgid = io->pgid ? io->pgid : *pidp;
+        setpgid(*pidp, pgid);
+        if (io->foreground) tcsetpgrp(sh->shell_terminal, pgid);
+    }
+out:
+    while (nopened > 0) close(opened[--nopened]);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    return status;
+}
+
+/* Size of the stdio buffer of a builtin stage, whole pages */
+#define SPLICE_CHUNK (64 * 1024)
+
+/* The stdout of a builtin stage whose output goes into a pipe */
+struct splice_stream {
+    int fd;
+    char *buf;      /* the stdio buffer, SPLICE_CHUNK bytes of our own */
+};
+
+/*
+ * splice_out:
+ *  - Purpose: Move a buffer into a pipe with vmsplice(), which maps the pages
+ *    into the pipe instead of copying them. Falls back to write() if the
+ *    kernel refuses, or right away when splice is false.
+ *  - Returns: 0 on success, -1 on error.
+ */
+static int splice_out(int fd, const char *buf, size_t len, bool splice) {
+    bool use_write = !splice;
+    while (len > 0) {
+        ssize_t n;
+        if (!use_write) {
+            struct iovec iov = { (void *)buf, len };
+            n = vmsplice(fd, &iov, 1, 0);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                use_write = true;
+                continue;
+            }
+        } else {
+            n = write(fd, buf, len);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * splice_write:
+ *  - Purpose: Write function of a builtin stage's stdout.
+ *      * A flush passes the stdio buffer, which is our own pages. They are
+ *        handed to the pipe with vmsplice() and fresh pages are mapped over
+ *        them, so stdio fills new memory while the pipe still references
+ *        the old pages. A flush always empties the whole buffer.
+ *      * Anything else, like a large fwrite() that stdio passes straight
+ *        through, belongs to the caller and may be reused, so it is copied
+ *        with write().
+ */
+static ssize_t splice_write(void *cookie, const char *data, size_t len) {
+    struct splice_stream *s = cookie;
+    bool own = data >= s->buf && data + len <= s->buf + SPLICE_CHUNK;
+    if (splice_out(s->fd, data, len, own) != 0) return -1;
+    if (own && mmap(s->buf, SPLICE_CHUNK, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        return -1;
+    }
+    return len;
+}
+
+/*
+ * splice_stream_open:
+ *  - Purpose: A stream that writes to the pipe fd through splice_write.
+ *  - Returns: The stream, or NULL if it could not be set up.
+ */
+static FILE *splice_stream_open(struct splice_stream *s, int fd) {
+    s->fd = fd;
+    s->buf = mmap(NULL, SPLICE_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (s->buf == MAP_FAILED) return NULL;
+    FILE *f = fopencookie(s, "w", (cookie_io_functions_t){ .write = splice_write });
+    if (f && setvbuf(f, s->buf, _IOFBF, SPLICE_CHUNK) == 0) return f;
+    if (f) fclose(f);
+    munmap(s->buf, SPLICE_CHUNK);
+    return NULL;
+}
+
+/*
+ * run_builtin_stage:
+ *  - Purpose: Run a built in command inside a forked pipeline stage and exit.
+ *      * When stdout is a pipe the builtin prints through a stream whose
+ *        buffer is handed to the pipe with vmsplice(), see splice_write.
+ *        What the builtin formats into that buffer reaches the reader
+ *        without another copy.
+ */
+static void run_builtin_stage(struct shell *sh, char **argv) {
+    struct stat st;
+    struct splice_stream ss;
+    FILE *out = NULL, *orig = stdout;
+    if (fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        fflush(stdout);
+        out = splice_stream_open(&ss, STDOUT_FILENO);
+        if (out) stdout = out;
+    }
+    sh->last_status = 0;
+    do_builtin(sh, argv);
+    if (out) {
+        stdout = orig;
+        if (fclose(out) != 0 && errno != EPIPE) perror(argv[0]);
+    }
+    fflush(NULL);
+    _exit(sh->last_status);
+}
+
+/*
+ * exec_simple_child:
+ *  - Purpose: Run an expanded simple command inside a forked child and exit.
+ *    External commands exec directly instead of forking again. The child's
+ *    variables are its own, so the assignments are simply made, exported
+ *    when a command follows.
+ */
+static void exec_simple_child(struct shell *sh, struct command *c, struct redir *redirs, struct arena *a) {
+    for (struct redir *r = redirs; r; r = r->next) {
+        if (redir_perform(sh, r, a) != 0) _exit(1);
+    }
+    for (size_t i = 0; i < c->nassigns; i++) {
+        vars_assign(sh->vars, c->assigns[i], c->argv[0] ? VAR_EXPORT : 0);
+    }
+    if (!c->argv[0]) _exit(0);
+    if (is_builtin(sh, c->argv[0])) run_builtin_stage(sh, c->argv);
+    exec_argv(sh, c->argv, vars_envp(sh->vars));
+}
+
+/*
+ * exec_in_child:
+ *  - Purpose: Run a node inside an already forked child and exit with its
+ *    status.
+ */
+static void exec_in_child(struct shell *sh, struct node *n, struct arena *a) {
+    if (n->type == N_SIMPLE) {
+        struct command c;
+        if (!expand_command(sh, n, a, &c)) _exit(1);
+        exec_simple_child(sh, &c, n->simple.redirs, a);
+    }
+    if (n->type == N_SUBSHELL) {
+        for (struct redir *r = n->sub.redirs; r; r = r->next) {
+            if (redir_perform(sh, r, a) != 0) _exit(1);
+        }
+        n = n->sub.body;
+    }
+    int status = exec_node(sh, n, a);
+    fflush(NULL);
+    _exit(status);
+}
+
+/*
+ * pipe_capacity:
+ *  - Purpose: Requested pipe buffer size from $PIPESIZE, 0 for the kernel default.
+ */
+static int pipe_capacity(struct shell *sh) {
+    const char *v = vars_get(sh->vars, "PIPESIZE");
+    return v ? atoi(v) : 0;
+}
+
+/*
+ * launch_stages:
+ *  - Purpose: Start the stages of a pipeline (or a single command) and
+ *    record their pids in the job.
+ *      * Pipes are created with pipe2(O_CLOEXEC), so no stage inherits a pipe
+ *        end it does not use and nothing has to be closed in the children.
+ *      * If $PIPESIZE is set each pipe is resized with F_SETPIPE_SZ.
+ *      * External commands are spawned with the pipe ends dup2'ed by file
+ *        actions. Built in commands and subshells are forked, built in output
+ *        reaches the pipe through vmsplice().
+ *      * Every stage joins the process group of the first one, a foreground
+ *        job gets the terminal.
+ *      * Without job control a background job reads from /dev/null.
+ *      * c0 is the already expanded first stage, or NULL.
+ */
+static void launch_stages(struct shell *sh, struct node **cmds, size_t ncmds, struct command *c0,
+                          struct arena *a, struct job *j, bool foreground) {
+    uint64_t start = bench_begin(sh);
+    int capacity = pipe_capacity(sh);
+    struct stage_io io = { .pgid = 0, .in = -1, .out = -1, .foreground = foreground };
+    if (!foreground && !sh->job_control) io.in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    for (size_t i = 0; i < ncmds; i++) {
+        int fds[2] = {-1, -1};
+        if (i + 1 < ncmds) {
+            if (pipe2(fds, O_CLOEXEC) < 0) {
+                perror("pipe");
+                break;
+            }
+            if (capacity > 0 && fcntl(fds[1], F_SETPIPE_SZ, capacity) < 0) {
+                perror("F_SETPIPE_SZ");
+            }
+        }
+        io.out = fds[1];
+        struct node *cmd = cmds[i];
+        pid_t pid = -1;
+        struct command c = {NULL, NULL, 0};
+        bool expanded = true;
+        if (i == 0 && c0) {
+            c = *c0;
+        } else if (cmd->type == N_SIMPLE) {
+            expanded = expand_command(sh, cmd, a, &c);
+        }
+        char **argv = c.argv;
+        if (!expanded) {
+            job_proc_failed(j, i, 1);
+        } else if (argv && argv[0] && !is_builtin(sh, argv[0]) && CAN_SPAWN(sh)) {
+            int status = spawn_simple(sh, argv, command_envp(sh, &c, a), cmd->simple.redirs, a, &io, &pid);
+            if (status != 0) job_proc_failed(j, i, status);
+        } else {
+            pid = fork_child(sh, io.pgid, foreground);
+            if (pid == 0) {
+                // Drop every pipe end that is not stdin or stdout of this stage
+                if (io.in >= 0) {
+                    dup2(io.in, STDIN_FILENO);
+                    close(io.in);
+                }
+                if (io.out >= 0) {
+                    dup2(io.out, STDOUT_FILENO);
+                    close(io.out);
+                    close(fds[0]);
+                }
+                if (argv) exec_simple_child(sh, &c, cmd->simple.redirs, a);
+                exec_in_child(sh, cmd, a);
+            }
+        }
+        if (pid > 0) {
+            if (!io.pgid) io.pgid = pid;
+            job_proc_start(j, i, pid);
+        }
+        if (io.in >= 0) close(io.in);
+        if (io.out >= 0) close(io.out);
+        io.in = fds[0];
+    }
+    if (io.in >= 0) close(io.in);
+    j->pgid = io.pgid;
+    bench_end(sh, BENCH_SPAWN, start);
+}
+
+/*
+ * run_builtin:
+ *  - Purpose: Call a builtin with the assignments in front of it in effect,
+ *    then put the variables back as they were.
+ */
+static int run_builtin(struct shell *sh, const struct builtin *b, struct command *c, struct arena *a) {
+    const char **old = arena_alloc(a, c->nassigns * sizeof(*old));
+    for (size_t i = 0; i < c->nassigns; i++) {
+        char *name = arena_strndup(a, c->assigns[i], assignment_name(c->assigns[i]));
+        const char *v = vars_get(sh->vars, name);
+        old[i] = v ? arena_strndup(a, v, strlen(v)) : NULL;
+        vars_assign(sh->vars, c->assigns[i], 0);
+    }
+    uint64_t start = bench_begin(sh);
+    int status = b->fn(sh, c->argv);
+    bench_end(sh, BENCH_BUILTIN, start);
+    for (size_t i = c->nassigns; i-- > 0;) {
+        char *name = arena_strndup(a, c->assigns[i], assignment_name(c->assigns[i]));
+        if (old[i]) {
+            vars_set(sh->vars, name, old[i], 0);
+        } else {
+            vars_unset(sh->vars, name);
+        }
+    }
+    return status;
+}
+
+/*
+ * exec_simple:
+ *  - Purpose: Run a simple command.
+ *      * Assignments alone set shell variables.
+ *      * Built in commands run in the shell with their redirections applied
+ *        temporarily.
+ *      * Anything else is launched as a one stage foreground job and waited
+ *        for.
+ *      * pre is the command when the caller already expanded it, expanding
+ *        again would repeat side effects such as $((i += 1)).
+ */
+static int exec_simple(struct shell *sh, struct node *n, struct arena *a, struct command *pre) {
+    struct command c;
+    if (pre) {
+        c = *pre;
+    } else if (!expand_command(sh, n, a, &c)) {
+        return 1;
+    }
+    const struct builtin *b = c.argv[0] ? builtin_lookup(sh, c.argv[0]) : NULL;
+    if (!c.argv[0] || b) {
+        size_t nsaved;
+        int err;
+        struct fd_save *saved = redir_apply(sh, n->simple.redirs, a, &nsaved, &err);
+        int status = err;
+        if (!err && b) {
+            status = run_builtin(sh, b, &c, a);
+        } else if (!err) {
+            for (size_t i = 0; i < c.nassigns; i++) vars_assign(sh->vars, c.assigns[i], 0);
+        }
+        redir_restore(saved, nsaved);
+        return status;
+    }
+    struct job *j = job_create(1);
+    launch_stages(sh, &n, 1, &c, a, j, true);
+    return wait_foreground(sh, j, n);
+}
+
+/*
+ * exec_pipeline:
+ *  - Purpose: Run a | b | c in the foreground.
+ *  - Returns: The status of the last stage, inverted for ! pipelines.
+ */
+static int exec_pipeline(struct shell *sh, struct node *n, struct arena *a) {
+    struct job *j = job_create(n->pipeline.ncmds);
+    launch_stages(sh, n->pipeline.cmds, n->pipeline.ncmds, NULL, a, j, true);
+    int status = wait_foreground(sh, j, n);
+    if (n->pipeline.negate) status = !status;
+    return status;
+}
+
+/*
+ * exec_background:
+ *  - Purpose: Start a list without waiting for it and enter it in the job
+ *    table.
+ *      * Simple commands, pipelines and subshells run as their own
+ *        processes, spawned directly, with no extra shell in between.
+ *      * Anything else (a && b &) runs in a forked copy of the shell.
+ *  - Returns: 0, or the launch status if nothing could be started.
+ */
+static int exec_background(struct shell *sh, struct node *n, struct arena *a) {
+    struct node *body = n->sub.body;
+    struct node **cmds = &n->sub.body;
+    size_t ncmds = 1;
+    if (body->type == N_PIPELINE && !body->pipeline.negate) {
+        cmds = body->pipeline.cmds;
+        ncmds = body->pipeline.ncmds;
+    }
+    struct job *j = job_create(ncmds);
+    launch_stages(sh, cmds, ncmds, NULL, a, j, false);
+    if (j->state == JOB_DONE) {
+        int status = job_status(j);
+        job_free(j);
+        return status;
+    }
+    j->cmd = node_string(body);
+    job_insert(sh->jobs, j);
+    job_watch(sh, j);
+    if (sh->job_control) fprintf(stderr, "[%d] %d\n", j->id, (int)j->pgid);
+    return 0;
+}
+
+/*
+ * exec_for:
+ *  - Purpose: Run the body of a for loop once per field of its words.
+ *      * Each word is brace expanded by a generator and each generated
+ *        word expanded on its own, so the list is never held in memory.
+ *      * Whatever an iteration allocates is released from the arena before
+ *        the next one, so a loop over {1..10000000} runs in constant
+ *        memory.
+ *      * Without "in" the positional parameters are walked.
+ *      * The loop stops on an expansion error or when a command of the body
+ *        is interrupted. SIGINT is only read through the event loop, so a
+ *        body of builtins never sees it; loop_interrupted polls for it
+ *        between iterations and the loop returns 130.
+ */
+static bool loop_interrupted(struct shell *sh, int *status) {
+    if (*status == 128 + SIGINT) return true;
+    if (!sh->events || !event_take_interrupt(sh->events)) return false;
+    *status = 128 + SIGINT;
+    return true;
+}
+
+static int exec_for(struct shell *sh, struct node *n, struct arena *a) {
+    size_t nsaved;
+    int err;
+    struct fd_save *saved = redir_apply(sh, n->loop.redirs, a, &nsaved, &err);
+    int status = err;
+    bool stop = err != 0;
+    for (size_t i = 0; !n->loop.in && !stop && sh->params && sh->params[i]; i++) {
+        vars_set(sh->vars, n->loop.name, sh->params[i], 0);
+        status = exec_node(sh, n->loop.body, a);
+        stop = loop_interrupted(sh, &status);
+    }
+    for (size_t i = 0; i < n->loop.nwords && !stop; i++) {
+        struct brace_iter it;
+        brace_begin(&it, n->loop.words[i]);
+        for (const char *w; !stop && (w = brace_next(&it));) {
+            struct arena_mark mark = arena_save(a);
+            char *raw = (char *)w;
+            char **fields = expand_words(sh, a, &raw, 1);
+            if (!fields) {
+                status = 1;
+                stop = true;
+            }
+            for (size_t k = 0; fields && fields[k] && !stop; k++) {
+                vars_set(sh->vars, n->loop.name, fields[k], 0);
+                status = exec_node(sh, n->loop.body, a);
+                stop = loop_interrupted(sh, &status);
+            }
+            arena_restore(a, mark);
+        }
+        brace_end(&it);
+    }
+    redir_restore(saved, nsaved);
+    return status;
+}
+
+/*
+ * exec_node:
+ *  - Purpose: Walk the tree.
+ *      * && and || short circuit on the status of the left side.
+ *      * Subshells run in a forked copy of the shell.
+ *      * Background lists become jobs that the event loop reaps as soon as
+ *        they exit.
+ */
+int exec_node(struct shell *sh, struct node *n, struct arena *a) {
+    int status = 0;
+    if (!n) return sh->last_status;
+    switch (n->type) {
+    case N_SIMPLE:
+        status = exec_simple(sh, n, a, NULL);
+        break;
+    case N_PIPELINE:
+        status = exec_pipeline(sh, n, a);
+        break;
+    case N_AND:
+        status = exec_node(sh, n->binary.left, a);
+        if (status == 0) status = exec_node(sh, n->binary.right, a);
+        break;
+    case N_OR:
+        status = exec_node(sh, n->binary.left, a);
+        if (status != 0) status = exec_node(sh, n->binary.right, a);
+        break;
+    case N_SEQ:
+        exec_node(sh, n->binary.left, a);
+        status = exec_node(sh, n->binary.right, a);
+        break;
+    case N_SUBSHELL: {
+        struct job *j = job_create(1);
+        launch_stages(sh, &n, 1, NULL, a, j, true);
+        status = wait_foreground(sh, j, n);
+        break;
+    }
+    case N_BACKGROUND:
+        status = exec_background(sh, n, a);
+        break;
+    case N_FOR:
+        status = exec_for(sh, n, a);
+        break;
+    }
+    sh->last_status = status;
+    return status;
+}
+
+/*
+ * exec_tail:
+ *  - Purpose: Run the last thing the shell will ever run.
+ *      * Lists are walked down to the command that runs last, as in
+ *        exec_node.
+ *      * If that is an external simple command it is exec'd in place of
+ *        the shell, instead of being forked and waited for. Its
+ *        redirections are applied to the shell itself, and the signal
+ *        mask of the event loop is dropped first so the command does not
+ *        start with SIGCHLD blocked.
+ *      * Anything else, and every command under --bench, runs as usual.
+ */
+int exec_tail(struct shell *sh, struct node *n, struct arena *a) {
+    int status;
+    if (!n) return sh->last_status;
+    switch (n->type) {
+    case N_AND:
+    case N_OR:
+        status = exec_node(sh, n->binary.left, a);
+        if ((status == 0) != (n->type == N_AND)) return status;
+        return exec_tail(sh, n->binary.right, a);
+    case N_SEQ:
+        exec_node(sh, n->binary.left, a);
+        return exec_tail(sh, n->binary.right, a);
+    case N_SIMPLE:
+        break;
+    default:
+        return exec_node(sh, n, a);
+    }
+    struct command c;
+    if (!expand_command(sh, n, a, &c)) return sh->last_status = 1;
+    if (!c.argv[0] || is_builtin(sh, c.argv[0]) || sh->job_control || sh->bench) {
+        return sh->last_status = exec_simple(sh, n, a, &c);
+    }
+    for (struct redir *r = n->simple.redirs; r; r = r->next) {
+        if (redir_perform(sh, r, a) != 0) return sh->last_status = 1;
+    }
+    char **envp = command_envp(sh, &c, a);
+    fflush(NULL);
+    event_loop_destroy(sh->events);
+    exec_argv(sh, c.argv, envp);
+}
@@ -0,0 +1,50 @@
+#ifndef EXEC_H
+#define EXEC_H
+#include "lab.h"
+#include "ast.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+* @brief Execute a command tree. Simple commands are looked up as built in
+* commands first and launched as child processes otherwise. Any memory
+* needed for expansion is taken from the arena that holds the tree.
+*
+* @param sh The shell
+* @param n The tree returned by parse_line, may be NULL
+* @param a The arena used for word expansion
+* @return The exit status of the tree, also stored in sh->last_status
+*/
+
+int exec_node(struct shell *sh, struct node *n, struct arena *a);
+/**
+* @brief Convert a status from waitpid into a shell exit status: the exit
+* code, or 128 plus the signal number for a child killed by a signal.
+*
+* @param status The status from waitpid
+* @return The exit status
+*/
+
+int exec_status(int status);
+/**
+* @brief Execute a tree that is the last input of the shell. When the
+* command that runs last is an external one, it replaces the shell process
+* instead of being forked and waited for, so this function only returns if
+* that is not the case.
+*
+* @param sh The shell
+* @param n The tree returned by parse_line, may be NULL
+* @param a The arena used for word expansion
+* @return The exit status of the tree, also stored in sh->last_status
+*/
+
+int exec_tail(struct shell *sh, struct node *n, struct arena *a);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,1116 @@
+#include "expand.h"
+#include "vars.h"
+#include "glob.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <pwd.h>
+
+/* Recursion limit for variables whose values are arithmetic expressions */
+#define ARITH_DEPTH 32
+
+/* Field splitting when $IFS is unset */
+#define DEFAULT_IFS " \t\n"
+
+/*
+ * The state of one expansion. Words are expanded left to right in a single
+ * pass; literal bytes and expansion results are appended to the field being
+ * built, which lives in the command's arena. A finished field is cut off
+ * where it ends and the next one continues in the same space.
+ *
+ * While splitting into fields, quoted * ? [ and \ are written with a
+ * backslash in front, so a field with unquoted ones can be handed to the
+ * glob engine as it is. The backslashes are taken out again if it is not
+ * a pattern or matches nothing.
+ */
+struct expander
+{
+    struct shell *sh;
+    struct arena *a;
+    char *buf;          /* the field being built */
+    size_t len;
+    size_t cap;
+    bool have_field;    /* the field exists even if empty, as for "" */
+    char **fields;      /* NULL while expanding a single word */
+    size_t nfields;
+    size_t fields_cap;
+    const char *ifs;
+    bool split_words;   /* inside ${name-word}, where literal text is split too */
+    bool glob;          /* the field has an unquoted * ? or [ */
+    bool escaped;       /* the field has backslashes added in front of quoted bytes */
+    bool ifs_space;     /* the last field was ended by IFS white space alone */
+    bool error;
+};
+
+static void expand_part(struct expander *e, const char *p, const char *end, bool quoted);
+
+/*
+ * reserve:
+ *  - Purpose: Make room for n more bytes and a NUL. A field that outgrows
+ *    its space moves to a block twice the size, so appending stays
+ *    amortized O(1) and at most half the arena space is wasted.
+ */
+static void reserve(struct expander *e, size_t n) {
+    if (e->len + n + 1 <= e->cap) return;
+    size_t cap = e->cap * 2 > 64 ? e->cap * 2 : 64;
+    while (cap < e->len + n + 1) cap *= 2;
+    char *buf = arena_alloc(e->a, cap);
+    memcpy(buf, e->buf, e->len);
+    e->buf = buf;
+    e->cap = cap;
+}
+
+static void put(struct expander *e, const char *s, size_t n) {
+    e->ifs_space = false;
+    reserve(e, n);
+    memcpy(e->buf + e->len, s, n);
+    e->len += n;
+}
+
+static void put_char(struct expander *e, char c) {
+    e->ifs_space = false;
+    reserve(e, 1);
+    e->buf[e->len++] = c;
+}
+
+/*
+ * put_quoted:
+ *  - Purpose: Append bytes that must not act as a pattern.
+ */
+static void put_quoted(struct expander *e, const char *s, size_t n) {
+    if (!e->fields) {
+        put(e, s, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\') {
+            put_char(e, '\\');
+            e->escaped = true;
+        }
+        put_char(e, s[i]);
+    }
+}
+
+/*
+ * put_pattern:
+ *  - Purpose: Append unquoted bytes, which may make the field a pattern. A
+ *    backslash, which can only come from an expansion result here, stays
+ *    a plain byte.
+ */
+static void put_pattern(struct expander *e, const char *s, size_t n) {
+    if (!e->fields) {
+        put(e, s, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\\') {
+            put_quoted(e, s + i, 1);
+            continue;
+        }
+        e->glob |= s[i] == '*' || s[i] == '?' || s[i] == '[';
+        put_char(e, s[i]);
+    }
+}
+
+static void add_field(struct expander *e, char *field) {
+    if (e->nfields + 1 >= e->fields_cap) {
+        size_t cap = e->fields_cap ? e->fields_cap * 2 : 16;
+        char **fields = arena_alloc(e->a, cap * sizeof(*fields));
+        if (e->nfields) memcpy(fields, e->fields, e->nfields * sizeof(*fields));
+        e->fields = fields;
+        e->fields_cap = cap;
+    }
+    e->fields[e->nfields++] = field;
+}
+
+/*
+ * unescape:
+ *  - Purpose: Take out the backslashes put_quoted added, in place.
+ */
+static void unescape(struct expander *e) {
+    size_t n = 0;
+    for (size_t i = 0; i < e->len; i++) {
+        if (e->buf[i] == '\\' && i + 1 < e->len) i++;
+        e->buf[n++] = e->buf[i];
+    }
+    e->len = n;
+    e->buf[n] = '\0';
+}
+
+/*
+ * end_field:
+ *  - Purpose: Finish the field being built, if there is one, and start the
+ *    next in the space left after it. A pattern is replaced by the paths
+ *    it matches, when there are any.
+ */
+static void end_field(struct expander *e) {
+    if (!e->len && !e->have_field) return;
+    reserve(e, 0);
+    e->buf[e->len] = '\0';
+    bool glob = e->glob && glob_magic(e->buf);
+    bool escaped = e->escaped;
+    e->glob = e->escaped = false;
+    e->have_field = false;
+    if (glob) {
+        struct glob_result r;
+        if (path_glob(e->buf, 0, &r)) {
+            for (size_t i = 0; i < r.count; i++) add_field(e, arena_strndup(e->a, r.paths[i], strlen(r.paths[i])));
+            glob_result_free(&r);
+            e->len = 0;
+            return;
+        }
+        glob_result_free(&r);
+    }
+    if (glob || escaped) unescape(e);
+    add_field(e, e->buf);
+    e->buf += e->len + 1;
+    e->cap -= e->len + 1;
+    e->len = 0;
+}
+
+/*
+ * put_value:
+ *  - Purpose: Append the result of an expansion.
+ *      * Quoted results, and any result while expanding a single word, are
+ *        copied as they are.
+ *      * Otherwise the result is split on $IFS: runs of IFS white space
+ *        separate fields, every other IFS byte ends one, empty or not.
+ */
+static void put_value(struct expander *e, const char *s, size_t n, bool quoted) {
+    if (quoted) {
+        put_quoted(e, s, n);
+        e->have_field = true;
+        return;
+    }
+    if (!e->fields || !*e->ifs) {
+        put_pattern(e, s, n);
+        return;
+    }
+    for (size_t i = 0; i < n;) {
+        size_t run = 0;
+        while (i + run < n && (!s[i + run] || !strchr(e->ifs, s[i + run]))) run++;
+        put_pattern(e, s + i, run);
+        i += run;
+        if (i == n) break;
+        // One delimiter is IFS white space around at most one other IFS
+        // byte, even when the white space ended the previous value
+        bool other = false;
+        while (i < n && s[i] && strchr(e->ifs, s[i])) {
+            if (!strchr(" \t\n", s[i])) {
+                if (other) break;
+                other = true;
+            }
+            i++;
+        }
+        if (other && !e->ifs_space) e->have_field = true;
+        end_field(e);
+        e->ifs_space = !other;
+    }
+}
+
+static bool is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/*
+ * find_close:
+ *  - Purpose: Find the bracket closing the one at p, skipping quoted text,
+ *    escaped bytes and nested brackets of the same kind.
+ *  - Returns: A pointer to the closing bracket, or NULL.
+ */
+static const char *find_close(const char *p, const char *end, char open, char close) {
+    int depth = 0;
+    for (; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        } else if (*p == '\'') {
+            const char *q = memchr(p + 1, '\'', end - p - 1);
+            if (!q) return NULL;
+            p = q;
+        } else if (*p == open) {
+            depth++;
+        } else if (*p == close && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * find_dq_end:
+ *  - Purpose: Find the " closing the double quoted text that starts at p.
+ *    Expansions inside it may contain quotes of their own.
+ */
+static const char *find_dq_end(const char *p, const char *end) {
+    while (p < end && *p != '"') {
+        if (*p == '\\' && p + 1 < end) {
+            p += 2;
+        } else if (*p == '$' && p + 1 < end && (p[1] == '{' || p[1] == '(')) {
+            const char *q = find_close(p + 1, end, p[1], p[1] == '{' ? '}' : ')');
+            p = q ? q + 1 : end;
+        } else {
+            p++;
+        }
+    }
+    return p;
+}
+
+/*
+ * skip_quoted:
+ *  - Purpose: Step over a quote, an escape, ${...} or $(...) starting at p,
+ *    where brace expansion does not look.
+ *  - Returns: Where the text after it starts, or NULL if p starts none.
+ */
+static const char *skip_quoted(const char *p, const char *end) {
+    const char *q;
+    switch (*p) {
+    case '\\':
+        return p + 2 < end ? p + 2 : end;
+    case '\'':
+        q = memchr(p + 1, '\'', end - p - 1);
+        return q ? q + 1 : end;
+    case '"':
+        q = find_dq_end(p + 1, end);
+        return q < end ? q + 1 : end;
+    case '$':
+        if (p + 1 >= end || (p[1] != '{' && p[1] != '(')) return NULL;
+        q = find_close(p + 1, end, p[1], p[1] == '{' ? '}' : ')');
+        return q ? q + 1 : end;
+    }
+    return NULL;
+}
+
+/*
+ * parse_int:
+ *  - Purpose: Read an optionally negative decimal number of at most 18
+ *    digits, so that stepping through a range cannot overflow.
+ *  - Returns: Where the text after it starts, or NULL if there is none.
+ */
+static const char *parse_int(const char *p, const char *end, long long *v) {
+    const char *q = p + (p < end && *p == '-');
+    const char *digits = q;
+    long long n = 0;
+    while (q < end && isdigit((unsigned char)*q) && q - digits < 18) n = n * 10 + (*q++ - '0');
+    if (q == digits || (q < end && isdigit((unsigned char)*q))) return NULL;
+    *v = *p == '-' ? -n : n;
+    return q;
+}
+
+/*
+ * parse_range:
+ *  - Purpose: Read the x..y or x..y..step between the braces at p and end.
+ *    x and y are both numbers or both single characters. When either number
+ *    is written with a leading zero, every value is padded to the wider one.
+ *  - Returns: True if it is a range.
+ */
+static bool parse_range(const char *p, const char *end, struct brace_frame *f) {
+    const char *q = parse_int(p, end, &f->value);
+    const char *r = NULL;
+    f->letters = false;
+    f->width = 0;
+    if (q && end - q > 2 && q[0] == '.' && q[1] == '.' && (r = parse_int(q + 2, end, &f->to))) {
+        const char *x = p + (*p == '-'), *y = q + 2 + (q[2] == '-');
+        if ((*x == '0' && q - x > 1) || (*y == '0' && r - y > 1)) {
+            f->width = q - p > r - q - 2 ? q - p : r - q - 2;
+        }
+    } else if (end - p >= 4 && isalpha((unsigned char)p[0]) && p[1] == '.' && p[2] == '.' &&
+               isalpha((unsigned char)p[3]) && (end - p == 4 || p[4] == '.')) {
+        f->letters = true;
+        f->value = (unsigned char)p[0];
+        f->to = (unsigned char)p[3];
+        r = p + 4;
+    } else {
+        return false;
+    }
+    f->step = 1;
+    if (r < end) {
+        long long step;
+        if (end - r < 3 || r[0] != '.' || r[1] != '.' || parse_int(r + 2, end, &step) != end) return false;
+        f->step = step < 0 ? -step : step ? step : 1;
+    }
+    if (f->to < f->value) f->step = -f->step;
+    return true;
+}
+
+/*
+ * find_group:
+ *  - Purpose: Find the first brace group of s at or after from: an unquoted
+ *    { with its matching }, and either a comma at the top level between them
+ *    or a range. Braces that are neither stay as they are, as do quoted ones
+ *    and the braces of ${...}.
+ *  - Returns: True if there is one; its position and kind are set in f.
+ */
+static bool find_group(const char *s, size_t from, size_t len, struct brace_frame *f) {
+    const char *end = s + len;
+    for (const char *p = s + from; p < end;) {
+        const char *q = skip_quoted(p, end);
+        if (q) {
+            p = q;
+            continue;
+        }
+        if (*p++ != '{') continue;
+        int depth = 1;
+        bool comma = false;
+        for (q = p; q < end && depth;) {
+            const char *r = skip_quoted(q, end);
+            if (r) {
+                q = r;
+                continue;
+            }
+            if (*q == '{') depth++;
+            if (*q == '}') depth--;
+            comma |= *q == ',' && depth == 1;
+            q++;
+        }
+        if (depth) continue;
+        f->range = !comma && parse_range(p, q - 1, f);
+        if (comma || f->range) {
+            f->open = p - 1 - s;
+            f->close = q - 1 - s;
+            f->next = f->open + 1;
+            f->done = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * frame_item:
+ *  - Purpose: The next alternative of the group of a frame, or the next
+ *    value of its range, formatted into the frame.
+ *  - Returns: False when the group is exhausted.
+ */
+static bool frame_item(struct brace_frame *f, const char **item, size_t *len) {
+    if (f->done) return false;
+    if (f->range) {
+        if (f->letters) {
+            f->num[0] = (char)f->value;
+            *len = 1;
+        } else {
+            *len = snprintf(f->num, sizeof(f->num), "%0*lld", f->width, f->value);
+        }
+        *item = f->num;
+        f->done = f->step > 0 ? f->to - f->value < f->step : f->to - f->value > f->step;
+        f->value += f->step;
+        return true;
+    }
+    const char *p = f->text + f->next, *end = f->text + f->close;
+    int depth = 0;
+    while (p < end && (depth || *p != ',')) {
+        const char *q = skip_quoted(p, end);
+        if (q) {
+            p = q;
+            continue;
+        }
+        if (*p == '{') depth++;
+        if (*p == '}') depth--;
+        p++;
+    }
+    *item = f->text + f->next;
+    *len = p - *item;
+    f->next = p - f->text + 1;
+    f->done = p >= end;
+    return true;
+}
+
+static void push_frame(struct brace_iter *it, const char *s, size_t len, const struct brace_frame *g) {
+    if (it->depth == it->cap) {
+        it->cap = it->cap ? it->cap * 2 : 8;
+        it->frames = realloc(it->frames, it->cap * sizeof(*it->frames));
+    }
+    char *text = malloc(len + 1);
+    if (!it->frames || !text) {
+        fprintf(stderr, "brace: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(text, s, len);
+    text[len] = '\0';
+    struct brace_frame *f = &it->frames[it->depth++];
+    *f = *g;
+    f->text = text;
+    f->len = len;
+}
+
+/*
+ * brace_begin:
+ *  - Purpose: Start generating the words of raw. A word without groups is
+ *    handed back as it is, without being copied.
+ */
+void brace_begin(struct brace_iter *it, const char *raw) {
+    struct brace_frame g;
+    memset(it, 0, sizeof(*it));
+    size_t len = strlen(raw);
+    if (memchr(raw, '{', len) && find_group(raw, 0, len, &g)) {
+        push_frame(it, raw, len, &g);
+    } else {
+        it->single = raw;
+    }
+}
+
+/*
+ * brace_next:
+ *  - Purpose: Generate the next word, depth first.
+ *      * The frame on top of the stack is a word with its first group
+ *        found. Each of its items is put in place of the group; if the
+ *        result has another group it is pushed as a new frame, otherwise
+ *        it is the next word.
+ *      * There is at most one frame per group of the word, so memory does
+ *        not depend on how many words are generated.
+ */
+const char *brace_next(struct brace_iter *it) {
+    if (it->single) {
+        const char *s = it->single;
+        it->single = NULL;
+        return s;
+    }
+    while (it->depth) {
+        struct brace_frame *f = &it->frames[it->depth - 1];
+        const char *item;
+        size_t n;
+        if (!frame_item(f, &item, &n)) {
+            free(f->text);
+            it->depth--;
+            continue;
+        }
+        size_t tail = f->len - f->close - 1;
+        size_t len = f->open + n + tail;
+        if (len + 1 > it->out_cap) {
+            it->out_cap = len + 1 > 2 * it->out_cap ? len + 1 : 2 * it->out_cap;
+            it->out = realloc(it->out, it->out_cap);
+            if (!it->out) {
+                fprintf(stderr, "brace: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(it->out, f->text, f->open);
+        memcpy(it->out + f->open, item, n);
+        memcpy(it->out + f->open + n, f->text + f->close + 1, tail);
+        it->out[len] = '\0';
+        struct brace_frame g;
+        if (find_group(it->out, f->open, len, &g)) {
+            push_frame(it, it->out, len, &g);
+            continue;
+        }
+        return it->out;
+    }
+    return NULL;
+}
+
+void brace_end(struct brace_iter *it) {
+    while (it->depth) free(it->frames[--it->depth].text);
+    free(it->frames);
+    free(it->out);
+    memset(it, 0, sizeof(*it));
+}
+
+static size_t count_params(struct shell *sh) {
+    size_t n = 0;
+    while (sh->params && sh->params[n]) n++;
+    return n;
+}
+
+/*
+ * lookup:
+ *  - Purpose: The value of a named, positional or special parameter other
+ *    than $@ and $*.
+ *  - Returns: NULL if it is not set.
+ */
+static const char *lookup(struct expander *e, const char *name, size_t len) {
+    struct shell *sh = e->sh;
+    char num[32];
+    if (len == 1 && !is_name_char(name[0])) {
+        switch (name[0]) {
+        case '?': snprintf(num, sizeof(num), "%d", sh->last_status); break;
+        case '$': snprintf(num, sizeof(num), "%ld", (long)sh->pid); break;
+        case '#': snprintf(num, sizeof(num), "%zu", count_params(sh)); break;
+        default:  return NULL;
+        }
+        return arena_strndup(e->a, num, strlen(num));
+    }
+    if (isdigit((unsigned char)name[0])) {
+        size_t n = strtoul(name, NULL, 10);
+        if (n == 0) return sh->name;
+        return n <= count_params(sh) ? sh->params[n - 1] : NULL;
+    }
+    char *key = arena_strndup(e->a, name, len);
+    return sh->vars ? vars_get(sh->vars, key) : getenv(key);
+}
+
+/*
+ * put_params:
+ *  - Purpose: $@ and $*. Quoted "$@" makes each parameter a field of its
+ *    own, "$*" joins them with the first byte of $IFS. Unquoted, both
+ *    split every parameter.
+ */
+static void put_params(struct expander *e, char which, bool quoted) {
+    char **params = e->sh->params;
+    for (size_t i = 0; params && params[i]; i++) {
+        if (i && e->fields && (!quoted || which == '@')) {
+            e->have_field = quoted;
+            end_field(e);
+        } else if (i && *e->ifs) {
+            put_quoted(e, e->ifs, 1);
+        }
+        put_value(e, params[i], strlen(params[i]), quoted);
+    }
+}
+
+/*
+ * expand_string:
+ *  - Purpose: Expand text as a single word, into a string of its own.
+ */
+static char *expand_string(struct expander *e, const char *p, const char *end, bool quoted) {
+    struct expander sub = *e;
+    sub.buf = NULL;
+    sub.len = sub.cap = 0;
+    sub.fields = NULL;
+    sub.nfields = sub.fields_cap = 0;
+    expand_part(&sub, p, end, quoted);
+    reserve(&sub, 0);
+    sub.buf[sub.len] = '\0';
+    e->error |= sub.error;
+    return sub.buf;
+}
+
+/* The state of an arithmetic evaluation */
+struct arith
+{
+    struct expander *e;
+    const char *p;
+    const char *err;
+    int depth;
+};
+
+static int64_t arith_comma(struct arith *ar, bool eval);
+
+static void arith_space(struct arith *ar) {
+    while (isspace((unsigned char)*ar->p)) ar->p++;
+}
+
+static bool arith_accept(struct arith *ar, const char *tok) {
+    arith_space(ar);
+    size_t n = strlen(tok);
+    if (strncmp(ar->p, tok, n) != 0) return false;
+    ar->p += n;
+    return true;
+}
+
+static void arith_fail(struct arith *ar, const char *err) {
+    if (!ar->err) ar->err = err;
+}
+
+/*
+ * arith_eval:
+ *  - Purpose: Evaluate expr, the whole of it, as an arithmetic expression.
+ */
+static int64_t arith_eval(struct expander *e, const char *expr, int depth, const char **err) {
+    struct arith ar = {e, expr, NULL, depth};
+    int64_t v = arith_comma(&ar, true);
+    arith_space(&ar);
+    if (*ar.p) arith_fail(&ar, "syntax error");
+    *err = ar.err;
+    return v;
+}
+
+/*
+ * arith_variable:
+ *  - Purpose: The value of a variable in an expression. Unset and empty
+ *    variables are 0; values that are not plain numbers are evaluated as
+ *    expressions themselves.
+ */
+static int64_t arith_variable(struct arith *ar, const char *name, size_t len) {
+    const char *v = lookup(ar->e, name, len);
+    if (!v || !*v) return 0;
+    char *end;
+    long long n = strtoll(v, &end, 0);
+    if (!*end) return n;
+    if (ar->depth >= ARITH_DEPTH) {
+        arith_fail(ar, "expression recursion level exceeded");
+        return 0;
+    }
+    const char *err;
+    int64_t r = arith_eval(ar->e, v, ar->depth + 1, &err);
+    if (err) arith_fail(ar, err);
+    return r;
+}
+
+static void arith_set(struct arith *ar, const char *name, size_t len, int64_t v) {
+    char num[32];
+    snprintf(num, sizeof(num), "%lld", (long long)v);
+    if (ar->e->sh->vars) vars_set(ar->e->sh->vars, arena_strndup(ar->e->a, name, len), num, 0);
+}
+
+/*
+ * arith_step:
+ *  - Purpose: Add delta to a variable for ++ and --.
+ *  - Returns: The new value.
+ */
+static int64_t arith_step(struct arith *ar, const char *name, size_t len, int64_t delta, bool eval) {
+    if (!eval) return 0;
+    int64_t v = (int64_t)((uint64_t)arith_variable(ar, name, len) + (uint64_t)delta);
+    if (!ar->err) arith_set(ar, name, len, v);
+    return v;
+}
+
+static int64_t arith_primary(struct arith *ar, bool eval) {
+    arith_space(ar);
+    const char *p = ar->p;
+    if (*p == '(') {
+        ar->p++;
+        int64_t v = arith_comma(ar, eval);
+        if (!arith_accept(ar, ")")) arith_fail(ar, "missing )");
+        return v;
+    }
+    if (isdigit((unsigned char)*p)) {
+        char *end;
+        uint64_t v = strtoull(p, &end, 0);
+        if (is_name_char(*end)) arith_fail(ar, "invalid number");
+        ar->p = end;
+        return (int64_t)v;
+    }
+    if (is_name_start(*p)) {
+        while (is_name_char(*ar->p)) ar->p++;
+        size_t len = ar->p - p;
+        arith_space(ar);
+        if ((ar->p[0] == '+' || ar->p[0] == '-') && ar->p[1] == ar->p[0]) {
+            // name++ and name-- give the value from before
+            int64_t delta = ar->p[0] == '+' ? 1 : -1;
+            ar->p += 2;
+            return (int64_t)((uint64_t)arith_step(ar, p, len, delta, eval) - (uint64_t)delta);
+        }
+        return eval ? arith_variable(ar, p, len) : 0;
+    }
+    arith_fail(ar, *p ? "syntax error" : "operand expected");
+    return 0;
+}
+
+static int64_t arith_unary(struct arith *ar, bool eval) {
+    arith_space(ar);
+    char c = *ar->p;
+    if ((c == '+' || c == '-') && ar->p[1] == c) {
+        // ++name and --name; before anything else they are two signs
+        const char *name = ar->p + 2;
+        while (isspace((unsigned char)*name)) name++;
+        if (is_name_start(*name)) {
+            const char *end = name;
+            while (is_name_char(*end)) end++;
+            ar->p = end;
+            return arith_step(ar, name, end - name, c == '+' ? 1 : -1, eval);
+        }
+    }
+    if (c == '-' || c == '+' || c == '!' || c == '~') {
+        ar->p++;
+        int64_t v = arith_unary(ar, eval);
+        switch (c) {
+        case '-': return (int64_t)(0 - (uint64_t)v);
+        case '!': return !v;
+        case '~': return ~v;
+        default:  return v;
+        }
+    }
+    return arith_primary(ar, eval);
+}
+
+/* Binary operators, longest first where one is a prefix of another */
+static const struct binop
+{
+    const char *tok;
+    int prec;
+} binops[] = {
+    {"||", 1}, {"&&", 2}, {"==", 6}, {"!=", 6}, {"<<", 8}, {">>", 8}, {"<=", 7}, {">=", 7},
+    {"|", 3}, {"^", 4}, {"&", 5}, {"<", 7}, {">", 7}, {"+", 9}, {"-", 9}, {"*", 10},
+    {"/", 10}, {"%", 10},
+};
+
+/*
+ * apply:
+ *  - Purpose: One binary operation. Overflow wraps around instead of being
+ *    undefined, and shift counts are taken modulo 64.
+ */
+static int64_t apply(struct arith *ar, const char *op, int64_t a, int64_t b, bool eval) {
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch (op[0]) {
+    case '+': return (int64_t)(ua + ub);
+    case '-': return (int64_t)(ua - ub);
+    case '*': return (int64_t)(ua * ub);
+    case '/':
+    case '%':
+        if (b == 0) {
+            if (eval) arith_fail(ar, "division by 0");
+            return 0;
+        }
+        if (b == -1) return op[0] == '/' ? (int64_t)(0 - ua) : 0;
+        return op[0] == '/' ? a / b : a % b;
+    case '<':
+        if (op[1] == '<') return (int64_t)(ua << (b & 63));
+        return op[1] == '=' ? a <= b : a < b;
+    case '>':
+        if (op[1] == '>') return a >> (b & 63);
+        return op[1] == '=' ? a >= b : a > b;
+    case '=': return a == b;
+    case '!': return a != b;
+    case '&': return op[1] ? a && b : a & b;
+    case '|': return op[1] ? a || b : a | b;
+    default:  return a ^ b;
+    }
+}
+
+/*
+ * arith_binary:
+ *  - Purpose: Precedence climbing over the binary operators. The right side
+ *    of && and || is parsed without evaluating it when the left side
+ *    decides the result, so it has no side effects and cannot fail.
+ */
+static int64_t arith_binary(struct arith *ar, int min_prec, bool eval) {
+    int64_t lhs = arith_unary(ar, eval);
+    for (;;) {
+        arith_space(ar);
+        const struct binop *op = NULL;
+        for (size_t i = 0; i < sizeof(binops) / sizeof(binops[0]); i++) {
+            size_t n = strlen(binops[i].tok);
+            if (strncmp(ar->p, binops[i].tok, n) == 0) {
+                op = &binops[i];
+                // a += b is an assignment, not a + (= b)
+                if (ar->p[n] == '=' && op->prec != 6 && op->prec != 7) op = NULL;
+                break;
+            }
+        }
+        if (!op || op->prec < min_prec || ar->err) return lhs;
+        ar->p += strlen(op->tok);
+        bool rhs_eval = eval;
+        if (op->prec == 1) rhs_eval = eval && !lhs;
+        if (op->prec == 2) rhs_eval = eval && lhs;
+        int64_t rhs = arith_binary(ar, op->prec + 1, rhs_eval);
+        lhs = apply(ar, op->tok, lhs, rhs, eval);
+    }
+}
+
+static int64_t arith_ternary(struct arith *ar, bool eval) {
+    int64_t cond = arith_binary(ar, 1, eval);
+    if (!arith_accept(ar, "?")) return cond;
+    int64_t a = arith_comma(ar, eval && cond);
+    if (!arith_accept(ar, ":")) {
+        arith_fail(ar, "expected :");
+        return 0;
+    }
+    int64_t b = arith_ternary(ar, eval && !cond);
+    return cond ? a : b;
+}
+
+/*
+ * arith_assign:
+ *  - Purpose: name = expr and the compound forms such as name += expr, which
+ *    set shell variables, so counters need no external command.
+ */
+static int64_t arith_assign(struct arith *ar, bool eval) {
+    static const char *const ops[] = {"<<=", ">>=", "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=", "="};
+    arith_space(ar);
+    const char *start = ar->p;
+    if (is_name_start(*start)) {
+        const char *p = start;
+        while (is_name_char(*p)) p++;
+        size_t len = p - start;
+        while (isspace((unsigned char)*p)) p++;
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            size_t n = strlen(ops[i]);
+            if (strncmp(p, ops[i], n) != 0 || (n == 1 && p[1] == '=')) continue;
+            ar->p = p + n;
+            int64_t v = arith_assign(ar, eval);
+            if (!eval || ar->err) return v;
+            if (n > 1) {
+                char op[3] = {ops[i][0], n == 3 ? ops[i][1] : '\0', '\0'};
+                v = apply(ar, op, arith_variable(ar, start, len), v, eval);
+            }
+            arith_set(ar, start, len, v);
+            return v;
+        }
+    }
+    return arith_ternary(ar, eval);
+}
+
+/*
+ * arith_comma:
+ *  - Purpose: a, b evaluates both and gives b, the lowest precedence of all.
+ */
+static int64_t arith_comma(struct arith *ar, bool eval) {
+    int64_t v = arith_assign(ar, eval);
+    while (!ar->err && arith_accept(ar, ",")) v = arith_assign(ar, eval);
+    return v;
+}
+
+/*
+ * expand_arith:
+ *  - Purpose: $((expr)). Parameters in expr are expanded first, then it is
+ *    evaluated in the shell with 64 bit integers.
+ */
+static void expand_arith(struct expander *e, const char *p, const char *end, bool quoted) {
+    char *expr = expand_string(e, p, end, true);
+    const char *err;
+    int64_t v = arith_eval(e, expr, 0, &err);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", expr, err);
+        e->error = true;
+        return;
+    }
+    char num[32];
+    snprintf(num, sizeof(num), "%lld", (long long)v);
+    put_value(e, num, strlen(num), quoted);
+}
+
+/*
+ * expand_braced:
+ *  - Purpose: ${name}, ${#name} and the ${name op word} forms -, =, +, ?,
+ *    each also with a colon to treat an empty value as unset. The word is
+ *    only expanded when it is used.
+ */
+static void expand_braced(struct expander *e, const char *p, const char *end, bool quoted) {
+    bool length = false;
+    if (*p == '#' && p + 1 < end) {
+        length = true;
+        p++;
+    }
+    const char *name = p;
+    if (is_name_start(*p)) {
+        while (p < end && is_name_char(*p)) p++;
+    } else if (isdigit((unsigned char)*p)) {
+        while (p < end && isdigit((unsigned char)*p)) p++;
+    } else if (p < end && strchr("@*#?$0", *p)) {
+        p++;
+    }
+    size_t len = p - name;
+    bool colon = p < end && *p == ':';
+    char op = colon ? (p + 1 < end ? p[1] : '\0') : (p < end ? *p : '}');
+    if (!len || (op != '}' && (!op || !strchr("-=+?", op))) || (length && p != end)) {
+        fprintf(stderr, "${%.*s}: bad substitution\n", (int)(end - name), name);
+        e->error = true;
+        return;
+    }
+    const char *word = p + colon + (op != '}');
+    bool all = len == 1 && (*name == '@' || *name == '*');
+    size_t nparams = count_params(e->sh);
+    const char *v = all ? (nparams ? "" : NULL) : lookup(e, name, len);
+    if (length) {
+        char num[32];
+        snprintf(num, sizeof(num), "%zu", all ? nparams : v ? strlen(v) : 0);
+        put_value(e, num, strlen(num), quoted);
+        return;
+    }
+    bool set = v && (!colon || *v || (all && nparams));
+    if ((op == '-' && !set) || (op == '+' && set)) {
+        bool split = e->split_words;
+        e->split_words = true;
+        expand_part(e, word, end, quoted);
+        e->split_words = split;
+        return;
+    }
+    if (op == '+') return;
+    if (op == '=' && !set) {
+        if (!is_name_start(*name)) {
+            fprintf(stderr, "$%.*s: cannot assign in this way\n", (int)len, name);
+            e->error = true;
+            return;
+        }
+        char *value = expand_string(e, word, end, true);
+        vars_set(e->sh->vars, arena_strndup(e->a, name, len), value, 0);
+        put_value(e, value, strlen(value), quoted);
+        return;
+    }
+    if (op == '?' && !set) {
+        char *msg = expand_string(e, word, end, true);
+        fprintf(stderr, "%.*s: %s\n", (int)len, name, *msg ? msg : "parameter null or not set");
+        e->error = true;
+        return;
+    }
+    if (all) {
+        put_params(e, *name, quoted);
+    } else if (v) {
+        put_value(e, v, strlen(v), quoted);
+    }
+}
+
+/*
+ * expand_dollar:
+ *  - Purpose: Expand the $ construct at p.
+ *  - Returns: Where the text after it starts.
+ */
+static const char *expand_dollar(struct expander *e, const char *p, const char *end, bool quoted) {
+    const char *q = p + 1;
+    if (q < end && *q == '(') {
+        const char *close = find_close(q, end, '(', ')');
+        if (close && q + 1 < end && q[1] == '(' && close[-1] == ')') {
+            expand_arith(e, q + 2, close - 1, quoted);
+            return close + 1;
+        }
+        // Command substitution is not supported, the text is kept
+        const char *stop = close ? close + 1 : end;
+        put_quoted(e, p, stop - p);
+        return stop;
+    }
+    if (q < end && *q == '{') {
+        const char *close = find_close(q, end, '{', '}');
+        if (!close) {
+            fprintf(stderr, "%.*s: bad substitution\n", (int)(end - p), p);
+            e->error = true;
+            return end;
+        }
+        expand_braced(e, q + 1, close, quoted);
+        return close + 1;
+    }
+    if (q < end && is_name_start(*q)) {
+        while (q < end && is_name_char(*q)) q++;
+    } else if (q < end && (isdigit((unsigned char)*q) || strchr("?$#", *q))) {
+        q++;
+    } else if (q < end && (*q == '@' || *q == '*')) {
+        put_params(e, *q, quoted);
+        return q + 1;
+    } else {
+        put_char(e, '$');
+        return q;
+    }
+    const char *v = lookup(e, p + 1, q - p - 1);
+    if (v) put_value(e, v, strlen(v), quoted);
+    return q;
+}
+
+/*
+ * expand_tilde:
+ *  - Purpose: ~ and ~user at the start of a word, up to the first /. A
+ *    prefix with quotes in it is left alone.
+ *  - Returns: Where the rest of the word starts.
+ */
+static const char *expand_tilde(struct expander *e, const char *p, const char *end) {
+    const char *q = p + 1;
+    while (q < end && *q != '/' && *q != ':') {
+        if (strchr("'\"\\$`", *q)) return p;
+        q++;
+    }
+    const char *home = NULL;
+    if (q == p + 1) {
+        home = lookup(e, "HOME", 4);
+        if (!home) {
+            struct passwd *pw = getpwuid(getuid());
+            home = pw ? pw->pw_dir : NULL;
+        }
+    } else {
+        struct passwd *pw = getpwnam(arena_strndup(e->a, p + 1, q - p - 1));
+        home = pw ? pw->pw_dir : NULL;
+    }
+    if (!home) return p;
+    put_quoted(e, home, strlen(home));
+    e->have_field = true;
+    return q;
+}
+
+/*
+ * expand_part:
+ *  - Purpose: Expand raw text from p to end. quoted is set inside "...",
+ *    where only $ and a few backslash escapes are special.
+ */
+static void expand_part(struct expander *e, const char *p, const char *end, bool quoted) {
+    while (p < end && !e->error) {
+        size_t run = 0;
+        while (p + run < end && !strchr(quoted ? "\\$" : "\\$'\"", p[run])) run++;
+        if (run) {
+            if (e->split_words) {
+                put_value(e, p, run, quoted);
+            } else if (quoted) {
+                put_quoted(e, p, run);
+            } else {
+                put_pattern(e, p, run);
+            }
+            p += run;
+            continue;
+        }
+        if (*p == '\'') {
+            const char *q = memchr(p + 1, '\'', end - p - 1);
+            if (!q) q = end;
+            put_quoted(e, p + 1, q - p - 1);
+            e->have_field = true;
+            p = q < end ? q + 1 : end;
+        } else if (*p == '"') {
+            const char *q = find_dq_end(p + 1, end);
+            // "$@" with no parameters is no field at all
+            bool empty_at = q - p == 3 && p[1] == '$' && p[2] == '@' && !count_params(e->sh);
+            if (!empty_at) e->have_field = true;
+            expand_part(e, p + 1, q, true);
+            p = q < end ? q + 1 : end;
+        } else if (*p == '\\') {
+            if (p + 1 >= end) {
+                put_quoted(e, p, 1);
+                p++;
+            } else if (!quoted || strchr("$`\"\\", p[1])) {
+                put_quoted(e, p + 1, 1);
+                p += 2;
+            } else {
+                put_quoted(e, p, 1);
+                p++;
+            }
+        } else {
+            p = expand_dollar(e, p, end, quoted);
+        }
+    }
+}
+
+static void expander_init(struct expander *e, struct shell *sh, struct arena *a) {
+    memset(e, 0, sizeof(*e));
+    e->sh = sh;
+    e->a = a;
+    const char *ifs = lookup(e, "IFS", 3);
+    e->ifs = ifs ? ifs : DEFAULT_IFS;
+}
+
+/*
+ * expand_word:
+ *  - Purpose: Expand one word to exactly one string: parameters, arithmetic
+ *    and tilde, then quote removal, without field splitting.
+ *      * In an assignment, ~ is also expanded right after the =.
+ */
+char *expand_word(struct shell *sh, struct arena *a, const char *raw) {
+    struct expander e;
+    expander_init(&e, sh, a);
+    const char *p = raw, *end = raw + strlen(raw);
+    size_t name = assignment_name(raw);
+    if (name) {
+        put(&e, raw, name + 1);
+        p += name + 1;
+    }
+    if (*p == '~') p = expand_tilde(&e, p, end);
+    expand_part(&e, p, end, false);
+    if (e.error) return NULL;
+    reserve(&e, 0);
+    e.buf[e.len] = '\0';
+    return e.buf;
+}
+
+/*
+ * expand_words:
+ *  - Purpose: Expand the words of a command into fields, appended to one
+ *    growing array in the arena. The words of a brace expansion are
+ *    expanded as they are generated, never all held at once.
+ */
+char **expand_words(struct shell *sh, struct arena *a, char *const *words, size_t n) {
+    struct expander e;
+    expander_init(&e, sh, a);
+    e.fields_cap = n + 1;
+    e.fields = arena_alloc(a, e.fields_cap * sizeof(char *));
+    for (size_t i = 0; i < n && !e.error; i++) {
+        struct brace_iter it;
+        brace_begin(&it, words[i]);
+        for (const char *p; !e.error && (p = brace_next(&it));) {
+            const char *end = p + strlen(p);
+            e.ifs_space = false;
+            if (*p == '~') p = expand_tilde(&e, p, end);
+            expand_part(&e, p, end, false);
+            end_field(&e);
+        }
+        brace_end(&it);
+    }
+    if (e.error) return NULL;
+    e.fields[e.nfields] = NULL;
+    return e.fields;
+}
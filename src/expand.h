@@ -0,0 +1,103 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A word with a brace group being expanded, see brace_next */
+struct brace_frame
+{
+    char *text;         /* the word */
+    size_t len;
+    size_t open;        /* where its first group starts */
+    size_t close;       /* and ends */
+    size_t next;        /* where the next alternative of a list starts */
+    bool range;         /* {x..y[..step]} rather than a list */
+    bool letters;       /* a range of characters */
+    bool done;
+    int width;          /* numbers are zero padded to this width */
+    long long value;    /* the next value of a range */
+    long long to;
+    long long step;
+    char num[32];       /* the current value, formatted */
+};
+
+/**
+* @brief A generator for brace expansion: a{b,c}d and ranges such as
+* {1..10}, {01..10..3} and {a..e}, nested or side by side, in the same
+* order as bash. Words are produced one at a time from a stack of frames,
+* so {1..10000000} never needs more memory than one word.
+*/
+struct brace_iter
+{
+    struct brace_frame *frames;
+    size_t depth;
+    size_t cap;
+    const char *single; /* a word with no group, returned as it is */
+    char *out;          /* the word last returned */
+    size_t out_cap;
+};
+
+/**
+* @brief Start the brace expansion of a raw word. Quoted and escaped braces,
+* those of ${...} and groups with neither a comma nor a range are left as
+* they are.
+*
+* @param it The generator, released with brace_end
+* @param raw The raw word, which must outlive the generator
+*/
+
+void brace_begin(struct brace_iter *it, const char *raw);
+/**
+* @brief The next word of a brace expansion, still raw.
+*
+* @param it The generator
+* @return The word, valid until the next call, or NULL after the last one
+*/
+
+const char *brace_next(struct brace_iter *it);
+/**
+* @brief Free a generator.
+*
+* @param it The generator
+*/
+
+void brace_end(struct brace_iter *it);
+/**
+* @brief Expand a raw word from the lexer into exactly one string, as for
+* assignments and redirection targets: parameters, $((arithmetic)) and ~
+* are expanded, then quotes are removed. There is no field splitting.
+*
+* @param sh The shell, for its variables and parameters
+* @param a The arena the result is allocated from
+* @param raw The raw word
+* @return The expanded word, or NULL after printing an error
+*/
+
+char *expand_word(struct shell *sh, struct arena *a, const char *raw);
+/**
+* @brief Expand a list of raw words into an argv array suitable for exec.
+* Brace groups are expanded first, each generated word going straight on
+* to the other expansions. Unquoted expansion results are split into fields on $IFS, and "$@" gives
+* one field per positional parameter. Fields with unquoted * ? or [ are
+* replaced by the sorted paths they match, if any.
+*
+* @param sh The shell, for its variables and parameters
+* @param a The arena the result is allocated from
+* @param words The raw words
+* @param n Number of words
+* @return A NULL terminated array, or NULL after printing an error
+*/
+
+char **expand_words(struct shell *sh, struct arena *a, char *const *words, size_t n);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,554 @@
+#define _GNU_SOURCE  /* syscall */
+#include "glob.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+enum pattern_opcode {
+    PAT_CHAR,   /* one given byte */
+    PAT_ANY,    /* ? */
+    PAT_STAR,   /* * */
+    PAT_SET     /* [...] */
+};
+
+/* Below this many names a bucket is sorted by insertion */
+#define RADIX_CUTOFF 32
+
+/* The record getdents64 fills the buffer with */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        fprintf(stderr, "glob: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+bool glob_magic(const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) {
+            s++;
+        } else if (*s == '*' || *s == '?' || (*s == '[' && s[1] && strchr(s + 2, ']'))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void set_bit(uint64_t *set, unsigned char c) {
+    set[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static bool has_bit(const uint64_t *set, unsigned char c) {
+    return set[c >> 6] >> (c & 63) & 1;
+}
+
+/*
+ * parse_class:
+ *  - Purpose: Add a [:name:] character class to the set.
+ *  - Returns: false for an unknown class name.
+ */
+static bool parse_class(uint64_t *set, const char *name, size_t len) {
+    static const struct
+    {
+        const char *name;
+        int (*fn)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+        {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+        {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != len || strncmp(classes[i].name, name, len) != 0) continue;
+        for (int c = 0; c < 256; c++) {
+            if (classes[i].fn(c)) set_bit(set, c);
+        }
+        return true;
+    }
+    return false;
+}
+
+/*
+ * parse_set:
+ *  - Purpose: Compile the bracket expression at s into a bitmap.
+ *      * [!...] and [^...] negate, a ] right after the [ is literal.
+ *      * a-z ranges go by byte value.
+ *  - Returns: The length of the expression, 0 if it is not closed.
+ */
+static size_t parse_set(const char *s, size_t n, uint64_t *set) {
+    size_t i = 1;
+    bool negate = i < n && (s[i] == '!' || s[i] == '^');
+    if (negate) i++;
+    memset(set, 0, 4 * sizeof(uint64_t));
+    for (bool first = true; i < n && (s[i] != ']' || first); first = false) {
+        if (s[i] == '[' && i + 1 < n && s[i + 1] == ':') {
+            const char *end = strstr(s + i + 2, ":]");
+            if (end && (size_t)(end - s) < n && parse_class(set, s + i + 2, end - s - i - 2)) {
+                i = end - s + 2;
+                continue;
+            }
+        }
+        unsigned char lo = s[i];
+        if (lo == '\\' && i + 1 < n) lo = s[++i];
+        i++;
+        unsigned char hi = lo;
+        if (i + 1 < n && s[i] == '-' && s[i + 1] != ']') {
+            hi = s[i + 1];
+            if (hi == '\\' && i + 2 < n) hi = s[++i + 1];
+            i += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) set_bit(set, c);
+    }
+    if (i >= n) return 0;
+    if (negate) {
+        for (int k = 0; k < 4; k++) set[k] = ~set[k];
+    }
+    return i + 1;
+}
+
+/*
+ * pattern_compile:
+ *  - Purpose: Translate the pattern to instructions once.
+ *      * Runs of * collapse into one.
+ *      * min_len and the literal tail after the last * let most names be
+ *        rejected by their length and last bytes alone.
+ */
+void pattern_compile(struct pattern *p, const char *pat, size_t len) {
+    memset(p, 0, sizeof(*p));
+    p->code = xmalloc(len * sizeof(*p->code));
+    size_t nsets = 0;
+    for (size_t i = 0; i < len; i++) nsets += pat[i] == '[';
+    p->sets = xmalloc(nsets * sizeof(*p->sets));
+    bool star = false;
+    for (size_t i = 0; i < len;) {
+        struct pattern_op op = {PAT_CHAR, (unsigned char)pat[i], 0};
+        size_t used = 1;
+        if (pat[i] == '\\' && i + 1 < len) {
+            op.c = pat[i + 1];
+            used = 2;
+        } else if (pat[i] == '*') {
+            op.op = PAT_STAR;
+        } else if (pat[i] == '?') {
+            op.op = PAT_ANY;
+        } else if (pat[i] == '[' && (used = parse_set(pat + i, len - i, p->sets[p->nsets]))) {
+            op.op = PAT_SET;
+            op.set = p->nsets++;
+        } else {
+            used = 1;
+        }
+        i += used;
+        if (op.op == PAT_STAR) {
+            star = true;
+            p->tail = 0;
+            if (p->n && p->code[p->n - 1].op == PAT_STAR) continue;
+        } else {
+            p->min_len++;
+            p->tail = op.op == PAT_CHAR && star && (p->tail || p->code[p->n - 1].op == PAT_STAR) ? p->tail + 1 : 0;
+        }
+        if (op.op != PAT_CHAR) p->magic = true;
+        p->code[p->n++] = op;
+    }
+    p->leading_dot = p->n && p->code[0].op == PAT_CHAR && p->code[0].c == '.';
+}
+
+void pattern_free(struct pattern *p) {
+    free(p->code);
+    free(p->sets);
+    memset(p, 0, sizeof(*p));
+}
+
+/*
+ * pattern_match:
+ *  - Purpose: Run the instructions over the name.
+ *      * Only * matches a variable length, so on a mismatch it is enough to
+ *        go back to the last * and let it take one more byte. When a
+ *        literal byte follows the *, memchr jumps to its next occurrence.
+ */
+bool pattern_match(const struct pattern *p, const char *name, size_t len) {
+    if (len < p->min_len) return false;
+    if (name[0] == '.' && !p->leading_dot) return false;
+    size_t n = p->n;
+    for (size_t k = 0; k < p->tail; k++) {
+        if (p->code[n - p->tail + k].c != (unsigned char)name[len - p->tail + k]) return false;
+    }
+    n -= p->tail;
+    len -= p->tail;
+    size_t pc = 0, i = 0, star = SIZE_MAX, star_i = 0;
+    while (i < len) {
+        if (pc < n) {
+            const struct pattern_op *op = &p->code[pc];
+            if (op->op == PAT_STAR) {
+                star = ++pc;
+                star_i = i;
+                continue;
+            }
+            if (op->op == PAT_ANY || (op->op == PAT_CHAR && op->c == (unsigned char)name[i]) ||
+                (op->op == PAT_SET && has_bit(p->sets[op->set], name[i]))) {
+                pc++;
+                i++;
+                continue;
+            }
+        }
+        if (star == SIZE_MAX) return false;
+        pc = star;
+        i = ++star_i;
+        if (pc < n && p->code[pc].op == PAT_CHAR) {
+            const char *q = memchr(name + i, p->code[pc].c, len - i);
+            if (!q) return false;
+            i = star_i = q - name;
+        }
+    }
+    while (pc < n && p->code[pc].op == PAT_STAR) pc++;
+    return pc == n;
+}
+
+/* One component of a path pattern */
+struct component
+{
+    struct pattern pat;
+    char *literal;      /* the name, when the component has no pattern */
+    size_t len;
+    bool globstar;      /* the component is ** */
+};
+
+/* A directory still to be read, and the component its names must match */
+struct task
+{
+    char *path;
+    size_t comp;
+};
+
+/* The state shared by the threads of one path_glob */
+struct walk
+{
+    struct component *comps;
+    size_t ncomps;
+    bool dir_only;      /* the pattern ended with / */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct task *tasks;
+    size_t ntasks;
+    size_t tasks_cap;
+    size_t active;      /* threads running a task */
+};
+
+/* One thread of a walk. Names and results are its own, so no locking */
+struct walker
+{
+    struct walk *w;
+    struct arena names;
+    char **found;
+    size_t count;
+    size_t cap;
+    char *buf;          /* GLOB_DIRBUF bytes for getdents64 */
+};
+
+static char *join(struct walker *k, const char *dir, const char *name, size_t len, bool slash) {
+    size_t dlen = strlen(dir);
+    bool sep = dlen && dir[dlen - 1] != '/';
+    char *path = arena_alloc(&k->names, dlen + sep + len + slash + 1);
+    memcpy(path, dir, dlen);
+    if (sep) path[dlen] = '/';
+    memcpy(path + dlen + sep, name, len);
+    if (slash) path[dlen + sep + len] = '/';
+    path[dlen + sep + len + slash] = '\0';
+    return path;
+}
+
+static void found(struct walker *k, char *path) {
+    if (k->count == k->cap) {
+        k->cap = k->cap ? k->cap * 2 : 64;
+        k->found = realloc(k->found, k->cap * sizeof(*k->found));
+        if (!k->found) {
+            fprintf(stderr, "glob: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    k->found[k->count++] = path;
+}
+
+static void push_task(struct walk *w, char *path, size_t comp) {
+    pthread_mutex_lock(&w->lock);
+    if (w->ntasks == w->tasks_cap) {
+        w->tasks_cap = w->tasks_cap ? w->tasks_cap * 2 : 64;
+        w->tasks = realloc(w->tasks, w->tasks_cap * sizeof(*w->tasks));
+        if (!w->tasks) {
+            fprintf(stderr, "glob: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    w->tasks[w->ntasks].path = path;
+    w->tasks[w->ntasks].comp = comp;
+    w->ntasks++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * is_dir:
+ *  - Purpose: Tell from the entry type whether a name is a directory, with
+ *    a stat() only when the file system does not say or for a symbolic
+ *    link that is to be followed. ** does not follow links, so it cannot
+ *    loop.
+ */
+static bool is_dir(int dfd, const char *name, unsigned char type, bool follow) {
+    if (type == DT_DIR) return true;
+    if (type != DT_UNKNOWN && !(follow && type == DT_LNK)) return false;
+    struct stat st;
+    return fstatat(dfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * read_dir:
+ *  - Purpose: Match the names of one directory against component i.
+ *      * Names that match the last component are results, directories that
+ *        match an earlier one become tasks.
+ *      * ** takes every directory not starting with . as a task for itself,
+ *        and the directory as a task for the next component.
+ */
+static void read_dir(struct walker *k, const char *path, size_t i) {
+    struct walk *w = k->w;
+    const struct component *c = &w->comps[i];
+    bool last = i + 1 == w->ncomps;
+    int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    if (!k->buf) k->buf = xmalloc(GLOB_DIRBUF);
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, k->buf, GLOB_DIRBUF)) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(k->buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+            size_t len = strlen(name);
+            if (c->globstar) {
+                if (name[0] == '.') continue;
+                bool dir = is_dir(fd, name, d->d_type, false);
+                if (last && (dir || !w->dir_only)) found(k, join(k, path, name, len, w->dir_only));
+                if (dir) push_task(w, join(k, path, name, len, false), i);
+            } else if (pattern_match(&c->pat, name, len)) {
+                if (last && !w->dir_only) {
+                    found(k, join(k, path, name, len, false));
+                } else if (is_dir(fd, name, d->d_type, true)) {
+                    if (last) {
+                        found(k, join(k, path, name, len, true));
+                    } else {
+                        push_task(w, join(k, path, name, len, false), i + 1);
+                    }
+                }
+            }
+        }
+    }
+    close(fd);
+    if (c->globstar && !last) push_task(w, (char *)path, i + 1);
+}
+
+/*
+ * run_task:
+ *  - Purpose: Follow the literal components after path without reading
+ *    any directory, then read the one the next pattern applies to. A path
+ *    that ends in literal components is checked with one stat().
+ */
+static void run_task(struct walker *k, char *path, size_t i) {
+    struct walk *w = k->w;
+    for (; i < w->ncomps && !w->comps[i].pat.magic && !w->comps[i].globstar; i++) {
+        path = join(k, path, w->comps[i].literal, w->comps[i].len, false);
+    }
+    if (i < w->ncomps) {
+        read_dir(k, path, i);
+        return;
+    }
+    struct stat st;
+    if (w->dir_only ? stat(path, &st) == 0 && S_ISDIR(st.st_mode) : lstat(path, &st) == 0) {
+        found(k, w->dir_only ? join(k, path, "", 0, true) : path);
+    }
+}
+
+/*
+ * walk_worker:
+ *  - Purpose: Take tasks until there are none and no thread is running
+ *    one that could add more. Tasks are taken last in, first out, which
+ *    walks depth first and keeps the list short.
+ */
+static void *walk_worker(void *arg) {
+    struct walker *k = arg;
+    struct walk *w = k->w;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->ntasks && w->active) pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->ntasks) break;
+        struct task t = w->tasks[--w->ntasks];
+        w->active++;
+        pthread_mutex_unlock(&w->lock);
+        run_task(k, t.path, t.comp);
+        pthread_mutex_lock(&w->lock);
+        if (--w->active == 0 && !w->ntasks) pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/*
+ * split_pattern:
+ *  - Purpose: Compile the components between the slashes. Empty components
+ *    from repeated slashes are dropped.
+ */
+static void split_pattern(struct walk *w, const char *pattern) {
+    size_t n = 1;
+    for (const char *p = pattern; *p; p++) n += *p == '/';
+    w->comps = xmalloc(n * sizeof(*w->comps));
+    for (const char *p = pattern; *p;) {
+        const char *e = strchr(p, '/');
+        size_t len = e ? (size_t)(e - p) : strlen(p);
+        if (len) {
+            struct component *c = &w->comps[w->ncomps++];
+            memset(c, 0, sizeof(*c));
+            c->globstar = len == 2 && p[0] == '*' && p[1] == '*';
+            pattern_compile(&c->pat, p, len);
+            if (!c->pat.magic) {
+                // The literal name is the pattern without its escapes
+                c->literal = xmalloc(len + 1);
+                for (size_t j = 0; j < c->pat.n; j++) c->literal[c->len++] = c->pat.code[j].c;
+                c->literal[c->len] = '\0';
+            }
+        }
+        if (!e) break;
+        p = e + 1;
+    }
+    size_t len = strlen(pattern);
+    w->dir_only = len > 1 && pattern[len - 1] == '/';
+}
+
+size_t path_glob(const char *pattern, int nthreads, struct glob_result *r) {
+    struct walk w;
+    memset(&w, 0, sizeof(w));
+    memset(r, 0, sizeof(*r));
+    split_pattern(&w, pattern);
+    bool globstar = false;
+    for (size_t i = 0; i < w.ncomps; i++) globstar |= w.comps[i].globstar;
+    if (nthreads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (nthreads > GLOB_MAX_THREADS) nthreads = GLOB_MAX_THREADS;
+    if (!globstar) nthreads = 1;  // one directory at a time, nothing to share
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    struct walker *walkers = xmalloc(nthreads * sizeof(*walkers));
+    for (int i = 0; i < nthreads; i++) {
+        memset(&walkers[i], 0, sizeof(walkers[i]));
+        walkers[i].w = &w;
+        arena_init(&walkers[i].names, 0);
+    }
+    if (w.ncomps) push_task(&w, pattern[0] == '/' ? "/" : "", 0);
+    pthread_t *threads = xmalloc(nthreads * sizeof(*threads));
+    int started = 0;
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, walk_worker, &walkers[i]) != 0) break;
+        started++;
+    }
+    walk_worker(&walkers[0]);  // The caller is a member of the pool
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    // Merge what every thread found; the arenas move to the result
+    for (int i = 0; i < nthreads; i++) r->count += walkers[i].count;
+    r->cap = r->count + 1;
+    r->paths = xmalloc(r->cap * sizeof(*r->paths));
+    r->arenas = xmalloc(nthreads * sizeof(*r->arenas));
+    size_t n = 0;
+    for (int i = 0; i < nthreads; i++) {
+        if (walkers[i].count) memcpy(r->paths + n, walkers[i].found, walkers[i].count * sizeof(char *));
+        n += walkers[i].count;
+        r->arenas[r->narenas++] = walkers[i].names;
+        free(walkers[i].found);
+        free(walkers[i].buf);
+    }
+    r->paths[n] = NULL;
+    free(walkers);
+    sort_names(r->paths, r->count);
+    for (size_t i = 0; i < w.ncomps; i++) {
+        pattern_free(&w.comps[i].pat);
+        free(w.comps[i].literal);
+    }
+    free(w.comps);
+    free(w.tasks);
+    pthread_mutex_destroy(&w.lock);
+    pthread_cond_destroy(&w.cond);
+    return r->count;
+}
+
+void glob_result_free(struct glob_result *r) {
+    for (size_t i = 0; i < r->narenas; i++) arena_destroy(&r->arenas[i]);
+    free(r->arenas);
+    free(r->paths);
+    memset(r, 0, sizeof(*r));
+}
+
+static void insertion_sort(char **a, size_t n, size_t depth) {
+    for (size_t i = 1; i < n; i++) {
+        char *t = a[i];
+        size_t j = i;
+        for (; j > 0 && strcmp(a[j - 1] + depth, t + depth) > 0; j--) a[j] = a[j - 1];
+        a[j] = t;
+    }
+}
+
+/*
+ * radix_sort:
+ *  - Purpose: Distribute the strings into 256 buckets by the byte at depth,
+ *    then sort each bucket by the next byte. Strings that end at depth are
+ *    equal and need no more work.
+ *      * When every string has the same byte there, the depth just moves on
+ *        without distributing, so long shared prefixes such as a directory
+ *        name cost one pass each and no stack.
+ */
+static void radix_sort(char **a, char **aux, size_t n, size_t depth) {
+    size_t count[256];
+    for (;;) {
+        if (n < RADIX_CUTOFF) {
+            insertion_sort(a, n, depth);
+            return;
+        }
+        memset(count, 0, sizeof(count));
+        for (size_t i = 0; i < n; i++) count[(unsigned char)a[i][depth]]++;
+        unsigned char b = a[0][depth];
+        if (count[b] != n) break;
+        if (b == 0) return;
+        depth++;
+    }
+    size_t pos[256];
+    size_t sum = 0;
+    for (int b = 0; b < 256; b++) {
+        pos[b] = sum;
+        sum += count[b];
+    }
+    for (size_t i = 0; i < n; i++) aux[pos[(unsigned char)a[i][depth]]++] = a[i];
+    memcpy(a, aux, n * sizeof(*a));
+    size_t off = count[0];
+    for (int b = 1; b < 256; b++) {
+        if (count[b] > 1) radix_sort(a + off, aux, count[b], depth + 1);
+        off += count[b];
+    }
+}
+
+void sort_names(char **names, size_t n) {
+    if (n < 2) return;
+    char **aux = xmalloc(n * sizeof(*aux));
+    radix_sort(names, aux, n, 0);
+    free(aux);
+}
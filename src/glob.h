@@ -0,0 +1,126 @@
+#ifndef GLOB_H
+#define GLOB_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Size of the buffer each walker reads directory entries into */
+#define GLOB_DIRBUF (256 * 1024)
+
+/* Most threads walking a ** pattern */
+#define GLOB_MAX_THREADS 8
+
+/* An instruction of a compiled pattern */
+struct pattern_op
+{
+    unsigned char op;   /* PAT_CHAR, PAT_ANY, PAT_STAR or PAT_SET */
+    unsigned char c;    /* the byte of PAT_CHAR */
+    uint16_t set;       /* the bitmap of PAT_SET */
+};
+
+/**
+* @brief A pattern for one path component, compiled once to a list of
+* instructions and matched against every name without looking at the
+* pattern text again. Bracket expressions become 256 bit bitmaps, so a
+* byte is tested in O(1) whatever the expression.
+*/
+struct pattern
+{
+    struct pattern_op *code;
+    size_t n;
+    uint64_t (*sets)[4];
+    size_t nsets;
+    size_t min_len;     /* names shorter than this cannot match */
+    size_t tail;        /* number of PAT_CHAR at the end, after the last * */
+    bool leading_dot;   /* the pattern starts with a literal . */
+    bool magic;         /* it has * ? or [ at all */
+};
+
+/**
+* @brief The paths matched by path_glob. The strings live in arenas owned
+* by the result.
+*/
+struct glob_result
+{
+    char **paths;
+    size_t count;
+    size_t cap;
+    struct arena *arenas;
+    size_t narenas;
+};
+
+/**
+* @brief Tell whether a word has unescaped * ? or [ in it.
+*
+* @param s The word
+* @return True if it is a pattern
+*/
+
+bool glob_magic(const char *s);
+/**
+* @brief Compile one path component. A backslash makes the next byte
+* literal, and a [ without its ] is literal too.
+*
+* @param p The compiled pattern, released with pattern_free
+* @param pat The pattern
+* @param len Its length
+*/
+
+void pattern_compile(struct pattern *p, const char *pat, size_t len);
+/**
+* @brief Match a name against a compiled pattern. A leading . is only
+* matched by a pattern that starts with one.
+*
+* @param p The pattern
+* @param name The name
+* @param len Its length
+* @return True if the whole name matches
+*/
+
+bool pattern_match(const struct pattern *p, const char *name, size_t len);
+/**
+* @brief Free a compiled pattern.
+*
+* @param p The pattern
+*/
+
+void pattern_free(struct pattern *p);
+/**
+* @brief Expand a pathname pattern such as src/[ab]*.c. A component that
+* is exactly ** matches any number of directories; those are walked by a
+* pool of threads. Each directory is read with getdents64 into a large
+* buffer, and the paths are sorted by a radix sort at the end.
+*
+* @param pattern The pattern, with backslash escapes
+* @param nthreads Threads for ** patterns, 0 or less for one per CPU
+* @param r The result, released with glob_result_free
+* @return The number of paths matched
+*/
+
+size_t path_glob(const char *pattern, int nthreads, struct glob_result *r);
+/**
+* @brief Free the paths of a result.
+*
+* @param r The result
+*/
+
+void glob_result_free(struct glob_result *r);
+/**
+* @brief Sort strings in byte order with an MSD radix sort.
+*
+* @param names The strings
+* @param n Their number
+*/
+
+void sort_names(char **names, size_t n);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,541 @@
+#define _GNU_SOURCE  /* mremap, asprintf, memmem */
+#include "history.h"
+#include "outbuf.h"
+#include "vars.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define MAP_MIN (1 << 20)
+
+/*
+ * hash_line:
+ *  - Purpose: 64 bit FNV-1a hash of a command, never 0 so 0 can mark an
+ *    empty slot. Folded to 32 bits it is also the record checksum, so
+ *    checking a record and deduplicating it take one pass.
+ */
+static uint64_t hash_line(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static uint32_t checksum(uint64_t hash) {
+    return (uint32_t)(hash ^ hash >> 32);
+}
+
+struct history *history_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct history *h = calloc(1, sizeof(*h));
+    if (!h) {
+        fprintf(stderr, "history: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    h->fd = fd;
+    // Should two shells create the file at once, both magic lines land and
+    // the second one is skipped like any other line that is not a record
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0 &&
+        write(fd, HISTORY_MAGIC, sizeof(HISTORY_MAGIC) - 1) < 0) {
+        perror(path);
+    }
+    return h;
+}
+
+void history_close(struct history *h) {
+    if (!h) return;
+    if (h->map) munmap((void *)h->map, h->map_cap);
+    close(h->fd);
+    free(h->records);
+    free(h->slots);
+    free(h->meta);
+    for (size_t i = 0; i < h->gram_cap; i++) free(h->grams[i].ids);
+    free(h->grams);
+    free(h);
+}
+
+/*
+ * map_file:
+ *  - Purpose: Make sure the first size bytes of the file are mapped.
+ *      * The mapping is made at least twice as large as the file, so the
+ *        file can grow for a while before it has to be mapped again. Pages
+ *        past the end of the file are never touched.
+ *      * mremap() moves the mapping without unmapping it first.
+ *  - Returns: false if the file could not be mapped.
+ */
+static bool map_file(struct history *h, size_t size) {
+    if (size <= h->map_cap) return true;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t cap = size * 2 > MAP_MIN ? size * 2 : MAP_MIN;
+    cap = (cap + page - 1) & ~(page - 1);
+    void *map = h->map ? mremap((void *)h->map, h->map_cap, cap, MREMAP_MAYMOVE)
+                       : mmap(NULL, cap, PROT_READ, MAP_SHARED, h->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("history: mmap");
+        return false;
+    }
+    h->map = map;
+    h->map_cap = cap;
+    return true;
+}
+
+/*
+ * find_slot:
+ *  - Purpose: Linear probe for a command. Returns its slot or the empty
+ *    slot where it would go.
+ */
+static struct history_slot *find_slot(const struct history *h, const char *line, size_t len,
+                                      uint64_t hash) {
+    size_t mask = h->slot_cap - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct history_slot *s = &h->slots[i];
+        if (!s->hash) return s;
+        if (s->hash == hash) {
+            size_t elen;
+            const char *e = history_entry((struct history *)h, s->entry, &elen);
+            if (elen == len && memcmp(e, line, len) == 0) return s;
+        }
+    }
+}
+
+static void grow_slots(struct history *h) {
+    struct history_slot *old = h->slots;
+    size_t oldcap = h->slot_cap;
+    h->slot_cap = oldcap ? oldcap * 2 : 1024;
+    h->slots = calloc(h->slot_cap, sizeof(*h->slots));
+    if (!h->slots) {
+        fprintf(stderr, "history: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t mask = h->slot_cap - 1;
+    for (size_t i = 0; i < oldcap; i++) {
+        if (!old[i].hash) continue;
+        size_t k = old[i].hash & mask;
+        while (h->slots[k].hash) k = (k + 1) & mask;
+        h->slots[k] = old[i];
+    }
+    free(old);
+}
+
+/*
+ * find_gram:
+ *  - Purpose: Linear probe for a trigram. Returns its list or the empty
+ *    slot where it would go.
+ */
+static struct trigram *find_gram(const struct history *h, uint32_t key) {
+    size_t mask = h->gram_cap - 1;
+    // Fibonacci hashing spreads the packed bytes over the table
+    for (size_t i = (key * 2654435769u) & mask;; i = (i + 1) & mask) {
+        if (h->grams[i].key == key || !h->grams[i].key) return &h->grams[i];
+    }
+}
+
+static void grow_grams(struct history *h) {
+    struct trigram *old = h->grams;
+    size_t oldcap = h->gram_cap;
+    h->gram_cap = oldcap ? oldcap * 2 : 4096;
+    h->grams = calloc(h->gram_cap, sizeof(*h->grams));
+    if (!h->grams) {
+        fprintf(stderr, "history: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].key) *find_gram(h, old[i].key) = old[i];
+    }
+    free(old);
+}
+
+static uint32_t gram_key(const char *p) {
+    return (unsigned char)p[0] | (uint32_t)(unsigned char)p[1] << 8 |
+           (uint32_t)(unsigned char)p[2] << 16 | 1u << 24;
+}
+
+/*
+ * index_grams:
+ *  - Purpose: Add the next entry to the trigram index. Entries are indexed
+ *    in order, so every list stays sorted and a trigram that occurs twice
+ *    in one entry is noticed by looking at the last id only.
+ */
+static void index_grams(struct history *h) {
+    size_t len;
+    uint32_t id = h->grams_indexed++;
+    const char *e = history_entry(h, id, &len);
+    for (size_t i = 0; i + 3 <= len; i++) {
+        if ((h->gram_count + 1) * 2 > h->gram_cap) grow_grams(h);
+        uint32_t key = gram_key(e + i);
+        struct trigram *g = find_gram(h, key);
+        if (!g->key) {
+            g->key = key;
+            h->gram_count++;
+        }
+        if (g->count && g->ids[g->count - 1] == id) continue;
+        if (g->count == g->cap) {
+            g->cap = g->cap ? g->cap * 2 : 4;
+            g->ids = realloc(g->ids, g->cap * sizeof(*g->ids));
+            if (!g->ids) {
+                fprintf(stderr, "history: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        g->ids[g->count++] = id;
+    }
+}
+
+/*
+ * index_entry:
+ *  - Purpose: Record the entry at off. A command that is in the file more
+ *    than once (written before it was deduplicated, or by another shell)
+ *    keeps one slot, pointing at its newest copy, which also takes over its
+ *    use count.
+ */
+static void index_entry(struct history *h, size_t off, size_t len, uint64_t hash) {
+    if (h->count == h->record_cap) {
+        h->record_cap = h->record_cap ? h->record_cap * 2 : 1024;
+        h->records = realloc(h->records, h->record_cap * sizeof(*h->records));
+        h->meta = realloc(h->meta, h->record_cap * sizeof(*h->meta));
+        if (!h->records || !h->meta) {
+            fprintf(stderr, "history: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t id = h->count++;
+    h->records[id].off = off;
+    h->records[id].len = len;
+    if ((h->count + 1) * 2 > h->slot_cap) grow_slots(h);
+    const char *line = h->map + off;
+    struct history_slot *s = find_slot(h, line, len, hash);
+    h->meta[id].uses = 1;
+    h->meta[id].last = ++h->clock;
+    if (s->hash) {
+        h->meta[id].uses += h->meta[s->entry].uses;
+        h->meta[s->entry].uses = 0;
+    }
+    s->hash = hash;
+    s->entry = id;
+    if (h->grams) index_grams(h);
+}
+
+/*
+ * parse_hex:
+ *  - Purpose: Read n lower case hex digits.
+ *  - Returns: false if one of them is not a hex digit.
+ */
+static bool parse_hex(const char *p, int n, uint64_t *v) {
+    *v = 0;
+    for (int i = 0; i < n; i++) {
+        int c = p[i];
+        int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (d < 0) return false;
+        *v = *v << 4 | d;
+    }
+    return true;
+}
+
+/*
+ * find_hash:
+ *  - Purpose: The slot of the command with this hash, for use records,
+ *    which carry the hash only.
+ */
+static struct history_slot *find_hash(const struct history *h, uint64_t hash) {
+    size_t mask = h->slot_cap - 1;
+    for (size_t i = hash & mask; h->slot_cap && h->slots[i].hash; i = (i + 1) & mask) {
+        if (h->slots[i].hash == hash) return &h->slots[i];
+    }
+    return NULL;
+}
+
+/*
+ * parse_record:
+ *  - Purpose: Check one line of a framed file and index what it records:
+ *    a command, or one more use of a command recorded earlier.
+ *  - Returns: false if it is not a record, or its checksum does not match.
+ */
+static bool parse_record(struct history *h, const char *p, size_t len) {
+    uint64_t sum, used;
+    if (len < 9 || (p[8] != ' ' && p[8] != '+') || !parse_hex(p, 8, &sum)) return false;
+    uint64_t hash = hash_line(p + 9, len - 9);
+    if (checksum(hash) != sum) return false;
+    if (p[8] == '+') {
+        if (len != 9 + 16 || !parse_hex(p + 9, 16, &used)) return false;
+        struct history_slot *s = find_hash(h, used);
+        if (s) {
+            h->meta[s->entry].uses++;
+            h->meta[s->entry].last = ++h->clock;
+        }
+        return true;
+    }
+    index_entry(h, p + 9 - h->map, len - 9, hash);
+    return true;
+}
+
+/*
+ * history_sync:
+ *  - Purpose: Index the complete lines past the part of the file already
+ *    looked at. A line still being written by someone else waits for its
+ *    newline.
+ */
+void history_sync(struct history *h) {
+    struct stat st;
+    if (fstat(h->fd, &st) != 0 || (size_t)st.st_size <= h->done) return;
+    if (!map_file(h, st.st_size)) return;
+    if (h->done == 0) {
+        h->framed = st.st_size >= (off_t)sizeof(HISTORY_MAGIC) - 1 &&
+                    memcmp(h->map, HISTORY_MAGIC, sizeof(HISTORY_MAGIC) - 1) == 0;
+    }
+    const char *p = h->map + h->done, *end = h->map + st.st_size;
+    const char *nl;
+    while ((nl = memchr(p, '\n', end - p))) {
+        size_t len = nl - p;
+        if (!h->framed) {
+            index_entry(h, p - h->map, len, hash_line(p, len));
+        } else if (len + 1 == sizeof(HISTORY_MAGIC) - 1 && memcmp(p, HISTORY_MAGIC, len) == 0) {
+            // the header, or a second one from a shell that raced to create the file
+        } else if (!parse_record(h, p, len)) {
+            h->skipped++;
+        }
+        p = nl + 1;
+    }
+    h->done = p - h->map;
+}
+
+/*
+ * append:
+ *  - Purpose: One writev() with O_APPEND lands a whole record at the end of
+ *    the file, after whatever other shells appended.
+ */
+static bool append(struct history *h, struct iovec *iov, int n) {
+    ssize_t rval;
+    do {
+        rval = writev(h->fd, iov, n);
+    } while (rval < 0 && errno == EINTR);
+    if (rval < 0) {
+        perror("history");
+        return false;
+    }
+    history_sync(h);
+    return true;
+}
+
+/*
+ * history_add:
+ *  - Purpose: Append a new command. A command already in the history is
+ *    not written again; in a framed file a short use record counts the use
+ *    instead, so the ranking survives a restart. A plain file only counts
+ *    uses in memory.
+ */
+bool history_add(struct history *h, const char *line, size_t len) {
+    char head[32];
+    if (len == 0) return false;
+    history_sync(h);
+    uint64_t hash = hash_line(line, len);
+    if (h->slot_cap) {
+        struct history_slot *s = find_slot(h, line, len, hash);
+        if (s->hash) {
+            int n = snprintf(head, sizeof(head), "%016llx", (unsigned long long)hash);
+            char sum[16];
+            snprintf(sum, sizeof(sum), "%08x+", checksum(hash_line(head, n)));
+            struct iovec iov[3] = {{sum, 9}, {head, n}, {"\n", 1}};
+            if (!h->framed || !append(h, iov, 3)) {
+                h->meta[s->entry].uses++;
+                h->meta[s->entry].last = ++h->clock;
+            }
+            return false;
+        }
+    }
+    snprintf(head, sizeof(head), "%08x ", checksum(hash));
+    struct iovec iov[3] = {{head, 9}, {(void *)line, len}, {"\n", 1}};
+    int first = h->framed ? 0 : 1;
+    return append(h, iov + first, 3 - first);
+}
+
+size_t history_count(struct history *h) {
+    history_sync(h);
+    return h->count;
+}
+
+const char *history_entry(struct history *h, size_t i, size_t *len) {
+    *len = h->records[i].len;
+    return h->map + h->records[i].off;
+}
+
+/* A match and its rank */
+struct hit
+{
+    size_t entry;
+    double score;
+};
+
+static int by_score(const void *a, const void *b) {
+    const struct hit *x = a, *y = b;
+    if (x->score != y->score) return x->score < y->score ? 1 : -1;
+    return x->entry < y->entry ? 1 : -1;
+}
+
+/*
+ * add_hit:
+ *  - Purpose: Check that entry contains the pattern and rank it. The score
+ *    is the number of uses, decayed by how many uses of other commands
+ *    happened since this one was last used.
+ */
+static void add_hit(struct history *h, size_t entry, const char *pat, size_t len, struct hit **hits,
+                    size_t *n, size_t *cap) {
+    size_t elen;
+    const struct history_meta *m = &h->meta[entry];
+    if (!m->uses) return;
+    const char *e = history_entry(h, entry, &elen);
+    if (len && !memmem(e, elen, pat, len)) return;
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *hits = realloc(*hits, *cap * sizeof(**hits));
+        if (!*hits) {
+            fprintf(stderr, "history: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*hits)[*n].entry = entry;
+    (*hits)[*n].score = m->uses / (1.0 + (h->clock - m->last) / 256.0);
+    (*n)++;
+}
+
+/*
+ * history_find:
+ *  - Purpose: Substring search.
+ *      * The trigram lists of the pattern are intersected, walking the
+ *        shortest one and advancing a cursor through each of the others,
+ *        so only entries that have every trigram are compared.
+ *      * Patterns shorter than a trigram check every entry.
+ */
+size_t history_find(struct history *h, const char *pat, size_t len, size_t *out, size_t max) {
+    struct hit *hits = NULL;
+    size_t n = 0, cap = 0;
+    history_sync(h);
+    if (len < 3) {
+        for (size_t i = 0; i < h->count; i++) add_hit(h, i, pat, len, &hits, &n, &cap);
+    } else {
+        if (!h->grams) grow_grams(h);
+        while (h->grams_indexed < h->count) index_grams(h);
+        size_t ngrams = len - 2;
+        struct trigram **lists = malloc(ngrams * sizeof(*lists));
+        size_t *cursor = calloc(ngrams, sizeof(*cursor));
+        if (!lists || !cursor) {
+            fprintf(stderr, "history: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        size_t shortest = 0;
+        bool missing = false;
+        for (size_t i = 0; i < ngrams && !missing; i++) {
+            lists[i] = find_gram(h, gram_key(pat + i));
+            missing = !lists[i]->key;
+            if (!missing && lists[i]->count < lists[shortest]->count) shortest = i;
+        }
+        const struct trigram *base = missing ? NULL : lists[shortest];
+        for (size_t k = 0; base && k < base->count; k++) {
+            uint32_t id = base->ids[k];
+            bool all = true;
+            for (size_t i = 0; i < ngrams && all; i++) {
+                const struct trigram *g = lists[i];
+                while (cursor[i] < g->count && g->ids[cursor[i]] < id) cursor[i]++;
+                if (cursor[i] == g->count) base = NULL;
+                all = cursor[i] < g->count && g->ids[cursor[i]] == id;
+            }
+            if (all) add_hit(h, id, pat, len, &hits, &n, &cap);
+        }
+        free(lists);
+        free(cursor);
+    }
+    qsort(hits, n, sizeof(*hits), by_score);
+    if (n > max) n = max;
+    for (size_t i = 0; i < n; i++) out[i] = hits[i].entry;
+    free(hits);
+    return n;
+}
+
+/*
+ * print_matches:
+ *  - Purpose: history -s, every match numbered as in the full listing.
+ *  - Returns: 0 if something matched, 1 otherwise.
+ */
+static int print_matches(struct history *h, const char *pat) {
+    struct outbuf o;
+    size_t max = history_count(h);
+    size_t *hits = malloc((max ? max : 1) * sizeof(*hits));
+    if (!hits) {
+        fprintf(stderr, "history: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = history_find(h, pat, strlen(pat), hits, max);
+    out_init(&o, stdout);
+    for (size_t i = 0; i < n; i++) {
+        size_t len;
+        const char *e = history_entry(h, hits[i], &len);
+        out_fmt(&o, "%5zu  ", hits[i] + 1);
+        out_ref(&o, e, len + 1);
+    }
+    free(hits);
+    return out_finish(&o, "history", n ? 0 : 1);
+}
+
+/*
+ * history_builtin:
+ *  - Purpose: Print the history. Each entry goes out straight from the
+ *    mapping, with its newline, as one iovec; only the numbers are
+ *    formatted.
+ */
+int history_builtin(struct shell *sh, char **argv) {
+    struct history *h = sh->history;
+    size_t first = 0, n;
+    struct outbuf o;
+    if (!h) return 0;
+    if (argv[1] && strcmp(argv[1], "-s") == 0) {
+        if (!argv[2]) {
+            fprintf(stderr, "history: -s: option requires an argument\n");
+            return 2;
+        }
+        return print_matches(h, argv[2]);
+    }
+    n = history_count(h);
+    if (argv[1]) {
+        char *end;
+        long k = strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end || k < 0) {
+            fprintf(stderr, "history: %s: numeric argument required\n", argv[1]);
+            return 1;
+        }
+        if ((size_t)k < n) first = n - k;
+    }
+    out_init(&o, stdout);
+    for (size_t i = first; i < n; i++) {
+        size_t len;
+        const char *e = history_entry(h, i, &len);
+        out_fmt(&o, "%5zu  ", i + 1);
+        out_ref(&o, e, len + 1);
+    }
+    return out_finish(&o, "history", 0);
+}
+
+char *history_default_path(struct shell *sh) {
+    const char *file = vars_get(sh->vars, "HISTFILE");
+    if (file && *file) return strdup(file);
+    const char *home = vars_get(sh->vars, "HOME");
+    if (!home) {
+        struct passwd *pw = getpwuid(getuid());
+        if (!pw) return NULL;
+        home = pw->pw_dir;
+    }
+    char *path;
+    if (asprintf(&path, "%s/.lab_history", home) < 0) return NULL;
+    return path;
+}
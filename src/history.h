@@ -0,0 +1,185 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * The command history of interactive shells, kept in a file that is only
+ * ever appended to, one command per line. The file is memory mapped and
+ * nothing is read at startup: the first lookup indexes whatever is new in
+ * the mapping, later ones only the part other writes appended since.
+ *
+ * Any number of shells can share the file without locking it. A new file
+ * starts with HISTORY_MAGIC and each line is then a record:
+ *
+ *     <8 hex digits of checksum> <command>\n
+ *
+ * written with a single O_APPEND writev(). A command is only written once;
+ * using it again appends a use record instead,
+ *
+ *     <8 hex digits of checksum>+<16 hex digits of the command's hash>\n
+ *
+ * so the use counts that rank searches carry over to later sessions. A
+ * record that was torn or interleaved with another one, which a crash or a
+ * network filesystem can cause, fails its checksum and is skipped. Files
+ * without the magic line hold plain commands and stay that way; their use
+ * counts only last for the session.
+ */
+
+#define HISTORY_MAGIC "#lab history 2\n"
+
+/* How often and how recently a command was used, for ranking searches */
+struct history_meta
+{
+    uint32_t uses;      /* 0 for an entry superseded by a newer copy */
+    uint32_t last;      /* value of the history clock at the last use */
+};
+
+/* The entries containing one trigram, in increasing order */
+struct trigram
+{
+    uint32_t key;       /* the three bytes, with bit 24 set; 0 when empty */
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *ids;
+};
+
+/* Where an entry is in the mapping */
+struct history_record
+{
+    size_t off;
+    size_t len;         /* without the newline */
+};
+
+/* A command in the dedupe set */
+struct history_slot
+{
+    uint64_t hash;      /* 0 for an empty slot */
+    size_t entry;
+};
+
+/**
+* @brief An open history file.
+*/
+struct history
+{
+    int fd;             /* O_APPEND */
+    const char *map;
+    size_t map_cap;     /* bytes mapped, may run past the end of the file */
+    bool framed;        /* records carry checksums, see HISTORY_MAGIC */
+    size_t done;        /* bytes of the file looked at */
+    size_t skipped;     /* records that failed their checksum */
+    struct history_record *records;
+    size_t count;       /* entries indexed */
+    size_t record_cap;
+    struct history_slot *slots;
+    size_t slot_cap;    /* power of two */
+    struct history_meta *meta;  /* one per entry */
+    uint32_t clock;     /* counts uses */
+    struct trigram *grams;      /* built by the first search */
+    size_t gram_cap;    /* power of two */
+    size_t gram_count;
+    size_t grams_indexed;       /* entries in the trigram index */
+};
+
+/**
+* @brief Open or create a history file. A new file gets the magic line,
+* nothing else is read or mapped yet.
+*
+* @param path The file
+* @return The history, or NULL after printing an error
+*/
+
+struct history *history_open(const char *path);
+/**
+* @brief Unmap and close a history file.
+*
+* @param h The history, may be NULL
+*/
+
+void history_close(struct history *h);
+/**
+* @brief Index the entries appended since the last call, by this or any
+* other shell. Only the new tail of the file is looked at. Called by the
+* other functions, so callers only need it to see other writers.
+*
+* @param h The history
+*/
+
+void history_sync(struct history *h);
+/**
+* @brief Append a command unless it is already in the history, in which
+* case one more use of it is recorded.
+*
+* @param h The history
+* @param line The command, without a newline
+* @param len Its length
+* @return True if it was appended
+*/
+
+bool history_add(struct history *h, const char *line, size_t len);
+/**
+* @brief The number of entries.
+*
+* @param h The history
+* @return The number of entries
+*/
+
+size_t history_count(struct history *h);
+/**
+* @brief An entry, pointing into the mapping.
+*
+* @param h The history
+* @param i The entry, 0 is the oldest
+* @param len Set to its length, without the newline
+* @return The text, not NUL terminated, valid until the next call that
+* syncs
+*/
+
+const char *history_entry(struct history *h, size_t i, size_t *len);
+/**
+* @brief Find the entries that contain a substring, best first. Entries are
+* ranked by how often and how recently they were used. Patterns of three
+* bytes or more are looked up in a trigram index, which the first search
+* builds and every later addition keeps up to date.
+*
+* @param h The history
+* @param pat The substring
+* @param len Its length
+* @param hits Filled in with up to max entry numbers
+* @param max The size of hits
+* @return The number of entries stored in hits
+*/
+
+size_t history_find(struct history *h, const char *pat, size_t len, size_t *hits, size_t max);
+/**
+* @brief The history builtin: history [n] | history -s pattern. Prints the
+* last n entries, or all of them, numbered from 1. With -s it prints the
+* entries containing pattern, best match first.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return The exit status
+*/
+
+int history_builtin(struct shell *sh, char **argv);
+/**
+* @brief The history file to use: $HISTFILE, or ~/.lab_history.
+*
+* @param sh The shell, whose variables are read
+* @return A path the caller frees, or NULL if there is no home directory
+*/
+
+char *history_default_path(struct shell *sh);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,531 @@
+#define _GNU_SOURCE  /* strsignal */
+#include "jobs.h"
+#include "event.h"
+#include "exec.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "jobs: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void job_table_init(struct job_table *jt) {
+    memset(jt, 0, sizeof(*jt));
+}
+
+void job_table_destroy(struct job_table *jt) {
+    for (int id = 1; id <= jt->max_id; id++) {
+        job_free(jt->jobs[id]);
+    }
+    free(jt->jobs);
+    free(jt->slots);
+    job_table_init(jt);
+}
+
+struct job *job_create(size_t nprocs) {
+    struct job *j = calloc(1, sizeof(*j) + nprocs * sizeof(j->procs[0]));
+    if (!j) {
+        fprintf(stderr, "jobs: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    j->nprocs = nprocs;
+    j->state = JOB_DONE;
+    for (size_t i = 0; i < nprocs; i++) {
+        j->procs[i].status = W_EXITCODE(1, 0);
+        j->procs[i].done = true;
+    }
+    return j;
+}
+
+void job_free(struct job *j) {
+    if (!j) return;
+    free(j->cmd);
+    free(j);
+}
+
+void job_proc_start(struct job *j, size_t i, pid_t pid) {
+    j->procs[i].pid = pid;
+    j->procs[i].status = 0;
+    j->procs[i].done = false;
+    j->nlive++;
+    j->state = JOB_RUNNING;
+}
+
+void job_proc_failed(struct job *j, size_t i, int code) {
+    j->procs[i].status = W_EXITCODE(code, 0);
+}
+
+/*
+ * pid_hash:
+ *  - Purpose: Fibonacci hashing, pids are sequential so the low bits alone
+ *    would cluster.
+ */
+static size_t pid_hash(pid_t pid, size_t cap) {
+    return (size_t)(((uint64_t)(uint32_t)pid * 11400714819323198485ULL) >> 32) & (cap - 1);
+}
+
+static struct job_slot *find_slot(struct job_table *jt, pid_t pid) {
+    size_t mask = jt->slot_cap - 1;
+    for (size_t i = pid_hash(pid, jt->slot_cap);; i = (i + 1) & mask) {
+        if (jt->slots[i].pid == 0 || jt->slots[i].pid == pid) return &jt->slots[i];
+    }
+}
+
+/*
+ * index_pid:
+ *  - Purpose: Enter a process in the pid index, keeping the load at or below
+ *    one half. A stale entry for a recycled pid is simply replaced.
+ */
+static void index_pid(struct job_table *jt, pid_t pid, struct job *j, size_t index) {
+    if ((jt->slot_count + 1) * 2 > jt->slot_cap) {
+        struct job_slot *old = jt->slots;
+        size_t oldcap = jt->slot_cap;
+        jt->slot_cap = oldcap ? oldcap * 2 : 64;
+        jt->slots = calloc(jt->slot_cap, sizeof(*jt->slots));
+        if (!jt->slots) {
+            fprintf(stderr, "jobs: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < oldcap; i++) {
+            if (old[i].pid) *find_slot(jt, old[i].pid) = old[i];
+        }
+        free(old);
+    }
+    struct job_slot *s = find_slot(jt, pid);
+    if (!s->pid) jt->slot_count++;
+    s->pid = pid;
+    s->job = j;
+    s->index = index;
+}
+
+/*
+ * unindex_pid:
+ *  - Purpose: Backward shift deletion, the same scheme as the path cache.
+ *    The entry is only removed if it still belongs to job j.
+ */
+static void unindex_pid(struct job_table *jt, pid_t pid, struct job *j) {
+    if (!jt->slot_cap) return;
+    size_t mask = jt->slot_cap - 1;
+    struct job_slot *s = find_slot(jt, pid);
+    if (!s->pid || s->job != j) return;
+    size_t hole = s - jt->slots;
+    for (size_t i = (hole + 1) & mask; jt->slots[i].pid; i = (i + 1) & mask) {
+        size_t home = pid_hash(jt->slots[i].pid, jt->slot_cap);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            jt->slots[hole] = jt->slots[i];
+            hole = i;
+        }
+    }
+    jt->slots[hole].pid = 0;
+    jt->slots[hole].job = NULL;
+    jt->slot_count--;
+}
+
+/*
+ * pick_current:
+ *  - Purpose: Fill in %+ and %- after one of them went away, from the
+ *    highest ids down.
+ */
+static void pick_current(struct job_table *jt) {
+    if (!jt->current) {
+        jt->current = jt->previous;
+        jt->previous = 0;
+    }
+    for (int id = jt->max_id; id > 0 && (!jt->current || !jt->previous); id--) {
+        if (!jt->jobs[id] || id == jt->current) continue;
+        if (!jt->current) jt->current = id;
+        else jt->previous = id;
+    }
+}
+
+void job_insert(struct job_table *jt, struct job *j) {
+    int id = jt->max_id + 1;
+    if ((size_t)id >= jt->cap) {
+        size_t ncap = jt->cap ? jt->cap * 2 : 16;
+        jt->jobs = xrealloc(jt->jobs, ncap * sizeof(*jt->jobs));
+        memset(jt->jobs + jt->cap, 0, (ncap - jt->cap) * sizeof(*jt->jobs));
+        jt->cap = ncap;
+    }
+    j->id = id;
+    jt->jobs[id] = j;
+    jt->max_id = id;
+    jt->count++;
+    if (j->state == JOB_RUNNING) jt->running++;
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (j->procs[i].pid > 0) index_pid(jt, j->procs[i].pid, j, i);
+    }
+    if (!j->cmd) j->cmd = strdup("");
+    jt->previous = jt->current;
+    jt->current = id;
+}
+
+void job_remove(struct job_table *jt, struct job *j) {
+    int id = j->id;
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (j->procs[i].pid > 0) unindex_pid(jt, j->procs[i].pid, j);
+    }
+    if (j->state == JOB_RUNNING) jt->running--;
+    jt->jobs[id] = NULL;
+    jt->count--;
+    while (jt->max_id > 0 && !jt->jobs[jt->max_id]) jt->max_id--;
+    if (jt->current == id) jt->current = 0;
+    if (jt->previous == id) jt->previous = 0;
+    if (!jt->current || !jt->previous) pick_current(jt);
+    job_free(j);
+}
+
+struct job *job_by_id(struct job_table *jt, int id) {
+    return id > 0 && id <= jt->max_id ? jt->jobs[id] : NULL;
+}
+
+struct job *job_by_pid(struct job_table *jt, pid_t pid) {
+    if (!jt->slot_cap || pid <= 0) return NULL;
+    return find_slot(jt, pid)->job;
+}
+
+struct job *job_find(struct job_table *jt, const char *spec, bool pids) {
+    char *end;
+    if (spec[0] != '%') {
+        long n = strtol(spec, &end, 10);
+        if (*spec == '\0' || *end != '\0' || n <= 0) return NULL;
+        return pids ? job_by_pid(jt, (pid_t)n) : job_by_id(jt, (int)n);
+    }
+    spec++;
+    if (*spec == '\0' || strcmp(spec, "%") == 0 || strcmp(spec, "+") == 0) {
+        return job_by_id(jt, jt->current);
+    }
+    if (strcmp(spec, "-") == 0) return job_by_id(jt, jt->previous);
+    long n = strtol(spec, &end, 10);
+    if (*end == '\0' && end != spec) return job_by_id(jt, (int)n);
+    bool contains = *spec == '?';
+    if (contains) spec++;
+    size_t len = strlen(spec);
+    for (int id = jt->max_id; id > 0; id--) {
+        struct job *j = jt->jobs[id];
+        if (!j) continue;
+        if (contains ? strstr(j->cmd, spec) != NULL : strncmp(j->cmd, spec, len) == 0) return j;
+    }
+    return NULL;
+}
+
+/*
+ * set_status:
+ *  - Purpose: Record a status for process i and recompute the job state.
+ *    Jobs in the table keep their counters and report flag up to date.
+ */
+static void set_status(struct job_table *jt, struct job *j, size_t i, int status) {
+    struct job_proc *p = &j->procs[i];
+    enum job_state old = j->state;
+    if (p->done) return;
+    if (WIFSTOPPED(p->status)) j->nstopped--;
+    p->status = status;
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        p->done = true;
+        j->nlive--;
+    } else if (WIFSTOPPED(status)) {
+        j->nstopped++;
+    }
+    j->state = j->nlive == 0 ? JOB_DONE : j->nstopped ? JOB_STOPPED : JOB_RUNNING;
+    if (!jt || !j->id || j->state == old) return;
+    if (old == JOB_RUNNING) jt->running--;
+    if (j->state == JOB_RUNNING) jt->running++;
+    if (j->state == JOB_DONE) j->done_seq = ++jt->done_seq;
+    j->changed = jt->changed = true;
+}
+
+/*
+ * set_continued:
+ *  - Purpose: Mark every live process as running after SIGCONT was sent.
+ */
+static void set_continued(struct job_table *jt, struct job *j) {
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (!j->procs[i].done && WIFSTOPPED(j->procs[i].status)) {
+            set_status(jt, j, i, 0xffff);  // what waitpid reports for WCONTINUED
+        }
+    }
+    j->changed = false;
+}
+
+void job_update(struct job_table *jt, pid_t pid, int status) {
+    if (!jt->slot_cap) return;
+    struct job_slot *s = find_slot(jt, pid);
+    if (s->pid) set_status(jt, s->job, s->index, status);
+}
+
+/*
+ * on_child:
+ *  - Purpose: Event loop callback for the processes of background jobs.
+ */
+static void on_child(void *ctx, pid_t pid, int status) {
+    struct shell *sh = ctx;
+    job_update(sh->jobs, pid, status);
+}
+
+void job_watch(struct shell *sh, struct job *j) {
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (!j->procs[i].done) event_watch_child(sh->events, j->procs[i].pid, on_child, sh);
+    }
+}
+
+/*
+ * job_wait:
+ *  - Purpose: Wait for every live process in turn. A job in the table is
+ *    taken away from the event loop first so its processes are reaped here.
+ *    After ^C the terminal is left on the line the job was using, so a
+ *    newline is printed for the prompt.
+ */
+void job_wait(struct shell *sh, struct job *j) {
+    struct job_table *jt = j->id ? sh->jobs : NULL;
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (j->procs[i].done) continue;
+        if (jt) event_unwatch_child(sh->events, j->procs[i].pid);
+        int status;
+        if (event_wait_child(sh->events, j->procs[i].pid, &status) < 0) {
+            fprintf(stderr, "Wait pid failed with -1\n");
+            status = W_EXITCODE(1, 0);
+        }
+        set_status(jt, j, i, status);
+    }
+    int last = j->procs[j->nprocs - 1].status;
+    if (sh->job_control && WIFSIGNALED(last) && WTERMSIG(last) == SIGINT) fputc('\n', stderr);
+}
+
+int job_status(const struct job *j) {
+    if (!j->nprocs) return 0;
+    int status = j->procs[j->nprocs - 1].status;
+    if (j->state == JOB_STOPPED) {
+        // The last stage may have exited while an earlier one stopped
+        for (size_t i = 0; i < j->nprocs; i++) {
+            if (!j->procs[i].done && WIFSTOPPED(j->procs[i].status)) {
+                return 128 + WSTOPSIG(j->procs[i].status);
+            }
+        }
+    }
+    return exec_status(status);
+}
+
+/*
+ * state_text:
+ *  - Purpose: The state column of the jobs builtin.
+ */
+static const char *state_text(const struct job *j, char *buf, size_t len) {
+    if (j->state == JOB_RUNNING) return "Running";
+    if (j->state == JOB_STOPPED) return "Stopped";
+    int status = j->procs[j->nprocs - 1].status;
+    if (WIFSIGNALED(status)) return strsignal(WTERMSIG(status));
+    if (WEXITSTATUS(status) == 0) return "Done";
+    snprintf(buf, len, "Exit %d", WEXITSTATUS(status));
+    return buf;
+}
+
+void job_print(FILE *f, struct job_table *jt, const struct job *j, bool pid) {
+    char buf[32];
+    char mark = j->id == jt->current ? '+' : j->id == jt->previous ? '-' : ' ';
+    fprintf(f, "[%d]%c ", j->id, mark);
+    if (pid) fprintf(f, "%d ", (int)j->pgid);
+    fprintf(f, " %-24s%s%s\n", state_text(j, buf, sizeof(buf)), j->cmd,
+            j->state == JOB_RUNNING ? " &" : "");
+}
+
+bool job_pending(const struct job_table *jt) {
+    return jt->changed;
+}
+
+void job_notify(struct shell *sh) {
+    struct job_table *jt = sh->jobs;
+    if (!jt->changed) return;
+    jt->changed = false;
+    if (!sh->job_control) return;
+    for (int id = 1; id <= jt->max_id; id++) {
+        struct job *j = jt->jobs[id];
+        if (!j || !j->changed) continue;
+        j->changed = false;
+        job_print(stderr, jt, j, false);
+        if (j->state == JOB_DONE) job_remove(jt, j);
+    }
+}
+
+/*
+ * no_job:
+ *  - Purpose: The error for a spec that matches nothing.
+ */
+static int no_job(const char *cmd, const char *spec) {
+    fprintf(stderr, "%s: %s: no such job\n", cmd, spec ? spec : "current");
+    return 1;
+}
+
+/*
+ * jobs_builtin:
+ *  - Purpose: List jobs. Finished jobs are shown once and then forgotten.
+ */
+int jobs_builtin(struct shell *sh, char **argv) {
+    struct job_table *jt = sh->jobs;
+    bool lflag = false, pflag = false;
+    int i = 1, status = 0;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "-l") == 0) lflag = true;
+        else if (strcmp(argv[i], "-p") == 0) pflag = true;
+        else {
+            fprintf(stderr, "jobs: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    for (int id = 1; id <= jt->max_id; id++) {
+        struct job *j = jt->jobs[id];
+        if (!j) continue;
+        bool wanted = !argv[i];
+        for (int k = i; argv[k] && !wanted; k++) wanted = job_find(jt, argv[k], false) == j;
+        if (!wanted) continue;
+        if (pflag) printf("%d\n", (int)j->pgid);
+        else job_print(stdout, jt, j, lflag);
+        j->changed = false;
+    }
+    for (int k = i; argv[k]; k++) {
+        if (!job_find(jt, argv[k], false)) status = no_job("jobs", argv[k]);
+    }
+    for (int id = jt->max_id; id > 0; id--) {
+        struct job *j = jt->jobs[id];
+        if (j && j->state == JOB_DONE && !j->changed) job_remove(jt, j);
+    }
+    return status;
+}
+
+/*
+ * fg_builtin:
+ *  - Purpose: Hand the terminal to a job, continue it and wait for it. If it
+ *    stops again it goes back to the event loop.
+ */
+int fg_builtin(struct shell *sh, char **argv) {
+    struct job_table *jt = sh->jobs;
+    if (!sh->job_control) {
+        fprintf(stderr, "fg: no job control\n");
+        return 1;
+    }
+    struct job *j = argv[1] ? job_find(jt, argv[1], false) : job_by_id(jt, jt->current);
+    if (!j) return no_job("fg", argv[1]);
+    fflush(stdout);
+    printf("%s\n", j->cmd);
+    fflush(stdout);
+    jt->previous = jt->current != j->id ? jt->current : jt->previous;
+    jt->current = j->id;
+    tcsetpgrp(sh->shell_terminal, j->pgid);
+    if (kill(-j->pgid, SIGCONT) < 0 && errno != ESRCH) perror("fg");
+    set_continued(jt, j);
+    job_wait(sh, j);
+    tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+    int status = job_status(j);
+    if (j->state == JOB_STOPPED) {
+        fputc('\n', stderr);
+        job_print(stderr, jt, j, false);
+        j->changed = false;
+        job_watch(sh, j);
+    } else {
+        job_remove(jt, j);
+    }
+    return status;
+}
+
+/*
+ * bg_builtin:
+ *  - Purpose: Continue stopped jobs in the background.
+ */
+int bg_builtin(struct shell *sh, char **argv) {
+    struct job_table *jt = sh->jobs;
+    int status = 0;
+    if (!sh->job_control) {
+        fprintf(stderr, "bg: no job control\n");
+        return 1;
+    }
+    int i = 1;
+    do {
+        struct job *j = argv[i] ? job_find(jt, argv[i], false) : job_by_id(jt, jt->current);
+        if (!j) {
+            status = no_job("bg", argv[i]);
+            continue;
+        }
+        if (j->state != JOB_STOPPED) {
+            fprintf(stderr, "bg: job %d already in background\n", j->id);
+            continue;
+        }
+        if (kill(-j->pgid, SIGCONT) < 0 && errno != ESRCH) perror("bg");
+        set_continued(jt, j);
+        char mark = j->id == jt->current ? '+' : j->id == jt->previous ? '-' : ' ';
+        printf("[%d]%c %s &\n", j->id, mark, j->cmd);
+    } while (argv[i] && argv[++i]);
+    return status;
+}
+
+/*
+ * collect:
+ *  - Purpose: Take the status of a job that wait is done with. A finished
+ *    job leaves the table, it has been accounted for.
+ */
+static int collect(struct job_table *jt, struct job *j) {
+    int status = job_status(j);
+    if (j->state == JOB_DONE) job_remove(jt, j);
+    return status;
+}
+
+/*
+ * wait_builtin:
+ *  - Purpose: Run the event loop until the requested jobs finish.
+ *      * wait: every running job, the status is 0.
+ *      * wait -n: the next job to finish, jobs that finished earlier and
+ *        were not collected come first, oldest first.
+ *      * wait spec...: each job in turn, the status is that of the last.
+ *      * SIGINT ends the wait with status 130.
+ */
+int wait_builtin(struct shell *sh, char **argv) {
+    struct job_table *jt = sh->jobs;
+    struct event_loop *ev = sh->events;
+    int status = 0;
+    ev->interrupted = false;
+    if (!argv[1]) {
+        while (jt->running > 0 && !ev->interrupted) {
+            event_run_once(ev, -1);
+        }
+        if (ev->interrupted) return 130;
+        for (int id = jt->max_id; id > 0; id--) {
+            struct job *j = jt->jobs[id];
+            if (j && j->state == JOB_DONE) job_remove(jt, j);
+        }
+        return 0;
+    }
+    if (strcmp(argv[1], "-n") == 0) {
+        for (;;) {
+            struct job *first = NULL;
+            for (int id = 1; id <= jt->max_id; id++) {
+                struct job *j = jt->jobs[id];
+                if (j && j->state == JOB_DONE && (!first || j->done_seq < first->done_seq)) first = j;
+            }
+            if (first) return collect(jt, first);
+            if (jt->running == 0) return 127;
+            event_run_once(ev, -1);
+            if (ev->interrupted) return 130;
+        }
+    }
+    for (int i = 1; argv[i]; i++) {
+        struct job *j = job_find(jt, argv[i], true);
+        if (!j) {
+            if (argv[i][0] == '%') fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+            else fprintf(stderr, "wait: pid %s is not a child of this shell\n", argv[i]);
+            status = 127;
+            continue;
+        }
+        while (j->state == JOB_RUNNING && !ev->interrupted) {
+            event_run_once(ev, -1);
+        }
+        if (ev->interrupted) return 130;
+        status = collect(jt, j);
+    }
+    return status;
+}
@@ -0,0 +1,277 @@
+#ifndef JOBS_H
+#define JOBS_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* What a job is doing, as shown by the jobs builtin */
+enum job_state
+{
+    JOB_RUNNING,
+    JOB_STOPPED,    /* at least one process is stopped */
+    JOB_DONE        /* every process has been reaped */
+};
+
+/* One process of a job */
+struct job_proc
+{
+    pid_t pid;      /* 0 if the stage could not be launched */
+    int status;     /* last status from waitpid */
+    bool done;      /* exited or killed, or never started */
+};
+
+/**
+* @brief A pipeline or list the shell is tracking as a unit. Jobs in the
+* table have an id starting at 1, a job that is only being waited for in
+* the foreground has id 0.
+*/
+struct job
+{
+    int id;
+    pid_t pgid;
+    enum job_state state;
+    bool changed;           /* state changed and not reported yet */
+    unsigned long done_seq; /* order in which jobs finished, for wait -n */
+    char *cmd;              /* the command as it was typed */
+    size_t nlive;           /* processes not reaped yet */
+    size_t nstopped;        /* live processes that are stopped */
+    size_t nprocs;
+    struct job_proc procs[];
+};
+
+/* An entry of the pid index */
+struct job_slot
+{
+    pid_t pid;              /* 0 for an empty slot */
+    struct job *job;
+    size_t index;           /* into job->procs */
+};
+
+/**
+* @brief The job table. Jobs are stored in an array indexed by job id and
+* every process is entered in an open addressing hash keyed by pid, so both
+* lookups are O(1) however many jobs are running. Both arrays grow by
+* doubling. A new job gets the id one above the highest id in use, so ids
+* are reused once the jobs at the top have finished.
+*/
+struct job_table
+{
+    struct job **jobs;      /* jobs[id], jobs[0] is unused */
+    size_t cap;
+    int max_id;
+    size_t count;
+    size_t running;         /* jobs in JOB_RUNNING */
+    struct job_slot *slots; /* linear probing, power of two */
+    size_t slot_cap;
+    size_t slot_count;
+    int current;            /* %+ */
+    int previous;           /* %- */
+    unsigned long done_seq;
+    bool changed;           /* some job has something to report */
+};
+
+/**
+* @brief Initialize an empty table.
+*
+* @param jt The table
+*/
+
+void job_table_init(struct job_table *jt);
+/**
+* @brief Free every job. The processes themselves are left alone.
+*
+* @param jt The table
+*/
+
+void job_table_destroy(struct job_table *jt);
+/**
+* @brief Allocate a job with nprocs processes that have not been started.
+* Each one counts as failed with status 1 until job_proc_start is called.
+*
+* @param nprocs The number of processes
+* @return The job, to be released with job_free or job_remove
+*/
+
+struct job *job_create(size_t nprocs);
+/**
+* @brief Free a job that is not in the table.
+*
+* @param j The job
+*/
+
+void job_free(struct job *j);
+/**
+* @brief Record that process i of the job was started.
+*
+* @param j The job
+* @param i The process index
+* @param pid The process id
+*/
+
+void job_proc_start(struct job *j, size_t i, pid_t pid);
+/**
+* @brief Record the exit status of a process that could not be started.
+*
+* @param j The job
+* @param i The process index
+* @param code The exit status, such as 127 for a missing command
+*/
+
+void job_proc_failed(struct job *j, size_t i, int code);
+/**
+* @brief Give the job an id, index its processes by pid and make it the
+* current job.
+*
+* @param jt The table
+* @param j The job
+*/
+
+void job_insert(struct job_table *jt, struct job *j);
+/**
+* @brief Take a job out of the table and free it.
+*
+* @param jt The table
+* @param j The job
+*/
+
+void job_remove(struct job_table *jt, struct job *j);
+/**
+* @brief Look up a job by id.
+*
+* @param jt The table
+* @param id The job id
+* @return The job or NULL
+*/
+
+struct job *job_by_id(struct job_table *jt, int id);
+/**
+* @brief Look up the job a process belongs to.
+*
+* @param jt The table
+* @param pid The process id
+* @return The job or NULL
+*/
+
+struct job *job_by_pid(struct job_table *jt, pid_t pid);
+/**
+* @brief Resolve a job spec: %n, %+, %%, %-, %prefix, %?substring, or with
+* pids allowed, a process id.
+*
+* @param jt The table
+* @param spec The spec
+* @param pids Accept a bare number as a process id
+* @return The job or NULL
+*/
+
+struct job *job_find(struct job_table *jt, const char *spec, bool pids);
+/**
+* @brief Record a new status for a process of a job in the table.
+*
+* @param jt The table
+* @param pid The process id
+* @param status The status from waitpid
+*/
+
+void job_update(struct job_table *jt, pid_t pid, int status);
+/**
+* @brief Have the event loop report state changes of the job's processes
+* to the table.
+*
+* @param sh The shell
+* @param j The job
+*/
+
+void job_watch(struct shell *sh, struct job *j);
+/**
+* @brief Wait in the foreground until every process of the job has exited
+* or the job stopped. The terminal is not touched.
+*
+* @param sh The shell
+* @param j The job
+*/
+
+void job_wait(struct shell *sh, struct job *j);
+/**
+* @brief The exit status of the job: that of its last process, 128 plus
+* the signal number if it was killed or stopped.
+*
+* @param j The job
+* @return The exit status
+*/
+
+int job_status(const struct job *j);
+/**
+* @brief Print one line about a job in the format of the jobs builtin.
+*
+* @param f Where to print
+* @param jt The table
+* @param j The job
+* @param pid Include the process group id
+*/
+
+void job_print(FILE *f, struct job_table *jt, const struct job *j, bool pid);
+/**
+* @brief Report the jobs that changed state since the last call and drop
+* the finished ones. Nothing is printed and finished jobs are kept for
+* wait when the shell has no job control.
+*
+* @param sh The shell
+*/
+
+void job_notify(struct shell *sh);
+/**
+* @brief Check if job_notify has anything to do.
+*
+* @param jt The table
+* @return True if a job changed state
+*/
+
+bool job_pending(const struct job_table *jt);
+/**
+* @brief The jobs builtin: jobs [-l | -p] [spec...]
+*
+* @param sh The shell
+* @param argv The arguments
+* @return The exit status
+*/
+
+int jobs_builtin(struct shell *sh, char **argv);
+/**
+* @brief The fg builtin: fg [spec]
+*
+* @param sh The shell
+* @param argv The arguments
+* @return The exit status of the job
+*/
+
+int fg_builtin(struct shell *sh, char **argv);
+/**
+* @brief The bg builtin: bg [spec...]
+*
+* @param sh The shell
+* @param argv The arguments
+* @return The exit status
+*/
+
+int bg_builtin(struct shell *sh, char **argv);
+/**
+* @brief The wait builtin: wait [-n] [spec | pid...]
+*
+* @param sh The shell
+* @param argv The arguments
+* @return The exit status of the last job waited for
+*/
+
+int wait_builtin(struct shell *sh, char **argv);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -1,12 +1,27 @@
 #include "lab.h"
+#include "scan.h"
+#include "pathcache.h"
+#include "event.h"
+#include "jobs.h"
+#include "builtins.h"
+#include "history.h"
+#include "complete.h"
+#include "prompt.h"
+#include "vars.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <pwd.h>
 #include <unistd.h>
 #include <termios.h>
 #include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <time.h>
+
+extern char **environ;
 
 /*
  * get_prompt:
@@ -30,8 +45,8 @@ char *get_prompt(const char *env) {
  *  - Purpose: Changes the current working directory.
  *  - Parameters:
  *      * dir: An array of strings where dir[0] is expected to be "cd" and dir[1] is the target directory.
- *      * If no directory argument is provided (i.e., dir[1] is NULL), it attempts to use the HOME directory.
- *      * If the HOME environment variable isn't set, it uses getpwuid/getuid to retrieve the home directory.
+ *      * If no directory argument is provided (i.e., dir[1] is NULL), it uses getpwuid/getuid to retrieve
+ *        the home directory. $HOME is a shell variable, the cd builtin passes it in.
  *      * It then calls chdir() to change to the specified directory.
  *      * If chdir() fails, an error message is printed.
  *  - Returns: 0 on success, -1 on error.
@@ -39,17 +54,13 @@ char *get_prompt(const char *env) {
 int change_dir(char **dir) {
     char *target;
     if (dir[1] == NULL) {
-        // No target directory provided; use the HOME directory.
-        target = getenv("HOME");
-        if (target == NULL) {
-            // If HOME isn't set, try to get the user's home directory via getpwuid.
-            struct passwd *pw = getpwuid(getuid());
-            if (pw) {
-                target = pw->pw_dir;
-            } else {
-                perror("change_dir: cannot determine home directory");
-                return -1;
-            }
+        // No target directory provided; get the user's home directory via getpwuid.
+        struct passwd *pw = getpwuid(getuid());
+        if (pw) {
+            target = pw->pw_dir;
+        } else {
+            perror("change_dir: cannot determine home directory");
+            return -1;
         }
     } else {
         // Use the provided target directory.
@@ -63,124 +74,199 @@ int change_dir(char **dir) {
     return ret;
 }
 
+/*
+ * cmd_tokenizer_init / cmd_next_token:
+ *  - Purpose: Reentrant replacement for the strtok() loop.
+ *      * All scanning state lives in the caller owned struct cmd_tokenizer,
+ *        so any number of threads can tokenize different lines at once.
+ *      * Token boundaries are found with the vectorized ws_skip()/ws_find()
+ *        kernels, which examine 16 or 32 bytes per step.
+ *      * Tokens are returned as (pointer, length) pairs into the original
+ *        line, which is never modified.
+ */
+void cmd_tokenizer_init(struct cmd_tokenizer *tk, const char *line) {
+    tk->pos = line;
+    tk->end = line + strlen(line);
+}
+
+bool cmd_next_token(struct cmd_tokenizer *tk, const char **tok, size_t *len) {
+    const char *p = ws_skip(tk->pos, tk->end);  // Skip delimiters
+    if (p == tk->end) {
+        tk->pos = p;
+        return false;
+    }
+    const char *e = ws_find(p, tk->end);  // Find the end of the token
+    *tok = p;
+    *len = e - p;
+    tk->pos = e;
+    return true;
+}
+
 /*
  * cmd_parse:
  *  - Purpose: Splits a command line string into tokens.
- *      * Allocates an initial array (tokens) to store pointers to token strings.
- *      * Duplicates the input line so the original isn't modified.
- *      * Uses strtok() to split the string on whitespace (spaces, tabs, newlines, etc.).
- *      * Each token is duplicated (using strdup) and stored in the tokens array.
- *      * If the number of tokens exceeds the initial buffer size, the buffer is resized.
+ *      * Makes a single allocation holding both the NULL-terminated argv array
+ *        and a private copy of the line. The block is sized from the input
+ *        length: a line of len bytes can hold at most (len + 1) / 2 tokens
+ *        because every token but the last needs a delimiter after it.
+ *      * Walks the line with cmd_next_token() and terminates each token in
+ *        the private copy, so each argv entry points into the block.
  *      * The tokens array is terminated with a NULL pointer.
  *  - Returns: A NULL-terminated array of tokens.
- *  - Note: Memory for both the array and each token is allocated on the heap. Use cmd_free() to free it.
+ *  - Note: The array and the token bytes share one heap block. Use cmd_free() to free it.
+ *          No hidden state is kept, so the function is safe to call from many threads.
  */
 char **cmd_parse(char const *line) {
-    int bufsize = 64;  // Initial allocation for tokens
-    char **tokens = malloc(bufsize * sizeof(char *));
+    size_t len = strlen(line);
+    size_t max_tokens = (len + 1) / 2;
+    // Layout: [argv pointers + NULL][copy of line]
+    char **tokens = malloc((max_tokens + 1) * sizeof(char *) + len + 1);
     if (!tokens) {
         fprintf(stderr, "cmd_parse: allocation error\n");
         exit(EXIT_FAILURE);
     }
-    // Duplicate the input line to avoid modifying the original string.
-    char *line_copy = strdup(line);
-    char *token;
-    int position = 0;
-    // Split the string into tokens based on whitespace.
-    token = strtok(line_copy, " \t\r\n");
-    while (token != NULL) {
-        tokens[position] = strdup(token);  // Allocate memory for the token
-        position++;
-        // If the buffer is full, increase its size.
-        if (position >= bufsize) {
-            bufsize *= 2;
-            tokens = realloc(tokens, bufsize * sizeof(char *));
-            if (!tokens) {
-                fprintf(stderr, "cmd_parse: allocation error\n");
-                exit(EXIT_FAILURE);
-            }
+    char *line_copy = (char *)(tokens + max_tokens + 1);
+    memcpy(line_copy, line, len + 1);
+    struct cmd_tokenizer tk;
+    const char *token;
+    size_t tok_len;
+    size_t position = 0;
+    // Split the copy into tokens based on whitespace.
+    tk.pos = line_copy;
+    tk.end = line_copy + len;
+    while (cmd_next_token(&tk, &token, &tok_len)) {
+        char *t = line_copy + (token - line_copy);
+        bool last = t + tok_len == tk.end;
+        t[tok_len] = '\0';       // Terminate the token in place
+        tokens[position++] = t;  // Points into the same block
+        if (!last) {
+            tk.pos++;  // Step over the delimiter we overwrote
         }
-        token = strtok(NULL, " \t\r\n");
     }
     tokens[position] = NULL;  // Terminate the array with NULL
-    free(line_copy);          // Free the duplicated input string
     return tokens;
 }
 
+/*
+ * cmd_parse_batch:
+ *  - Purpose: Parses an array of lines across a pool of worker threads.
+ *      * Workers claim fixed size chunks of the input with an atomic counter,
+ *        so uneven line lengths still balance across the pool.
+ *      * Each result is produced by cmd_parse() and written to out[i].
+ *      * If a worker thread cannot be created the calling thread picks up
+ *        the remaining work, so every line is always parsed.
+ *  - Returns: 0 on success.
+ */
+#define BATCH_CHUNK 64
+
+struct batch_job {
+    char const *const *lines;
+    char ***out;
+    size_t n;
+    atomic_size_t next;
+};
+
+static void *batch_worker(void *arg) {
+    struct batch_job *job = arg;
+    for (;;) {
+        size_t start = atomic_fetch_add(&job->next, BATCH_CHUNK);
+        if (start >= job->n) break;
+        size_t stop = start + BATCH_CHUNK < job->n ? start + BATCH_CHUNK : job->n;
+        for (size_t i = start; i < stop; i++) {
+            job->out[i] = cmd_parse(job->lines[i]);
+        }
+    }
+    return NULL;
+}
+
+int cmd_parse_batch(char const *const *lines, size_t n, char ***out, int nthreads) {
+    if (nthreads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (int)cpus : 1;
+    }
+    size_t chunks = (n + BATCH_CHUNK - 1) / BATCH_CHUNK;
+    if ((size_t)nthreads > chunks) nthreads = chunks ? (int)chunks : 1;
+
+    struct batch_job job = { .lines = lines, .out = out, .n = n };
+    atomic_init(&job.next, 0);
+    pthread_t *workers = NULL;
+    int started = 0;
+    if (nthreads > 1) {
+        workers = malloc((nthreads - 1) * sizeof(pthread_t));
+        for (int i = 0; workers && i < nthreads - 1; i++) {
+            if (pthread_create(&workers[i], NULL, batch_worker, &job) != 0) break;
+            started++;
+        }
+    }
+    batch_worker(&job);  // The caller is a member of the pool
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    return 0;
+}
+
 /*
  * cmd_free:
  *  - Purpose: Frees memory allocated for the tokens by cmd_parse.
- *      * Iterates through the tokens array and frees each token.
- *      * Frees the tokens array itself.
+ *      * The argv array and every token live in one block, so a single free()
+ *        releases the whole parse.
  */
 void cmd_free(char **line) {
-    if (line) {
-        for (int i = 0; line[i] != NULL; i++) {
-            free(line[i]);  // Free each individual token
-        }
-        free(line);  // Free the tokens array
-    }
+    free(line);
 }
 
 /*
  * trim_white:
  *  - Purpose: Removes leading and trailing whitespace from a string.
- *      * Moves the pointer forward to skip any leading whitespace.
- *      * Finds the end of the string and moves backward to remove trailing whitespace.
+ *      * Uses ws_skip() to move the pointer forward over leading whitespace.
+ *      * Uses ws_rskip() to scan backward from the end over trailing whitespace.
  *      * Inserts a null terminator after the last non-whitespace character.
  *  - Note: The function modifies the string in place and returns a pointer to the trimmed string.
  */
 char *trim_white(char *line) {
     if (line == NULL) return line;
+    char *end = line + strlen(line);
     // Skip leading whitespace.
-    while (*line && isspace((unsigned char)*line)) {
-        line++;
-    }
+    line += ws_skip(line, end) - line;
     // If the string is empty after trimming, return it.
-    if (*line == '\0') {
+    if (line == end) {
         return line;
     }
-    // Find the end of the string.
-    char *end = line + strlen(line) - 1;
-    // Move backward over any trailing whitespace.
-    while (end > line && isspace((unsigned char)*end)) {
-        end--;
-    }
-    // Terminate the string after the last non-whitespace character.
-    *(end + 1) = '\0';
+    // Move backward over any trailing whitespace and terminate the string there.
+    end = line + (ws_rskip(line, end) - line);
+    *end = '\0';
     return line;
 }
 
 /*
  * do_builtin:
- *  - Purpose: Checks if a command is a built-in command (e.g., exit, cd, history) and executes it.
- *      * If the command is "exit":
- *            - During tests (when SKIP_EXIT is set to "1"), it simply returns true.
- *            - Otherwise, it calls exit(0) to terminate the shell.
- *      * If the command is "cd", it calls change_dir() to change the directory.
- *      * If the command is "history", it returns true (a full implementation might print command history).
+ *  - Purpose: Looks the command up in the builtin registry and runs it.
+ *      * Registered builtins, including those loaded with enable -f, are
+ *        tried first, then the core builtins (exit, cd, hash, history, jobs,
+ *        fg, bg, wait, enable, echo, printf, test, [, true, false and pwd)
+ *        through their perfect hash.
+ *      * The handler's exit status is stored in sh->last_status.
  *  - Returns: true if the command is a built-in, false otherwise.
  */
 bool do_builtin(struct shell *sh, char **argv) {
-    (void)sh;  // Unused parameter; suppresses compiler warnings.
     if (argv == NULL || argv[0] == NULL) {
         return false;
     }
-    if (strcmp(argv[0], "exit") == 0) {
-        // Check if SKIP_EXIT is set to "1" to bypass exit (used during testing).
-        char *skip_exit = getenv("SKIP_EXIT");
-        if (skip_exit && strcmp(skip_exit, "1") == 0) {
-            return true;  // Indicate the command was handled without terminating.
-        }
-        exit(0);  // In normal operation, terminate the shell.
-    } else if (strcmp(argv[0], "cd") == 0) {
-        change_dir(argv);  // Change the current working directory.
-        return true;
-    } else if (strcmp(argv[0], "history") == 0) {
-        // For a full shell, you might print the command history here.
-        return true;
+    const struct builtin *b = builtin_lookup(sh, argv[0]);
+    if (!b) {
+        return false;  // Not a built-in command.
     }
-    return false;  // Not a built-in command.
+    sh->last_status = b->fn(sh, argv);
+    return true;
+}
+
+/*
+ * is_builtin:
+ *  - Purpose: Reports whether do_builtin() would handle the command name.
+ */
+bool is_builtin(struct shell *sh, const char *name) {
+    return name && builtin_lookup(sh, name) != NULL;
 }
 
 /*
@@ -192,17 +278,42 @@ bool do_builtin(struct shell *sh, char **argv) {
  *            - Puts the shell in its own process group.
  *            - Gets the terminal's current attributes.
  *            - Sets the shell's process group as the foreground process group.
- *      * Sets the shell's prompt using the MY_PROMPT environment variable (or a default).
+ *            - Ignores the job control signals so that only foreground jobs receive them.
+ *      * Imports the environment as exported shell variables.
+ *      * Sets the shell's prompt using the MY_PROMPT variable (or a default).
+ *      * Creates the empty command path cache.
+ *      * Creates the event loop, which blocks SIGCHLD (and SIGINT and SIGTSTP
+ *        under job control) so they are only seen through its signalfd.
+ *      * Creates the empty job table.
  */
 void sh_init(struct shell *sh) {
+    sh_init_with(sh, NULL);
+}
+
+/*
+ * sh_init_with:
+ *  - Purpose: sh_init for a shell started with options. Running -c or a
+ *    script turns off interactive mode, and --bench turns on the timers.
+ */
+void sh_init_with(struct shell *sh, const struct shell_options *opt) {
     if (!sh) return;
     // Set the terminal descriptor (standard input)
     sh->shell_terminal = STDIN_FILENO;
     // Check if the shell is running interactively (i.e., attached to a terminal)
-    sh->shell_is_interactive = isatty(sh->shell_terminal);
+    sh->shell_is_interactive = isatty(sh->shell_terminal) && (!opt || (!opt->command && !opt->script));
     /* Check if SKIP_TC is set to "1" to bypass terminal control (useful during testing) */
     char *skip_tc = getenv("SKIP_TC");
+    sh->job_control = 0;
+    sh->last_status = 0;
+    sh->shell_pgid = getpgrp();
     if (sh->shell_is_interactive && (!skip_tc || strcmp(skip_tc, "1") != 0)) {
+        // Ignore interactive and job-control signals, children reset them.
+        // SIGTTOU must be ignored before tcsetpgrp below or it stops the shell.
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
         // Set the shell's process group ID to its own PID
         sh->shell_pgid = getpid();
         // Put the shell in its own process group
@@ -214,15 +325,72 @@ void sh_init(struct shell *sh) {
         tcgetattr(sh->shell_terminal, &sh->shell_tmodes);
         // Set the shell's process group as the foreground process group
         tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+        sh->job_control = 1;
+    }
+    // The environment becomes the exported shell variables
+    sh->vars = malloc(sizeof(struct var_table));
+    if (!sh->vars) {
+        fprintf(stderr, "sh_init: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    vars_init(sh->vars);
+    vars_import(sh->vars, environ);
+    static char *no_params[] = {NULL};
+    sh->name = opt && opt->name ? opt->name : "lab";
+    sh->pid = getpid();
+    sh->params = opt && opt->args ? opt->args : no_params;
+    // Set the shell prompt from the MY_PROMPT variable (or default to "shell>")
+    const char *prompt = vars_get(sh->vars, "MY_PROMPT");
+    sh->prompt = strdup(prompt ? prompt : "shell>");
+    // Commands are resolved lazily through the path cache
+    sh->path_cache = malloc(sizeof(struct path_cache));
+    if (!sh->path_cache) {
+        fprintf(stderr, "sh_init: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    path_cache_init(sh->path_cache);
+    sh->events = malloc(sizeof(struct event_loop));
+    if (!sh->events) {
+        fprintf(stderr, "sh_init: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    event_loop_init(sh->events, sh->job_control);
+    sh->jobs = malloc(sizeof(struct job_table));
+    if (!sh->jobs) {
+        fprintf(stderr, "sh_init: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    job_table_init(sh->jobs);
+    // Only created when something registers a builtin
+    sh->builtins = NULL;
+    sh->bench = NULL;
+    // Opened by the interactive front end
+    sh->history = NULL;
+    sh->commands = NULL;
+    sh->prompt_cache = NULL;
+    sh->last_ns = 0;
+    if (opt && opt->bench) {
+        sh->bench = calloc(1, sizeof(struct bench));
+        if (!sh->bench) {
+            fprintf(stderr, "sh_init: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        sh->bench->start = bench_begin(sh);
     }
-    // Set the shell prompt based on the MY_PROMPT environment variable (or default to "shell>")
-    sh->prompt = get_prompt("MY_PROMPT");
 }
 
 /*
  * sh_destroy:
  *  - Purpose: Cleans up the shell structure.
  *      * Frees the prompt string if it was allocated.
+ *      * Frees the command path cache.
+ *      * Stops the prompt's lookup thread.
+ *      * Closes the event loop and restores the signal mask.
+ *      * Forgets the jobs, which keep running.
+ *      * Frees the registered builtins.
+ *      * Closes the history file.
+ *      * Frees the command completion index.
+ *      * Frees the shell variables.
  *      * Sets the prompt pointer to NULL to prevent dangling references.
  */
 void sh_destroy(struct shell *sh) {
@@ -231,14 +399,129 @@ void sh_destroy(struct shell *sh) {
         free(sh->prompt);   // Free the dynamically allocated prompt
         sh->prompt = NULL;  // Avoid leaving a dangling pointer
     }
+    if (sh->path_cache) {
+        path_cache_destroy(sh->path_cache);
+        free(sh->path_cache);
+        sh->path_cache = NULL;
+    }
+    // The lookup thread may wake the event loop until it is joined
+    prompt_cache_destroy(sh->prompt_cache);
+    sh->prompt_cache = NULL;
+    sh->last_ns = 0;
+    if (sh->events) {
+        event_loop_destroy(sh->events);
+        free(sh->events);
+        sh->events = NULL;
+    }
+    if (sh->jobs) {
+        job_table_destroy(sh->jobs);
+        free(sh->jobs);
+        sh->jobs = NULL;
+    }
+    builtin_table_destroy(sh);
+    free(sh->bench);
+    sh->bench = NULL;
+    history_close(sh->history);
+    sh->history = NULL;
+    if (sh->vars) {
+        vars_destroy(sh->vars);
+        free(sh->vars);
+        sh->vars = NULL;
+    }
+    if (sh->commands) {
+        command_index_destroy(sh->commands);
+        free(sh->commands);
+        sh->commands = NULL;
+    }
 }
 
 /*
  * parse_args:
- *  - Purpose: A placeholder function for parsing command line arguments.
+ *  - Purpose: Parse the command line with getopt_long.
+ *      * Option parsing stops at the first operand, so a script's own
+ *        arguments are never taken as shell options.
+ *      * -c takes the command string from the first operand, the next one
+ *        becomes $0 and the rest the positional parameters, as in sh -c.
+ *      * Without -c or -s the first operand is the script to run.
+ *  - Returns: 0 on success, -1 on a usage error.
+ */
+int parse_args(int argc, char **argv, struct shell_options *opt) {
+    static const struct option longopts[] = {
+        {"norc", no_argument, NULL, 'n'},
+        {"bench", no_argument, NULL, 'b'},
+        {"version", no_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0},
+    };
+    bool command = false;
+    int c;
+    memset(opt, 0, sizeof(*opt));
+    opt->name = argv[0];
+    // 0 rather than 1 makes glibc start over if called again
+    optind = 0;
+    while ((c = getopt_long(argc, argv, "+csv", longopts, NULL)) != -1) {
+        switch (c) {
+        case 'c':
+            command = true;
+            break;
+        case 's':
+            opt->read_stdin = true;
+            break;
+        case 'v':
+            opt->version = true;
+            break;
+        case 'n':
+            opt->norc = true;
+            break;
+        case 'b':
+            opt->bench = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v] [--norc] [--bench] [-c command [name] | -s | script] [arg ...]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+    char **rest = argv + optind;
+    if (command) {
+        if (!*rest) {
+            fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+            return -1;
+        }
+        opt->command = *rest++;
+        if (*rest) opt->name = *rest++;
+    } else if (!opt->read_stdin && *rest) {
+        opt->script = *rest++;
+        opt->name = opt->script;
+    }
+    opt->args = rest;
+    return 0;
+}
+
+uint64_t bench_begin(const struct shell *sh) {
+    if (!sh->bench) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void bench_end(struct shell *sh, enum bench_phase phase, uint64_t start) {
+    if (!sh->bench) return;
+    sh->bench->ns[phase] += bench_begin(sh) - start;
+    sh->bench->count[phase]++;
+}
+
+/*
+ * bench_report:
+ *  - Purpose: Print the calls and time of every phase, and the time since
+ *    the shell started. What is not in any phase is reading input,
+ *    expansion, redirections and the shell's own bookkeeping.
  */
-void parse_args(int argc, char **argv) {
-    (void)argc;
-    (void)argv;
-    /* No argument parsing implemented for now */
+void bench_report(const struct shell *sh, FILE *f) {
+    static const char *const names[BENCH_PHASES] = {"parse", "builtin", "spawn", "wait"};
+    if (!sh->bench) return;
+    fprintf(f, "%-8s %10s %12s\n", "phase", "calls", "ms");
+    for (int i = 0; i < BENCH_PHASES; i++) {
+        fprintf(f, "%-8s %10lu %12.3f\n", names[i], sh->bench->count[i], sh->bench->ns[i] / 1e6);
+    }
+    fprintf(f, "%-8s %10s %12.3f\n", "total", "", (bench_begin(sh) - sh->bench->start) / 1e6);
 }
@@ -2,6 +2,8 @@
 #define LAB_H
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <unistd.h>
@@ -15,6 +17,58 @@ extern "C"
 {
 #endif
 
+/**
+* @brief Caller owned state for the reentrant tokenizer. Initialize with
+* cmd_tokenizer_init and pull tokens with cmd_next_token.
+*/
+struct cmd_tokenizer
+{
+    const char *pos;
+    const char *end;
+};
+
+/* The phases --bench reports */
+enum bench_phase
+{
+    BENCH_PARSE,
+    BENCH_BUILTIN,      /* builtins run in the shell process */
+    BENCH_SPAWN,        /* creating pipes and starting processes */
+    BENCH_WAIT,         /* waiting for foreground jobs */
+    BENCH_PHASES
+};
+
+/* Time spent in each phase, kept when the shell runs with --bench */
+struct bench
+{
+    uint64_t ns[BENCH_PHASES];
+    unsigned long count[BENCH_PHASES];
+    uint64_t start;
+};
+
+/**
+* @brief How the shell was started, filled in by parse_args.
+*/
+struct shell_options
+{
+    const char *command;    /* -c: the command string */
+    const char *script;     /* the script to run */
+    bool read_stdin;        /* -s: commands come from stdin */
+    bool norc;              /* --norc: skip the startup file */
+    bool bench;             /* --bench: report phase timings on exit */
+    bool version;           /* -v: print the version and exit */
+    const char *name;       /* $0 */
+    char **args;            /* the positional parameters, NULL terminated */
+};
+
+struct path_cache;
+struct event_loop;
+struct job_table;
+struct builtin_table;
+struct history;
+struct command_index;
+struct prompt_cache;
+struct var_table;
+
 struct shell
 {
     int shell_is_interactive;
@@ -22,6 +76,21 @@ struct shell
     struct termios shell_tmodes;
     int shell_terminal;
     char *prompt;
+    int job_control;    /* put jobs in process groups and hand them the terminal */
+    int last_status;    /* exit status of the last command, $? */
+    pid_t pid;          /* $$, the same in subshells */
+    uint64_t last_ns;   /* how long the last interactive line ran */
+    struct path_cache *path_cache;  /* command name to executable path */
+    struct event_loop *events;      /* child, signal and input events */
+    struct job_table *jobs;         /* background and stopped jobs */
+    struct builtin_table *builtins; /* builtins registered at run time */
+    struct bench *bench;            /* phase timings, NULL unless --bench */
+    struct history *history;        /* the history file, NULL if not recording */
+    struct command_index *commands; /* for completion, NULL until first used */
+    struct prompt_cache *prompt_cache;  /* NULL until the prompt is drawn */
+    struct var_table *vars;         /* shell variables, the environment included */
+    const char *name;               /* $0 */
+    char **params;                  /* $1 and on, NULL terminated */
 };
 
 /**
@@ -48,9 +117,9 @@ char *get_prompt(const char *env);
 int change_dir(char **dir);
 /**
 * @brief Convert line read from the user into to format that will work with
-* execvp. We limit the number of arguments to ARG_MAX loaded from sysconf.
-* This function allocates memory that must be reclaimed with the cmd_free
-* function.
+* execvp. The argv array and the bytes of every token are carved out of
+* a single allocation sized from the length of the line, so a parse costs
+* one malloc. The memory must be reclaimed with the cmd_free function.
 *
 * @param line The line to process
 *
@@ -59,7 +128,43 @@ int change_dir(char **dir);
 
 char **cmd_parse(char const *line);
 /**
-* @brief Free the line that was constructed with parse_cmd
+* @brief Start tokenizing line. The tokenizer keeps no global state so
+* separate tokenizers may be used concurrently from different threads.
+*
+* @param tk The tokenizer state owned by the caller
+* @param line The line to tokenize, it must outlive the tokenizer
+*/
+
+void cmd_tokenizer_init(struct cmd_tokenizer *tk, const char *line);
+/**
+* @brief Return the next whitespace separated token of the line. Whitespace
+* is the C locale isspace() set. The token
+* is not NUL terminated, it is described by a pointer into the line and a
+* length.
+*
+* @param tk The tokenizer state
+* @param tok Set to the start of the token
+* @param len Set to the length of the token
+* @return True if a token was found, false at the end of the line
+*/
+
+bool cmd_next_token(struct cmd_tokenizer *tk, const char **tok, size_t *len);
+/**
+* @brief Parse n lines in parallel with a pool of worker threads. Each
+* out[i] receives the result of cmd_parse(lines[i]) and must be released
+* with cmd_free.
+*
+* @param lines The lines to parse
+* @param n Number of lines
+* @param out Array of n results
+* @param nthreads Size of the pool, zero or less uses one per online CPU
+* @return 0 on success
+*/
+
+int cmd_parse_batch(char const *const *lines, size_t n, char ***out, int nthreads);
+/**
+* @brief Free the line that was constructed with parse_cmd. Because the
+* whole parse is one block this is a single call to free.
 *
 * @param line the line to free
 */
@@ -90,6 +195,17 @@ char *trim_white(char *line);
 
 bool do_builtin(struct shell *sh, char **argv);
 /**
+* @brief Check if name is a built in command without running it. The
+* executor uses this to decide whether redirections must be applied in the
+* shell itself or in a child process.
+*
+* @param sh The shell
+* @param name The command name
+* @return True if do_builtin would handle the command
+*/
+
+bool is_builtin(struct shell *sh, const char *name);
+/**
 * @brief Initialize the shell for use. Allocate all data structures
 * Grab control of the terminal and put the shell in its own
 * process group. NOTE: This function will block until the shell is
@@ -102,6 +218,16 @@ bool do_builtin(struct shell *sh, char **argv);
 
 void sh_init(struct shell *sh);
 /**
+* @brief Initialize the shell for the way it was started. A shell running a
+* command string or a script is never interactive, whatever its stdin is.
+* sh_init(sh) is sh_init_with(sh, NULL).
+*
+* @param sh The shell
+* @param opt The options from parse_args, or NULL
+*/
+
+void sh_init_with(struct shell *sh, const struct shell_options *opt);
+/**
 * @brief Destroy shell. Free any allocated memory and resources and exit
 * normally.
 *
@@ -112,11 +238,42 @@ void sh_destroy(struct shell *sh);
 /**
 * @brief Parse command line args from the user when the shell was launched
 *
+*   myprogram [-v] [--norc] [--bench] [script [arg...]]
+*   myprogram [options] -c command [name [arg...]]
+*   myprogram [options] -s [arg...]
+*
 * @param argc Number of args
 * @param argv The arg array
+* @param opt Filled in with the options, pointing into argv
+* @return 0 on success, -1 after printing a usage message
+*/
+
+int parse_args(int argc, char **argv, struct shell_options *opt);
+/**
+* @brief Start timing a phase for --bench.
+*
+* @param sh The shell
+* @return The start time, or 0 when the shell is not timing phases
+*/
+
+uint64_t bench_begin(const struct shell *sh);
+/**
+* @brief Add the time since bench_begin to a phase.
+*
+* @param sh The shell
+* @param phase The phase
+* @param start What bench_begin returned
+*/
+
+void bench_end(struct shell *sh, enum bench_phase phase, uint64_t start);
+/**
+* @brief Print the phase timings.
+*
+* @param sh The shell
+* @param f Where to print them
 */
 
-void parse_args(int argc, char **argv);
+void bench_report(const struct shell *sh, FILE *f);
 #ifdef __cplusplus
 } // extern "C"
 #endif
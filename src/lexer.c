@@ -0,0 +1,452 @@
+#include "lexer.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * The lexer is a table driven state machine. Every input byte is mapped to
+ * a character class, and the pair (state, class) selects an action. Actions
+ * never look behind the current byte and only look ahead by not consuming
+ * it, so each byte is examined a bounded number of times and a multi
+ * megabyte script is lexed in O(n).
+ */
+
+enum lex_state {
+    S_START,    /* between tokens */
+    S_WORD,     /* inside an unquoted part of a word */
+    S_SQ,       /* inside '...' */
+    S_DQ,       /* inside "..." */
+    S_ESC,      /* after a backslash in a word */
+    S_DQ_ESC,   /* after a backslash inside "..." */
+    S_OP,       /* accumulating an operator */
+    S_COMMENT,  /* after # up to the newline */
+    S_NSTATES
+};
+
+enum char_class {
+    C_OTHER, C_BLANK, C_NL, C_SQ, C_DQ, C_BSLASH, C_DOLLAR, C_HASH,
+    C_OP, C_LPAREN, C_RPAREN, C_LBRACE, C_RBRACE, C_NCLASSES
+};
+
+enum lex_action {
+    A_SKIP,         /* consume and ignore */
+    A_NEWLINE,      /* emit a newline token */
+    A_COMMENT,      /* start a comment */
+    A_COMMENT_SKIP, /* skip the body of a comment */
+    A_COMMENT_END,  /* newline ends the comment, handled from S_START */
+    A_OP_BEGIN,     /* first byte of an operator */
+    A_OP_NEXT,      /* extend the operator or emit it */
+    A_WORD_BEGIN,   /* start a word, the byte is handled from S_WORD */
+    A_APPEND,       /* append the byte to the word */
+    A_RUN,          /* append a run of plain bytes */
+    A_DELIM,        /* end of word unless nested inside $( ) */
+    A_OPEN,         /* ( or { inside a word */
+    A_CLOSE,        /* ) or } inside a word */
+    A_SQ_OPEN,
+    A_SQ_BODY,
+    A_SQ_CLOSE,
+    A_DQ_OPEN,
+    A_DQ_BODY,
+    A_DQ_CLOSE,
+    A_ESC,          /* backslash outside of quotes */
+    A_ESC_CHAR,     /* the byte after the backslash */
+    A_DQ_ESC,       /* backslash inside "..." */
+    A_DQ_ESC_CHAR
+};
+
+static const unsigned char cclass[256] = {
+    [' '] = C_BLANK, ['\t'] = C_BLANK, ['\r'] = C_BLANK, ['\v'] = C_BLANK, ['\f'] = C_BLANK,
+    ['\n'] = C_NL,
+    ['\''] = C_SQ,
+    ['"'] = C_DQ,
+    ['\\'] = C_BSLASH,
+    ['$'] = C_DOLLAR,
+    ['#'] = C_HASH,
+    ['|'] = C_OP, ['&'] = C_OP, [';'] = C_OP, ['<'] = C_OP, ['>'] = C_OP,
+    ['('] = C_LPAREN,
+    [')'] = C_RPAREN,
+    ['{'] = C_LBRACE,
+    ['}'] = C_RBRACE,
+    /* everything else is C_OTHER */
+};
+
+static const unsigned char actions[S_NSTATES][C_NCLASSES] = {
+    /*             OTHER           BLANK           NL              SQ              DQ              BSLASH          DOLLAR          HASH            OP              LPAREN          RPAREN          LBRACE          RBRACE */
+    [S_START]   = {A_WORD_BEGIN,   A_SKIP,         A_NEWLINE,      A_WORD_BEGIN,   A_WORD_BEGIN,   A_WORD_BEGIN,   A_WORD_BEGIN,   A_COMMENT,      A_OP_BEGIN,     A_OP_BEGIN,     A_OP_BEGIN,     A_WORD_BEGIN,   A_WORD_BEGIN},
+    [S_WORD]    = {A_RUN,          A_DELIM,        A_DELIM,        A_SQ_OPEN,      A_DQ_OPEN,      A_ESC,          A_APPEND,       A_APPEND,       A_DELIM,        A_OPEN,         A_CLOSE,        A_OPEN,         A_CLOSE},
+    [S_SQ]      = {A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY,      A_SQ_CLOSE,     A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY,      A_SQ_BODY},
+    [S_DQ]      = {A_DQ_BODY,      A_DQ_BODY,      A_DQ_BODY,      A_DQ_BODY,      A_DQ_CLOSE,     A_DQ_ESC,       A_DQ_BODY,      A_DQ_BODY,      A_DQ_BODY,      A_DQ_BODY,      A_DQ_BODY,      A_DQ_BODY,      A_DQ_BODY},
+    [S_ESC]     = {A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR,     A_ESC_CHAR},
+    [S_DQ_ESC]  = {A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR,  A_DQ_ESC_CHAR},
+    [S_OP]      = {A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT,      A_OP_NEXT},
+    [S_COMMENT] = {A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_END,  A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP, A_COMMENT_SKIP},
+};
+
+/*
+ * op_start / op_extend:
+ *  - Purpose: The operator automaton. op_extend returns the longer operator
+ *    formed by appending c, or OP_NONE if the operator is complete.
+ */
+static enum tok_op op_start(char c) {
+    switch (c) {
+    case '|': return OP_PIPE;
+    case '&': return OP_AMP;
+    case ';': return OP_SEMI;
+    case '<': return OP_LESS;
+    case '>': return OP_GREAT;
+    case '(': return OP_LPAREN;
+    default:  return OP_RPAREN;
+    }
+}
+
+static enum tok_op op_extend(enum tok_op op, char c) {
+    switch (op) {
+    case OP_PIPE:  return c == '|' ? OP_OR_IF : OP_NONE;
+    case OP_AMP:   return c == '&' ? OP_AND_IF : OP_NONE;
+    case OP_SEMI:  return c == ';' ? OP_DSEMI : OP_NONE;
+    case OP_LESS:
+        if (c == '<') return OP_DLESS;
+        if (c == '&') return OP_LESSAND;
+        if (c == '>') return OP_LESSGREAT;
+        return OP_NONE;
+    case OP_GREAT:
+        if (c == '>') return OP_DGREAT;
+        if (c == '&') return OP_GREATAND;
+        if (c == '|') return OP_CLOBBER;
+        return OP_NONE;
+    case OP_DLESS: return c == '-' ? OP_DLESSDASH : OP_NONE;
+    default:       return OP_NONE;
+    }
+}
+
+const char *tok_op_str(enum tok_op op) {
+    static const char *const names[] = {
+        [OP_NONE] = "", [OP_PIPE] = "|", [OP_OR_IF] = "||", [OP_AMP] = "&",
+        [OP_AND_IF] = "&&", [OP_SEMI] = ";", [OP_DSEMI] = ";;",
+        [OP_LPAREN] = "(", [OP_RPAREN] = ")", [OP_LESS] = "<", [OP_GREAT] = ">",
+        [OP_DGREAT] = ">>", [OP_DLESS] = "<<", [OP_DLESSDASH] = "<<-",
+        [OP_LESSAND] = "<&", [OP_GREATAND] = ">&", [OP_LESSGREAT] = "<>",
+        [OP_CLOBBER] = ">|",
+    };
+    return names[op];
+}
+
+/*
+ * reserve / append / span_open / span_close:
+ *  - Purpose: Manage the token buffer. The buffer grows geometrically so the
+ *    cost of a token is amortized O(length), and it is reused across tokens.
+ */
+static void reserve(struct lexer *lx, size_t extra) {
+    if (lx->len + extra + 1 <= lx->cap) return;
+    size_t cap = lx->cap ? lx->cap : 64;
+    while (cap < lx->len + extra + 1) cap *= 2;
+    char *buf = realloc(lx->buf, cap);
+    if (!buf) {
+        fprintf(stderr, "lexer: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    lx->buf = buf;
+    lx->cap = cap;
+}
+
+static void append(struct lexer *lx, const char *p, size_t n) {
+    reserve(lx, n);
+    memcpy(lx->buf + lx->len, p, n);
+    lx->len += n;
+    lx->prev = p[n - 1];
+}
+
+static void span_open(struct lexer *lx, enum quote_kind kind) {
+    if (lx->nspans == lx->spans_cap) {
+        size_t cap = lx->spans_cap ? lx->spans_cap * 2 : 8;
+        struct quote_span *spans = realloc(lx->spans, cap * sizeof(*spans));
+        if (!spans) {
+            fprintf(stderr, "lexer: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        lx->spans = spans;
+        lx->spans_cap = cap;
+    }
+    lx->spans[lx->nspans].start = lx->len;
+    lx->spans[lx->nspans].len = 0;
+    lx->spans[lx->nspans].kind = kind;
+    lx->nspans++;
+    lx->digits = false;
+}
+
+static void span_close(struct lexer *lx) {
+    struct quote_span *sp = &lx->spans[lx->nspans - 1];
+    sp->len = lx->len - sp->start;
+}
+
+void lex_init(struct lexer *lx) {
+    memset(lx, 0, sizeof(*lx));
+    lx->state = S_START;
+}
+
+void lex_destroy(struct lexer *lx) {
+    free(lx->buf);
+    free(lx->spans);
+    lx->buf = NULL;
+    lx->spans = NULL;
+}
+
+void lex_reset(struct lexer *lx) {
+    lx->in = lx->in_end = NULL;
+    lx->eof = false;
+    lx->state = S_START;
+    lx->len = 0;
+    lx->nspans = 0;
+    lx->depth = 0;
+    lx->error = NULL;
+}
+
+void lex_feed(struct lexer *lx, const char *buf, size_t len) {
+    lx->in = buf;
+    lx->in_end = buf + len;
+}
+
+void lex_eof(struct lexer *lx) {
+    lx->eof = true;
+}
+
+/*
+ * emit_word / emit_op:
+ *  - Purpose: Hand the accumulated token to the caller and return to S_START.
+ */
+static enum lex_status emit_word(struct lexer *lx, struct token *tok, bool io_number) {
+    reserve(lx, 0);
+    lx->buf[lx->len] = '\0';
+    tok->type = io_number ? TOK_IO_NUMBER : TOK_WORD;
+    tok->op = OP_NONE;
+    tok->text = lx->buf;
+    tok->len = lx->len;
+    tok->spans = lx->spans;
+    tok->nspans = lx->nspans;
+    lx->state = S_START;
+    return LEX_OK;
+}
+
+static enum lex_status emit_op(struct lexer *lx, struct token *tok) {
+    tok->type = lx->op >= OP_LESS ? TOK_REDIRECT : TOK_OPERATOR;
+    tok->op = lx->op;
+    tok->text = tok_op_str(lx->op);
+    tok->len = strlen(tok->text);
+    tok->spans = NULL;
+    tok->nspans = 0;
+    lx->state = S_START;
+    return LEX_OK;
+}
+
+/*
+ * lex_at_end:
+ *  - Purpose: Decide what to do once the current chunk is exhausted. Before
+ *    lex_eof the lexer asks for more input, after it any pending token is
+ *    completed or an error is reported for unterminated constructs.
+ */
+static enum lex_status lex_at_end(struct lexer *lx, struct token *tok) {
+    if (!lx->eof) return LEX_MORE;
+    switch (lx->state) {
+    case S_WORD:
+        if (lx->depth > 0) {
+            lx->error = "unexpected end of input while looking for matching `)' or `}'";
+            return LEX_ERROR;
+        }
+        return emit_word(lx, tok, false);
+    case S_ESC:
+        span_close(lx);  // A trailing backslash stays a literal backslash
+        return emit_word(lx, tok, false);
+    case S_SQ:
+        lx->error = "unexpected end of input while looking for matching `''";
+        return LEX_ERROR;
+    case S_DQ:
+    case S_DQ_ESC:
+        lx->error = "unexpected end of input while looking for matching `\"'";
+        return LEX_ERROR;
+    case S_OP:
+        return emit_op(lx, tok);
+    default:
+        tok->type = TOK_EOF;
+        tok->op = OP_NONE;
+        tok->text = "";
+        tok->len = 0;
+        tok->spans = NULL;
+        tok->nspans = 0;
+        return LEX_OK;
+    }
+}
+
+/*
+ * lex_next:
+ *  - Purpose: Run the state machine until a token is complete or the input
+ *    chunk is used up. Actions that end a token leave the delimiting byte
+ *    unconsumed so it is classified again from S_START.
+ */
+enum lex_status lex_next(struct lexer *lx, struct token *tok) {
+    if (lx->error) return LEX_ERROR;
+    while (lx->in < lx->in_end) {
+        const char *p = lx->in;
+        char c = *p;
+        int cls = cclass[(unsigned char)c];
+        switch (actions[lx->state][cls]) {
+        case A_SKIP:
+            lx->in++;
+            break;
+        case A_NEWLINE:
+            lx->in++;
+            tok->type = TOK_NEWLINE;
+            tok->op = OP_NONE;
+            tok->text = "\n";
+            tok->len = 1;
+            tok->spans = NULL;
+            tok->nspans = 0;
+            return LEX_OK;
+        case A_COMMENT:
+            lx->in++;
+            lx->state = S_COMMENT;
+            break;
+        case A_COMMENT_SKIP: {
+            const char *nl = memchr(p, '\n', lx->in_end - p);
+            lx->in = nl ? nl : lx->in_end;
+            break;
+        }
+        case A_COMMENT_END:
+            lx->state = S_START;
+            break;
+        case A_OP_BEGIN:
+            lx->in++;
+            lx->op = op_start(c);
+            lx->state = S_OP;
+            break;
+        case A_OP_NEXT: {
+            enum tok_op longer = op_extend(lx->op, c);
+            if (longer == OP_NONE) return emit_op(lx, tok);
+            lx->in++;
+            lx->op = longer;
+            break;
+        }
+        case A_WORD_BEGIN:
+            lx->len = 0;
+            lx->nspans = 0;
+            lx->depth = 0;
+            lx->digits = true;
+            lx->prev = '\0';
+            lx->state = S_WORD;
+            break;
+        case A_APPEND:
+            append(lx, p, 1);
+            lx->digits = false;
+            lx->in++;
+            break;
+        case A_RUN: {
+            const char *e = p + 1;
+            while (e < lx->in_end && cclass[(unsigned char)*e] == C_OTHER) e++;
+            if (lx->digits) {
+                for (const char *d = p; d < e; d++) {
+                    if (*d < '0' || *d > '9') {
+                        lx->digits = false;
+                        break;
+                    }
+                }
+            }
+            append(lx, p, e - p);
+            lx->in = e;
+            break;
+        }
+        case A_DELIM:
+            if (lx->depth > 0) {
+                append(lx, p, 1);
+                lx->in++;
+                break;
+            }
+            return emit_word(lx, tok, lx->digits && lx->len > 0 && (c == '<' || c == '>'));
+        case A_OPEN:
+            if (lx->depth > 0 || lx->prev == '$') {
+                lx->depth++;
+            } else if (c == '(') {
+                return emit_word(lx, tok, false);  // ( is an operator here
+            }
+            append(lx, p, 1);
+            lx->digits = false;
+            lx->in++;
+            break;
+        case A_CLOSE:
+            if (lx->depth > 0) {
+                lx->depth--;
+            } else if (c == ')') {
+                return emit_word(lx, tok, false);  // ) is an operator here
+            }
+            append(lx, p, 1);
+            lx->digits = false;
+            lx->in++;
+            break;
+        case A_SQ_OPEN:
+            span_open(lx, QUOTE_SINGLE);
+            append(lx, p, 1);
+            lx->in++;
+            lx->state = S_SQ;
+            break;
+        case A_SQ_BODY: {
+            const char *q = memchr(p, '\'', lx->in_end - p);
+            const char *e = q ? q : lx->in_end;
+            append(lx, p, e - p);
+            lx->in = e;
+            break;
+        }
+        case A_SQ_CLOSE:
+        case A_DQ_CLOSE:
+            append(lx, p, 1);
+            lx->in++;
+            span_close(lx);
+            lx->state = S_WORD;
+            break;
+        case A_DQ_OPEN:
+            span_open(lx, QUOTE_DOUBLE);
+            append(lx, p, 1);
+            lx->in++;
+            lx->state = S_DQ;
+            break;
+        case A_DQ_BODY: {
+            const char *e = p + 1;
+            while (e < lx->in_end && *e != '"' && *e != '\\') e++;
+            append(lx, p, e - p);
+            lx->in = e;
+            break;
+        }
+        case A_ESC:
+            span_open(lx, QUOTE_ESCAPE);
+            append(lx, p, 1);
+            lx->in++;
+            lx->state = S_ESC;
+            break;
+        case A_ESC_CHAR:
+            lx->in++;
+            lx->state = S_WORD;
+            if (c == '\n') {
+                lx->len--;        // Line continuation, drop the backslash
+                lx->nspans--;
+                if (lx->len == 0 && lx->nspans == 0) {
+                    lx->state = S_START;  // Nothing of the word was seen yet
+                }
+                break;
+            }
+            append(lx, p, 1);
+            span_close(lx);
+            break;
+        case A_DQ_ESC:
+            append(lx, p, 1);
+            lx->in++;
+            lx->state = S_DQ_ESC;
+            break;
+        case A_DQ_ESC_CHAR:
+            lx->in++;
+            lx->state = S_DQ;
+            if (c == '\n') {
+                lx->len--;        // Line continuation, drop the backslash
+                break;
+            }
+            append(lx, p, 1);
+            break;
+        }
+    }
+    return lex_at_end(lx, tok);
+}
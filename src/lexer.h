@@ -0,0 +1,172 @@
+#ifndef LEXER_H
+#define LEXER_H
+#include <stdlib.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* The kind of token produced by the lexer */
+enum tok_type
+{
+    TOK_WORD,       /* A word, quotes are kept in the text */
+    TOK_IO_NUMBER,  /* Digits directly in front of a redirection, the 2 in 2>file */
+    TOK_OPERATOR,   /* A control operator such as | && ; ( */
+    TOK_REDIRECT,   /* A redirection operator such as > >> < 2>& */
+    TOK_NEWLINE,    /* An unquoted newline */
+    TOK_EOF         /* End of input */
+};
+
+/* Operators recognized by the lexer */
+enum tok_op
+{
+    OP_NONE,
+    /* control operators */
+    OP_PIPE,        /* |  */
+    OP_OR_IF,       /* || */
+    OP_AMP,         /* &  */
+    OP_AND_IF,      /* && */
+    OP_SEMI,        /* ;  */
+    OP_DSEMI,       /* ;; */
+    OP_LPAREN,      /* (  */
+    OP_RPAREN,      /* )  */
+    /* redirection operators */
+    OP_LESS,        /* <  */
+    OP_GREAT,       /* >  */
+    OP_DGREAT,      /* >> */
+    OP_DLESS,       /* << */
+    OP_DLESSDASH,   /* <<- */
+    OP_LESSAND,     /* <& */
+    OP_GREATAND,    /* >& */
+    OP_LESSGREAT,   /* <> */
+    OP_CLOBBER      /* >| */
+};
+
+/* How a region of a word was quoted */
+enum quote_kind
+{
+    QUOTE_SINGLE,   /* '...' */
+    QUOTE_DOUBLE,   /* "..." */
+    QUOTE_ESCAPE    /* \x */
+};
+
+/**
+* @brief A quoted region of a word. Offsets are relative to the start of
+* the token text and include the quote characters themselves.
+*/
+struct quote_span
+{
+    size_t start;
+    size_t len;
+    enum quote_kind kind;
+};
+
+/**
+* @brief A token returned by lex_next. The text and spans are owned by the
+* lexer and stay valid until the next call to lex_next.
+*/
+struct token
+{
+    enum tok_type type;
+    enum tok_op op;
+    const char *text;   /* NUL terminated, raw word text or the operator */
+    size_t len;
+    const struct quote_span *spans;
+    size_t nspans;
+};
+
+/* Return values of lex_next */
+enum lex_status
+{
+    LEX_OK,     /* A token was returned */
+    LEX_MORE,   /* The current chunk is used up, feed more input or call lex_eof */
+    LEX_ERROR   /* Malformed input, see lexer.error */
+};
+
+/**
+* @brief Streaming lexer state. The input is supplied in chunks with
+* lex_feed, a token may span any number of chunks.
+*/
+struct lexer
+{
+    const char *in;
+    const char *in_end;
+    bool eof;
+    int state;
+    enum tok_op op;
+    char *buf;
+    size_t len;
+    size_t cap;
+    struct quote_span *spans;
+    size_t nspans;
+    size_t spans_cap;
+    int depth;          /* nesting inside $( ) and ${ } */
+    bool digits;        /* word so far is all digits */
+    char prev;          /* last byte appended to the word */
+    const char *error;
+};
+
+/**
+* @brief Initialize a lexer. Must be released with lex_destroy.
+*
+* @param lx The lexer
+*/
+
+void lex_init(struct lexer *lx);
+/**
+* @brief Free the buffers held by the lexer.
+*
+* @param lx The lexer
+*/
+
+void lex_destroy(struct lexer *lx);
+/**
+* @brief Discard any partial token and start over, keeping the buffers.
+*
+* @param lx The lexer
+*/
+
+void lex_reset(struct lexer *lx);
+/**
+* @brief Supply the next chunk of input. The chunk is not copied and must
+* stay valid until lex_next returns LEX_MORE.
+*
+* @param lx The lexer
+* @param buf The input bytes
+* @param len The number of bytes
+*/
+
+void lex_feed(struct lexer *lx, const char *buf, size_t len);
+/**
+* @brief Signal that no more input will be fed.
+*
+* @param lx The lexer
+*/
+
+void lex_eof(struct lexer *lx);
+/**
+* @brief Produce the next token. Every input byte is examined once, no
+* backtracking is done and the only allocations are amortized growth of
+* the token buffer.
+*
+* @param lx The lexer
+* @param tok Filled in when LEX_OK is returned
+* @return LEX_OK, LEX_MORE or LEX_ERROR
+*/
+
+enum lex_status lex_next(struct lexer *lx, struct token *tok);
+/**
+* @brief The source text of an operator, for example "&&".
+*
+* @param op The operator
+* @return A static string
+*/
+
+const char *tok_op_str(enum tok_op op);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef LOADABLE_H
+#define LOADABLE_H
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * The interface between the shell and builtins loaded from shared objects
+ * with enable -f. This header is all a loadable builtin needs, it does not
+ * depend on the layout of any shell structure. Only add fields at the end
+ * and bump SHELL_BUILTIN_ABI when doing so.
+ */
+
+/* Version of struct loadable_builtin */
+#define SHELL_BUILTIN_ABI 1
+
+/* The shell, opaque to a loadable builtin */
+struct shell;
+
+/**
+* @brief What a shared object exports for every builtin it provides, under
+* the symbol <name>_builtin. The handler has the same signature as the
+* shell's own builtins: it runs in the shell process, writes to stdout and
+* stderr, and returns the exit status.
+*/
+struct loadable_builtin
+{
+    uint32_t abi;                               /* SHELL_BUILTIN_ABI */
+    const char *name;                           /* the command, the symbol prefix if NULL */
+    int (*fn)(struct shell *sh, char **argv);
+    int (*load)(struct shell *sh);              /* optional, nonzero refuses the load */
+    void (*unload)(struct shell *sh);           /* optional */
+    const char *usage;                          /* one line listed by enable, optional */
+};
+
+/**
+* @brief Define the descriptor of a loadable builtin:
+*
+*   static int hello(struct shell *sh, char **argv) { ... }
+*   SHELL_BUILTIN(hello, hello, "hello [name]");
+*/
+#define SHELL_BUILTIN(name, fn, usage) \
+    const struct loadable_builtin name##_builtin = { SHELL_BUILTIN_ABI, #name, fn, NULL, NULL, usage }
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
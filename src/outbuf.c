@@ -0,0 +1,137 @@
+#include "outbuf.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+void out_init(struct outbuf *o, FILE *f) {
+    o->f = f;
+    o->err = 0;
+    o->n = 0;
+    o->used = 0;
+}
+
+/*
+ * out_flush:
+ *  - Purpose: Write everything collected so far.
+ *      * Pending stdio output goes first so the two never reorder.
+ *      * A stdout that has no descriptor (the spliced stream of a
+ *        pipeline stage, see exec.c) is written with fwrite instead.
+ */
+void out_flush(struct outbuf *o) {
+    int fd = fileno(o->f);
+    struct iovec *v = o->iov;
+    int n = o->n;
+    if (n > 0 && !o->err) {
+        if (fd < 0) {
+            for (int i = 0; i < n; i++) fwrite(v[i].iov_base, 1, v[i].iov_len, o->f);
+        } else {
+            fflush(o->f);
+        }
+    }
+    while (fd >= 0 && n > 0 && !o->err) {
+        ssize_t w = writev(fd, v, n);
+        if (w < 0) {
+            if (errno != EINTR) o->err = errno;
+            continue;
+        }
+        while (n > 0 && (size_t)w >= v->iov_len) {
+            w -= v->iov_len;
+            v++;
+            n--;
+        }
+        if (n > 0) {
+            v->iov_base = (char *)v->iov_base + w;
+            v->iov_len -= w;
+        }
+    }
+    o->n = 0;
+    o->used = 0;
+}
+
+void out_copy(struct outbuf *o, const char *s, size_t len) {
+    while (len > 0) {
+        if (o->used == OUT_BUF) out_flush(o);
+        char *d = o->buf + o->used;
+        struct iovec *last = o->n ? &o->iov[o->n - 1] : NULL;
+        bool joins = last && (char *)last->iov_base + last->iov_len == d;
+        if (!joins && o->n == OUT_IOV) {
+            out_flush(o);
+            d = o->buf;
+        }
+        size_t k = OUT_BUF - o->used < len ? OUT_BUF - o->used : len;
+        memcpy(d, s, k);
+        o->used += k;
+        if (joins) {
+            last->iov_len += k;
+        } else {
+            o->iov[o->n].iov_base = d;
+            o->iov[o->n].iov_len = k;
+            o->n++;
+        }
+        s += k;
+        len -= k;
+    }
+}
+
+/*
+ * out_write:
+ *  - Purpose: Add s to the output. s must stay valid until the next flush,
+ *    which holds for arguments and anything else owned by the caller.
+ */
+void out_write(struct outbuf *o, const char *s, size_t len) {
+    if (len < OUT_REF_MIN) {
+        out_copy(o, s, len);
+        return;
+    }
+    out_ref(o, s, len);
+}
+
+void out_ref(struct outbuf *o, const char *s, size_t len) {
+    if (len == 0) return;
+    if (o->n == OUT_IOV) out_flush(o);
+    o->iov[o->n].iov_base = (void *)s;
+    o->iov[o->n].iov_len = len;
+    o->n++;
+}
+
+void out_char(struct outbuf *o, char c) {
+    out_copy(o, &c, 1);
+}
+
+void out_fmt(struct outbuf *o, const char *spec, ...) {
+    char tmp[256];
+    va_list ap;
+    va_start(ap, spec);
+    int len = vsnprintf(tmp, sizeof(tmp), spec, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if ((size_t)len < sizeof(tmp)) {
+        out_copy(o, tmp, len);
+        return;
+    }
+    char *big = malloc(len + 1);
+    if (!big) {
+        fprintf(stderr, "outbuf: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    va_start(ap, spec);
+    vsnprintf(big, len + 1, spec, ap);
+    va_end(ap);
+    out_copy(o, big, len);
+    free(big);
+}
+
+/*
+ * out_finish:
+ *  - Purpose: Flush and turn a write error into a message and status 1.
+ */
+int out_finish(struct outbuf *o, const char *name, int status) {
+    out_flush(o);
+    if (o->err) {
+        fprintf(stderr, "%s: write error: %s\n", name, strerror(o->err));
+        return 1;
+    }
+    return status;
+}
+
@@ -0,0 +1,105 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define OUT_IOV 256         /* well below any IOV_MAX */
+#define OUT_BUF 4096
+#define OUT_REF_MIN 128     /* longer strings are referenced, not copied */
+
+/**
+* @brief Output of a builtin. Short pieces are copied into buf, long ones
+* are referenced in place, and everything goes out with one writev() per
+* flush. Lives on the stack of the builtin.
+*/
+struct outbuf
+{
+    FILE *f;
+    int err;                /* errno of the first failed write */
+    int n;
+    size_t used;
+    struct iovec iov[OUT_IOV];
+    char buf[OUT_BUF];
+};
+
+/**
+* @brief Start collecting output for a stream.
+*
+* @param o The buffer
+* @param f The stream, normally stdout
+*/
+
+void out_init(struct outbuf *o, FILE *f);
+/**
+* @brief Write everything collected so far.
+*
+* @param o The buffer
+*/
+
+void out_flush(struct outbuf *o);
+/**
+* @brief Add a copy of s.
+*
+* @param o The buffer
+* @param s The bytes
+* @param len Their number
+*/
+
+void out_copy(struct outbuf *o, const char *s, size_t len);
+/**
+* @brief Add s, copied if it is short and referenced otherwise. s must stay
+* valid until the next flush.
+*
+* @param o The buffer
+* @param s The bytes
+* @param len Their number
+*/
+
+void out_write(struct outbuf *o, const char *s, size_t len);
+/**
+* @brief Add s without copying it, whatever its length. s must stay valid
+* until the next flush.
+*
+* @param o The buffer
+* @param s The bytes
+* @param len Their number
+*/
+
+void out_ref(struct outbuf *o, const char *s, size_t len);
+/**
+* @brief Add one byte.
+*
+* @param o The buffer
+* @param c The byte
+*/
+
+void out_char(struct outbuf *o, char c);
+/**
+* @brief Add printf formatted output.
+*
+* @param o The buffer
+* @param spec The printf format
+*/
+
+void out_fmt(struct outbuf *o, const char *spec, ...);
+/**
+* @brief Flush, and turn a write error into a message and status 1.
+*
+* @param o The buffer
+* @param name The builtin, for the message
+* @param status The status to return when everything was written
+* @return status, or 1 after a write error
+*/
+
+int out_finish(struct outbuf *o, const char *name, int status);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+#include "pathcache.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+ * hash_name:
+ *  - Purpose: 64 bit FNV-1a hash of a command name.
+ */
+static uint64_t hash_name(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static char *xstrdup(const char *s) {
+    char *d = strdup(s);
+    if (!d) {
+        fprintf(stderr, "path_cache: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return d;
+}
+
+void path_cache_init(struct path_cache *pc) {
+    memset(pc, 0, sizeof(*pc));
+    pc->recheck_ns = PATH_CACHE_RECHECK_NS;
+}
+
+/*
+ * free_entries / free_dirs:
+ *  - Purpose: Release the table entries and the split $PATH.
+ */
+static void free_entries(struct path_cache *pc) {
+    for (size_t i = 0; i < pc->cap; i++) {
+        if (pc->slots[i].name) {
+            free(pc->slots[i].name);
+            free(pc->slots[i].path);
+            pc->slots[i].name = pc->slots[i].path = NULL;
+        }
+    }
+    pc->count = 0;
+}
+
+static void free_dirs(struct path_cache *pc) {
+    for (size_t i = 0; i < pc->ndirs; i++) {
+        free(pc->dirs[i].dir);
+    }
+    free(pc->dirs);
+    free(pc->path_env);
+    pc->dirs = NULL;
+    pc->ndirs = 0;
+    pc->path_env = NULL;
+}
+
+void path_cache_destroy(struct path_cache *pc) {
+    free_entries(pc);
+    free(pc->slots);
+    free_dirs(pc);
+    path_cache_init(pc);
+}
+
+void path_cache_clear(struct path_cache *pc) {
+    free_entries(pc);
+}
+
+/*
+ * dir_mtime:
+ *  - Purpose: Modification time of a directory, zero if it cannot be read.
+ */
+static struct timespec dir_mtime(const char *dir) {
+    struct stat st;
+    struct timespec zero = {0, 0};
+    return stat(dir, &st) == 0 ? st.st_mtim : zero;
+}
+
+/*
+ * split_path:
+ *  - Purpose: Split $PATH into directories and record their mtimes. An empty
+ *    component means the current directory, as it does for execvp.
+ */
+static void split_path(struct path_cache *pc, const char *path) {
+    free_dirs(pc);
+    pc->path_env = xstrdup(path);
+    size_t n = 1;
+    for (const char *p = path; *p; p++) n += *p == ':';
+    pc->dirs = calloc(n, sizeof(*pc->dirs));
+    if (!pc->dirs) {
+        fprintf(stderr, "path_cache: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    const char *p = path;
+    for (;;) {
+        const char *e = strchr(p, ':');
+        size_t len = e ? (size_t)(e - p) : strlen(p);
+        char *dir = len ? strndup(p, len) : xstrdup(".");
+        pc->dirs[pc->ndirs].dir = dir ? dir : xstrdup(".");
+        pc->dirs[pc->ndirs].mtime = dir_mtime(pc->dirs[pc->ndirs].dir);
+        pc->ndirs++;
+        if (!e) break;
+        p = e + 1;
+    }
+    pc->checked = now_ns();
+}
+
+/*
+ * revalidate:
+ *  - Purpose: Throw the table away when it may be stale.
+ *      * A different $PATH resplits the directories.
+ *      * Once every recheck_ns the directory mtimes are compared with the
+ *        ones recorded, any change means a command may have appeared or
+ *        disappeared somewhere, so every entry is dropped.
+ */
+static void revalidate(struct path_cache *pc, const char *path) {
+    if (!path) path = "/usr/local/bin:/bin:/usr/bin";  // the execvp default
+    if (!pc->path_env || strcmp(path, pc->path_env) != 0) {
+        free_entries(pc);
+        split_path(pc, path);
+        return;
+    }
+    int64_t now = now_ns();
+    if (now - pc->checked < pc->recheck_ns) return;
+    pc->checked = now;
+    bool changed = false;
+    for (size_t i = 0; i < pc->ndirs; i++) {
+        struct timespec m = dir_mtime(pc->dirs[i].dir);
+        if (m.tv_sec != pc->dirs[i].mtime.tv_sec || m.tv_nsec != pc->dirs[i].mtime.tv_nsec) {
+            pc->dirs[i].mtime = m;
+            changed = true;
+        }
+    }
+    if (changed) free_entries(pc);
+}
+
+/*
+ * find_slot:
+ *  - Purpose: Linear probe for name. Returns the slot holding it or the empty
+ *    slot where it would be inserted.
+ */
+static struct path_entry *find_slot(struct path_cache *pc, const char *name, uint64_t h) {
+    size_t mask = pc->cap - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        struct path_entry *e = &pc->slots[i];
+        if (!e->name || (e->hash == h && strcmp(e->name, name) == 0)) return e;
+    }
+}
+
+/*
+ * grow:
+ *  - Purpose: Double the table, keeping the load factor at or below one half.
+ */
+static void grow(struct path_cache *pc) {
+    struct path_entry *old = pc->slots;
+    size_t oldcap = pc->cap;
+    pc->cap = oldcap ? oldcap * 2 : 64;
+    pc->slots = calloc(pc->cap, sizeof(*pc->slots));
+    if (!pc->slots) {
+        fprintf(stderr, "path_cache: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].name) *find_slot(pc, old[i].name, old[i].hash) = old[i];
+    }
+    free(old);
+}
+
+/*
+ * resolve:
+ *  - Purpose: Search the directories in order for a regular executable file.
+ */
+static char *resolve(struct path_cache *pc, const char *name, size_t *dir) {
+    size_t nlen = strlen(name);
+    for (size_t i = 0; i < pc->ndirs; i++) {
+        size_t dlen = strlen(pc->dirs[i].dir);
+        char *full = malloc(dlen + nlen + 2);
+        if (!full) {
+            fprintf(stderr, "path_cache: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(full, pc->dirs[i].dir, dlen);
+        full[dlen] = '/';
+        memcpy(full + dlen + 1, name, nlen + 1);
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111)) {
+            *dir = i;
+            return full;
+        }
+        free(full);
+    }
+    return NULL;
+}
+
+/*
+ * path_cache_lookup:
+ *  - Purpose: Return the cached path of name, resolving and caching it on a
+ *    miss. A hit touches only the table.
+ */
+const char *path_cache_lookup(struct path_cache *pc, const char *path, const char *name) {
+    if (strchr(name, '/')) return name;
+    revalidate(pc, path);
+    if ((pc->count + 1) * 2 > pc->cap) grow(pc);
+    uint64_t h = hash_name(name);
+    struct path_entry *e = find_slot(pc, name, h);
+    if (e->name) {
+        pc->hits++;
+        e->hits++;
+        return e->path;
+    }
+    pc->misses++;
+    e->name = xstrdup(name);
+    e->hash = h;
+    e->hits = 1;
+    e->dir = 0;
+    e->path = resolve(pc, name, &e->dir);
+    pc->count++;
+    return e->path;
+}
+
+/*
+ * path_cache_forget:
+ *  - Purpose: Remove one entry using backward shift deletion, so the probe
+ *    sequences of the remaining entries stay intact without tombstones.
+ */
+void path_cache_forget(struct path_cache *pc, const char *name) {
+    if (!pc->cap) return;
+    size_t mask = pc->cap - 1;
+    struct path_entry *e = find_slot(pc, name, hash_name(name));
+    if (!e->name) return;
+    free(e->name);
+    free(e->path);
+    size_t hole = e - pc->slots;
+    for (size_t i = (hole + 1) & mask; pc->slots[i].name; i = (i + 1) & mask) {
+        size_t home = pc->slots[i].hash & mask;
+        // Move the entry back if its home is not between the hole and i
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            pc->slots[hole] = pc->slots[i];
+            hole = i;
+        }
+    }
+    pc->slots[hole].name = pc->slots[hole].path = NULL;
+    pc->count--;
+}
+
+/*
+ * path_cache_builtin:
+ *  - Purpose: Implement the hash builtin on top of the cache.
+ */
+int path_cache_builtin(struct path_cache *pc, const char *path, char **argv) {
+    int status = 0;
+    if (!argv[1]) {
+        revalidate(pc, path);
+        if (pc->count) printf("hits\tcommand\n");
+        for (size_t i = 0; i < pc->cap; i++) {
+            struct path_entry *e = &pc->slots[i];
+            if (e->name && e->path) printf("%4lu\t%s\n", e->hits, e->path);
+        }
+        printf("hash: %lu hits, %lu misses\n", pc->hits, pc->misses);
+        return 0;
+    }
+    if (strcmp(argv[1], "-r") == 0) {
+        path_cache_clear(pc);
+        return 0;
+    }
+    if (strcmp(argv[1], "-d") == 0) {
+        for (int i = 2; argv[i]; i++) {
+            path_cache_forget(pc, argv[i]);
+        }
+        return 0;
+    }
+    for (int i = 1; argv[i]; i++) {
+        if (!path_cache_lookup(pc, path, argv[i])) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,115 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Default minimum time between two scans of the PATH directory mtimes */
+#define PATH_CACHE_RECHECK_NS 100000000L
+
+/* A cached command, path is NULL when the command was not found */
+struct path_entry
+{
+    char *name;
+    char *path;
+    size_t dir;         /* index of the directory it was found in */
+    uint64_t hash;
+    unsigned long hits;
+};
+
+/* A directory of $PATH and the modification time it had when it was scanned */
+struct path_dir
+{
+    char *dir;
+    struct timespec mtime;
+};
+
+/**
+* @brief A hash table from command name to absolute path, in the spirit of
+* the bash hash builtin. Entries are filled lazily, "not found" results are
+* cached too, and the table is invalidated when $PATH changes or when the
+* modification time of one of the directories changes. Directory mtimes are
+* checked at most once every recheck_ns so a hit normally costs no system
+* call at all.
+*/
+struct path_cache
+{
+    struct path_entry *slots;   /* open addressing, linear probing */
+    size_t cap;                 /* power of two */
+    size_t count;
+    char *path_env;             /* $PATH the directories were split from */
+    struct path_dir *dirs;
+    size_t ndirs;
+    int64_t checked;            /* monotonic time of the last mtime scan, in ns */
+    int64_t recheck_ns;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/**
+* @brief Initialize an empty cache.
+*
+* @param pc The cache
+*/
+
+void path_cache_init(struct path_cache *pc);
+/**
+* @brief Free everything held by the cache.
+*
+* @param pc The cache
+*/
+
+void path_cache_destroy(struct path_cache *pc);
+/**
+* @brief Resolve a command name to the absolute path that execvp would run.
+* Names containing a slash are returned unchanged.
+*
+* @param pc The cache
+* @param path The value of $PATH, NULL if it is not set
+* @param name The command name
+* @return The path, or NULL if the command is not on $PATH. The string is
+* owned by the cache and valid until the next call.
+*/
+
+const char *path_cache_lookup(struct path_cache *pc, const char *path, const char *name);
+/**
+* @brief Drop one command from the cache, for example after exec reported
+* that the cached file no longer exists.
+*
+* @param pc The cache
+* @param name The command name
+*/
+
+void path_cache_forget(struct path_cache *pc, const char *name);
+/**
+* @brief Drop every command from the cache.
+*
+* @param pc The cache
+*/
+
+void path_cache_clear(struct path_cache *pc);
+/**
+* @brief The hash builtin.
+*   hash            list the cached commands with their hit counts
+*   hash -r         forget every command
+*   hash -d name    forget the named commands
+*   hash name       look up and remember the named commands
+*
+* @param pc The cache
+* @param path The value of $PATH, NULL if it is not set
+* @param argv The arguments, argv[0] is "hash"
+* @return The exit status
+*/
+
+int path_cache_builtin(struct path_cache *pc, const char *path, char **argv);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
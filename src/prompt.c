@@ -0,0 +1,321 @@
+#define _GNU_SOURCE  /* open_memstream */
+#include "prompt.h"
+#include "event.h"
+#include "vars.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* readline's markers around bytes that do not move the cursor */
+#define PROMPT_IGNORE_START '\001'
+#define PROMPT_IGNORE_END '\002'
+
+static char *xstrdup(const char *s) {
+    char *d = strdup(s);
+    if (!d) {
+        fprintf(stderr, "prompt: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return d;
+}
+
+static bool same_string(const char *a, const char *b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+/*
+ * read_small:
+ *  - Purpose: Read the start of a small file, NUL terminated and without
+ *    its trailing newline.
+ *  - Returns: false if the file could not be read.
+ */
+static bool read_small(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) return false;
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return true;
+}
+
+/*
+ * find_head:
+ *  - Purpose: Walk up from dir to the first directory with a .git entry.
+ *    A .git directory holds HEAD itself; a .git file, as in worktrees and
+ *    submodules, names the directory that does.
+ *  - Returns: The path of HEAD, or NULL outside a repository.
+ */
+static char *find_head(const char *dir) {
+    char *path = xstrdup(dir);
+    char *head = NULL;
+    for (;;) {
+        struct stat st;
+        char link[4096];
+        char *git = NULL;
+        if (asprintf(&git, "%s/.git", strcmp(path, "/") ? path : "") < 0) break;
+        bool found = stat(git, &st) == 0;
+        if (found && S_ISDIR(st.st_mode)) {
+            if (asprintf(&head, "%s/HEAD", git) < 0) head = NULL;
+        } else if (found && S_ISREG(st.st_mode) && read_small(git, link, sizeof(link)) &&
+                   strncmp(link, "gitdir: ", 8) == 0) {
+            const char *to = link + 8;
+            int r = to[0] == '/' ? asprintf(&head, "%s/HEAD", to)
+                                 : asprintf(&head, "%s/%s/HEAD", path, to);
+            if (r < 0) head = NULL;
+        }
+        free(git);
+        if (head || strcmp(path, "/") == 0) break;
+        char *slash = strrchr(path, '/');
+        if (!slash) break;
+        slash[slash == path] = '\0';
+    }
+    free(path);
+    return head;
+}
+
+/*
+ * vcs_branch:
+ *  - Purpose: Read the branch from HEAD, which is either a symbolic ref or
+ *    the id of a detached commit.
+ */
+char *vcs_branch(const char *dir, char **head) {
+    char buf[256];
+    char *path = find_head(dir);
+    char *branch = NULL;
+    if (path && read_small(path, buf, sizeof(buf))) {
+        if (strncmp(buf, "ref: refs/heads/", 16) == 0) {
+            branch = xstrdup(buf + 16);
+        } else if (strncmp(buf, "ref: ", 5) == 0) {
+            branch = xstrdup(buf + 5);
+        } else {
+            buf[7] = '\0';
+            branch = xstrdup(buf);
+        }
+    }
+    if (head) {
+        *head = path;
+    } else {
+        free(path);
+    }
+    return branch;
+}
+
+static bool head_mtime(const char *head, struct timespec *m) {
+    struct stat st;
+    if (!head || stat(head, &st) != 0) return false;
+    *m = st.st_mtim;
+    return true;
+}
+
+/*
+ * lookup_thread:
+ *  - Purpose: Look up the branch of each requested directory.
+ *      * Only this thread writes cwd, branch, head and head_mtime, so it
+ *        reads them without the lock; the shell reads them with it.
+ *      * Asking again for the same directory costs one stat() of HEAD,
+ *        the file is only read when its mtime changed.
+ *      * The shell is woken only when the branch it shows is wrong.
+ */
+static void *lookup_thread(void *arg) {
+    struct prompt_cache *pc = arg;
+    pthread_mutex_lock(&pc->lock);
+    for (;;) {
+        while (!pc->want && !pc->stop) pthread_cond_wait(&pc->cond, &pc->lock);
+        if (pc->stop) break;
+        char *dir = pc->want;
+        pc->want = NULL;
+        pthread_mutex_unlock(&pc->lock);
+        struct timespec m = {0, 0};
+        bool same = pc->head && same_string(dir, pc->cwd) && head_mtime(pc->head, &m) &&
+                    m.tv_sec == pc->head_mtime.tv_sec && m.tv_nsec == pc->head_mtime.tv_nsec;
+        char *head = NULL;
+        char *branch = same ? NULL : vcs_branch(dir, &head);
+        if (!same) head_mtime(head, &m);
+        pthread_mutex_lock(&pc->lock);
+        if (same) {
+            free(dir);
+            continue;
+        }
+        bool changed = !same_string(branch, pc->branch);
+        free(pc->cwd);
+        free(pc->branch);
+        free(pc->head);
+        pc->cwd = dir;
+        pc->branch = branch;
+        pc->head = head;
+        pc->head_mtime = m;
+        if (changed) {
+            pc->changed = true;
+            event_wake(pc->events);
+        }
+    }
+    pthread_mutex_unlock(&pc->lock);
+    return NULL;
+}
+
+/*
+ * request_branch:
+ *  - Purpose: Hand dir to the lookup thread, starting it on first use. A
+ *    request that was not picked up yet is replaced.
+ */
+static void request_branch(struct prompt_cache *pc, struct shell *sh, const char *dir) {
+    if (!pc->started) {
+        // Without the wakeup the branch still shows, one prompt late
+        event_enable_wake(sh->events);
+        pc->events = sh->events;
+        if (pthread_create(&pc->thread, NULL, lookup_thread, pc) != 0) return;
+        pc->started = true;
+    }
+    pthread_mutex_lock(&pc->lock);
+    free(pc->want);
+    pc->want = xstrdup(dir);
+    pthread_cond_signal(&pc->cond);
+    pthread_mutex_unlock(&pc->lock);
+}
+
+static struct prompt_cache *get_cache(struct shell *sh) {
+    if (sh->prompt_cache) return sh->prompt_cache;
+    struct prompt_cache *pc = calloc(1, sizeof(*pc));
+    if (!pc) {
+        fprintf(stderr, "prompt: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pc->lock, NULL);
+    pthread_cond_init(&pc->cond, NULL);
+    struct passwd *pw = getpwuid(getuid());
+    pc->user = xstrdup(pw ? pw->pw_name : "");
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) host[0] = '\0';
+    host[sizeof(host) - 1] = '\0';
+    pc->host = xstrdup(host);
+    sh->prompt_cache = pc;
+    return pc;
+}
+
+/*
+ * put_duration:
+ *  - Purpose: 35ms, 1.2s, 3m07s.
+ */
+static void put_duration(FILE *f, uint64_t ns) {
+    uint64_t ms = ns / 1000000;
+    if (ms < 1000) {
+        fprintf(f, "%lums", (unsigned long)ms);
+    } else if (ms < 60000) {
+        fprintf(f, "%.1fs", ms / 1000.0);
+    } else {
+        fprintf(f, "%lum%02lus", (unsigned long)(ms / 60000), (unsigned long)(ms / 1000 % 60));
+    }
+}
+
+/*
+ * put_dir:
+ *  - Purpose: \w and \W. The home directory and what is below it start
+ *    with ~.
+ */
+static void put_dir(FILE *f, const char *home, const char *cwd, bool last) {
+    size_t hlen = home ? strlen(home) : 0;
+    if (hlen > 1 && strncmp(cwd, home, hlen) == 0 && (cwd[hlen] == '/' || !cwd[hlen])) {
+        if (!cwd[hlen]) {
+            fputc('~', f);
+            return;
+        }
+        if (!last) {
+            fputc('~', f);
+            cwd += hlen;
+        }
+    }
+    const char *slash = strrchr(cwd, '/');
+    if (last && slash && slash[1]) cwd = slash + 1;
+    fputs(cwd, f);
+}
+
+/*
+ * prompt_render:
+ *  - Purpose: Expand the escapes of the template. Everything but the branch
+ *    is computed here, from values that are either cached or cheap.
+ */
+const char *prompt_render(struct shell *sh) {
+    struct prompt_cache *pc = get_cache(sh);
+    char *buf = NULL, *cwd = NULL;
+    size_t len;
+    FILE *f = open_memstream(&buf, &len);
+    if (!f) {
+        fprintf(stderr, "prompt: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (const char *p = sh->prompt ? sh->prompt : ""; *p; p++) {
+        if (*p != '\\' || !p[1]) {
+            fputc(*p, f);
+            continue;
+        }
+        char c = *++p;
+        if ((c == 'w' || c == 'W' || c == 'b') && !cwd) {
+            cwd = getcwd(NULL, 0);
+            if (!cwd) cwd = xstrdup("?");
+        }
+        switch (c) {
+        case 'u': fputs(pc->user, f); break;
+        case 'h': fwrite(pc->host, 1, strcspn(pc->host, "."), f); break;
+        case 'H': fputs(pc->host, f); break;
+        case 'w': put_dir(f, vars_get(sh->vars, "HOME"), cwd, false); break;
+        case 'W': put_dir(f, vars_get(sh->vars, "HOME"), cwd, true); break;
+        case '$': fputc(geteuid() == 0 ? '#' : '$', f); break;
+        case '?': fprintf(f, "%d", sh->last_status); break;
+        case 'D': put_duration(f, sh->last_ns); break;
+        case 'n': fputc('\n', f); break;
+        case '\\': fputc('\\', f); break;
+        case '[': fputc(PROMPT_IGNORE_START, f); break;
+        case ']': fputc(PROMPT_IGNORE_END, f); break;
+        case 'b':
+            request_branch(pc, sh, cwd);
+            pthread_mutex_lock(&pc->lock);
+            if (pc->branch) fputs(pc->branch, f);
+            pc->changed = false;
+            pthread_mutex_unlock(&pc->lock);
+            break;
+        default:
+            fputc('\\', f);
+            fputc(c, f);
+        }
+    }
+    fclose(f);
+    free(cwd);
+    free(pc->line);
+    pc->line = buf;
+    return buf;
+}
+
+bool prompt_stale(struct shell *sh) {
+    struct prompt_cache *pc = sh->prompt_cache;
+    if (!pc) return false;
+    pthread_mutex_lock(&pc->lock);
+    bool changed = pc->changed;
+    pthread_mutex_unlock(&pc->lock);
+    return changed;
+}
+
+void prompt_cache_destroy(struct prompt_cache *pc) {
+    if (!pc) return;
+    if (pc->started) {
+        pthread_mutex_lock(&pc->lock);
+        pc->stop = true;
+        pthread_cond_signal(&pc->cond);
+        pthread_mutex_unlock(&pc->lock);
+        pthread_join(pc->thread, NULL);
+    }
+    pthread_mutex_destroy(&pc->lock);
+    pthread_cond_destroy(&pc->cond);
+    free(pc->user);
+    free(pc->host);
+    free(pc->line);
+    free(pc->want);
+    free(pc->cwd);
+    free(pc->branch);
+    free(pc->head);
+    free(pc);
+}
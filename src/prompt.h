@@ -0,0 +1,100 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Prompt escapes, expanded from $MY_PROMPT before every line:
+ *
+ *     \u     user name
+ *     \h     host name up to the first dot
+ *     \H     host name
+ *     \w     working directory, with $HOME shown as ~
+ *     \W     last part of the working directory
+ *     \$     # for root, $ for everyone else
+ *     \?     exit status of the last command
+ *     \D     how long the last command line took
+ *     \b     VCS branch
+ *     \n     newline
+ *     \\     backslash
+ *     \[ \]  around bytes that take no space, such as colors
+ *
+ * \b is the only expensive one. It is looked up on a thread and the prompt
+ * uses whatever was found last, so a new directory first shows the old
+ * branch and is redrawn when the lookup finishes.
+ */
+
+/**
+* @brief What the prompt needs that is worth keeping between prompts. The
+* branch fields belong to the thread while lock is not held.
+*/
+struct prompt_cache
+{
+    char *user;         /* looked up once */
+    char *host;
+    char *line;         /* the last expansion */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool started;
+    bool stop;
+    char *want;         /* directory to look up next, NULL if none */
+    char *cwd;          /* directory branch was found for */
+    char *branch;       /* NULL outside a repository */
+    char *head;         /* the HEAD file branch was read from */
+    struct timespec head_mtime;
+    bool changed;       /* branch changed since the last expansion */
+    struct event_loop *events;  /* woken when branch changes */
+};
+
+/**
+* @brief Expand the prompt template in sh->prompt. Starts a branch lookup
+* when the template uses \b.
+*
+* @param sh The shell
+* @return The prompt, valid until the next call
+*/
+
+const char *prompt_render(struct shell *sh);
+/**
+* @brief Tell whether a lookup finished with a different result since the
+* prompt was last expanded, in which case it should be drawn again.
+*
+* @param sh The shell
+* @return True if prompt_render would now give a different prompt
+*/
+
+bool prompt_stale(struct shell *sh);
+/**
+* @brief The branch checked out in the repository dir is in. Only reads
+* files: .git/HEAD, or the HEAD of the directory a .git file points to.
+*
+* @param dir An absolute directory
+* @param head Set to the HEAD file that was read, which the caller frees;
+* may be NULL
+* @return The branch, or a short commit id when HEAD is detached, or NULL
+* outside a repository; the caller frees it
+*/
+
+char *vcs_branch(const char *dir, char **head);
+/**
+* @brief Stop the lookup thread and free the cache.
+*
+* @param pc The cache, may be NULL
+*/
+
+void prompt_cache_destroy(struct prompt_cache *pc);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+#include "reader.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define READ_BLOCK (64 * 1024)
+
+void line_reader_init(struct line_reader *r, int fd) {
+    struct stat st;
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (r->seekable) {
+        r->end = lseek(fd, 0, SEEK_CUR);
+        if (r->end < 0) r->seekable = false;
+    }
+}
+
+void line_reader_destroy(struct line_reader *r) {
+    free(r->buf);
+    r->buf = NULL;
+    r->cap = r->len = r->pos = 0;
+}
+
+/*
+ * fill:
+ *  - Purpose: Read the next block behind the partial line at pos.
+ *      * The partial line is moved to the front first, and the buffer only
+ *        grows when a single line does not fit.
+ *      * One byte is always kept free so a last line without a newline can
+ *        be terminated in place.
+ *  - Returns: false at end of input or on an error.
+ */
+static bool fill(struct line_reader *r) {
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+    if (r->cap - r->len < READ_BLOCK / 2) {
+        size_t cap = r->cap ? r->cap * 2 : READ_BLOCK;
+        char *buf = realloc(r->buf, cap);
+        if (!buf) {
+            fprintf(stderr, "reader: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        r->buf = buf;
+        r->cap = cap;
+    }
+    ssize_t n;
+    do {
+        n = read(r->fd, r->buf + r->len, r->cap - r->len - 1);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) perror("read");
+    if (n <= 0) {
+        r->eof = true;
+        return false;
+    }
+    r->len += n;
+    r->end += n;
+    return true;
+}
+
+/*
+ * line_reader_next:
+ *  - Purpose: Hand out the next line from the buffer.
+ *      * The newline is found with memchr, which glibc vectorizes, so a
+ *        block costs one read() and one pass over its bytes.
+ */
+ssize_t line_reader_next(struct line_reader *r, char **line) {
+    size_t scanned = r->pos;
+    for (;;) {
+        char *nl = r->len > scanned ? memchr(r->buf + scanned, '\n', r->len - scanned) : NULL;
+        if (nl) {
+            *nl = '\0';
+            *line = r->buf + r->pos;
+            ssize_t n = nl - *line;
+            r->pos = nl + 1 - r->buf;
+            r->lineno++;
+            return n;
+        }
+        // Bytes already searched are not searched again after the refill
+        scanned = r->len - r->pos;
+        if (r->eof || !fill(r)) break;
+    }
+    if (r->pos == r->len) return -1;
+    r->buf[r->len] = '\0';
+    *line = r->buf + r->pos;
+    ssize_t n = r->len - r->pos;
+    r->pos = r->len;
+    r->lineno++;
+    return n;
+}
+
+/*
+ * line_reader_at_end:
+ *  - Purpose: Look for more input. Buffered bytes count as more input even
+ *    when they are only blank lines, a pipe is never read ahead.
+ */
+bool line_reader_at_end(struct line_reader *r) {
+    if (r->pos < r->len) return false;
+    if (r->eof) return true;
+    if (!r->seekable) return false;
+    return !fill(r);
+}
+
+void line_reader_share(struct line_reader *r) {
+    if (!r->seekable) return;
+    lseek(r->fd, r->end - (off_t)(r->len - r->pos), SEEK_SET);
+}
+
+void line_reader_resume(struct line_reader *r) {
+    if (!r->seekable) return;
+    off_t off = lseek(r->fd, 0, SEEK_CUR);
+    if (off < 0) return;
+    if (off == r->end - (off_t)(r->len - r->pos)) {
+        lseek(r->fd, r->end, SEEK_SET);
+        return;
+    }
+    // The command read some of the input, continue after it
+    r->pos = r->len = 0;
+    r->end = off;
+    r->eof = false;
+}
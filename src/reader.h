@@ -0,0 +1,92 @@
+#ifndef READER_H
+#define READER_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+* @brief Reads commands from a script or a pipe a block at a time and hands
+* them out a line at a time. Used instead of readline when the shell is not
+* interactive.
+*/
+struct line_reader
+{
+    int fd;
+    bool seekable;      /* fd is a regular file, see line_reader_share */
+    bool eof;
+    char *buf;
+    size_t cap;
+    size_t pos;         /* start of the next line */
+    size_t len;         /* bytes in buf */
+    off_t end;          /* file offset of buf + len, when seekable */
+    unsigned long lineno;
+};
+
+/**
+* @brief Initialize a reader. The descriptor is not closed by
+* line_reader_destroy.
+*
+* @param r The reader
+* @param fd The descriptor to read from
+*/
+
+void line_reader_init(struct line_reader *r, int fd);
+/**
+* @brief Free the buffer of a reader.
+*
+* @param r The reader
+*/
+
+void line_reader_destroy(struct line_reader *r);
+/**
+* @brief Return the next line, without its newline and terminated by a NUL.
+* The line stays valid until the next call. A last line without a newline
+* is returned as well.
+*
+* @param r The reader
+* @param line Set to the line
+* @return The length of the line, or -1 at end of input or on a read error
+*/
+
+ssize_t line_reader_next(struct line_reader *r, char **line);
+/**
+* @brief Tell whether the last line has been handed out. This may read
+* ahead, but only from a regular file, so it never blocks. Since it moves the
+* file offset it must not be called between line_reader_share and
+* line_reader_resume.
+*
+* @param r The reader
+* @return True if line_reader_next is known to return -1 next; false if
+* there is more input or that cannot be known without blocking
+*/
+
+bool line_reader_at_end(struct line_reader *r);
+/**
+* @brief Before running a command, move the file offset back to the end of
+* the lines handed out so far, so a command that reads the same input
+* starts where the shell stopped. Only regular files can do this; on a pipe
+* whatever the reader buffered is not seen by commands.
+*
+* @param r The reader
+*/
+
+void line_reader_share(struct line_reader *r);
+/**
+* @brief After the command, put the offset back where the reader left it.
+* If the command consumed input the buffered lines are dropped and reading
+* continues after what it consumed.
+*
+* @param r The reader
+*/
+
+void line_reader_resume(struct line_reader *r);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,218 @@
+#include "scan.h"
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/*
+ * A set of kernels. One of these is chosen at runtime and every call goes
+ * through the active set.
+ */
+struct ws_kernels {
+    const char *name;
+    const char *(*skip)(const char *p, const char *end);
+    const char *(*find)(const char *p, const char *end);
+    const char *(*rskip)(const char *begin, const char *end);
+};
+
+static inline int is_ws(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/*
+ * Scalar kernels:
+ *  - Purpose: Portable byte at a time versions. They are also used by the
+ *    vector kernels to finish the tail of a range that is shorter than one
+ *    vector.
+ */
+static const char *skip_scalar(const char *p, const char *end) {
+    while (p < end && is_ws((unsigned char)*p)) p++;
+    return p;
+}
+
+static const char *find_scalar(const char *p, const char *end) {
+    while (p < end && !is_ws((unsigned char)*p)) p++;
+    return p;
+}
+
+static const char *rskip_scalar(const char *begin, const char *end) {
+    while (end > begin && is_ws((unsigned char)end[-1])) end--;
+    return end;
+}
+
+static const struct ws_kernels scalar_kernels = {
+    "scalar", skip_scalar, find_scalar, rskip_scalar
+};
+
+#ifdef SCAN_X86
+/*
+ * SSE2 kernels:
+ *  - Purpose: Classify 16 bytes per step.
+ *      * A byte is whitespace when it equals ' ' or lies in '\t'..'\r'. The
+ *        range test is done with a signed compare after biasing the bytes
+ *        so that '\t' maps to -128.
+ *      * movemask turns the comparison into a bit per byte, and the
+ *        position of the first (or last) interesting byte is a bit scan.
+ */
+__attribute__((target("sse2")))
+static inline unsigned ws_mask16(const char *p) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i biased = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - '\t')));
+    __m128i ctl = _mm_cmplt_epi8(biased, _mm_set1_epi8((char)(0x80 + '\r' - '\t' + 1)));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(sp, ctl));
+}
+
+__attribute__((target("sse2")))
+static const char *skip_sse2(const char *p, const char *end) {
+    while (end - p >= 16) {
+        unsigned m = ~ws_mask16(p) & 0xFFFFu;
+        if (m) return p + __builtin_ctz(m);
+        p += 16;
+    }
+    return skip_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const char *p, const char *end) {
+    while (end - p >= 16) {
+        unsigned m = ws_mask16(p);
+        if (m) return p + __builtin_ctz(m);
+        p += 16;
+    }
+    return find_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char *rskip_sse2(const char *begin, const char *end) {
+    while (end - begin >= 16) {
+        unsigned m = ~ws_mask16(end - 16) & 0xFFFFu;
+        if (m) return end - 16 + (31 - __builtin_clz(m)) + 1;
+        end -= 16;
+    }
+    return rskip_scalar(begin, end);
+}
+
+static const struct ws_kernels sse2_kernels = {
+    "sse2", skip_sse2, find_sse2, rskip_sse2
+};
+
+/*
+ * AVX2 kernels:
+ *  - Purpose: Same classification as the SSE2 kernels, 32 bytes per step.
+ */
+__attribute__((target("avx2")))
+static inline unsigned ws_mask32(const char *p) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    __m256i biased = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - '\t')));
+    __m256i ctl = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + '\r' - '\t' + 1)), biased);
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(sp, ctl));
+}
+
+__attribute__((target("avx2")))
+static const char *skip_avx2(const char *p, const char *end) {
+    while (end - p >= 32) {
+        unsigned m = ~ws_mask32(p);
+        if (m) return p + __builtin_ctz(m);
+        p += 32;
+    }
+    return skip_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, const char *end) {
+    while (end - p >= 32) {
+        unsigned m = ws_mask32(p);
+        if (m) return p + __builtin_ctz(m);
+        p += 32;
+    }
+    return find_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *rskip_avx2(const char *begin, const char *end) {
+    while (end - begin >= 32) {
+        unsigned m = ~ws_mask32(end - 32);
+        if (m) return end - 32 + (31 - __builtin_clz(m)) + 1;
+        end -= 32;
+    }
+    return rskip_sse2(begin, end);
+}
+
+static const struct ws_kernels avx2_kernels = {
+    "avx2", skip_avx2, find_avx2, rskip_avx2
+};
+#endif
+
+static _Atomic(const struct ws_kernels *) active;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+/*
+ * pick_kernels:
+ *  - Purpose: Runtime dispatch. Uses the widest kernel set the CPU supports.
+ */
+static void pick_kernels(void) {
+    const struct ws_kernels *k = &scalar_kernels;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        k = &avx2_kernels;
+    } else if (__builtin_cpu_supports("sse2")) {
+        k = &sse2_kernels;
+    }
+#endif
+    atomic_store_explicit(&active, k, memory_order_release);
+}
+
+static inline const struct ws_kernels *kernels(void) {
+    const struct ws_kernels *k = atomic_load_explicit(&active, memory_order_acquire);
+    if (!k) {
+        pthread_once(&active_once, pick_kernels);
+        k = atomic_load_explicit(&active, memory_order_acquire);
+    }
+    return k;
+}
+
+const char *ws_skip(const char *p, const char *end) {
+    return kernels()->skip(p, end);
+}
+
+const char *ws_find(const char *p, const char *end) {
+    return kernels()->find(p, end);
+}
+
+const char *ws_rskip(const char *begin, const char *end) {
+    return kernels()->rskip(begin, end);
+}
+
+const char *ws_scan_impl(void) {
+    return kernels()->name;
+}
+
+/*
+ * ws_scan_select:
+ *  - Purpose: Override the runtime choice, refusing kernels the CPU cannot run.
+ *  - Returns: 0 on success, -1 if the kernel set is unknown or unsupported.
+ */
+int ws_scan_select(const char *name) {
+    const struct ws_kernels *k = NULL;
+    kernels();  // Make sure the one time pick does not overwrite us later
+    if (strcmp(name, "scalar") == 0) {
+        k = &scalar_kernels;
+    }
+#ifdef SCAN_X86
+    else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        k = &sse2_kernels;
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        k = &avx2_kernels;
+    }
+#endif
+    if (!k) return -1;
+    atomic_store_explicit(&active, k, memory_order_release);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef SCAN_H
+#define SCAN_H
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Whitespace scanning kernels. Whitespace is the C locale isspace() set:
+ * space, \t, \n, \v, \f and \r. Every function works on the half open
+ * range [begin, end) and never reads outside of it. The implementation
+ * (AVX2, SSE2 or scalar) is picked at runtime the first time any of the
+ * functions is called.
+ */
+
+/**
+* @brief Find the first byte in [p, end) that is not whitespace.
+*
+* @param p Start of the range
+* @param end End of the range
+* @return Pointer to the first non whitespace byte, or end if none
+*/
+
+const char *ws_skip(const char *p, const char *end);
+/**
+* @brief Find the first whitespace byte in [p, end).
+*
+* @param p Start of the range
+* @param end End of the range
+* @return Pointer to the first whitespace byte, or end if none
+*/
+
+const char *ws_find(const char *p, const char *end);
+/**
+* @brief Scan backwards over trailing whitespace in [begin, end).
+*
+* @param begin Start of the range
+* @param end End of the range
+* @return Pointer one past the last non whitespace byte, or begin if the
+* whole range is whitespace
+*/
+
+const char *ws_rskip(const char *begin, const char *end);
+/**
+* @brief Name of the kernel set in use: "avx2", "sse2" or "scalar".
+*
+* @return The name of the active implementation
+*/
+
+const char *ws_scan_impl(void);
+/**
+* @brief Force a kernel set by name. Used by the tests and for benchmarking
+* the implementations against each other.
+*
+* @param name One of "avx2", "sse2" or "scalar"
+* @return 0 on success, -1 if the kernel set is not supported on this CPU
+*/
+
+int ws_scan_select(const char *name);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,365 @@
+#include "vars.h"
+#include "outbuf.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+/* Garbage in the string arena is only collected past this many bytes */
+#define COMPACT_MIN (64 * 1024)
+
+/*
+ * hash_name:
+ *  - Purpose: 64 bit FNV-1a hash of a variable name.
+ */
+static uint64_t hash_name(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static bool has_value(const struct var *v) {
+    return v->entry[v->name_len] == '=';
+}
+
+void vars_init(struct var_table *vt) {
+    memset(vt, 0, sizeof(*vt));
+    arena_init(&vt->strings, 0);
+    vt->envp_dirty = true;
+}
+
+void vars_destroy(struct var_table *vt) {
+    free(vt->slots);
+    free(vt->envp);
+    arena_destroy(&vt->strings);
+    vars_init(vt);
+}
+
+/*
+ * find_slot:
+ *  - Purpose: Linear probe for a name. Returns the slot holding it or the
+ *    empty slot where it would be inserted.
+ */
+static struct var *find_slot(const struct var_table *vt, const char *name, size_t len, uint64_t h) {
+    size_t mask = vt->cap - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        struct var *v = &vt->slots[i];
+        if (!v->entry) return v;
+        if (v->hash == h && v->name_len == len && memcmp(v->entry, name, len) == 0) return v;
+    }
+}
+
+/*
+ * grow:
+ *  - Purpose: Double the table, keeping the load factor at or below one half.
+ */
+static void grow(struct var_table *vt) {
+    struct var *old = vt->slots;
+    size_t oldcap = vt->cap;
+    vt->cap = oldcap ? oldcap * 2 : 256;
+    vt->slots = calloc(vt->cap, sizeof(*vt->slots));
+    if (!vt->slots) {
+        fprintf(stderr, "vars: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].entry) *find_slot(vt, old[i].entry, old[i].name_len, old[i].hash) = old[i];
+    }
+    free(old);
+}
+
+/*
+ * new_entry:
+ *  - Purpose: Copy "name=value" into the arena, or only the name when
+ *    value is NULL.
+ */
+static char *new_entry(struct var_table *vt, const char *name, size_t nlen, const char *value,
+                       size_t vlen) {
+    size_t n = nlen + (value ? vlen + 1 : 0);
+    char *e = arena_alloc(&vt->strings, n + 1);
+    memcpy(e, name, nlen);
+    if (value) {
+        e[nlen] = '=';
+        memcpy(e + nlen + 1, value, vlen);
+    }
+    e[n] = '\0';
+    vt->live += n + 1;
+    return e;
+}
+
+static void drop_entry(struct var_table *vt, struct var *v) {
+    size_t n = strlen(v->entry) + 1;
+    vt->live -= n;
+    vt->dead += n;
+}
+
+/*
+ * compact:
+ *  - Purpose: Once most of the arena is replaced entries, copy the live
+ *    ones to a new arena and free the old one. Every entry moves, so the
+ *    environment is rebuilt on next use.
+ */
+static void compact(struct var_table *vt) {
+    if (vt->dead < COMPACT_MIN || vt->dead < vt->live) return;
+    struct arena old = vt->strings;
+    arena_init(&vt->strings, 0);
+    for (size_t i = 0; i < vt->cap; i++) {
+        struct var *v = &vt->slots[i];
+        if (!v->entry) continue;
+        size_t n = strlen(v->entry) + 1;
+        v->entry = memcpy(arena_alloc(&vt->strings, n), v->entry, n);
+    }
+    arena_destroy(&old);
+    vt->dead = 0;
+    vt->envp_dirty = true;
+}
+
+static struct var *lookup_or_add(struct var_table *vt, const char *name, size_t len) {
+    if ((vt->count + 1) * 2 > vt->cap) grow(vt);
+    uint64_t h = hash_name(name, len);
+    struct var *v = find_slot(vt, name, len, h);
+    if (!v->entry) {
+        v->hash = h;
+        v->name_len = len;
+        v->flags = 0;
+        vt->count++;
+    }
+    return v;
+}
+
+/*
+ * set_var:
+ *  - Purpose: Give a variable a new entry. The old one stays in the arena
+ *    until the next compaction, which is what makes a string handed out by
+ *    vars_get valid until the next change rather than forever.
+ */
+static void set_var(struct var_table *vt, const char *name, size_t nlen, const char *value,
+                    size_t vlen, uint32_t flags) {
+    struct var *v = lookup_or_add(vt, name, nlen);
+    if (v->entry) drop_entry(vt, v);
+    v->entry = new_entry(vt, name, nlen, value, vlen);
+    v->flags |= flags;
+    if (v->flags & VAR_EXPORT) vt->envp_dirty = true;
+    compact(vt);
+}
+
+void vars_import(struct var_table *vt, char *const *env) {
+    for (; *env; env++) {
+        const char *eq = strchr(*env, '=');
+        if (!eq || eq == *env) continue;
+        set_var(vt, *env, eq - *env, eq + 1, strlen(eq + 1), VAR_EXPORT);
+    }
+}
+
+const char *vars_get(const struct var_table *vt, const char *name) {
+    if (!vt->cap) return NULL;
+    size_t len = strlen(name);
+    const struct var *v = find_slot(vt, name, len, hash_name(name, len));
+    return v->entry && has_value(v) ? v->entry + len + 1 : NULL;
+}
+
+void vars_set(struct var_table *vt, const char *name, const char *value, uint32_t flags) {
+    set_var(vt, name, strlen(name), value, strlen(value), flags);
+}
+
+void vars_assign(struct var_table *vt, const char *word, uint32_t flags) {
+    const char *eq = strchr(word, '=');
+    set_var(vt, word, eq - word, eq + 1, strlen(eq + 1), flags);
+}
+
+void vars_export(struct var_table *vt, const char *name) {
+    size_t len = strlen(name);
+    struct var *v = lookup_or_add(vt, name, len);
+    if (!v->entry) v->entry = new_entry(vt, name, len, NULL, 0);
+    if (v->flags & VAR_EXPORT) return;
+    v->flags |= VAR_EXPORT;
+    if (has_value(v)) vt->envp_dirty = true;
+}
+
+/*
+ * vars_unset:
+ *  - Purpose: Remove a variable using backward shift deletion, so the probe
+ *    sequences of the remaining variables stay intact without tombstones.
+ */
+bool vars_unset(struct var_table *vt, const char *name) {
+    if (!vt->cap) return false;
+    size_t len = strlen(name);
+    size_t mask = vt->cap - 1;
+    struct var *v = find_slot(vt, name, len, hash_name(name, len));
+    if (!v->entry) return false;
+    if (v->flags & VAR_EXPORT) vt->envp_dirty = true;
+    drop_entry(vt, v);
+    size_t hole = v - vt->slots;
+    for (size_t i = (hole + 1) & mask; vt->slots[i].entry; i = (i + 1) & mask) {
+        size_t home = vt->slots[i].hash & mask;
+        // Move the variable back if its home is not between the hole and i
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            vt->slots[hole] = vt->slots[i];
+            hole = i;
+        }
+    }
+    vt->slots[hole].entry = NULL;
+    vt->count--;
+    compact(vt);
+    return true;
+}
+
+char **vars_envp(struct var_table *vt) {
+    if (!vt->envp_dirty) return vt->envp;
+    size_t n = 0;
+    if (vt->count + 1 > vt->envp_cap) {
+        vt->envp_cap = vt->count + 1;
+        vt->envp = realloc(vt->envp, vt->envp_cap * sizeof(*vt->envp));
+        if (!vt->envp) {
+            fprintf(stderr, "vars: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t i = 0; i < vt->cap; i++) {
+        struct var *v = &vt->slots[i];
+        if (v->entry && (v->flags & VAR_EXPORT) && has_value(v)) vt->envp[n++] = v->entry;
+    }
+    vt->envp[n] = NULL;
+    vt->envp_dirty = false;
+    return vt->envp;
+}
+
+/* True if entry is "name=..." for the name that assignment word w sets */
+static bool same_name(const char *entry, const char *w) {
+    size_t len = strchr(w, '=') - w;
+    return strncmp(entry, w, len + 1) == 0;
+}
+
+/*
+ * vars_envp_with:
+ *  - Purpose: Copy the cached environment, leaving out what the assignments
+ *    override, and add the assignments. Only the pointer array is copied.
+ */
+char **vars_envp_with(struct var_table *vt, struct arena *a, char *const *assigns, size_t n) {
+    char **base = vars_envp(vt);
+    size_t nbase = 0;
+    while (base[nbase]) nbase++;
+    char **envp = arena_alloc(a, (nbase + n + 1) * sizeof(*envp));
+    size_t k = 0;
+    for (size_t i = 0; i < nbase; i++) {
+        bool replaced = false;
+        for (size_t j = 0; j < n && !replaced; j++) replaced = same_name(base[i], assigns[j]);
+        if (!replaced) envp[k++] = base[i];
+    }
+    for (size_t j = 0; j < n; j++) {
+        // FOO=1 FOO=2 cmd: the last one wins
+        bool later = false;
+        for (size_t l = j + 1; l < n && !later; l++) later = same_name(assigns[l], assigns[j]);
+        if (!later) envp[k++] = assigns[j];
+    }
+    envp[k] = NULL;
+    return envp;
+}
+
+size_t assignment_name(const char *word) {
+    size_t i = 0;
+    if (!isalpha((unsigned char)word[0]) && word[0] != '_') return 0;
+    while (isalnum((unsigned char)word[i]) || word[i] == '_') i++;
+    return word[i] == '=' ? i : 0;
+}
+
+static bool valid_name(const char *s) {
+    size_t i = 0;
+    if (!isalpha((unsigned char)s[0]) && s[0] != '_') return false;
+    while (isalnum((unsigned char)s[i]) || s[i] == '_') i++;
+    return s[i] == '\0';
+}
+
+static int by_name(const void *a, const void *b) {
+    const struct var *x = *(const struct var *const *)a, *y = *(const struct var *const *)b;
+    size_t n = x->name_len < y->name_len ? x->name_len : y->name_len;
+    int c = memcmp(x->entry, y->entry, n);
+    return c ? c : (int)x->name_len - (int)y->name_len;
+}
+
+/*
+ * print_exports:
+ *  - Purpose: export -p, sorted by name, values double quoted with the
+ *    characters that are special there escaped.
+ */
+static int print_exports(struct var_table *vt) {
+    struct outbuf o;
+    const struct var **list = malloc((vt->count ? vt->count : 1) * sizeof(*list));
+    if (!list) {
+        fprintf(stderr, "vars: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < vt->cap; i++) {
+        if (vt->slots[i].entry && (vt->slots[i].flags & VAR_EXPORT)) list[n++] = &vt->slots[i];
+    }
+    qsort(list, n, sizeof(*list), by_name);
+    out_init(&o, stdout);
+    for (size_t i = 0; i < n; i++) {
+        const struct var *v = list[i];
+        out_copy(&o, "export ", 7);
+        out_copy(&o, v->entry, v->name_len);
+        if (has_value(v)) {
+            out_copy(&o, "=\"", 2);
+            for (const char *p = v->entry + v->name_len + 1; *p; p++) {
+                if (strchr("\"\\$`", *p)) out_char(&o, '\\');
+                out_char(&o, *p);
+            }
+            out_char(&o, '"');
+        }
+        out_char(&o, '\n');
+    }
+    free(list);
+    return out_finish(&o, "export", 0);
+}
+
+int export_builtin(struct shell *sh, char **argv) {
+    int i = 1, status = 0;
+    for (; argv[i] && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-p") != 0) {
+            fprintf(stderr, "export: usage: export [-p] [name[=value] ...]\n");
+            return 2;
+        }
+    }
+    if (!argv[i]) return print_exports(sh->vars);
+    for (; argv[i]; i++) {
+        if (assignment_name(argv[i])) {
+            vars_assign(sh->vars, argv[i], VAR_EXPORT);
+        } else if (valid_name(argv[i])) {
+            vars_export(sh->vars, argv[i]);
+        } else {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int unset_builtin(struct shell *sh, char **argv) {
+    int i = 1, status = 0;
+    for (; argv[i] && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-v") != 0) {
+            fprintf(stderr, "unset: usage: unset [-v] name ...\n");
+            return 2;
+        }
+    }
+    for (; argv[i]; i++) {
+        if (!valid_name(argv[i])) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        vars_unset(sh->vars, argv[i]);
+    }
+    return status;
+}
@@ -0,0 +1,173 @@
+#ifndef VARS_H
+#define VARS_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Variable flags */
+#define VAR_EXPORT 1u
+
+/* A shell variable */
+struct var
+{
+    char *entry;        /* "name=value", or just "name" when declared but unset; NULL for an empty slot */
+    uint32_t name_len;
+    uint32_t flags;
+    uint64_t hash;
+};
+
+/**
+* @brief The shell variables. Open addressing with linear probing, keyed by
+* name. Every "name=value" string lives in an arena owned by the table;
+* replaced strings stay there as garbage until there is more garbage than
+* live data, then the live ones are copied to a fresh arena.
+*
+* The environment handed to commands is an array of pointers to the
+* exported entries themselves. It is built on first use and again only
+* after an exported variable changed, so launching a command costs nothing
+* however many variables there are.
+*/
+struct var_table
+{
+    struct var *slots;
+    size_t cap;         /* power of two */
+    size_t count;
+    struct arena strings;
+    size_t live;        /* bytes of the entries in use */
+    size_t dead;        /* bytes of replaced entries */
+    char **envp;
+    size_t envp_cap;
+    bool envp_dirty;
+};
+
+/**
+* @brief Initialize an empty table.
+*
+* @param vt The table
+*/
+
+void vars_init(struct var_table *vt);
+/**
+* @brief Free everything held by the table.
+*
+* @param vt The table
+*/
+
+void vars_destroy(struct var_table *vt);
+/**
+* @brief Add every "name=value" of env as an exported variable.
+*
+* @param vt The table
+* @param env A NULL terminated environment such as environ
+*/
+
+void vars_import(struct var_table *vt, char *const *env);
+/**
+* @brief The value of a variable.
+*
+* @param vt The table
+* @param name The name
+* @return The value, or NULL if it is not set. Valid until the table
+* changes.
+*/
+
+const char *vars_get(const struct var_table *vt, const char *name);
+/**
+* @brief Set a variable, keeping its flags. The process environment is left
+* alone: it stays what the shell started with, so the shell's own lookups
+* read the table, never getenv().
+*
+* @param vt The table
+* @param name The name
+* @param value The value
+* @param flags Flags to add, VAR_EXPORT or 0
+*/
+
+void vars_set(struct var_table *vt, const char *name, const char *value, uint32_t flags);
+/**
+* @brief Perform an assignment word such as FOO=bar, already expanded.
+*
+* @param vt The table
+* @param word The assignment
+* @param flags Flags to add, VAR_EXPORT or 0
+*/
+
+void vars_assign(struct var_table *vt, const char *word, uint32_t flags);
+/**
+* @brief Mark a variable for export, declaring it if it does not exist.
+*
+* @param vt The table
+* @param name The name
+*/
+
+void vars_export(struct var_table *vt, const char *name);
+/**
+* @brief Remove a variable.
+*
+* @param vt The table
+* @param name The name
+* @return True if it existed
+*/
+
+bool vars_unset(struct var_table *vt, const char *name);
+/**
+* @brief The environment for commands: every exported variable that has a
+* value.
+*
+* @param vt The table
+* @return A NULL terminated array owned by the table, valid until the
+* table changes
+*/
+
+char **vars_envp(struct var_table *vt);
+/**
+* @brief The environment for one command run with assignments in front of
+* it, FOO=1 cmd. Allocated from a, the table is not changed.
+*
+* @param vt The table
+* @param a The arena of the command
+* @param assigns The expanded assignment words
+* @param n Their number
+* @return A NULL terminated array
+*/
+
+char **vars_envp_with(struct var_table *vt, struct arena *a, char *const *assigns, size_t n);
+/**
+* @brief Tell whether a raw word is an assignment: a name, then =.
+*
+* @param word The word
+* @return The length of the name, 0 if it is not an assignment
+*/
+
+size_t assignment_name(const char *word);
+/**
+* @brief The export builtin: export [-p] [name[=value] ...]. Without names
+* it prints the exported variables in a form that can be read back.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return The exit status
+*/
+
+int export_builtin(struct shell *sh, char **argv);
+/**
+* @brief The unset builtin: unset [-v] name ...
+*
+* @param sh The shell
+* @param argv The arguments
+* @return The exit status
+*/
+
+int unset_builtin(struct shell *sh, char **argv);
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
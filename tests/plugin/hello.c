@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include "../../src/loadable.h"
+
+// A loadable builtin for the tests: prints a greeting and returns the
+// number of names it greeted
+static int loads;
+
+static int hello(struct shell *sh, char **argv)
+{
+    (void)sh;
+    int n = 0;
+    if (!argv[1]) {
+        printf("hello\n");
+    }
+    for (int i = 1; argv[i]; i++, n++) {
+        printf("hello %s\n", argv[i]);
+    }
+    return n;
+}
+
+static int hello_load(struct shell *sh)
+{
+    (void)sh;
+    loads++;
+    return 0;
+}
+
+static void hello_unload(struct shell *sh)
+{
+    (void)sh;
+    loads--;
+}
+
+const struct loadable_builtin hello_builtin = {
+    SHELL_BUILTIN_ABI, "hello", hello, hello_load, hello_unload, "hello [name ...]"
+};
+
+// The plain form, without hooks
+static int quiet(struct shell *sh, char **argv)
+{
+    (void)sh;
+    (void)argv;
+    return 3;
+}
+
+SHELL_BUILTIN(quiet, quiet, "quiet");
+
+// Registered under a name other than its symbol
+const struct loadable_builtin greet_builtin = {
+    SHELL_BUILTIN_ABI, "hi", hello, NULL, NULL, "hi [name ...]"
+};
@@ -1,9 +1,39 @@
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "harness/unity.h"
 #include "../src/lab.h"  // Adjust the path as needed
+#include "../src/scan.h"
+#include "../src/lexer.h"
+#include "../src/arena.h"
+#include "../src/ast.h"
+#include "../src/exec.h"
+#include "../src/pathcache.h"
+#include "../src/event.h"
+#include "../src/jobs.h"
+#include "../src/builtins.h"
+#include "../src/reader.h"
+#include "../src/history.h"
+#include "../src/complete.h"
+#include "../src/prompt.h"
+#include "../src/vars.h"
+#include "../src/expand.h"
+#include "../src/glob.h"
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+// Where the build put the loadable builtins of tests/plugin
+#ifndef PLUGIN_DIR
+#define PLUGIN_DIR "./build/plugin"
+#endif
 
 // Set up function to run before each test
 void setUp(void) {
@@ -46,6 +76,81 @@ void test_cmd_parse(void)
     cmd_free(rval);
 }
 
+// Test that the argv array and the tokens come from one block
+void test_cmd_parse_single_block(void)
+{
+    char **rval = cmd_parse("  echo   hello\tworld  ");
+    TEST_ASSERT_EQUAL_STRING("echo", rval[0]);
+    TEST_ASSERT_EQUAL_STRING("hello", rval[1]);
+    TEST_ASSERT_EQUAL_STRING("world", rval[2]);
+    TEST_ASSERT_NULL(rval[3]);
+    // Token bytes are stored right after the pointer array
+    TEST_ASSERT_TRUE((char *)rval[0] > (char *)&rval[3]);
+    cmd_free(rval);
+}
+
+// Test parsing a line with the maximum number of tokens for its length
+void test_cmd_parse_many_tokens(void)
+{
+    char line[401];
+    for (int i = 0; i < 200; i++) {
+        line[2 * i] = 'a' + (i % 26);
+        line[2 * i + 1] = ' ';
+    }
+    line[399] = '\0';
+    char **rval = cmd_parse(line);
+    for (int i = 0; i < 200; i++) {
+        TEST_ASSERT_EQUAL_CHAR('a' + (i % 26), rval[i][0]);
+        TEST_ASSERT_EQUAL_CHAR('\0', rval[i][1]);
+    }
+    TEST_ASSERT_NULL(rval[200]);
+    cmd_free(rval);
+}
+
+// Test the reentrant tokenizer with interleaved use of two states
+void test_cmd_tokenizer_interleaved(void)
+{
+    struct cmd_tokenizer a, b;
+    const char *tok;
+    size_t len;
+    cmd_tokenizer_init(&a, "ls -l");
+    cmd_tokenizer_init(&b, " cat\tfile ");
+    TEST_ASSERT_TRUE(cmd_next_token(&a, &tok, &len));
+    TEST_ASSERT_EQUAL_STRING_LEN("ls", tok, len);
+    TEST_ASSERT_TRUE(cmd_next_token(&b, &tok, &len));
+    TEST_ASSERT_EQUAL_STRING_LEN("cat", tok, len);
+    TEST_ASSERT_TRUE(cmd_next_token(&a, &tok, &len));
+    TEST_ASSERT_EQUAL_STRING_LEN("-l", tok, len);
+    TEST_ASSERT_TRUE(cmd_next_token(&b, &tok, &len));
+    TEST_ASSERT_EQUAL_STRING_LEN("file", tok, len);
+    TEST_ASSERT_FALSE(cmd_next_token(&a, &tok, &len));
+    TEST_ASSERT_FALSE(cmd_next_token(&b, &tok, &len));
+}
+
+// Test parsing a batch of lines across several threads
+void test_cmd_parse_batch(void)
+{
+    enum { N = 1000 };
+    char bufs[N][32];
+    char const *lines[N];
+    char **out[N];
+    for (int i = 0; i < N; i++) {
+        snprintf(bufs[i], sizeof(bufs[i]), "cmd%d arg %d", i, i * 2);
+        lines[i] = bufs[i];
+    }
+    TEST_ASSERT_EQUAL_INT(0, cmd_parse_batch(lines, N, out, 4));
+    for (int i = 0; i < N; i++) {
+        char expect[32];
+        snprintf(expect, sizeof(expect), "cmd%d", i);
+        TEST_ASSERT_EQUAL_STRING(expect, out[i][0]);
+        TEST_ASSERT_EQUAL_STRING("arg", out[i][1]);
+        snprintf(expect, sizeof(expect), "%d", i * 2);
+        TEST_ASSERT_EQUAL_STRING(expect, out[i][2]);
+        TEST_ASSERT_NULL(out[i][3]);
+        cmd_free(out[i]);
+    }
+}
+
 // Test trimming a string with no whitespace
 void test_trim_white_no_whitespace(void)
 {
@@ -115,6 +220,1759 @@ void test_trim_white_mostly_whitespace(void)
     free(line);
 }
 
+// Test every whitespace kernel set against a byte at a time reference
+void test_ws_scan_kernels(void)
+{
+    static const char *impls[] = {"scalar", "sse2", "avx2"};
+    static const char alphabet[] = " \t\n\v\f\rab";
+    char buf[200];
+    const char *orig = ws_scan_impl();
+    srand(42);
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+        if (ws_scan_select(impls[k]) != 0) continue;  // Not supported on this CPU
+        for (int iter = 0; iter < 500; iter++) {
+            size_t n = rand() % sizeof(buf);
+            // Long runs of one class so the vector paths see full blocks
+            for (size_t i = 0; i < n; i++) {
+                buf[i] = (rand() % 8 == 0) ? alphabet[rand() % 8] : (i && rand() % 4 ? buf[i - 1] : alphabet[rand() % 8]);
+            }
+            const char *end = buf + n;
+            const char *skip = buf, *find = buf, *rskip = end;
+            while (skip < end && isspace((unsigned char)*skip)) skip++;
+            while (find < end && !isspace((unsigned char)*find)) find++;
+            while (rskip > buf && isspace((unsigned char)rskip[-1])) rskip--;
+            TEST_ASSERT_EQUAL_PTR(skip, ws_skip(buf, end));
+            TEST_ASSERT_EQUAL_PTR(find, ws_find(buf, end));
+            TEST_ASSERT_EQUAL_PTR(rskip, ws_rskip(buf, end));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(0, ws_scan_select(orig));
+    TEST_ASSERT_EQUAL_INT(-1, ws_scan_select("mmx"));
+}
+
+// Test trimming a string longer than one vector on both ends
+void test_trim_white_long(void)
+{
+    char line[256];
+    memset(line, ' ', sizeof(line));
+    memcpy(line + 70, "ls\t-a", 5);
+    line[200] = '\r';
+    line[255] = '\0';
+    char *rval = trim_white(line);
+    TEST_ASSERT_EQUAL_STRING("ls\t-a", rval);
+}
+
+// Lex src in chunks of the given size and render the tokens as one string
+static void lex_render(const char *src, size_t chunk, char *out, size_t outlen)
+{
+    struct lexer lx;
+    struct token tok;
+    size_t n = strlen(src), off = 0;
+    out[0] = '\0';
+    lex_init(&lx);
+    for (;;) {
+        enum lex_status st = lex_next(&lx, &tok);
+        if (st == LEX_MORE) {
+            size_t len = n - off < chunk ? n - off : chunk;
+            lex_feed(&lx, src + off, len);
+            off += len;
+            if (off == n) lex_eof(&lx);
+            continue;
+        }
+        if (st == LEX_ERROR) {
+            strncat(out, "ERR", outlen - strlen(out) - 1);
+            break;
+        }
+        static const char *kinds[] = {"W", "N", "O", "R", "NL", "EOF"};
+        char item[128];
+        snprintf(item, sizeof(item), "%s[%s] ", kinds[tok.type], tok.type == TOK_NEWLINE ? "" : tok.text);
+        strncat(out, item, outlen - strlen(out) - 1);
+        if (tok.type == TOK_EOF) break;
+    }
+    lex_destroy(&lx);
+}
+
+// Test lexing words, quotes, operators and redirections
+void test_lex_tokens(void)
+{
+    char out[512];
+    lex_render("echo \"a b\" | grep -v 'x y'&&ls;cat 2>err >>out # note\nx", 4096, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("W[echo] W[\"a b\"] O[|] W[grep] W[-v] W['x y'] O[&&] W[ls] O[;] "
+                             "W[cat] N[2] R[>] W[err] R[>>] W[out] NL[] W[x] EOF[] ", out);
+    lex_render("a\\ b ( c ) <<-x 2>&1 >|f <>g ;;", 4096, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("W[a\\ b] O[(] W[c] O[)] R[<<-] W[x] N[2] R[>&] W[1] R[>|] W[f] "
+                             "R[<>] W[g] O[;;] EOF[] ", out);
+    lex_render("x=$((1 + (2*3))) ${a:-b c}", 4096, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("W[x=$((1 + (2*3)))] W[${a:-b c}] EOF[] ", out);
+}
+
+// Test that feeding the input one byte at a time gives the same tokens
+void test_lex_streaming(void)
+{
+    const char *src = "for f in \"x y\" 'z'; do echo $f>>log 2>&1 || exit; done\n";
+    char whole[512], bytes[512];
+    lex_render(src, 4096, whole, sizeof(whole));
+    lex_render(src, 1, bytes, sizeof(bytes));
+    TEST_ASSERT_EQUAL_STRING(whole, bytes);
+}
+
+// Test quote spans and unterminated quotes
+void test_lex_quotes(void)
+{
+    struct lexer lx;
+    struct token tok;
+    const char *src = "a'b c'\\d\"e\"";
+    lex_init(&lx);
+    lex_feed(&lx, src, strlen(src));
+    lex_eof(&lx);
+    TEST_ASSERT_EQUAL_INT(LEX_OK, lex_next(&lx, &tok));
+    TEST_ASSERT_EQUAL_INT(TOK_WORD, tok.type);
+    TEST_ASSERT_EQUAL_size_t(3, tok.nspans);
+    TEST_ASSERT_EQUAL_INT(QUOTE_SINGLE, tok.spans[0].kind);
+    TEST_ASSERT_EQUAL_size_t(1, tok.spans[0].start);
+    TEST_ASSERT_EQUAL_size_t(5, tok.spans[0].len);
+    TEST_ASSERT_EQUAL_INT(QUOTE_ESCAPE, tok.spans[1].kind);
+    TEST_ASSERT_EQUAL_size_t(6, tok.spans[1].start);
+    TEST_ASSERT_EQUAL_size_t(2, tok.spans[1].len);
+    TEST_ASSERT_EQUAL_INT(QUOTE_DOUBLE, tok.spans[2].kind);
+    TEST_ASSERT_EQUAL_size_t(3, tok.spans[2].len);
+    lex_destroy(&lx);
+
+    char out[64];
+    lex_render("echo 'abc", 4096, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("W[echo] ERR", out);
+    lex_render("echo \"abc", 4096, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("W[echo] ERR", out);
+}
+
+// Test that reset arenas reuse their blocks and large objects fit
+void test_arena_reset_reuse(void)
+{
+    struct arena a;
+    arena_init(&a, 128);
+    char *first = arena_alloc(&a, 10);
+    for (int i = 0; i < 100; i++) arena_alloc(&a, 24);
+    char *big = arena_alloc(&a, 10000);
+    memset(big, 'x', 10000);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t)big % _Alignof(max_align_t));
+    arena_reset(&a);
+    TEST_ASSERT_EQUAL_PTR(first, arena_alloc(&a, 10));
+    TEST_ASSERT_EQUAL_STRING("abc", arena_strndup(&a, "abcdef", 3));
+    arena_destroy(&a);
+}
+
+// Test that restoring a mark releases what was allocated after it
+void test_arena_mark(void)
+{
+    struct arena a;
+    arena_init(&a, 128);
+    arena_alloc(&a, 10);
+    struct arena_mark m = arena_save(&a);
+    char *first = arena_alloc(&a, 24);
+    for (int i = 0; i < 100; i++) arena_alloc(&a, 24);
+    arena_restore(&a, m);
+    TEST_ASSERT_EQUAL_PTR(first, arena_alloc(&a, 24));
+    arena_destroy(&a);
+}
+
+// Test the shape of the tree built for lists, pipelines and redirections
+void test_parse_tree(void)
+{
+    struct parser ps;
+    struct arena a;
+    struct node *n;
+    parser_init(&ps);
+    arena_init(&a, 0);
+    const char *src = "a x | b && c 2>>log; (d) > f &";
+    TEST_ASSERT_EQUAL_INT(PARSE_OK, parse_line(&ps, src, strlen(src), &a, &n));
+    TEST_ASSERT_EQUAL_INT(N_SEQ, n->type);
+    struct node *and = n->binary.left;
+    TEST_ASSERT_EQUAL_INT(N_AND, and->type);
+    TEST_ASSERT_EQUAL_INT(N_PIPELINE, and->binary.left->type);
+    TEST_ASSERT_EQUAL_size_t(2, and->binary.left->pipeline.ncmds);
+    struct node *a0 = and->binary.left->pipeline.cmds[0];
+    TEST_ASSERT_EQUAL_STRING("a", a0->simple.words[0]);
+    TEST_ASSERT_EQUAL_STRING("x", a0->simple.words[1]);
+    TEST_ASSERT_NULL(a0->simple.words[2]);
+    struct node *c = and->binary.right;
+    TEST_ASSERT_EQUAL_INT(N_SIMPLE, c->type);
+    TEST_ASSERT_EQUAL_INT(2, c->simple.redirs->fd);
+    TEST_ASSERT_EQUAL_INT(OP_DGREAT, c->simple.redirs->op);
+    TEST_ASSERT_EQUAL_STRING("log", c->simple.redirs->target);
+    struct node *bg = n->binary.right;
+    TEST_ASSERT_EQUAL_INT(N_BACKGROUND, bg->type);
+    TEST_ASSERT_EQUAL_INT(N_SUBSHELL, bg->sub.body->type);
+    TEST_ASSERT_EQUAL_INT(1, bg->sub.body->sub.redirs->fd);
+
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_line(&ps, "a &&", 4, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_line(&ps, "(a", 2, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_line(&ps, "echo 'a", 7, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_ERROR, parse_line(&ps, "a ; ; b", 7, &a, &n));
+    TEST_ASSERT_EQUAL_STRING("syntax error near unexpected token `;'", ps.error);
+    TEST_ASSERT_EQUAL_INT(PARSE_ERROR, parse_line(&ps, "ls >", 4, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_OK, parse_line(&ps, "  # only a comment", 18, &a, &n));
+    TEST_ASSERT_NULL(n);
+    arena_destroy(&a);
+    parser_destroy(&ps);
+}
+
+// Parse and execute a line, returning the exit status
+static int run_line(struct shell *sh, const char *line)
+{
+    struct parser ps;
+    struct arena a;
+    struct node *n;
+    parser_init(&ps);
+    arena_init(&a, 0);
+    int status = -1;
+    if (parse_line(&ps, line, strlen(line), &a, &n) == PARSE_OK) {
+        status = exec_node(sh, n, &a);
+    }
+    arena_destroy(&a);
+    parser_destroy(&ps);
+    return status;
+}
+
+// Read a whole small file into buf
+static void read_file(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    size_t n = f ? fread(buf, 1, len - 1, f) : 0;
+    buf[n] = '\0';
+    if (f) fclose(f);
+}
+
+// Run text a line at a time the way a script is read, -1 on a syntax error
+static int run_lines(struct shell *sh, const char *text)
+{
+    struct parser ps;
+    struct arena a;
+    struct parse_lines pl;
+    struct node *n;
+    parser_init(&ps);
+    arena_init(&a, 0);
+    parse_lines_init(&pl);
+    int status = 0;
+    while (*text && status >= 0) {
+        size_t len = strcspn(text, "\n");
+        enum parse_status st = parse_lines_add(&ps, &pl, text, len, &a, &n);
+        if (st == PARSE_ERROR) status = -1;
+        if (st == PARSE_OK && n) status = exec_node(sh, n, &a);
+        text += len + (text[len] == '\n');
+    }
+    if (pl.pending) status = -1;
+    parse_lines_destroy(&pl);
+    arena_destroy(&a);
+    parser_destroy(&ps);
+    return status;
+}
+
+// Test commands that continue over several lines of a script
+void test_parse_lines(void)
+{
+    struct parser ps;
+    struct arena a;
+    struct parse_lines pl;
+    struct node *n;
+    struct shell sh;
+    char buf[256];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    parser_init(&ps);
+    arena_init(&a, 0);
+    parse_lines_init(&pl);
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_lines_add(&ps, &pl, "for i in 1 2", 12, &a, &n));
+    TEST_ASSERT_TRUE(pl.pending);
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_lines_add(&ps, &pl, "do", 2, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_lines_add(&ps, &pl, " echo $i", 8, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_OK, parse_lines_add(&ps, &pl, "done", 4, &a, &n));
+    TEST_ASSERT_FALSE(pl.pending);
+    char *s = node_string(n);
+    TEST_ASSERT_EQUAL_STRING("for i in 1 2; do echo $i; done", s);
+    free(s);
+    // A quoted newline is kept
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_lines_add(&ps, &pl, "echo \"a", 7, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_OK, parse_lines_add(&ps, &pl, "b\"", 2, &a, &n));
+    TEST_ASSERT_EQUAL_STRING("\"a\nb\"", n->simple.words[1]);
+    // After a complete command the next line starts over
+    TEST_ASSERT_EQUAL_INT(PARSE_OK, parse_lines_add(&ps, &pl, "echo c", 6, &a, &n));
+    TEST_ASSERT_EQUAL_STRING("c", n->simple.words[1]);
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_lines_add(&ps, &pl, "(true", 5, &a, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_ERROR, parse_lines_add(&ps, &pl, ";;", 2, &a, &n));
+    TEST_ASSERT_FALSE(pl.pending);
+    parse_lines_destroy(&pl);
+    arena_destroy(&a);
+    parser_destroy(&ps);
+
+    sh_init(&sh);
+    snprintf(buf, sizeof(buf), "for i in 1 2\ndo\n printf $i\ndone > %s", path);
+    TEST_ASSERT_EQUAL_INT(0, run_lines(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("12", buf);
+    snprintf(buf, sizeof(buf), "true &&\n echo yes > %s\nfalse ||\n\n true", path);
+    TEST_ASSERT_EQUAL_INT(0, run_lines(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("yes\n", buf);
+    // Still open at the end of the input
+    TEST_ASSERT_EQUAL_INT(-1, run_lines(&sh, "true &&\n"));
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Test executing lists, pipelines, subshells, quoting and redirections
+void test_exec_tree(void)
+{
+    struct shell sh;
+    char buf[256];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "true && false"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "false || true"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "! false"));
+    TEST_ASSERT_EQUAL_INT(127, run_line(&sh, "no-such-command-xyz 2>/dev/null"));
+
+    snprintf(buf, sizeof(buf), "echo \"a  b\" 'c|d' > %s; echo e\\ f >> %s", path, path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("a  b c|d\ne f\n", buf);
+
+    snprintf(buf, sizeof(buf), "printf 'x\\ny\\nz\\n' | grep -v y | (wc -l) > %s", path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(2, atoi(buf));
+
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "cd /invalid/path 2>/dev/null"));
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Test launching external commands with redirections set up by spawn
+void test_exec_spawn_redirections(void)
+{
+    struct shell sh;
+    char buf[256];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    // Redirections are applied left to right
+    snprintf(buf, sizeof(buf), "ls / /no-such-dir-xyz > %s 2>&1", path);
+    TEST_ASSERT_NOT_EQUAL(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "no-such-dir-xyz"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "tmp"));
+    // A failed redirection does not run the command
+    snprintf(buf, sizeof(buf), "cat < /no-such-file-xyz 2>/dev/null > %s", path);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, buf));
+    // A descriptor opened earlier in the same list can be duplicated
+    snprintf(buf, sizeof(buf), "/bin/echo dup 3> %s >&3", path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("dup\n", buf);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "(/bin/echo x 3>/dev/null 3>&- >&3) 2>/dev/null"));
+    // Closing a descriptor and exit status from a signal
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "true <&-"));
+    TEST_ASSERT_EQUAL_INT(128 + 9, run_line(&sh, "sh -c 'kill -9 $$'"));
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Test scripts without #! and scripts whose interpreter is missing
+void test_exec_scripts(void)
+{
+    struct shell sh;
+    char buf[256];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    char plain[] = "/tmp/test-lab-XXXXXX";
+    char bad[] = "/tmp/test-lab-XXXXXX";
+    close(mkstemp(path));
+    int fd = mkstemp(plain);
+    dprintf(fd, "echo plain \"$@\"\n");
+    close(fd);
+    chmod(plain, 0755);
+    fd = mkstemp(bad);
+    dprintf(fd, "#!/no-such-interpreter-xyz\necho bad\n");
+    close(fd);
+    chmod(bad, 0755);
+    sh_init(&sh);
+    // Spawned, and from a forked subshell
+    snprintf(buf, sizeof(buf), "(%s a b; (%s c)) > %s", plain, plain, path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("plain a b\nplain c\n", buf);
+    snprintf(buf, sizeof(buf), "%s 2>/dev/null", bad);
+    TEST_ASSERT_EQUAL_INT(126, run_line(&sh, buf));
+    snprintf(buf, sizeof(buf), "(%s) 2>/dev/null", bad);
+    TEST_ASSERT_EQUAL_INT(126, run_line(&sh, buf));
+    TEST_ASSERT_EQUAL_INT(127, run_line(&sh, "no-such-command-xyz 2>/dev/null"));
+    unlink(path);
+    unlink(plain);
+    unlink(bad);
+    sh_destroy(&sh);
+}
+
+// Test command lookup, negative caching and invalidation of the path cache
+void test_path_cache(void)
+{
+    char dir[] = "/tmp/test-lab-path-XXXXXX";
+    char file[64], other[64];
+    struct path_cache pc;
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    path_cache_init(&pc);
+    pc.recheck_ns = 0;
+
+    // Not found results are cached
+    TEST_ASSERT_NULL(path_cache_lookup(&pc, dir, "mytool"));
+    TEST_ASSERT_NULL(path_cache_lookup(&pc, dir, "mytool"));
+    TEST_ASSERT_EQUAL_UINT(1, pc.misses);
+    TEST_ASSERT_EQUAL_UINT(1, pc.hits);
+
+    // Creating the file changes the directory mtime and invalidates the miss
+    snprintf(file, sizeof(file), "%s/mytool", dir);
+    FILE *f = fopen(file, "w");
+    fclose(f);
+    chmod(file, 0755);
+    TEST_ASSERT_EQUAL_STRING(file, path_cache_lookup(&pc, dir, "mytool"));
+    TEST_ASSERT_EQUAL_STRING(file, path_cache_lookup(&pc, dir, "mytool"));
+    TEST_ASSERT_EQUAL_STRING("/bin/x", path_cache_lookup(&pc, dir, "/bin/x"));
+
+    // Changing PATH drops everything
+    snprintf(other, sizeof(other), "%s/sub", dir);
+    mkdir(other, 0755);
+    TEST_ASSERT_NULL(path_cache_lookup(&pc, other, "mytool"));
+
+    // Forgetting entries keeps the rest of the table reachable
+    char name[32];
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "cmd%d", i);
+        path_cache_lookup(&pc, other, name);
+    }
+    for (int i = 0; i < 200; i += 3) {
+        snprintf(name, sizeof(name), "cmd%d", i);
+        path_cache_forget(&pc, name);
+    }
+    unsigned long misses = pc.misses;
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "cmd%d", i);
+        path_cache_lookup(&pc, other, name);
+    }
+    TEST_ASSERT_EQUAL_UINT(misses + 67, pc.misses);
+
+    path_cache_destroy(&pc);
+    unlink(file);
+    rmdir(other);
+    rmdir(dir);
+}
+
+static void make_exec(const char *dir, const char *name, mode_t mode)
+{
+    char file[128];
+    snprintf(file, sizeof(file), "%s/%s", dir, name);
+    fclose(fopen(file, "w"));
+    chmod(file, mode);
+}
+
+static void join_names(const char *name, void *arg)
+{
+    strcat(arg, name);
+    strcat(arg, " ");
+}
+
+// Test the PATH trie and its incremental refresh
+void test_command_complete(void)
+{
+    char dir[] = "/tmp/test-lab-path-XXXXXX";
+    char sub[64], path[128], file[128], out[256];
+    char *saved = strdup(getenv("PATH"));
+    struct command_index ci;
+    struct shell sh;
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    snprintf(sub, sizeof(sub), "%s/sub", dir);
+    mkdir(sub, 0755);
+    make_exec(dir, "gitk", 0755);
+    make_exec(dir, "git", 0755);
+    make_exec(dir, "gimp", 0755);
+    make_exec(dir, "gnotes", 0644);
+    make_exec(sub, "git", 0755);
+    snprintf(path, sizeof(path), "%s:%s", dir, sub);
+    command_index_init(&ci);
+    command_index_refresh(&ci, path);
+    out[0] = '\0';
+    command_index_each(&ci, "gi", join_names, out);
+    TEST_ASSERT_EQUAL_STRING("gimp git gitk ", out);
+    out[0] = '\0';
+    command_index_each(&ci, "x", join_names, out);
+    command_index_each(&ci, "gitkk", join_names, out);
+    TEST_ASSERT_EQUAL_STRING("", out);
+    // Only the directory that changed is read again
+    size_t nodes = ci.count;
+    make_exec(dir, "gitg", 0755);
+    snprintf(file, sizeof(file), "%s/gitk", dir);
+    unlink(file);
+    command_index_refresh(&ci, path);
+    out[0] = '\0';
+    command_index_each(&ci, "git", join_names, out);
+    TEST_ASSERT_EQUAL_STRING("git gitg ", out);
+    TEST_ASSERT_EQUAL_size_t(nodes + 1, ci.count);
+    // git is still in sub
+    snprintf(file, sizeof(file), "%s/git", dir);
+    unlink(file);
+    command_index_refresh(&ci, path);
+    out[0] = '\0';
+    command_index_each(&ci, "git", join_names, out);
+    TEST_ASSERT_EQUAL_STRING("git gitg ", out);
+    command_index_destroy(&ci);
+    // With the builtins, once each
+    make_exec(dir, "echo", 0755);
+    setenv("PATH", path, 1);
+    sh_init(&sh);
+    char **names = command_complete(&sh, "e");
+    TEST_ASSERT_EQUAL_STRING("echo", names[0]);
+    TEST_ASSERT_EQUAL_STRING("enable", names[1]);
+    TEST_ASSERT_EQUAL_STRING("exit", names[2]);
+    TEST_ASSERT_EQUAL_STRING("export", names[3]);
+    TEST_ASSERT_NULL(names[4]);
+    for (int i = 0; names[i]; i++) free(names[i]);
+    free(names);
+    sh_destroy(&sh);
+    const char *files[] = {"gimp", "gnotes", "gitg", "echo", "sub/git"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(file, sizeof(file), "%s/%s", dir, files[i]);
+        unlink(file);
+    }
+    rmdir(sub);
+    rmdir(dir);
+    setenv("PATH", saved, 1);
+    free(saved);
+}
+
+// Test the hash builtin through do_builtin
+void test_do_builtin_hash(void)
+{
+    struct shell sh;
+    sh_init(&sh);
+    char *add[] = {"hash", "ls", NULL};
+    char *bad[] = {"hash", "no-such-command-xyz", NULL};
+    char *reset[] = {"hash", "-r", NULL};
+    TEST_ASSERT_TRUE(do_builtin(&sh, add));
+    TEST_ASSERT_EQUAL_INT(0, sh.last_status);
+    TEST_ASSERT_EQUAL_size_t(1, sh.path_cache->count);
+    TEST_ASSERT_TRUE(do_builtin(&sh, bad));
+    TEST_ASSERT_EQUAL_INT(1, sh.last_status);
+    TEST_ASSERT_TRUE(do_builtin(&sh, reset));
+    TEST_ASSERT_EQUAL_size_t(0, sh.path_cache->count);
+    sh_destroy(&sh);
+}
+
+// Test long pipelines, resized pipes and built in commands as stages
+void test_exec_pipeline_stages(void)
+{
+    struct shell sh;
+    char buf[256];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    vars_set(sh.vars, "PIPESIZE", "1048576", 0);
+    snprintf(buf, sizeof(buf), "head -c 3000000 /dev/zero | cat | cat | cat | wc -c > %s", path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(3000000, atoi(buf));
+    vars_unset(sh.vars, "PIPESIZE");
+    // Built in output is spliced into the pipe
+    snprintf(buf, sizeof(buf), "hash ls; hash | head -1 > %s", path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("hits\tcommand\n", buf);
+    // More than one buffer of it, each spliced page must keep its bytes
+    snprintf(buf, sizeof(buf), "printf '%%s\\n' {1..50000} | (sleep 0.1; cksum) > %s", path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("2937936293 288894\n", buf);
+    // Status of the last stage, a missing command in the middle does not hang
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "true | false"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "echo x | no-such-command-xyz 2>/dev/null | true"));
+    TEST_ASSERT_EQUAL_INT(127, run_line(&sh, "true | no-such-command-xyz 2>/dev/null"));
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Records what the event loop reported for a watched child
+struct child_report
+{
+    pid_t pid;
+    int status;
+    int calls;
+};
+
+static void record_child(void *ctx, pid_t pid, int status)
+{
+    struct child_report *r = ctx;
+    r->pid = pid;
+    r->status = status;
+    r->calls++;
+}
+
+// Test that watched children are reaped by the event loop
+void test_event_watch_child(void)
+{
+    struct event_loop ev;
+    struct child_report r = {0, 0, 0};
+    event_loop_init(&ev, false);
+    pid_t pid = fork();
+    if (pid == 0) _exit(3);
+    TEST_ASSERT_EQUAL_INT(0, event_watch_child(&ev, pid, record_child, &r));
+    for (int i = 0; i < 100 && ev.watches; i++) {
+        event_run_once(&ev, 100);
+    }
+    TEST_ASSERT_NULL(ev.watches);
+    TEST_ASSERT_EQUAL_INT(1, r.calls);
+    TEST_ASSERT_EQUAL_INT(pid, r.pid);
+    TEST_ASSERT_TRUE(WIFEXITED(r.status));
+    TEST_ASSERT_EQUAL_INT(3, WEXITSTATUS(r.status));
+    // Already reaped, no zombie left behind
+    TEST_ASSERT_EQUAL_INT(-1, waitpid(pid, NULL, WNOHANG));
+    TEST_ASSERT_EQUAL_INT(ECHILD, errno);
+    event_loop_destroy(&ev);
+}
+
+// Test waiting for a foreground child that stops instead of exiting
+void test_event_wait_stopped(void)
+{
+    struct event_loop ev;
+    int status;
+    event_loop_init(&ev, false);
+    pid_t pid = fork();
+    if (pid == 0) {
+        raise(SIGSTOP);
+        _exit(0);
+    }
+    TEST_ASSERT_EQUAL_INT(0, event_wait_child(&ev, pid, &status));
+    TEST_ASSERT_TRUE(WIFSTOPPED(status));
+    kill(pid, SIGKILL);
+    TEST_ASSERT_EQUAL_INT(0, event_wait_child(&ev, pid, &status));
+    TEST_ASSERT_TRUE(WIFSIGNALED(status));
+    event_loop_destroy(&ev);
+}
+
+// Test that background lists are reaped while a foreground command runs
+void test_exec_background_reaped(void)
+{
+    struct shell sh;
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "true & sleep 0.2"));
+    TEST_ASSERT_NULL(sh.events->watches);
+    TEST_ASSERT_EQUAL_INT(-1, waitpid(-1, NULL, WNOHANG));
+    // Without job control the finished job is kept for wait
+    TEST_ASSERT_EQUAL_INT(1, sh.jobs->count);
+    TEST_ASSERT_EQUAL_INT(JOB_DONE, job_by_id(sh.jobs, 1)->state);
+    TEST_ASSERT_EQUAL_STRING("true", job_by_id(sh.jobs, 1)->cmd);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "wait"));
+    TEST_ASSERT_EQUAL_INT(0, sh.jobs->count);
+    sh_destroy(&sh);
+}
+
+// Test job table lookups with thousands of jobs
+void test_job_table(void)
+{
+    struct job_table jt;
+    job_table_init(&jt);
+    for (int i = 0; i < 5000; i++) {
+        struct job *j = job_create(2);
+        job_proc_start(j, 0, 100000 + 2 * i);
+        job_proc_start(j, 1, 100001 + 2 * i);
+        j->cmd = strdup(i == 4999 ? "last | job" : "a | b");
+        job_insert(&jt, j);
+    }
+    TEST_ASSERT_EQUAL_INT(5000, jt.count);
+    TEST_ASSERT_EQUAL_INT(5000, jt.running);
+    TEST_ASSERT_EQUAL_INT(5000, jt.current);
+    TEST_ASSERT_EQUAL_INT(4999, jt.previous);
+    for (int i = 0; i < 5000; i++) {
+        TEST_ASSERT_EQUAL_INT(i + 1, job_by_pid(&jt, 100001 + 2 * i)->id);
+    }
+    TEST_ASSERT_EQUAL_PTR(job_by_id(&jt, 42), job_find(&jt, "%42", false));
+    TEST_ASSERT_EQUAL_PTR(job_by_id(&jt, 42), job_find(&jt, "100082", true));
+    TEST_ASSERT_EQUAL_PTR(job_by_id(&jt, 5000), job_find(&jt, "%last", false));
+    TEST_ASSERT_EQUAL_PTR(job_by_id(&jt, 5000), job_find(&jt, "%?t | j", false));
+    TEST_ASSERT_EQUAL_PTR(job_by_id(&jt, 4999), job_find(&jt, "%-", false));
+    // Removing the top jobs frees their ids for reuse
+    for (int id = 5000; id > 2500; id--) {
+        job_remove(&jt, job_by_id(&jt, id));
+    }
+    job_remove(&jt, job_by_id(&jt, 7));
+    TEST_ASSERT_EQUAL_INT(2499, jt.count);
+    TEST_ASSERT_EQUAL_INT(2500, jt.max_id);
+    TEST_ASSERT_EQUAL_INT(2500, jt.current);
+    TEST_ASSERT_EQUAL_INT(2499, jt.previous);
+    TEST_ASSERT_NULL(job_by_pid(&jt, 100013));
+    TEST_ASSERT_NULL(job_by_pid(&jt, 109999));
+    TEST_ASSERT_EQUAL_INT(8, job_by_pid(&jt, 100015)->id);
+    struct job *j = job_create(1);
+    job_proc_start(j, 0, 99);
+    job_insert(&jt, j);
+    TEST_ASSERT_EQUAL_INT(2501, j->id);
+    // Exits reported by pid update the state and the running count
+    job_update(&jt, 99, W_EXITCODE(5, 0));
+    TEST_ASSERT_EQUAL_INT(JOB_DONE, j->state);
+    TEST_ASSERT_EQUAL_INT(5, job_status(j));
+    TEST_ASSERT_EQUAL_INT(2499, jt.running);
+    job_update(&jt, 100015, W_STOPCODE(SIGTSTP));
+    TEST_ASSERT_EQUAL_INT(JOB_STOPPED, job_by_id(&jt, 8)->state);
+    TEST_ASSERT_TRUE(job_pending(&jt));
+    job_table_destroy(&jt);
+}
+
+// Test wait, wait -n and wait %n on background jobs
+void test_do_builtin_wait(void)
+{
+    struct shell sh;
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "sh -c 'exit 3' &"));
+    TEST_ASSERT_EQUAL_INT(3, run_line(&sh, "wait %1"));
+    TEST_ASSERT_EQUAL_INT(0, sh.jobs->count);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "sleep 0.3 & sh -c 'exit 4' | cat & sh -c 'exit 5' &"));
+    TEST_ASSERT_EQUAL_INT(3, sh.jobs->count);
+    TEST_ASSERT_EQUAL_INT(2, job_by_id(sh.jobs, 2)->nprocs);
+    // A pipeline job's status is that of its last stage
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "wait %2"));
+    TEST_ASSERT_EQUAL_INT(5, run_line(&sh, "wait -n"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "wait -n"));
+    TEST_ASSERT_EQUAL_INT(127, run_line(&sh, "wait -n"));
+    TEST_ASSERT_EQUAL_INT(127, run_line(&sh, "wait %9 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "fg 2>/dev/null"));
+    sh_destroy(&sh);
+}
+
+// Test that every core builtin sits in its perfect hash slot
+void test_builtin_core_table(void)
+{
+    const char *core[] = {"exit", "cd", "hash", "history", "jobs", "fg", "bg", "wait", "enable",
+                          "echo", "printf", "test", "[", "true", "false", "pwd", "export",
+                          "unset"};
+    for (size_t i = 0; i < sizeof(core) / sizeof(core[0]); i++) {
+        const struct builtin *b = builtin_core_lookup(core[i]);
+        TEST_ASSERT_NOT_NULL_MESSAGE(b, core[i]);
+        TEST_ASSERT_EQUAL_STRING(core[i], b->name);
+    }
+    const char *other[] = {"", "ls", "cdx", "c", "exi", "exits", "wai", "f", "history2"};
+    for (size_t i = 0; i < sizeof(other) / sizeof(other[0]); i++) {
+        TEST_ASSERT_NULL_MESSAGE(builtin_core_lookup(other[i]), other[i]);
+    }
+}
+
+static int seen_status;
+
+static int builtin_seen(struct shell *sh, char **argv)
+{
+    seen_status = sh->last_status;
+    return argv[1] ? atoi(argv[1]) : 0;
+}
+
+// Test registering, shadowing and removing builtins at run time
+void test_builtin_register(void)
+{
+    struct shell sh;
+    char *cmd[] = {"seen", "7", NULL};
+    char *cd[] = {"cd", "3", NULL};
+    char buf[32];
+    sh_init(&sh);
+    TEST_ASSERT_FALSE(do_builtin(&sh, cmd));
+    builtin_register(&sh, "seen", builtin_seen);
+    sh.last_status = 42;
+    TEST_ASSERT_TRUE(do_builtin(&sh, cmd));
+    TEST_ASSERT_EQUAL_INT(42, seen_status);
+    TEST_ASSERT_EQUAL_INT(7, sh.last_status);
+    TEST_ASSERT_TRUE(is_builtin(&sh, "seen"));
+    // Enough registrations to grow the table
+    for (int i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "b%d", i);
+        builtin_register(&sh, buf, builtin_seen);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        snprintf(buf, sizeof(buf), "b%d", i);
+        TEST_ASSERT_TRUE(builtin_unregister(&sh, buf));
+    }
+    for (int i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "b%d", i);
+        TEST_ASSERT_EQUAL(i % 2 == 1, is_builtin(&sh, buf));
+    }
+    // A registration shadows a core builtin until it is removed
+    builtin_register(&sh, "cd", builtin_seen);
+    TEST_ASSERT_TRUE(do_builtin(&sh, cd));
+    TEST_ASSERT_EQUAL_INT(3, sh.last_status);
+    TEST_ASSERT_TRUE(builtin_unregister(&sh, "cd"));
+    TEST_ASSERT_FALSE(builtin_unregister(&sh, "cd"));
+    TEST_ASSERT_EQUAL_PTR(builtin_core_lookup("cd"), builtin_lookup(&sh, "cd"));
+    // Registered builtins run in the shell, with output redirected
+    TEST_ASSERT_EQUAL_INT(5, run_line(&sh, "seen 5 >/dev/null"));
+    sh_destroy(&sh);
+}
+
+// Run cmd with stdout sent to path and read back what it wrote
+static int run_capture(struct shell *sh, const char *cmd, const char *path, char *buf, size_t len)
+{
+    char line[1024];
+    snprintf(line, sizeof(line), "%s > %s", cmd, path);
+    int status = run_line(sh, line);
+    read_file(path, buf, len);
+    return status;
+}
+
+// Test loading builtins from a shared object with enable -f
+void test_builtin_enable(void)
+{
+    struct shell sh;
+    char buf[256];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "enable -f " PLUGIN_DIR "/hello.so hello quiet"));
+    TEST_ASSERT_TRUE(is_builtin(&sh, "hello"));
+    snprintf(buf, sizeof(buf), "hello a b > %s", path);
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("hello a\nhello b\n", buf);
+    TEST_ASSERT_EQUAL_INT(3, run_line(&sh, "quiet"));
+    // Loaded builtins run in pipelines like any other
+    snprintf(buf, sizeof(buf), "hello | tr a-z A-Z > %s", path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("HELLO\n", buf);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "enable hello cd"));
+    // The descriptor names the command and gives the usage enable lists
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "enable -f " PLUGIN_DIR "/hello.so greet"));
+    TEST_ASSERT_TRUE(is_builtin(&sh, "hi"));
+    TEST_ASSERT_FALSE(is_builtin(&sh, "greet"));
+    char list[4096];
+    run_capture(&sh, "enable", path, list, sizeof(list));
+    TEST_ASSERT_NOT_NULL(strstr(list, "enable -f hi\t# hi [name ...]\n"));
+    TEST_ASSERT_NOT_NULL(strstr(list, "enable -f quiet\t# quiet\n"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "enable -d quiet"));
+    TEST_ASSERT_FALSE(is_builtin(&sh, "quiet"));
+    // Errors leave the table alone
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "enable -d cd 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "enable quiet 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "enable -f " PLUGIN_DIR "/hello.so nothere 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "enable -f " PLUGIN_DIR "/hello.so 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "enable -f /no/such/lib.so hello 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "enable -x 2>/dev/null"));
+    TEST_ASSERT_FALSE(is_builtin(&sh, "nothere"));
+    TEST_ASSERT_TRUE(is_builtin(&sh, "hello"));
+    unlink(path);
+    // hello is still loaded, sh_destroy closes it
+    sh_destroy(&sh);
+}
+
+// Test echo and printf running in the shell process
+void test_builtin_echo_printf(void)
+{
+    struct shell sh;
+    char buf[8192];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(0, run_capture(&sh, "echo a  'b  c'", path, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("a b  c\n", buf);
+    run_capture(&sh, "echo -n -x", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("-x", buf);
+    run_capture(&sh, "echo -e 'a\\tb\\x41\\0102\\cz' y", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("a\tbAB", buf);
+    run_capture(&sh, "echo 'a\\tb'", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("a\\tb\n", buf);
+    run_capture(&sh, "printf '%s=%d|%5.1f|%-3s|%x|%%\\n' a 42 2.25 b 255 c", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("a=42|  2.2|b  |ff|%\nc=0|  0.0|   |0|%\n", buf);
+    run_capture(&sh, "printf '%*d|%.2s|%c|%b\\n' 4 7 abc xyz 'q\\tr'", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("   7|ab|x|q\tr\n", buf);
+    run_capture(&sh, "printf x", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("x", buf);
+    TEST_ASSERT_EQUAL_INT(1, run_capture(&sh, "printf %d z 2>/dev/null", path, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("0", buf);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "printf %y 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "printf 2>/dev/null"));
+    // More pieces than fit in one writev, and arguments long enough to be
+    // referenced instead of copied
+    char cmd[1024] = "printf '%s.'";
+    for (int i = 0; i < 100; i++) strcat(cmd, " ab");
+    size_t len = strlen(cmd);
+    cmd[len++] = ' ';
+    memset(cmd + len, 'z', 300);
+    cmd[len + 300] = '\0';
+    run_capture(&sh, cmd, path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_size_t(300 + 300 + 1, strlen(buf));
+    TEST_ASSERT_EQUAL_STRING_LEN("ab.ab.", buf, 6);
+    TEST_ASSERT_EQUAL_CHAR('z', buf[599]);
+    // Output ordering with a pipeline stage, which buffers in memory
+    run_capture(&sh, "(echo one; printf '%s\\n' two three | cat; echo four)", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("one\ntwo\nthree\nfour\n", buf);
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Test the expressions of test and [
+void test_builtin_test(void)
+{
+    struct shell sh;
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "test"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "test -n"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "test ''"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "[ abc ]"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "[ a = a ]"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "[ a != a ]"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "test -z ''"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "test 10 -gt 9 -a 3 -le 3"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "test 1 -eq 2 -o ! 1 -ne 1"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "[ '(' 1 -lt 0 ')' ]"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "[ ! = x ]"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "test -d / -a -e /tmp -a ! -f /"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "test -f Makefile -a -s Makefile -a -r Makefile"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "test / -ef /tmp/.. -a /tmp -nt /no-such-file"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "test -e /no-such-file"));
+    // Syntax errors
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "[ a = a 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "test 1 -eq x 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "test a b c 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "test '(' a 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "true"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "false"));
+    sh_destroy(&sh);
+}
+
+// Test pwd, logical and physical
+void test_builtin_pwd(void)
+{
+    struct shell sh;
+    char buf[4096];
+    char expect[4096];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    TEST_ASSERT_NOT_NULL(getcwd(expect, sizeof(expect) - 1));
+    strcat(expect, "\n");
+    vars_set(sh.vars, "PWD", "/no-such-dir", 0);
+    TEST_ASSERT_EQUAL_INT(0, run_capture(&sh, "pwd", path, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING(expect, buf);
+    TEST_ASSERT_EQUAL_INT(0, run_capture(&sh, "pwd -P", path, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING(expect, buf);
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "pwd -x 2>/dev/null"));
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Test the variable table, its exported environment and the builtins on it
+void test_vars(void)
+{
+    struct var_table vt;
+    struct arena a;
+    char name[32];
+    char value[32];
+    arena_init(&a, 0);
+    vars_init(&vt);
+    // Enough names to grow the table, rewritten enough times to compact it
+    for (int round = 0; round < 40; round++) {
+        for (int i = 0; i < 500; i++) {
+            snprintf(name, sizeof(name), "LAB_V%d", i);
+            snprintf(value, sizeof(value), "%d-%d", i, round);
+            vars_set(&vt, name, value, 0);
+        }
+    }
+    TEST_ASSERT_EQUAL_size_t(500, vt.count);
+    TEST_ASSERT_EQUAL_STRING("123-39", vars_get(&vt, "LAB_V123"));
+    for (int i = 0; i < 500; i += 2) {
+        snprintf(name, sizeof(name), "LAB_V%d", i);
+        TEST_ASSERT_TRUE(vars_unset(&vt, name));
+    }
+    TEST_ASSERT_NULL(vars_get(&vt, "LAB_V122"));
+    TEST_ASSERT_EQUAL_STRING("499-39", vars_get(&vt, "LAB_V499"));
+    TEST_ASSERT_FALSE(vars_unset(&vt, "LAB_V122"));
+    // Only exported variables with a value reach the environment, and it is
+    // only rebuilt after a change
+    char **envp = vars_envp(&vt);
+    TEST_ASSERT_NULL(envp[0]);
+    vars_assign(&vt, "LAB_V1=x=y", VAR_EXPORT);
+    vars_export(&vt, "LAB_DECLARED");
+    envp = vars_envp(&vt);
+    TEST_ASSERT_EQUAL_STRING("LAB_V1=x=y", envp[0]);
+    TEST_ASSERT_NULL(envp[1]);
+    TEST_ASSERT_EQUAL_PTR(envp, vars_envp(&vt));
+    // The process environment is left alone
+    TEST_ASSERT_NULL(getenv("LAB_V1"));
+    char *assigns[] = {"LAB_V1=z", "LAB_TMP=1", "LAB_TMP=2"};
+    char **with = vars_envp_with(&vt, &a, assigns, 3);
+    TEST_ASSERT_EQUAL_STRING("LAB_V1=z", with[0]);
+    TEST_ASSERT_EQUAL_STRING("LAB_TMP=2", with[1]);
+    TEST_ASSERT_NULL(with[2]);
+    TEST_ASSERT_EQUAL_STRING("x=y", vars_get(&vt, "LAB_V1"));
+    vars_unset(&vt, "LAB_V1");
+    TEST_ASSERT_NULL(getenv("LAB_V1"));
+    TEST_ASSERT_EQUAL_size_t(3, assignment_name("FOO=bar"));
+    TEST_ASSERT_EQUAL_size_t(0, assignment_name("1FOO=bar"));
+    TEST_ASSERT_EQUAL_size_t(0, assignment_name("=bar"));
+    TEST_ASSERT_EQUAL_size_t(0, assignment_name("FOO"));
+    vars_destroy(&vt);
+    arena_destroy(&a);
+}
+
+// Test assignments in front of commands, export and unset
+void test_exec_assignments(void)
+{
+    struct shell sh;
+    char buf[4096];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "LAB_A=one"));
+    TEST_ASSERT_EQUAL_STRING("one", vars_get(sh.vars, "LAB_A"));
+    TEST_ASSERT_NULL(getenv("LAB_A"));
+    run_capture(&sh, "env | grep ^LAB_", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("", buf);
+    // Only for the one command, spawned or run in a forked stage
+    run_capture(&sh, "LAB_B=two env | grep ^LAB_", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("LAB_B=two\n", buf);
+    run_capture(&sh, "LAB_B=two sh -c 'echo $LAB_B' | cat", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("two\n", buf);
+    TEST_ASSERT_NULL(vars_get(sh.vars, "LAB_B"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "export LAB_A LAB_C='a \"b\"'"));
+    run_capture(&sh, "env | grep ^LAB_ | sort", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("LAB_A=one\nLAB_C=a \"b\"\n", buf);
+    run_capture(&sh, "export -p | grep LAB_C", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("export LAB_C=\"a \\\"b\\\"\"\n", buf);
+    // A builtin sees the assignment, which is undone afterwards
+    run_line(&sh, "LAB_A=tmp export LAB_D");
+    TEST_ASSERT_EQUAL_STRING("one", vars_get(sh.vars, "LAB_A"));
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "unset LAB_A LAB_C LAB_D"));
+    TEST_ASSERT_NULL(getenv("LAB_A"));
+    TEST_ASSERT_NULL(vars_get(sh.vars, "LAB_C"));
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "export 1X=2 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "unset -q X 2>/dev/null"));
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Test changing directories keeps PWD and OLDPWD
+void test_vars_cd(void)
+{
+    struct shell sh;
+    char cwd[4096];
+    TEST_ASSERT_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+    sh_init(&sh);
+    char line[4200];
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, "cd /"));
+    TEST_ASSERT_EQUAL_STRING("/", vars_get(sh.vars, "PWD"));
+    snprintf(line, sizeof(line), "cd %s", cwd);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, line));
+    TEST_ASSERT_EQUAL_STRING("/", vars_get(sh.vars, "OLDPWD"));
+    TEST_ASSERT_EQUAL_STRING(cwd, vars_get(sh.vars, "PWD"));
+    sh_destroy(&sh);
+}
+
+// Test parameter, tilde and arithmetic expansion with field splitting
+void test_expand(void)
+{
+    struct shell sh;
+    struct arena a;
+    char *params[] = {"p 1", "", "p3", NULL};
+    sh_init(&sh);
+    arena_init(&a, 128);
+    sh.params = params;
+    sh.last_status = 3;
+    char *home = strdup(getenv("HOME"));
+    vars_set(sh.vars, "HOME", "/home/lab", 0);
+    vars_set(sh.vars, "X", "a  b", 0);
+    vars_set(sh.vars, "N", "7", 0);
+    char *words[] = {"$X", "\"$X\"", "'$X'", "~/d", "x${N}y", "$((N * (2 + 1) - 1))", "$?$#", "${U:-u v}",
+                     "\"$@\"", "-$*-", "$U", "\"$U\"", "${#X}"};
+    char **argv = expand_words(&sh, &a, words, sizeof(words) / sizeof(words[0]));
+    const char *expect[] = {"a", "b", "a  b", "$X", "/home/lab/d", "x7y", "20", "33", "u", "v",
+                            "p 1", "", "p3", "-p", "1", "p3-", "", "4", NULL};
+    for (size_t i = 0; expect[i]; i++) TEST_ASSERT_EQUAL_STRING(expect[i], argv[i]);
+    TEST_ASSERT_NULL(argv[sizeof(expect) / sizeof(expect[0]) - 1]);
+    // Non white space IFS bytes delimit empty fields
+    vars_set(sh.vars, "IFS", ":", 0);
+    vars_set(sh.vars, "P", "a::b:", 0);
+    char *colon[] = {"$P"};
+    argv = expand_words(&sh, &a, colon, 1);
+    TEST_ASSERT_EQUAL_STRING("a", argv[0]);
+    TEST_ASSERT_EQUAL_STRING("", argv[1]);
+    TEST_ASSERT_EQUAL_STRING("b", argv[2]);
+    TEST_ASSERT_NULL(argv[3]);
+    // White space around a non white space byte is part of its delimiter
+    vars_set(sh.vars, "IFS", " :", 0);
+    vars_set(sh.vars, "P", " :a : b::c ", 0);
+    argv = expand_words(&sh, &a, colon, 1);
+    TEST_ASSERT_EQUAL_STRING("", argv[0]);
+    TEST_ASSERT_EQUAL_STRING("a", argv[1]);
+    TEST_ASSERT_EQUAL_STRING("b", argv[2]);
+    TEST_ASSERT_EQUAL_STRING("", argv[3]);
+    TEST_ASSERT_EQUAL_STRING("c", argv[4]);
+    TEST_ASSERT_NULL(argv[5]);
+    vars_unset(sh.vars, "IFS");
+    // A single word is never split, and an assignment expands ~ after =
+    TEST_ASSERT_EQUAL_STRING("D=/home/lab/x a  b", expand_word(&sh, &a, "D=~/x\\ $X"));
+    TEST_ASSERT_EQUAL_STRING("p 1  p3", expand_word(&sh, &a, "$*"));
+    // Arithmetic is 64 bit, assigns variables and short circuits
+    TEST_ASSERT_EQUAL_STRING("9223372036854775807", expand_word(&sh, &a, "$(( (1 << 63) - 1 ))"));
+    TEST_ASSERT_EQUAL_STRING("-9223372036854775808", expand_word(&sh, &a, "$(( (1 << 63) / -1 ))"));
+    TEST_ASSERT_EQUAL_STRING("12 12", expand_word(&sh, &a, "$((C = N + 5)) $C"));
+    TEST_ASSERT_EQUAL_STRING("48", expand_word(&sh, &a, "$((C <<= 2))"));
+    TEST_ASSERT_EQUAL_STRING("0 1 1", expand_word(&sh, &a, "$((0 && (C = 1))) $((C == 48)) $((N > 3 ? N != 7 || 1 : 0))"));
+    TEST_ASSERT_EQUAL_STRING("-1 7 16 8 1", expand_word(&sh, &a, "$((-7 % 3)) $((~-8)) $((0x10)) $((010)) $((!0))"));
+    TEST_ASSERT_EQUAL_STRING("48 49 50 50 49", expand_word(&sh, &a, "$((C++)) $C $((++C)) $((C--)) $C"));
+    TEST_ASSERT_EQUAL_STRING("7 2 6 5", expand_word(&sh, &a, "$((I = 2, J = I * 3, J + 1)) $I $J $((--5))"));
+    vars_set(sh.vars, "E", "N + 1", 0);
+    TEST_ASSERT_EQUAL_STRING("16", expand_word(&sh, &a, "$((E * 2))"));
+    TEST_ASSERT_EQUAL_STRING("dflt dflt", expand_word(&sh, &a, "${S:=dflt} $S"));
+    // Errors are reported and fail the expansion
+    int saved = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+    TEST_ASSERT_NULL(expand_word(&sh, &a, "$((1 / 0))"));
+    TEST_ASSERT_NULL(expand_word(&sh, &a, "$((1 +))"));
+    TEST_ASSERT_NULL(expand_word(&sh, &a, "${U:?unset}"));
+    TEST_ASSERT_NULL(expand_word(&sh, &a, "${2:=x}"));
+    TEST_ASSERT_NULL(expand_word(&sh, &a, "${X%b}"));
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    vars_set(sh.vars, "HOME", home, 0);
+    free(home);
+    arena_destroy(&a);
+    sh_destroy(&sh);
+}
+
+// Test expansion in commands: counters without external commands
+void test_exec_expand(void)
+{
+    struct shell sh;
+    char buf[4096];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    run_line(&sh, "i=0; s=; i=$((i + 1)); s=$s$i; i=$((i + 1)); s=$s-$i");
+    TEST_ASSERT_EQUAL_STRING("1-2", vars_get(sh.vars, "s"));
+    run_capture(&sh, "V='x y'; printf '<%s>' $V \"$V\" $((i * 10))", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("<x><y><x y><20>", buf);
+    // The redirection target is expanded too
+    snprintf(buf, sizeof(buf), "T=%s; echo $((i += 1)) > $T", path);
+    TEST_ASSERT_EQUAL_INT(0, run_line(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("3\n", buf);
+    // A failed expansion fails the command without running it
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "echo $((1 / 0)) > /dev/null 2>&1 || true; : ${Q:?} 2>/dev/null"));
+    run_capture(&sh, "echo $?", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("1\n", buf);
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+// Expand a word with the brace generator, joining the words with blanks
+static void brace_join(const char *raw, char *out, size_t len)
+{
+    struct brace_iter it;
+    size_t n = 0;
+    out[0] = '\0';
+    brace_begin(&it, raw);
+    for (const char *w; (w = brace_next(&it));) {
+        n += snprintf(out + n, len - n, n ? " %s" : "%s", w);
+    }
+    brace_end(&it);
+}
+
+// Test brace expansion: lists, ranges, nesting and what stays literal
+void test_brace_expand(void)
+{
+    static const struct
+    {
+        const char *raw;
+        const char *words;
+    } cases[] = {
+        {"a{b,c}d", "abd acd"}, {"{a,b}{1,2}", "a1 a2 b1 b2"}, {"x{a,b{1..2}}y", "xay xb1y xb2y"},
+        {"a{,b}", "a ab"}, {"{1..3}", "1 2 3"}, {"{3..1}", "3 2 1"}, {"{-2..2..2}", "-2 0 2"},
+        {"{01..10..3}", "01 04 07 10"}, {"{a..e..2}", "a c e"}, {"{1..a}", "{1..a}"},
+        {"{a}", "{a}"}, {"{x{a,b}", "{xa {xb"}, {"{{a,b}}", "{a} {b}"}, {"${x}", "${x}"},
+        {"'{a,b}'", "'{a,b}'"}, {"\\{a,b}", "\\{a,b}"}, {"\"{a,b}\"{c,d}", "\"{a,b}\"c \"{a,b}\"d"},
+        {"plain", "plain"},
+    };
+    char buf[256];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        brace_join(cases[i].raw, buf, sizeof(buf));
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(cases[i].words, buf, cases[i].raw);
+    }
+    // Generated words go on to the other expansions
+    struct shell sh;
+    struct arena a;
+    sh_init(&sh);
+    arena_init(&a, 0);
+    vars_set(sh.vars, "X", "1 2", 0);
+    char *words[] = {"{a,$X}", "\"{b,$X}\""};
+    char **argv = expand_words(&sh, &a, words, 2);
+    TEST_ASSERT_EQUAL_STRING("a", argv[0]);
+    TEST_ASSERT_EQUAL_STRING("1", argv[1]);
+    TEST_ASSERT_EQUAL_STRING("2", argv[2]);
+    TEST_ASSERT_EQUAL_STRING("{b,1 2}", argv[3]);
+    TEST_ASSERT_NULL(argv[4]);
+    arena_destroy(&a);
+    sh_destroy(&sh);
+}
+
+// Test for loops: the tree, running them and their memory
+void test_for_loop(void)
+{
+    struct parser ps;
+    struct arena t, a;
+    struct node *n;
+    struct shell sh;
+    char buf[4096];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    parser_init(&ps);
+    arena_init(&t, 0);
+    const char *src = "for i in a {1..3}\ndo echo $i; done > f";
+    TEST_ASSERT_EQUAL_INT(PARSE_OK, parse_line(&ps, src, strlen(src), &t, &n));
+    TEST_ASSERT_EQUAL_INT(N_FOR, n->type);
+    TEST_ASSERT_EQUAL_STRING("i", n->loop.name);
+    TEST_ASSERT_EQUAL_size_t(2, n->loop.nwords);
+    TEST_ASSERT_EQUAL_STRING("{1..3}", n->loop.words[1]);
+    TEST_ASSERT_EQUAL_INT(1, n->loop.redirs->fd);
+    char *s = node_string(n);
+    TEST_ASSERT_EQUAL_STRING("for i in a {1..3}; do echo $i; done >f", s);
+    free(s);
+    TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, parse_line(&ps, "for i in a; do echo", 19, &t, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_ERROR, parse_line(&ps, "for i in a; do done", 19, &t, &n));
+    TEST_ASSERT_EQUAL_INT(PARSE_ERROR, parse_line(&ps, "for 1 in a; do :; done", 22, &t, &n));
+    // Reserved words are only reserved where a command starts
+    TEST_ASSERT_EQUAL_INT(PARSE_OK, parse_line(&ps, "echo for do done", 16, &t, &n));
+    TEST_ASSERT_EQUAL_INT(N_SIMPLE, n->type);
+
+    sh_init(&sh);
+    run_capture(&sh, "for i in a{1,2} \"x y\"; do printf '<%s>' $i; done", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("<a1><a2><x><y>", buf);
+    run_capture(&sh, "for i in {1..3}; do for j in {a..b}; do printf $i$j; done; done", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("1a1b2a2b3a3b", buf);
+    char **params = sh.params;
+    sh.params = (char *[]){"p", "q", NULL};
+    run_capture(&sh, "for x; do printf $x; done", path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("pq", buf);
+    sh.params = params;
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "(for i in ${U?}; do :; done) 2>/dev/null"));
+    // The layout scripts use, one part per line
+    snprintf(buf, sizeof(buf), "for i in a b\ndo\n  for j in 1 2\n  do\n    printf $i$j\n  done\ndone > %s", path);
+    TEST_ASSERT_EQUAL_INT(0, run_lines(&sh, buf));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("a1a2b1b2", buf);
+    TEST_ASSERT_EQUAL_INT(-1, run_lines(&sh, "for i in a b\ndo\n  true\n"));
+    // Every iteration gives its memory back, however many there are
+    arena_init(&a, 0);
+    src = "n=0; for i in {1..10}; do true $((n += i)) $i $i; done";
+    parse_line(&ps, src, strlen(src), &t, &n);
+    exec_node(&sh, n, &a);
+    TEST_ASSERT_EQUAL_STRING("55", vars_get(sh.vars, "n"));
+    struct arena_mark m = arena_save(&a);
+    arena_reset(&a);
+    src = "n=0; for i in {1..100000}; do true $((n += i)) $i $i; done";
+    parse_line(&ps, src, strlen(src), &t, &n);
+    exec_node(&sh, n, &a);
+    TEST_ASSERT_EQUAL_STRING("5000050000", vars_get(sh.vars, "n"));
+    TEST_ASSERT_EQUAL_PTR(m.ptr, arena_save(&a).ptr);
+    // A body of builtins stops on a Ctrl-C only the event loop sees
+    struct event_loop ev, *events = sh.events;
+    event_loop_init(&ev, true);
+    sh.events = &ev;
+    raise(SIGINT);
+    TEST_ASSERT_EQUAL_INT(130, run_line(&sh, "for i in {1..10000000}; do n=$i; done"));
+    TEST_ASSERT_EQUAL_STRING("1", vars_get(sh.vars, "n"));
+    TEST_ASSERT_FALSE(ev.interrupted);
+    sh.events = events;
+    event_loop_destroy(&ev);
+    unlink(path);
+    arena_destroy(&a);
+    arena_destroy(&t);
+    parser_destroy(&ps);
+    sh_destroy(&sh);
+}
+
+// Test compiled patterns against single names
+void test_glob_pattern(void)
+{
+    static const struct
+    {
+        const char *pat;
+        const char *name;
+        bool match;
+    } cases[] = {
+        {"*.log", "a.log", true}, {"*.log", "a.log.1", false}, {"*.log", ".a.log", false},
+        {".*", ".a", true}, {"a*b*c", "aXbYbZc", true}, {"a*b*c", "aXbYc", true},
+        {"a*b*c", "acb", false}, {"?", "", false}, {"??", "ab", true}, {"*", "", true},
+        {"[abc]x", "bx", true}, {"[!abc]x", "bx", false}, {"[^a-c]x", "dx", true},
+        {"[]]", "]", true}, {"[a-]", "-", true}, {"[[:digit:]]*", "7up", true},
+        {"[[:upper:]]", "a", false}, {"\\*", "*", true}, {"\\*", "a", false},
+        {"[", "[", true}, {"a[", "a[", true}, {"*a*a*a*a*b", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", false},
+        {"f*[0-9].txt", "f12.txt", true}, {"f*[0-9].txt", "f1x.txt", false},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct pattern p;
+        pattern_compile(&p, cases[i].pat, strlen(cases[i].pat));
+        TEST_ASSERT_EQUAL_MESSAGE(cases[i].match, pattern_match(&p, cases[i].name, strlen(cases[i].name)), cases[i].pat);
+        pattern_free(&p);
+    }
+    TEST_ASSERT_TRUE(glob_magic("a*"));
+    TEST_ASSERT_TRUE(glob_magic("[ab]"));
+    TEST_ASSERT_FALSE(glob_magic("["));
+    TEST_ASSERT_FALSE(glob_magic("a\\*b"));
+    // The radix sort agrees with strcmp, across the insertion sort cutoff
+    char *names[300];
+    char buf[300][8];
+    for (int i = 0; i < 300; i++) {
+        snprintf(buf[i], sizeof(buf[i]), "%c%d", "abc"[i * 7 % 3], i * 7919 % 1000);
+        names[i] = buf[i];
+    }
+    sort_names(names, 300);
+    for (int i = 1; i < 300; i++) TEST_ASSERT_TRUE(strcmp(names[i - 1], names[i]) <= 0);
+}
+
+// Test pathname expansion over a directory tree
+void test_path_glob(void)
+{
+    char dir[] = "/tmp/test-lab-XXXXXX";
+    char path[256];
+    char cwd[4096];
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    TEST_ASSERT_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+    const char *dirs[] = {"a", "a/b", "c", "c/.h"};
+    const char *files[] = {"x.log", "y.log", ".z.log", "a/1.log", "a/b/2.log", "c/3.log", "c/.h/4.log", "q*"};
+    for (size_t i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+        mkdir(path, 0755);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        fclose(fopen(path, "w"));
+    }
+    TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+    struct glob_result r;
+    TEST_ASSERT_EQUAL_size_t(2, path_glob("*.log", 0, &r));
+    TEST_ASSERT_EQUAL_STRING("x.log", r.paths[0]);
+    TEST_ASSERT_EQUAL_STRING("y.log", r.paths[1]);
+    glob_result_free(&r);
+    TEST_ASSERT_EQUAL_size_t(2, path_glob("*/", 0, &r));
+    TEST_ASSERT_EQUAL_STRING("a/", r.paths[0]);
+    TEST_ASSERT_EQUAL_STRING("c/", r.paths[1]);
+    glob_result_free(&r);
+    TEST_ASSERT_EQUAL_size_t(1, path_glob("?/b/*", 0, &r));
+    TEST_ASSERT_EQUAL_STRING("a/b/2.log", r.paths[0]);
+    glob_result_free(&r);
+    TEST_ASSERT_EQUAL_size_t(1, path_glob("q\\*", 0, &r));
+    glob_result_free(&r);
+    // ** walked by several threads, without hidden directories
+    TEST_ASSERT_EQUAL_size_t(5, path_glob("**/*.log", 4, &r));
+    const char *all[] = {"a/1.log", "a/b/2.log", "c/3.log", "x.log", "y.log"};
+    for (size_t i = 0; i < 5; i++) TEST_ASSERT_EQUAL_STRING(all[i], r.paths[i]);
+    glob_result_free(&r);
+    snprintf(path, sizeof(path), "%s/**/?.log", dir);
+    TEST_ASSERT_EQUAL_size_t(5, path_glob(path, 2, &r));
+    snprintf(path, sizeof(path), "%s/a/1.log", dir);
+    TEST_ASSERT_EQUAL_STRING(path, r.paths[0]);
+    glob_result_free(&r);
+    TEST_ASSERT_EQUAL_size_t(0, path_glob("nothing*", 0, &r));
+    glob_result_free(&r);
+    // Through the expansion of a command
+    struct shell sh;
+    char buf[256];
+    sh_init(&sh);
+    run_line(&sh, "P='*.log'; echo *.log \"*\".log $P \"$P\" n*ne '[' [xy].l?g > out");
+    read_file("out", buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("x.log y.log *.log x.log y.log *.log n*ne [ x.log y.log\n", buf);
+    sh_destroy(&sh);
+    unlink("out");
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    for (size_t i = 0; i < 8; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    for (size_t i = 4; i-- > 0;) {
+        snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+        rmdir(path);
+    }
+    rmdir(dir);
+}
+
+// Test splitting piped input into lines, across block boundaries
+void test_line_reader_pipe(void)
+{
+    int fds[2];
+    char *line;
+    TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        FILE *f = fdopen(fds[1], "w");
+        fputs("one\n\nthree\n", f);
+        for (int i = 0; i < 100000; i++) fputc('x', f);
+        fputs("\n", f);
+        for (int i = 0; i < 20000; i++) fprintf(f, "line %d\n", i);
+        fputs("last", f);
+        fclose(f);
+        _exit(0);
+    }
+    close(fds[1]);
+    struct line_reader r;
+    line_reader_init(&r, fds[0]);
+    TEST_ASSERT_FALSE(r.seekable);
+    TEST_ASSERT_EQUAL_INT(3, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_STRING("one", line);
+    TEST_ASSERT_EQUAL_INT(0, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_INT(5, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_INT(100000, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_size_t(100000, strlen(line));
+    char expect[32];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(expect, sizeof(expect), "line %d", i);
+        TEST_ASSERT_EQUAL_INT(strlen(expect), line_reader_next(&r, &line));
+        TEST_ASSERT_EQUAL_STRING(expect, line);
+    }
+    TEST_ASSERT_EQUAL_INT(4, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_STRING("last", line);
+    TEST_ASSERT_EQUAL_INT(-1, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_UINT(20005, r.lineno);
+    line_reader_destroy(&r);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+}
+
+// Test handing the offset of a script on stdin to the commands it runs
+void test_line_reader_share(void)
+{
+    char path[] = "/tmp/test-lab-XXXXXX";
+    char buf[16];
+    char *line;
+    int fd = mkstemp(path);
+    const char text[] = "a\nb\nc\nd\n";
+    TEST_ASSERT_EQUAL_INT(sizeof(text) - 1, write(fd, text, sizeof(text) - 1));
+    lseek(fd, 0, SEEK_SET);
+    struct line_reader r;
+    line_reader_init(&r, fd);
+    TEST_ASSERT_TRUE(r.seekable);
+    TEST_ASSERT_EQUAL_INT(1, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_STRING("a", line);
+    // A command that reads nothing leaves the buffered lines alone
+    line_reader_share(&r);
+    TEST_ASSERT_EQUAL_INT(2, lseek(fd, 0, SEEK_CUR));
+    line_reader_resume(&r);
+    TEST_ASSERT_EQUAL_INT(1, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_STRING("b", line);
+    // A command that reads a line takes it away from the shell
+    line_reader_share(&r);
+    TEST_ASSERT_EQUAL_INT(2, read(fd, buf, 2));
+    TEST_ASSERT_EQUAL_CHAR('c', buf[0]);
+    line_reader_resume(&r);
+    TEST_ASSERT_EQUAL_INT(1, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_STRING("d", line);
+    TEST_ASSERT_EQUAL_INT(-1, line_reader_next(&r, &line));
+    line_reader_destroy(&r);
+    close(fd);
+    unlink(path);
+}
+
+// Test looking ahead for the tail exec when the handed out lines end
+// exactly where the first read stopped
+void test_line_reader_share_boundary(void)
+{
+    char path[] = "/tmp/test-lab-XXXXXX";
+    char *line;
+    int fd = mkstemp(path);
+    // 13107 lines of "true" fill the first 65535 byte read exactly
+    for (int i = 0; i < 13107; i++) TEST_ASSERT_EQUAL_INT(5, write(fd, "true\n", 5));
+    TEST_ASSERT_EQUAL_INT(14, write(fd, "echo A\necho B\n", 14));
+    lseek(fd, 0, SEEK_SET);
+    struct line_reader r;
+    line_reader_init(&r, fd);
+    for (int i = 0; i < 13107; i++) TEST_ASSERT_EQUAL_INT(4, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_size_t(r.len, r.pos);
+    // The order of run_script: look ahead, then share and resume
+    TEST_ASSERT_FALSE(line_reader_at_end(&r));
+    line_reader_share(&r);
+    TEST_ASSERT_EQUAL_INT(65535, lseek(fd, 0, SEEK_CUR));
+    line_reader_resume(&r);
+    TEST_ASSERT_EQUAL_INT(6, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_STRING("echo A", line);
+    TEST_ASSERT_EQUAL_INT(6, line_reader_next(&r, &line));
+    TEST_ASSERT_EQUAL_STRING("echo B", line);
+    TEST_ASSERT_TRUE(line_reader_at_end(&r));
+    line_reader_destroy(&r);
+    close(fd);
+    unlink(path);
+}
+
+// Test the command line forms of the shell
+void test_parse_args(void)
+{
+    struct shell_options opt;
+    char *a1[] = {"sh", "--norc", "script.sh", "-c", "x", NULL};
+    TEST_ASSERT_EQUAL_INT(0, parse_args(5, a1, &opt));
+    TEST_ASSERT_TRUE(opt.norc);
+    TEST_ASSERT_NULL(opt.command);
+    TEST_ASSERT_EQUAL_STRING("script.sh", opt.script);
+    TEST_ASSERT_EQUAL_STRING("script.sh", opt.name);
+    TEST_ASSERT_EQUAL_STRING("-c", opt.args[0]);
+    TEST_ASSERT_EQUAL_STRING("x", opt.args[1]);
+    TEST_ASSERT_NULL(opt.args[2]);
+    char *a2[] = {"sh", "-c", "echo hi", "name", "one", NULL};
+    TEST_ASSERT_EQUAL_INT(0, parse_args(5, a2, &opt));
+    TEST_ASSERT_EQUAL_STRING("echo hi", opt.command);
+    TEST_ASSERT_NULL(opt.script);
+    TEST_ASSERT_EQUAL_STRING("name", opt.name);
+    TEST_ASSERT_EQUAL_STRING("one", opt.args[0]);
+    TEST_ASSERT_FALSE(opt.norc);
+    char *a3[] = {"sh", "-s", "--bench", "a", NULL};
+    TEST_ASSERT_EQUAL_INT(0, parse_args(4, a3, &opt));
+    TEST_ASSERT_TRUE(opt.read_stdin);
+    TEST_ASSERT_TRUE(opt.bench);
+    TEST_ASSERT_NULL(opt.script);
+    TEST_ASSERT_EQUAL_STRING("sh", opt.name);
+    TEST_ASSERT_EQUAL_STRING("a", opt.args[0]);
+    char *a4[] = {"sh", NULL};
+    TEST_ASSERT_EQUAL_INT(0, parse_args(1, a4, &opt));
+    TEST_ASSERT_NULL(opt.script);
+    TEST_ASSERT_NULL(opt.args[0]);
+    char *a5[] = {"sh", "-c", NULL};
+    TEST_ASSERT_EQUAL_INT(-1, parse_args(2, a5, &opt));
+}
+
+// Test that --bench times each phase of running commands
+void test_bench_phases(void)
+{
+    struct shell sh;
+    struct shell_options opt = {.command = "true", .bench = true};
+    sh_init_with(&sh, &opt);
+    TEST_ASSERT_FALSE(sh.shell_is_interactive);
+    TEST_ASSERT_NOT_NULL(sh.bench);
+    run_line(&sh, "true; sh -c 'exit 3' | cat; cd .");
+    TEST_ASSERT_EQUAL_UINT(2, sh.bench->count[BENCH_BUILTIN]);
+    TEST_ASSERT_EQUAL_UINT(1, sh.bench->count[BENCH_SPAWN]);
+    TEST_ASSERT_EQUAL_UINT(1, sh.bench->count[BENCH_WAIT]);
+    TEST_ASSERT_TRUE(sh.bench->ns[BENCH_WAIT] > 0);
+    FILE *f = tmpfile();
+    bench_report(&sh, f);
+    TEST_ASSERT_TRUE(ftell(f) > 0);
+    fclose(f);
+    sh_destroy(&sh);
+    // Without --bench nothing is timed
+    sh_init(&sh);
+    TEST_ASSERT_NULL(sh.bench);
+    TEST_ASSERT_EQUAL_UINT64(0, bench_begin(&sh));
+    sh_destroy(&sh);
+}
+
+// Parse line and hand it to exec_tail
+static int run_tail(struct shell *sh, const char *line)
+{
+    struct parser ps;
+    struct arena a;
+    struct node *n;
+    parser_init(&ps);
+    arena_init(&a, 0);
+    int status = -1;
+    if (parse_line(&ps, line, strlen(line), &a, &n) == PARSE_OK) {
+        status = exec_tail(sh, n, &a);
+    }
+    arena_destroy(&a);
+    parser_destroy(&ps);
+    return status;
+}
+
+// Test that the last command replaces the shell instead of being forked
+void test_exec_tail(void)
+{
+    struct shell sh;
+    char buf[64];
+    char path[] = "/tmp/test-lab-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    sh_init(&sh);
+    // Builtins and failed lists return to the caller
+    TEST_ASSERT_EQUAL_INT(1, run_tail(&sh, "true; false"));
+    TEST_ASSERT_EQUAL_INT(1, run_tail(&sh, "false && sh -c 'exit 5'"));
+    TEST_ASSERT_EQUAL_INT(0, run_tail(&sh, "true || sh -c 'exit 5'"));
+    sh_destroy(&sh);
+    // In a child standing in for the shell, the command's parent is the
+    // test itself
+    snprintf(buf, sizeof(buf), "true && sh -c 'echo $PPID' > %s", path);
+    pid_t pid = fork();
+    if (pid == 0) {
+        sh_init(&sh);
+        run_tail(&sh, buf);
+        _exit(99);
+    }
+    int status;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(status));
+    read_file(path, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(getpid(), atoi(buf));
+    unlink(path);
+}
+
+// Test the history file: appending, dedupe, other writers and printing
+void test_history_file(void)
+{
+    struct shell sh;
+    char path[] = "/tmp/test-lab-XXXXXX";
+    char out[] = "/tmp/test-lab-XXXXXX";
+    char buf[1024];
+    size_t len;
+    int fd = mkstemp(path);
+    close(mkstemp(out));
+    // Entries already in the file, one of them twice
+    const char text[] = "ls\nmake\nls\n";
+    TEST_ASSERT_EQUAL_INT(sizeof(text) - 1, write(fd, text, sizeof(text) - 1));
+    struct history *h = history_open(path);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_NULL(h->map);
+    TEST_ASSERT_EQUAL_size_t(3, history_count(h));
+    TEST_ASSERT_FALSE(history_add(h, "ls", 2));
+    TEST_ASSERT_FALSE(history_add(h, "", 0));
+    TEST_ASSERT_TRUE(history_add(h, "echo hi", 7));
+    TEST_ASSERT_FALSE(history_add(h, "echo hi", 7));
+    TEST_ASSERT_TRUE(history_add(h, "echo h", 6));
+    TEST_ASSERT_EQUAL_size_t(5, history_count(h));
+    TEST_ASSERT_EQUAL_STRING_LEN("echo h", history_entry(h, 4, &len), 6);
+    TEST_ASSERT_EQUAL_size_t(6, len);
+    // Another writer, with a line it has not finished yet
+    lseek(fd, 0, SEEK_END);
+    TEST_ASSERT_EQUAL_INT(8, write(fd, "pwd\ncd /", 8));
+    TEST_ASSERT_EQUAL_size_t(6, history_count(h));
+    TEST_ASSERT_FALSE(history_add(h, "pwd", 3));
+    TEST_ASSERT_EQUAL_INT(1, write(fd, "\n", 1));
+    TEST_ASSERT_EQUAL_size_t(7, history_count(h));
+    TEST_ASSERT_EQUAL_STRING_LEN("cd /", history_entry(h, 6, &len), 4);
+    // Enough entries to grow the index and the mapping
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(buf, sizeof(buf), "command number %d %0100d", i, 0);
+        TEST_ASSERT_TRUE(history_add(h, buf, n));
+    }
+    TEST_ASSERT_EQUAL_size_t(20007, history_count(h));
+    close(fd);
+    sh_init(&sh);
+    sh.history = h;
+    TEST_ASSERT_EQUAL_INT(0, run_capture(&sh, "history 2", out, buf, sizeof(buf)));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "20006  command number 19998 0"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "\n20007  command number 19999 0"));
+    TEST_ASSERT_EQUAL_CHAR('\n', buf[strlen(buf) - 1]);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "history x 2>/dev/null"));
+    sh_destroy(&sh);
+    // A new session sees the same entries
+    h = history_open(path);
+    TEST_ASSERT_EQUAL_size_t(20007, history_count(h));
+    TEST_ASSERT_EQUAL_STRING_LEN("make", history_entry(h, 1, &len), 4);
+    history_close(h);
+    unlink(path);
+    unlink(out);
+}
+
+void test_history_shared(void)
+{
+    char path[] = "/tmp/test-lab-XXXXXX";
+    char text[256];
+    size_t len;
+    int fd = mkstemp(path);
+    // Two sessions open the new file; only one magic line is written
+    struct history *a = history_open(path);
+    struct history *b = history_open(path);
+    TEST_ASSERT_TRUE(history_add(a, "make", 4));
+    TEST_ASSERT_TRUE(history_add(b, "make test", 9));
+    TEST_ASSERT_FALSE(history_add(b, "make", 4));
+    TEST_ASSERT_TRUE(history_add(a, "ls -l", 5));
+    TEST_ASSERT_TRUE(a->framed);
+    TEST_ASSERT_EQUAL_size_t(3, history_count(a));
+    TEST_ASSERT_EQUAL_size_t(3, history_count(b));
+    TEST_ASSERT_EQUAL_STRING_LEN("ls -l", history_entry(b, 2, &len), 5);
+    ssize_t n = pread(fd, text, sizeof(text) - 1, 0);
+    text[n] = '\0';
+    TEST_ASSERT_EQUAL_STRING_LEN(HISTORY_MAGIC, text, sizeof(HISTORY_MAGIC) - 1);
+    TEST_ASSERT_EQUAL_CHAR(' ', text[sizeof(HISTORY_MAGIC) - 1 + 8]);
+    // A torn record, a record with a bad checksum, then a good one
+    lseek(fd, 0, SEEK_END);
+    const char bad[] = "1234abcd make instal\n00000000 pwd\n";
+    TEST_ASSERT_EQUAL_INT(sizeof(bad) - 1, write(fd, bad, sizeof(bad) - 1));
+    TEST_ASSERT_TRUE(history_add(a, "pwd", 3));
+    TEST_ASSERT_EQUAL_size_t(4, history_count(b));
+    TEST_ASSERT_EQUAL_size_t(2, b->skipped);
+    TEST_ASSERT_EQUAL_STRING_LEN("pwd", history_entry(b, 3, &len), 3);
+    history_close(a);
+    history_close(b);
+    close(fd);
+    unlink(path);
+}
+
+void test_history_find(void)
+{
+    struct shell sh;
+    char path[] = "/tmp/test-lab-XXXXXX";
+    char out[] = "/tmp/test-lab-XXXXXX";
+    char buf[256];
+    size_t hits[8];
+    close(mkstemp(path));
+    close(mkstemp(out));
+    struct history *h = history_open(path);
+    history_add(h, "git status", 10);
+    history_add(h, "git commit -m wip", 17);
+    history_add(h, "make check", 10);
+    history_add(h, "git push", 8);
+    history_add(h, "git status", 10);
+    // Used twice beats used last
+    TEST_ASSERT_EQUAL_size_t(3, history_find(h, "git", 3, hits, 8));
+    TEST_ASSERT_EQUAL_size_t(0, hits[0]);
+    TEST_ASSERT_EQUAL_size_t(3, hits[1]);
+    TEST_ASSERT_EQUAL_size_t(1, hits[2]);
+    TEST_ASSERT_EQUAL_size_t(1, history_find(h, "git", 3, hits, 1));
+    // Longer than a trigram, and spanning words
+    TEST_ASSERT_EQUAL_size_t(1, history_find(h, "it comm", 7, hits, 8));
+    TEST_ASSERT_EQUAL_size_t(1, hits[0]);
+    // Every trigram present, but not together
+    TEST_ASSERT_EQUAL_size_t(0, history_find(h, "git check", 9, hits, 8));
+    TEST_ASSERT_EQUAL_size_t(0, history_find(h, "xyz", 3, hits, 8));
+    // Short patterns scan
+    TEST_ASSERT_EQUAL_size_t(3, history_find(h, "it", 2, hits, 8));
+    TEST_ASSERT_EQUAL_size_t(4, history_find(h, "", 0, hits, 8));
+    // Added after the index was built
+    history_add(h, "make install", 12);
+    TEST_ASSERT_EQUAL_size_t(2, history_find(h, "make", 4, hits, 8));
+    TEST_ASSERT_EQUAL_size_t(4, hits[0]);
+    sh_init(&sh);
+    sh.history = h;
+    TEST_ASSERT_EQUAL_INT(0, run_capture(&sh, "history -s make", out, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("    5  make install\n    3  make check\n", buf);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "history -s nothing"));
+    TEST_ASSERT_EQUAL_INT(2, run_line(&sh, "history -s 2>/dev/null"));
+    sh_destroy(&sh);
+    // Uses are recorded in the file, the ranking holds in a new session
+    h = history_open(path);
+    TEST_ASSERT_EQUAL_size_t(5, history_count(h));
+    TEST_ASSERT_EQUAL_UINT(2, h->meta[0].uses);
+    TEST_ASSERT_EQUAL_size_t(3, history_find(h, "git", 3, hits, 8));
+    TEST_ASSERT_EQUAL_size_t(0, hits[0]);
+    history_add(h, "git push", 8);
+    history_add(h, "git push", 8);
+    history_close(h);
+    h = history_open(path);
+    TEST_ASSERT_EQUAL_size_t(3, history_find(h, "git", 3, hits, 8));
+    TEST_ASSERT_EQUAL_size_t(3, hits[0]);
+    TEST_ASSERT_EQUAL_UINT(3, h->meta[3].uses);
+    TEST_ASSERT_EQUAL_size_t(0, h->skipped);
+    history_close(h);
+    unlink(path);
+    unlink(out);
+}
+
 // Test default shell prompt when MY_PROMPT is not set
 void test_get_prompt_default(void)
 {
@@ -134,6 +1992,82 @@ void test_get_prompt_custom(void)
     unsetenv("MY_PROMPT");
 }
 
+static void write_file(const char *path, const char *text)
+{
+    FILE *f = fopen(path, "w");
+    fputs(text, f);
+    fclose(f);
+}
+
+// Render until the lookup thread has delivered the expected prompt
+static const char *render_until(struct shell *sh, const char *want)
+{
+    const char *p = prompt_render(sh);
+    for (int i = 0; i < 200 && strcmp(p, want) != 0; i++) {
+        event_run_once(sh->events, 10);
+        p = prompt_render(sh);
+    }
+    return p;
+}
+
+// Test prompt escapes and the branch lookup on the prompt thread
+void test_prompt_render(void)
+{
+    char dir[] = "/tmp/test-lab-repo-XXXXXX";
+    char path[128];
+    char *orig = getcwd(NULL, 0);
+    struct shell sh;
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/.git", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/.git/HEAD", dir);
+    write_file(path, "ref: refs/heads/feature\n");
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    mkdir(path, 0755);
+    TEST_ASSERT_EQUAL_INT(0, chdir(path));
+    sh_init(&sh);
+    free(sh.prompt);
+    sh.prompt = strdup("\\W \\? \\D \\[x\\] \\q\\\\");
+    sh.last_status = 3;
+    sh.last_ns = 1500000000ULL;
+    TEST_ASSERT_EQUAL_STRING("sub 3 1.5s \001x\002 \\q\\", prompt_render(&sh));
+    sh.last_ns = 61000000000ULL;
+    sh.prompt[1] = 'w';
+    TEST_ASSERT_NOT_NULL(strstr(prompt_render(&sh), "/sub 3 1m01s"));
+    free(sh.prompt);
+    sh.prompt = strdup("(\\b)");
+    TEST_ASSERT_EQUAL_STRING("(feature)", render_until(&sh, "(feature)"));
+    // A detached HEAD; the file changed so it is read again
+    snprintf(path, sizeof(path), "%s/.git/HEAD", dir);
+    write_file(path, "0123456789abcdef0123456789abcdef01234567\n");
+    TEST_ASSERT_EQUAL_STRING("(0123456)", render_until(&sh, "(0123456)"));
+    TEST_ASSERT_EQUAL_INT(0, chdir("/"));
+    TEST_ASSERT_EQUAL_STRING("()", render_until(&sh, "()"));
+    sh_destroy(&sh);
+    // A worktree points to its git directory with a .git file
+    char *head;
+    snprintf(path, sizeof(path), "%s/sub/.git", dir);
+    write_file(path, "gitdir: ../.git\n");
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    char *branch = vcs_branch(path, &head);
+    TEST_ASSERT_EQUAL_STRING("0123456", branch);
+    TEST_ASSERT_NOT_NULL(strstr(head, "/sub/../.git/HEAD"));
+    free(branch);
+    free(head);
+    TEST_ASSERT_NULL(vcs_branch("/", NULL));
+    strcat(path, "/.git");
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/.git/HEAD", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.git", dir);
+    rmdir(path);
+    rmdir(dir);
+    TEST_ASSERT_EQUAL_INT(0, chdir(orig));
+    free(orig);
+}
+
 // Test changing directory to home
 void test_ch_dir_home(void)
 {
@@ -174,6 +2108,38 @@ void test_do_builtin_exit(void) {
     sh_destroy(&sh);
 }
 
+// Run line the way -c does in a child that really exits, return its status
+static int exit_status(const char *line)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct shell sh;
+        unsetenv("SKIP_EXIT");
+        sh_init(&sh);
+        run_tail(&sh, line);
+        _exit(99);
+    }
+    int status;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Test the status exit leaves the shell with
+void test_builtin_exit_status(void)
+{
+    TEST_ASSERT_EQUAL_INT(3, exit_status("exit 3"));
+    TEST_ASSERT_EQUAL_INT(1, exit_status("false; exit"));
+    TEST_ASSERT_EQUAL_INT(0, exit_status("false; true; exit"));
+    TEST_ASSERT_EQUAL_INT(2, exit_status("exit abc 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(44, exit_status("exit 300"));
+    // Too many arguments is an error that does not exit
+    struct shell sh;
+    sh_init(&sh);
+    TEST_ASSERT_EQUAL_INT(1, run_line(&sh, "exit 1 2 2>/dev/null"));
+    TEST_ASSERT_EQUAL_INT(5, run_line(&sh, "exit 5"));
+    sh_destroy(&sh);
+}
+
 // Test handling of "cd" with an invalid path
 void test_do_builtin_cd_invalid(void) {
     struct shell sh;
@@ -241,6 +2207,10 @@ int main(void)
 
     RUN_TEST(test_cmd_parse);
     RUN_TEST(test_cmd_parse2);
+    RUN_TEST(test_cmd_parse_single_block);
+    RUN_TEST(test_cmd_parse_many_tokens);
+    RUN_TEST(test_cmd_tokenizer_interleaved);
+    RUN_TEST(test_cmd_parse_batch);
     RUN_TEST(test_trim_white_no_whitespace);
     RUN_TEST(test_trim_white_start_whitespace);
     RUN_TEST(test_trim_white_end_whitespace);
@@ -248,11 +2218,58 @@ int main(void)
     RUN_TEST(test_trim_white_both_whitespace_double);
     RUN_TEST(test_trim_white_all_whitespace);
     RUN_TEST(test_trim_white_mostly_whitespace);
+    RUN_TEST(test_ws_scan_kernels);
+    RUN_TEST(test_trim_white_long);
+    RUN_TEST(test_lex_tokens);
+    RUN_TEST(test_lex_streaming);
+    RUN_TEST(test_lex_quotes);
+    RUN_TEST(test_arena_reset_reuse);
+    RUN_TEST(test_arena_mark);
+    RUN_TEST(test_parse_tree);
+    RUN_TEST(test_parse_lines);
+    RUN_TEST(test_exec_tree);
+    RUN_TEST(test_exec_spawn_redirections);
+    RUN_TEST(test_exec_scripts);
+    RUN_TEST(test_path_cache);
+    RUN_TEST(test_command_complete);
+    RUN_TEST(test_do_builtin_hash);
+    RUN_TEST(test_exec_pipeline_stages);
+    RUN_TEST(test_event_watch_child);
+    RUN_TEST(test_event_wait_stopped);
+    RUN_TEST(test_exec_background_reaped);
+    RUN_TEST(test_job_table);
+    RUN_TEST(test_do_builtin_wait);
+    RUN_TEST(test_builtin_core_table);
+    RUN_TEST(test_builtin_register);
+    RUN_TEST(test_builtin_enable);
+    RUN_TEST(test_builtin_echo_printf);
+    RUN_TEST(test_builtin_test);
+    RUN_TEST(test_builtin_pwd);
+    RUN_TEST(test_vars);
+    RUN_TEST(test_exec_assignments);
+    RUN_TEST(test_vars_cd);
+    RUN_TEST(test_expand);
+    RUN_TEST(test_exec_expand);
+    RUN_TEST(test_brace_expand);
+    RUN_TEST(test_for_loop);
+    RUN_TEST(test_glob_pattern);
+    RUN_TEST(test_path_glob);
+    RUN_TEST(test_line_reader_pipe);
+    RUN_TEST(test_line_reader_share);
+    RUN_TEST(test_line_reader_share_boundary);
+    RUN_TEST(test_parse_args);
+    RUN_TEST(test_bench_phases);
+    RUN_TEST(test_exec_tail);
+    RUN_TEST(test_history_file);
+    RUN_TEST(test_history_find);
+    RUN_TEST(test_history_shared);
     RUN_TEST(test_get_prompt_default);
     RUN_TEST(test_get_prompt_custom);
+    RUN_TEST(test_prompt_render);
     RUN_TEST(test_ch_dir_home);
     RUN_TEST(test_ch_dir_root);
     RUN_TEST(test_do_builtin_exit);
+    RUN_TEST(test_builtin_exit_status);
     RUN_TEST(test_do_builtin_cd_invalid);
     RUN_TEST(test_do_builtin_cd_home);
     RUN_TEST(test_do_builtin_history);